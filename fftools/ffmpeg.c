@@ -63,6 +63,7 @@
 #include "libavutil/time.h"
 #include "libavutil/thread.h"
 #include "libavutil/threadmessage.h"
+#include "libavutil/cpu.h"
 #include "libavcodec/mathops.h"
 #include "libavformat/os_support.h"
 
@@ -142,6 +143,7 @@ static int want_sdp = 1;
 
 static BenchmarkTimeStamps current_time;
 AVIOContext *progress_avio = NULL;
+AVIOContext *progress_json_avio = NULL;
 
 static uint8_t *subtitle_out;
 
@@ -512,10 +514,20 @@ static int decode_interrupt_cb(void *ctx)
 
 const AVIOInterruptCB int_cb = { decode_interrupt_cb, NULL };
 
+#if HAVE_THREADS
+static void free_output_threads(void);
+static void free_filter_threads(void);
+#endif
+
 static void ffmpeg_cleanup(int ret)
 {
     int i, j;
 
+#if HAVE_THREADS
+    free_output_threads();
+    free_filter_threads();
+#endif
+
     if (do_benchmark) {
         int maxrss = getmaxrss() / 1024;
         av_log(NULL, AV_LOG_INFO, "bench: maxrss=%ikB\n", maxrss);
@@ -545,6 +557,8 @@ static void ffmpeg_cleanup(int ret)
                 av_fifo_freep(&ist->sub2video.sub_queue);
             }
             av_buffer_unref(&ifilter->hw_frames_ctx);
+            avfilter_graph_free(&ifilter->adapter);
+            av_frame_free(&ifilter->adapter_frame);
             av_freep(&ifilter->name);
             av_freep(&fg->inputs[j]);
         }
@@ -726,59 +740,95 @@ static void close_all_output_streams(OutputStream *ost, OSTFinished this_stream,
     }
 }
 
-static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
+#if HAVE_THREADS
+typedef struct EncoderMessage {
+    AVFrame *frame;     /* frame to encode, NULL to flush the encoder */
+    int discard;        /* drop the packets returned by the flushed encoder */
+} EncoderMessage;
+
+typedef struct MuxMessage {
+    OutputStream *ost;
+    AVPacket *pkt;
+} MuxMessage;
+#endif
+
+static void output_file_lock(OutputFile *of)
 {
-    AVFormatContext *s = of->ctx;
-    AVStream *st = ost->st;
-    int ret;
+#if HAVE_THREADS
+    if (of->threaded)
+        pthread_mutex_lock(&of->lock);
+#endif
+}
 
-    /*
-     * Audio encoders may split the packets --  #frames in != #packets out.
-     * But there is no reordering, so we can limit the number of output packets
-     * by simply dropping them here.
-     * Counting encoded video frames needs to be done separately because of
-     * reordering, see do_video_out().
-     * Do not count the packet when unqueued because it has been counted when queued.
-     */
-    if (!(st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && ost->encoding_needed) && !unqueue) {
-        if (ost->frame_number >= ost->max_frames) {
-            av_packet_unref(pkt);
-            return;
-        }
-        ost->frame_number++;
+static void output_file_unlock(OutputFile *of)
+{
+#if HAVE_THREADS
+    if (of->threaded)
+        pthread_mutex_unlock(&of->lock);
+#endif
+}
+
+static int64_t thread_cpu_usec(void)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#endif
+    return 0;
+}
+
+/* Start timing a stage. The stages are only timed for -progress_json. */
+static StageTime stage_time_start(void)
+{
+    StageTime t = { 0 };
+
+    if (progress_json_avio) {
+        t.real_usec = av_gettime_relative();
+        t.cpu_usec  = thread_cpu_usec();
     }
+    return t;
+}
 
-    if (!of->header_written) {
-        AVPacket *tmp_pkt;
-        /* the muxer is not initialized yet, buffer the packet */
-        if (!av_fifo_space(ost->muxing_queue)) {
-            unsigned int are_we_over_size =
-                (ost->muxing_queue_data_size + pkt->size) > ost->muxing_queue_data_threshold;
-            int new_size = are_we_over_size ?
-                           FFMIN(2 * av_fifo_size(ost->muxing_queue),
-                                 ost->max_muxing_queue_size) :
-                           2 * av_fifo_size(ost->muxing_queue);
+/* Add the time elapsed since *start to *acc and restart the timing. */
+static void stage_time_update(StageTime *acc, StageTime *start)
+{
+    StageTime now;
 
-            if (new_size <= av_fifo_size(ost->muxing_queue)) {
-                av_log(NULL, AV_LOG_ERROR,
-                       "Too many packets buffered for output stream %d:%d.\n",
-                       ost->file_index, ost->st->index);
-                exit_program(1);
-            }
-            ret = av_fifo_realloc2(ost->muxing_queue, new_size);
-            if (ret < 0)
-                exit_program(1);
-        }
-        ret = av_packet_make_refcounted(pkt);
-        if (ret < 0)
-            exit_program(1);
-        tmp_pkt = av_packet_alloc();
-        if (!tmp_pkt)
-            exit_program(1);
-        av_packet_move_ref(tmp_pkt, pkt);
-        ost->muxing_queue_data_size += tmp_pkt->size;
-        av_fifo_generic_write(ost->muxing_queue, &tmp_pkt, sizeof(tmp_pkt), NULL);
+    if (!progress_json_avio)
+        return;
+    now = stage_time_start();
+    acc->real_usec += now.real_usec - start->real_usec;
+    acc->cpu_usec  += now.cpu_usec  - start->cpu_usec;
+    *start = now;
+}
+
+/* Add the time t to the statistics of a stream of the file of. */
+static void stage_time_add(OutputFile *of, StageTime *acc, const StageTime *t)
+{
+    if (!progress_json_avio)
         return;
+    output_file_lock(of);
+    acc->real_usec += t->real_usec;
+    acc->cpu_usec  += t->cpu_usec;
+    output_file_unlock(of);
+}
+
+/*
+ * Write a packet to the muxer once its header has been written. This is run
+ * by the muxing thread of the file if it has one.
+ */
+static int mux_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost)
+{
+    AVFormatContext *s = of->ctx;
+    AVStream *st = ost->st;
+    StageTime start, mux_time = { 0 };
+    int ret, size;
+
+    if (ost->mux_error) {
+        av_packet_unref(pkt);
+        return 0;
     }
 
     if ((st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && video_sync_method == VSYNC_DROP) ||
@@ -789,6 +839,7 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
         int i;
         uint8_t *sd = av_packet_get_side_data(pkt, AV_PKT_DATA_QUALITY_STATS,
                                               NULL);
+        output_file_lock(of);
         ost->quality = sd ? AV_RL32(sd) : -1;
         ost->pict_type = sd ? sd[4] : AV_PICTURE_TYPE_NONE;
 
@@ -798,6 +849,7 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
             else
                 ost->error[i] = -1;
         }
+        output_file_unlock(of);
 
         if (ost->frame_rate.num && ost->is_cfr) {
             if (pkt->duration > 0)
@@ -835,7 +887,8 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
                        ost->file_index, ost->st->index, ost->last_mux_dts, pkt->dts);
                 if (exit_on_error) {
                     av_log(NULL, AV_LOG_FATAL, "aborting.\n");
-                    exit_program(1);
+                    av_packet_unref(pkt);
+                    return AVERROR(EINVAL);
                 }
                 av_log(s, loglevel, "changing to %"PRId64". This may result "
                        "in incorrect timestamps in the output file.\n",
@@ -848,10 +901,8 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
     }
     ost->last_mux_dts = pkt->dts;
 
-    ost->data_size += pkt->size;
-    ost->packets_written++;
-
     pkt->stream_index = ost->index;
+    size = pkt->size;
 
     if (debug_ts) {
         av_log(NULL, AV_LOG_INFO, "muxer <- type:%s "
@@ -863,13 +914,147 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
               );
     }
 
+    start = stage_time_start();
     ret = av_interleaved_write_frame(s, pkt);
+    stage_time_update(&mux_time, &start);
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
-        main_return_code = 1;
-        close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+        ost->mux_error = 1;
+#if HAVE_THREADS
+        /* the main thread closes the streams when it notices the failure */
+        if (of->threaded) {
+            pthread_mutex_lock(&of->lock);
+            of->mux_failed_ost = ost;
+            pthread_mutex_unlock(&of->lock);
+        } else
+#endif
+        {
+            main_return_code = 1;
+            close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+        }
     }
     av_packet_unref(pkt);
+
+    output_file_lock(of);
+    ost->data_size += size;
+    ost->packets_written++;
+    ost->mux_end_pts = av_stream_get_end_pts(st);
+    of->mux_pos      = s->pb ? avio_tell(s->pb) : 0;
+    ost->mux_time.real_usec += mux_time.real_usec;
+    ost->mux_time.cpu_usec  += mux_time.cpu_usec;
+    output_file_unlock(of);
+
+    return 0;
+}
+
+/* Close the streams of the files whose muxing thread failed to write a packet. */
+static void check_mux_failures(void)
+{
+#if HAVE_THREADS
+    int i;
+
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+        OutputStream *ost;
+
+        if (!of->threaded)
+            continue;
+        pthread_mutex_lock(&of->lock);
+        ost = of->mux_failed_ost;
+        of->mux_failed_ost = NULL;
+        pthread_mutex_unlock(&of->lock);
+
+        if (ost) {
+            main_return_code = 1;
+            close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+        }
+    }
+#endif
+}
+
+/*
+ * Send a packet to the muxer, or buffer it if the muxer is not initialized
+ * yet. This is called by the thread producing the packets of ost, which is
+ * the encoding thread of the stream if it has one.
+ */
+static int write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
+{
+    AVStream *st = ost->st;
+    int ret;
+
+    /*
+     * Audio encoders may split the packets --  #frames in != #packets out.
+     * But there is no reordering, so we can limit the number of output packets
+     * by simply dropping them here.
+     * Counting encoded video frames needs to be done separately because of
+     * reordering, see do_video_out().
+     * Do not count the packet when unqueued because it has been counted when queued.
+     */
+    if (!(st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && ost->encoding_needed) && !unqueue) {
+        if (ost->frame_number >= ost->max_frames) {
+            av_packet_unref(pkt);
+            return 0;
+        }
+        output_file_lock(of);
+        ost->frame_number++;
+        output_file_unlock(of);
+    }
+
+    if (!of->header_written) {
+        AVPacket *tmp_pkt;
+        /* the muxer is not initialized yet, buffer the packet */
+        if (!av_fifo_space(ost->muxing_queue)) {
+            unsigned int are_we_over_size =
+                (ost->muxing_queue_data_size + pkt->size) > ost->muxing_queue_data_threshold;
+            int new_size = are_we_over_size ?
+                           FFMIN(2 * av_fifo_size(ost->muxing_queue),
+                                 ost->max_muxing_queue_size) :
+                           2 * av_fifo_size(ost->muxing_queue);
+
+            if (new_size <= av_fifo_size(ost->muxing_queue)) {
+                av_log(NULL, AV_LOG_ERROR,
+                       "Too many packets buffered for output stream %d:%d.\n",
+                       ost->file_index, ost->st->index);
+                return AVERROR(ENOSPC);
+            }
+            ret = av_fifo_realloc2(ost->muxing_queue, new_size);
+            if (ret < 0)
+                return ret;
+        }
+        ret = av_packet_make_refcounted(pkt);
+        if (ret < 0)
+            return ret;
+        tmp_pkt = av_packet_alloc();
+        if (!tmp_pkt)
+            return AVERROR(ENOMEM);
+        av_packet_move_ref(tmp_pkt, pkt);
+        ost->muxing_queue_data_size += tmp_pkt->size;
+        av_fifo_generic_write(ost->muxing_queue, &tmp_pkt, sizeof(tmp_pkt), NULL);
+        output_file_lock(of);
+        ost->muxing_queue_nb_packets++;
+        output_file_unlock(of);
+        return 0;
+    }
+
+#if HAVE_THREADS
+    if (of->mux_queue) {
+        MuxMessage msg = { ost };
+
+        ret = av_packet_make_refcounted(pkt);
+        if (ret < 0)
+            return ret;
+        msg.pkt = av_packet_alloc();
+        if (!msg.pkt)
+            return AVERROR(ENOMEM);
+        av_packet_move_ref(msg.pkt, pkt);
+        ret = av_thread_message_queue_send(of->mux_queue, &msg, 0);
+        if (ret < 0)
+            av_packet_free(&msg.pkt);
+        return ret;
+    }
+#endif
+
+    return mux_packet(of, pkt, ost);
 }
 
 static void close_output_stream(OutputStream *ost)
@@ -893,9 +1078,11 @@ static void close_output_stream(OutputStream *ost)
  * If eof is set, instead indicate EOF to all bitstream filters and
  * therefore flush any delayed packets to the output.  A blank packet
  * must be supplied in this case.
+ *
+ * Return a negative error code if the packets could not be sent to the muxer.
  */
-static void output_packet(OutputFile *of, AVPacket *pkt,
-                          OutputStream *ost, int eof)
+static int output_packet(OutputFile *of, AVPacket *pkt,
+                         OutputStream *ost, int eof)
 {
     int ret = 0;
 
@@ -904,20 +1091,24 @@ static void output_packet(OutputFile *of, AVPacket *pkt,
         ret = av_bsf_send_packet(ost->bsf_ctx, eof ? NULL : pkt);
         if (ret < 0)
             goto finish;
-        while ((ret = av_bsf_receive_packet(ost->bsf_ctx, pkt)) >= 0)
-            write_packet(of, pkt, ost, 0);
+        while ((ret = av_bsf_receive_packet(ost->bsf_ctx, pkt)) >= 0) {
+            ret = write_packet(of, pkt, ost, 0);
+            if (ret < 0)
+                return ret;
+        }
         if (ret == AVERROR(EAGAIN))
             ret = 0;
     } else if (!eof)
-        write_packet(of, pkt, ost, 0);
+        return write_packet(of, pkt, ost, 0);
 
 finish:
     if (ret < 0 && ret != AVERROR_EOF) {
         av_log(NULL, AV_LOG_ERROR, "Error applying bitstream filters to an output "
                "packet for stream #%d:%d.\n", ost->file_index, ost->index);
         if(exit_on_error)
-            exit_program(1);
+            return ret;
     }
+    return 0;
 }
 
 static int check_recording_time(OutputStream *ost)
@@ -1001,62 +1192,136 @@ static int init_output_stream_wrapper(OutputStream *ost, AVFrame *frame,
     return ret;
 }
 
-static void do_audio_out(OutputFile *of, OutputStream *ost,
-                         AVFrame *frame)
+/*
+ * Send a frame to the encoder of ost and write the packets it returns. This
+ * is run by the encoding thread of the stream if it has one.
+ *
+ * Return the size of the last packet written or a negative error code.
+ */
+static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
 {
     AVCodecContext *enc = ost->enc_ctx;
     AVPacket *pkt = ost->pkt;
-    int ret;
-
-    adjust_frame_pts_to_encoder_tb(of, ost, frame);
-
-    if (!check_recording_time(ost))
-        return;
-
-    if (frame->pts == AV_NOPTS_VALUE || audio_sync_method < 0)
-        frame->pts = ost->sync_opts;
-    ost->sync_opts = frame->pts + frame->nb_samples;
-    ost->samples_encoded += frame->nb_samples;
-    ost->frames_encoded++;
+    const char *type_desc = av_get_media_type_string(enc->codec_type);
+    StageTime start, enc_time = { 0 };
+    int ret, frame_size = 0;
 
     update_benchmark(NULL);
     if (debug_ts) {
-        av_log(NULL, AV_LOG_INFO, "encoder <- type:audio "
+        av_log(NULL, AV_LOG_INFO, "encoder <- type:%s "
                "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
+               type_desc,
                av_ts2str(frame->pts), av_ts2timestr(frame->pts, &enc->time_base),
                enc->time_base.num, enc->time_base.den);
     }
 
+    start = stage_time_start();
     ret = avcodec_send_frame(enc, frame);
+    stage_time_update(&enc_time, &start);
     if (ret < 0)
         goto error;
 
     while (1) {
         av_packet_unref(pkt);
         ret = avcodec_receive_packet(enc, pkt);
+        stage_time_update(&enc_time, &start);
+        update_benchmark("encode_%s %d.%d", type_desc,
+                         ost->file_index, ost->index);
         if (ret == AVERROR(EAGAIN))
             break;
         if (ret < 0)
             goto error;
 
-        update_benchmark("encode_audio %d.%d", ost->file_index, ost->index);
-
-        av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
-
         if (debug_ts) {
-            av_log(NULL, AV_LOG_INFO, "encoder -> type:audio "
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:%s "
                    "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                   type_desc,
                    av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &enc->time_base),
                    av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &enc->time_base));
         }
 
-        output_packet(of, pkt, ost, 0);
+        if (enc->codec_type == AVMEDIA_TYPE_VIDEO &&
+            pkt->pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
+            pkt->pts = frame->pts;
+
+        av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
+
+        if (debug_ts && enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
+                "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &ost->mux_timebase),
+                av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &ost->mux_timebase));
+        }
+
+        frame_size = pkt->size;
+        ret = output_packet(of, pkt, ost, 0);
+        if (ret < 0)
+            goto finish;
+
+        /* if two pass, output log */
+        if (ost->logfile && enc->stats_out) {
+            fprintf(ost->logfile, "%s", enc->stats_out);
+        }
+        start = stage_time_start();
     }
 
-    return;
+    ret = frame_size;
+    goto finish;
 error:
-    av_log(NULL, AV_LOG_FATAL, "Audio encoding failed\n");
-    exit_program(1);
+    av_log(NULL, AV_LOG_FATAL, "%s encoding failed\n",
+           enc->codec_type == AVMEDIA_TYPE_VIDEO ? "Video" : "Audio");
+finish:
+    stage_time_add(of, &ost->encode_time, &enc_time);
+    return ret;
+}
+
+/*
+ * Encode a frame, or queue a reference to it for the encoding thread of ost.
+ *
+ * Return the size of the last packet written, 0 if the frame was queued, or a
+ * negative error code.
+ */
+static int submit_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
+{
+    if (frame->pts != AV_NOPTS_VALUE)
+        ost->last_sent_ts = av_rescale_q(frame->pts, ost->enc_ctx->time_base,
+                                         AV_TIME_BASE_Q);
+
+#if HAVE_THREADS
+    if (ost->enc_queue) {
+        EncoderMessage msg = { av_frame_clone(frame) };
+        int ret;
+
+        if (!msg.frame)
+            return AVERROR(ENOMEM);
+        ret = av_thread_message_queue_send(ost->enc_queue, &msg, 0);
+        if (ret < 0) {
+            av_frame_free(&msg.frame);
+            return ret;
+        }
+        ost->enc_nb_sent++;
+        return 0;
+    }
+#endif
+    return encode_frame(of, ost, frame);
+}
+
+static void do_audio_out(OutputFile *of, OutputStream *ost,
+                         AVFrame *frame)
+{
+    adjust_frame_pts_to_encoder_tb(of, ost, frame);
+
+    if (!check_recording_time(ost))
+        return;
+
+    if (frame->pts == AV_NOPTS_VALUE || audio_sync_method < 0)
+        frame->pts = ost->sync_opts;
+    ost->sync_opts = frame->pts + frame->nb_samples;
+    ost->samples_encoded += frame->nb_samples;
+    ost->frames_encoded++;
+
+    if (submit_frame(of, ost, frame) < 0)
+        exit_program(1);
 }
 
 static void do_subtitle_out(OutputFile *of,
@@ -1138,7 +1403,9 @@ static void do_subtitle_out(OutputFile *of,
                 pkt->pts += av_rescale_q(sub->end_display_time, (AVRational){ 1, 1000 }, ost->mux_timebase);
         }
         pkt->dts = pkt->pts;
-        output_packet(of, pkt, ost, 0);
+        ost->last_sent_ts = av_rescale_q(pkt->dts, ost->mux_timebase, AV_TIME_BASE_Q);
+        if (output_packet(of, pkt, ost, 0) < 0)
+            exit_program(1);
     }
 }
 
@@ -1146,8 +1413,7 @@ static void do_video_out(OutputFile *of,
                          OutputStream *ost,
                          AVFrame *next_picture)
 {
-    int ret, format_video_sync;
-    AVPacket *pkt = ost->pkt;
+    int ret, format_video_sync, is_cfr;
     AVCodecContext *enc = ost->enc_ctx;
     AVRational frame_rate;
     int nb_frames, nb0_frames, i;
@@ -1209,7 +1475,10 @@ static void do_video_out(OutputFile *of,
                 format_video_sync = VSYNC_VSCFR;
             }
         }
-        ost->is_cfr = (format_video_sync == VSYNC_CFR || format_video_sync == VSYNC_VSCFR);
+        is_cfr = format_video_sync == VSYNC_CFR || format_video_sync == VSYNC_VSCFR;
+        /* the value does not change, do not write what the muxing thread reads */
+        if (ost->is_cfr != is_cfr)
+            ost->is_cfr = is_cfr;
 
         if (delta0 < 0 &&
             delta > 0 &&
@@ -1269,17 +1538,22 @@ static void do_video_out(OutputFile *of,
 
     if (nb0_frames == 0 && ost->last_dropped) {
         nb_frames_drop++;
+        ost->nb_frames_drop++;
         av_log(NULL, AV_LOG_VERBOSE,
                "*** dropping frame %d from stream %d at ts %"PRId64"\n",
                ost->frame_number, ost->st->index, ost->last_frame->pts);
     }
     if (nb_frames > (nb0_frames && ost->last_dropped) + (nb_frames > nb0_frames)) {
+        int dup = nb_frames - (nb0_frames && ost->last_dropped) - (nb_frames > nb0_frames);
+
         if (nb_frames > dts_error_threshold * 30) {
             av_log(NULL, AV_LOG_ERROR, "%d frame duplication too large, skipping\n", nb_frames - 1);
             nb_frames_drop++;
+            ost->nb_frames_drop++;
             return;
         }
-        nb_frames_dup += nb_frames - (nb0_frames && ost->last_dropped) - (nb_frames > nb0_frames);
+        nb_frames_dup      += dup;
+        ost->nb_frames_dup += dup;
         av_log(NULL, AV_LOG_VERBOSE, "*** %d dup!\n", nb_frames - 1);
         if (nb_frames_dup > dup_warning) {
             av_log(NULL, AV_LOG_WARNING, "More than %d frames duplicated\n", dup_warning);
@@ -1354,58 +1628,15 @@ static void do_video_out(OutputFile *of,
             av_log(NULL, AV_LOG_DEBUG, "Forced keyframe at time %f\n", pts_time);
         }
 
-        update_benchmark(NULL);
-        if (debug_ts) {
-            av_log(NULL, AV_LOG_INFO, "encoder <- type:video "
-                   "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
-                   av_ts2str(in_picture->pts), av_ts2timestr(in_picture->pts, &enc->time_base),
-                   enc->time_base.num, enc->time_base.den);
-        }
-
         ost->frames_encoded++;
 
-        ret = avcodec_send_frame(enc, in_picture);
+        ret = submit_frame(of, ost, in_picture);
         if (ret < 0)
-            goto error;
+            exit_program(1);
+        frame_size = ret;
         // Make sure Closed Captions will not be duplicated
         av_frame_remove_side_data(in_picture, AV_FRAME_DATA_A53_CC);
 
-        while (1) {
-            av_packet_unref(pkt);
-            ret = avcodec_receive_packet(enc, pkt);
-            update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
-            if (ret == AVERROR(EAGAIN))
-                break;
-            if (ret < 0)
-                goto error;
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                       "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                       av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &enc->time_base),
-                       av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &enc->time_base));
-            }
-
-            if (pkt->pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
-                pkt->pts = ost->sync_opts;
-
-            av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                    "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                    av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &ost->mux_timebase),
-                    av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &ost->mux_timebase));
-            }
-
-            frame_size = pkt->size;
-            output_packet(of, pkt, ost, 0);
-
-            /* if two pass, output log */
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
-            }
-        }
         ost->sync_opts++;
         /*
          * For video, number of frames in == number of packets out.
@@ -1425,11 +1656,6 @@ static void do_video_out(OutputFile *of,
         av_frame_ref(ost->last_frame, next_picture);
     else
         av_frame_free(&ost->last_frame);
-
-    return;
-error:
-    av_log(NULL, AV_LOG_FATAL, "Video encoding failed\n");
-    exit_program(1);
 }
 
 static double psnr(double d)
@@ -1699,11 +1925,164 @@ static void print_final_stats(int64_t total_size)
     }
 }
 
+static int64_t output_file_size(OutputFile *of)
+{
+    int64_t size;
+
+#if HAVE_THREADS
+    /* the output is only accessed by the muxing thread while it runs */
+    if (of->mux_queue) {
+        pthread_mutex_lock(&of->lock);
+        size = of->mux_pos;
+        pthread_mutex_unlock(&of->lock);
+        return size;
+    }
+#endif
+    size = avio_size(of->ctx->pb);
+    if (size <= 0) // FIXME improve avio_size() so it works with non seekable output too
+        size = avio_tell(of->ctx->pb);
+    return size;
+}
+
+static int thread_queue_nb_elems(AVThreadMessageQueue *mq)
+{
+    return mq ? av_thread_message_queue_nb_elems(mq) : 0;
+}
+
+static void print_stage_time(AVBPrint *buf, const char *name, const StageTime *t)
+{
+    av_bprintf(buf, ",\"%s_real_us\":%"PRId64",\"%s_cpu_us\":%"PRId64,
+               name, t->real_usec, name, t->cpu_usec);
+}
+
+/*
+ * Write one line of JSON with the progress and the statistics of every stage
+ * of the transcoding to the -progress_json output.
+ */
+static void print_json_report(int is_last_report, double t, int64_t pts)
+{
+    BenchmarkTimeStamps ts = get_benchmark_time_stamps();
+    AVBPrint buf;
+    int i, n, ret;
+
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&buf, "{\"progress\":\"%s\",\"time\":%.6f",
+               is_last_report ? "end" : "continue", t);
+    if (pts == AV_NOPTS_VALUE)
+        av_bprintf(&buf, ",\"out_time_us\":null");
+    else
+        av_bprintf(&buf, ",\"out_time_us\":%"PRId64, pts);
+    av_bprintf(&buf, ",\"user_cpu_us\":%"PRId64",\"sys_cpu_us\":%"PRId64
+               ",\"maxrss\":%"PRId64",\"dup_frames\":%d,\"drop_frames\":%d",
+               ts.user_usec, ts.sys_usec, getmaxrss(), nb_frames_dup, nb_frames_drop);
+
+    av_bprintf(&buf, ",\"input_files\":[");
+    for (i = 0; i < nb_input_files; i++) {
+        int queue = 0;
+#if HAVE_THREADS
+        queue = thread_queue_nb_elems(input_files[i]->in_thread_queue);
+#endif
+        av_bprintf(&buf, "%s{\"file\":%d,\"queue\":%d}", i ? "," : "", i, queue);
+    }
+
+    av_bprintf(&buf, "],\"input_streams\":[");
+    for (i = 0, n = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+        const char *type = av_get_media_type_string(ist->st->codecpar->codec_type);
+
+        if (ist->discard)
+            continue;
+        av_bprintf(&buf, "%s{\"file\":%d,\"stream\":%d,\"type\":\"%s\""
+                   ",\"packets\":%"PRIu64",\"bytes\":%"PRIu64",\"frames\":%"PRIu64,
+                   n++ ? "," : "",
+                   ist->file_index, ist->st->index, type ? type : "unknown",
+                   ist->nb_packets, ist->data_size, ist->frames_decoded);
+        print_stage_time(&buf, "decode", &ist->decode_time);
+        print_stage_time(&buf, "filter", &ist->filter_time);
+        av_bprintf(&buf, "}");
+    }
+
+    av_bprintf(&buf, "],\"output_files\":[");
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+        int queue = 0;
+#if HAVE_THREADS
+        queue = thread_queue_nb_elems(of->mux_queue);
+#endif
+        av_bprintf(&buf, "%s{\"file\":%d,\"size\":%"PRId64",\"queue\":%d}",
+                   i ? "," : "", i, output_file_size(of), queue);
+    }
+
+    av_bprintf(&buf, "],\"output_streams\":[");
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        OutputFile    *of = output_files[ost->file_index];
+        const char *type = av_get_media_type_string(ost->enc_ctx->codec_type);
+        StageTime encode_time, mux_time;
+        uint64_t packets, bytes;
+        int queue = 0, muxing_queue;
+
+        output_file_lock(of);
+        muxing_queue = ost->muxing_queue_nb_packets;
+        packets      = ost->packets_written;
+        bytes        = ost->data_size;
+        encode_time  = ost->encode_time;
+        mux_time     = ost->mux_time;
+        output_file_unlock(of);
+#if HAVE_THREADS
+        queue = thread_queue_nb_elems(ost->enc_queue);
+#endif
+
+        av_bprintf(&buf, "%s{\"file\":%d,\"stream\":%d,\"type\":\"%s\""
+                   ",\"frames\":%"PRIu64",\"packets\":%"PRIu64",\"bytes\":%"PRIu64
+                   ",\"dup_frames\":%d,\"drop_frames\":%d"
+                   ",\"encode_queue\":%d,\"muxing_queue\":%d",
+                   i ? "," : "", ost->file_index, ost->index, type ? type : "unknown",
+                   ost->frames_encoded, packets, bytes,
+                   ost->nb_frames_dup, ost->nb_frames_drop, queue, muxing_queue);
+        print_stage_time(&buf, "encode", &encode_time);
+        print_stage_time(&buf, "mux", &mux_time);
+        av_bprintf(&buf, "}");
+    }
+
+    av_bprintf(&buf, "],\"filters\":[");
+    for (i = 0, n = 0; i < nb_filtergraphs; i++) {
+        AVFilterGraph *graph = filtergraphs[i]->graph;
+        unsigned j;
+
+        for (j = 0; graph && j < graph->nb_filters; j++) {
+            AVFilterStats *s = avfilter_get_stats(graph->filters[j]);
+
+            if (!s)
+                continue;
+            av_bprintf(&buf, "%s{\"graph\":%d,\"name\":\"", n++ ? "," : "", i);
+            av_bprint_escape(&buf, s->filter->name, "\"", AV_ESCAPE_MODE_BACKSLASH, 0);
+            av_bprintf(&buf, "\",\"frames_in\":%"PRId64",\"frames_out\":%"PRId64
+                       ",\"max_queued\":%u,\"copies\":%"PRId64",\"activate_us\":%"PRId64"}",
+                       s->frames_in, s->frames_out, s->max_queued, s->copies,
+                       s->activate_time);
+            av_free(s);
+        }
+    }
+    av_bprintf(&buf, "]}\n");
+
+    if (av_bprint_is_complete(&buf)) {
+        avio_write(progress_json_avio, buf.str, buf.len);
+        avio_flush(progress_json_avio);
+    }
+    av_bprint_finalize(&buf, NULL);
+
+    if (is_last_report) {
+        if ((ret = avio_closep(&progress_json_avio)) < 0)
+            av_log(NULL, AV_LOG_ERROR,
+                   "Error closing JSON progress log, loss of information possible: %s\n", av_err2str(ret));
+    }
+}
+
 static void print_report(int is_last_report, int64_t timer_start, int64_t cur_time)
 {
     AVBPrint buf, buf_script;
     OutputStream *ost;
-    AVFormatContext *oc;
     int64_t total_size;
     AVCodecContext *enc;
     int frame_number, vid, i;
@@ -1718,7 +2097,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     int ret;
     float t;
 
-    if (!print_stats && !is_last_report && !progress_avio)
+    if (!print_stats && !is_last_report && !progress_avio && !progress_json_avio)
         return;
 
     if (!is_last_report) {
@@ -1734,21 +2113,27 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     t = (cur_time-timer_start) / 1000000.0;
 
 
-    oc = output_files[0]->ctx;
-
-    total_size = avio_size(oc->pb);
-    if (total_size <= 0) // FIXME improve avio_size() so it works with non seekable output too
-        total_size = avio_tell(oc->pb);
+    total_size = output_file_size(output_files[0]);
 
     vid = 0;
     av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
     av_bprint_init(&buf_script, 0, AV_BPRINT_SIZE_AUTOMATIC);
     for (i = 0; i < nb_output_streams; i++) {
         float q = -1;
+        int quality, pict_type;
+        int64_t errors[FF_ARRAY_ELEMS(ost->error)], end_pts;
         ost = output_streams[i];
         enc = ost->enc_ctx;
+
+        output_file_lock(output_files[ost->file_index]);
+        quality   = ost->quality;
+        pict_type = ost->pict_type;
+        memcpy(errors, ost->error, sizeof(errors));
+        end_pts   = ost->mux_end_pts;
+        output_file_unlock(output_files[ost->file_index]);
+
         if (!ost->stream_copy)
-            q = ost->quality / (float) FF_QP2LAMBDA;
+            q = quality / (float) FF_QP2LAMBDA;
 
         if (vid && enc->codec_type == AVMEDIA_TYPE_VIDEO) {
             av_bprintf(&buf, "q=%2.1f ", q);
@@ -1777,7 +2162,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
                     av_bprintf(&buf, "%X", av_log2(qp_histogram[j] + 1));
             }
 
-            if ((enc->flags & AV_CODEC_FLAG_PSNR) && (ost->pict_type != AV_PICTURE_TYPE_NONE || is_last_report)) {
+            if ((enc->flags & AV_CODEC_FLAG_PSNR) && (pict_type != AV_PICTURE_TYPE_NONE || is_last_report)) {
                 int j;
                 double error, error_sum = 0;
                 double scale, scale_sum = 0;
@@ -1789,7 +2174,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
                         error = enc->error[j];
                         scale = enc->width * enc->height * 255.0 * 255.0 * frame_number;
                     } else {
-                        error = ost->error[j];
+                        error = errors[j];
                         scale = enc->width * enc->height * 255.0 * 255.0;
                     }
                     if (j)
@@ -1809,8 +2194,8 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
             vid = 1;
         }
         /* compute min output value */
-        if (av_stream_get_end_pts(ost->st) != AV_NOPTS_VALUE) {
-            pts = FFMAX(pts, av_rescale_q(av_stream_get_end_pts(ost->st),
+        if (end_pts != AV_NOPTS_VALUE) {
+            pts = FFMAX(pts, av_rescale_q(end_pts,
                                           ost->st->time_base, AV_TIME_BASE_Q));
             if (copy_ts) {
                 if (copy_ts_first_pts == AV_NOPTS_VALUE && pts > 1)
@@ -1820,8 +2205,10 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
             }
         }
 
-        if (is_last_report)
-            nb_frames_drop += ost->last_dropped;
+        if (is_last_report) {
+            nb_frames_drop      += ost->last_dropped;
+            ost->nb_frames_drop += ost->last_dropped;
+        }
     }
 
     secs = FFABS(pts) / AV_TIME_BASE;
@@ -1903,24 +2290,266 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
         }
     }
 
-    first_report = 0;
+    if (progress_json_avio)
+        print_json_report(is_last_report, t, pts);
+
+    first_report = 0;
+
+    if (is_last_report)
+        print_final_stats(total_size);
+}
+
+static void ifilter_parameters_from_codecpar(InputFilter *ifilter, AVCodecParameters *par)
+{
+    // We never got any input. Set a fake format, which will
+    // come from libavformat.
+    ifilter->format                 = par->format;
+    ifilter->sample_rate            = par->sample_rate;
+    ifilter->channels               = par->channels;
+    ifilter->channel_layout         = par->channel_layout;
+    ifilter->width                  = par->width;
+    ifilter->height                 = par->height;
+    ifilter->sample_aspect_ratio    = par->sample_aspect_ratio;
+}
+
+/*
+ * Drain the encoder of ost, dropping the packets it returns if discard is set.
+ * This is run by the encoding thread of the stream if it has one.
+ */
+static int flush_encoder(OutputFile *of, OutputStream *ost, int discard)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+    AVPacket *pkt = ost->pkt;
+    const char *desc = av_get_media_type_string(enc->codec_type);
+    int ret;
+
+    for (;;) {
+        int pkt_size;
+
+        update_benchmark(NULL);
+
+        av_packet_unref(pkt);
+        while ((ret = avcodec_receive_packet(enc, pkt)) == AVERROR(EAGAIN)) {
+            ret = avcodec_send_frame(enc, NULL);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                       desc,
+                       av_err2str(ret));
+                return ret;
+            }
+        }
+
+        update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
+        if (ret < 0 && ret != AVERROR_EOF) {
+            av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                   desc,
+                   av_err2str(ret));
+            return ret;
+        }
+        if (ost->logfile && enc->stats_out) {
+            fprintf(ost->logfile, "%s", enc->stats_out);
+        }
+        if (ret == AVERROR_EOF)
+            return output_packet(of, pkt, ost, 1);
+        if (discard) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
+        pkt_size = pkt->size;
+        ret = output_packet(of, pkt, ost, 0);
+        if (ret < 0)
+            return ret;
+        if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
+            do_video_stats(ost, pkt_size);
+        }
+    }
+}
+
+#if HAVE_THREADS
+static void free_encoder_message(void *msg)
+{
+    av_frame_free(&((EncoderMessage *)msg)->frame);
+}
+
+static void free_mux_message(void *msg)
+{
+    av_packet_free(&((MuxMessage *)msg)->pkt);
+}
+
+static void *encoder_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    OutputFile *of = output_files[ost->file_index];
+    EncoderMessage msg;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(ost->enc_queue, &msg, 0)) >= 0) {
+        int flush = !msg.frame;
+
+        if (flush) {
+            ret = flush_encoder(of, ost, msg.discard);
+        } else {
+            ret = encode_frame(of, ost, msg.frame);
+            av_frame_free(&msg.frame);
+        }
+
+        pthread_mutex_lock(&of->lock);
+        ost->enc_nb_done++;
+        pthread_cond_broadcast(&of->cond);
+        pthread_mutex_unlock(&of->lock);
+
+        if (ret < 0 || flush)
+            break;
+    }
+    if (ret < 0)
+        av_thread_message_queue_set_err_send(ost->enc_queue, ret);
+
+    pthread_mutex_lock(&of->lock);
+    ost->enc_ret      = FFMIN(ret, 0);
+    ost->enc_finished = 1;
+    pthread_cond_broadcast(&of->cond);
+    pthread_mutex_unlock(&of->lock);
+
+    return NULL;
+}
+
+static void *mux_thread(void *arg)
+{
+    OutputFile *of = arg;
+    MuxMessage msg;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(of->mux_queue, &msg, 0)) >= 0) {
+        ret = mux_packet(of, msg.pkt, msg.ost);
+        av_packet_free(&msg.pkt);
+        if (ret < 0)
+            break;
+    }
+    av_thread_message_queue_set_err_send(of->mux_queue, ret);
+    of->mux_ret = ret == AVERROR_EOF ? 0 : ret;
+
+    return NULL;
+}
+
+static int init_encoder_thread(OutputStream *ost)
+{
+    OutputFile *of = output_files[ost->file_index];
+    int ret;
+
+    ret = av_thread_message_queue_alloc(&ost->enc_queue, of->thread_queue_size,
+                                        sizeof(EncoderMessage));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(ost->enc_queue, free_encoder_message);
+
+    if ((ret = pthread_create(&ost->enc_thread, NULL, encoder_thread, ost))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        av_thread_message_queue_free(&ost->enc_queue);
+        return AVERROR(ret);
+    }
+
+    return 0;
+}
+
+static int init_mux_thread(OutputFile *of)
+{
+    int ret;
+
+    ret = av_thread_message_queue_alloc(&of->mux_queue, of->thread_queue_size,
+                                        sizeof(MuxMessage));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(of->mux_queue, free_mux_message);
+
+    if ((ret = pthread_create(&of->mux_thread, NULL, mux_thread, of))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        av_thread_message_queue_free(&of->mux_queue);
+        return AVERROR(ret);
+    }
+
+    return 0;
+}
+
+/* Wait until the encoding threads of the file are done with what they were sent. */
+static void wait_encoders(OutputFile *of)
+{
+    int i;
+
+    if (!of->threaded)
+        return;
+
+    pthread_mutex_lock(&of->lock);
+    for (i = 0; i < of->ctx->nb_streams; i++) {
+        OutputStream *ost = output_streams[of->ost_index + i];
+
+        while (ost->enc_queue && !ost->enc_finished &&
+               ost->enc_nb_done < ost->enc_nb_sent)
+            pthread_cond_wait(&of->cond, &of->lock);
+    }
+    pthread_mutex_unlock(&of->lock);
+}
+
+static int join_encoder_thread(OutputStream *ost)
+{
+    if (!ost->enc_queue)
+        return 0;
+
+    pthread_join(ost->enc_thread, NULL);
+    av_thread_message_queue_free(&ost->enc_queue);
 
-    if (is_last_report)
-        print_final_stats(total_size);
+    return ost->enc_ret;
 }
 
-static void ifilter_parameters_from_codecpar(InputFilter *ifilter, AVCodecParameters *par)
+/* Wait for the muxing thread to write all the packets it was sent. */
+static int join_mux_thread(OutputFile *of)
 {
-    // We never got any input. Set a fake format, which will
-    // come from libavformat.
-    ifilter->format                 = par->format;
-    ifilter->sample_rate            = par->sample_rate;
-    ifilter->channels               = par->channels;
-    ifilter->channel_layout         = par->channel_layout;
-    ifilter->width                  = par->width;
-    ifilter->height                 = par->height;
-    ifilter->sample_aspect_ratio    = par->sample_aspect_ratio;
+    if (!of->mux_queue)
+        return 0;
+
+    av_thread_message_queue_set_err_recv(of->mux_queue, AVERROR_EOF);
+    pthread_join(of->mux_thread, NULL);
+    av_thread_message_queue_free(&of->mux_queue);
+
+    return of->mux_ret;
+}
+
+static void free_output_threads(void)
+{
+    int i;
+
+    /* wake up the encoding threads waiting for room in a muxing queue */
+    for (i = 0; i < nb_output_files; i++)
+        if (output_files[i] && output_files[i]->mux_queue)
+            av_thread_message_queue_set_err_send(output_files[i]->mux_queue, AVERROR_EXIT);
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        if (!ost || !ost->enc_queue)
+            continue;
+        av_thread_message_flush(ost->enc_queue);
+        av_thread_message_queue_set_err_recv(ost->enc_queue, AVERROR_EXIT);
+        join_encoder_thread(ost);
+    }
+
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+
+        if (!of)
+            continue;
+        if (of->mux_queue) {
+            av_thread_message_flush(of->mux_queue);
+            join_mux_thread(of);
+        }
+        if (of->threaded) {
+            pthread_mutex_destroy(&of->lock);
+            pthread_cond_destroy(&of->cond);
+            of->threaded = 0;
+        }
+    }
 }
+#endif
 
 static void flush_encoders(void)
 {
@@ -1969,61 +2598,27 @@ static void flush_encoders(void)
         if (enc->codec_type != AVMEDIA_TYPE_VIDEO && enc->codec_type != AVMEDIA_TYPE_AUDIO)
             continue;
 
-        for (;;) {
-            const char *desc = NULL;
-            AVPacket *pkt = ost->pkt;
-            int pkt_size;
-
-            switch (enc->codec_type) {
-            case AVMEDIA_TYPE_AUDIO:
-                desc   = "audio";
-                break;
-            case AVMEDIA_TYPE_VIDEO:
-                desc   = "video";
-                break;
-            default:
-                av_assert0(0);
-            }
-
-            update_benchmark(NULL);
-
-            av_packet_unref(pkt);
-            while ((ret = avcodec_receive_packet(enc, pkt)) == AVERROR(EAGAIN)) {
-                ret = avcodec_send_frame(enc, NULL);
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
-                           desc,
-                           av_err2str(ret));
-                    exit_program(1);
-                }
-            }
+#if HAVE_THREADS
+        /* the encoding threads are flushed in parallel and joined below,
+         * which reports their errors */
+        if (ost->enc_queue) {
+            EncoderMessage msg = { NULL, !!(ost->finished & MUXER_FINISHED) };
 
-            update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
-            if (ret < 0 && ret != AVERROR_EOF) {
-                av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
-                       desc,
-                       av_err2str(ret));
-                exit_program(1);
-            }
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
-            }
-            if (ret == AVERROR_EOF) {
-                output_packet(of, pkt, ost, 1);
-                break;
-            }
-            if (ost->finished & MUXER_FINISHED) {
-                av_packet_unref(pkt);
-                continue;
-            }
-            av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
-            pkt_size = pkt->size;
-            output_packet(of, pkt, ost, 0);
-            if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
-                do_video_stats(ost, pkt_size);
-            }
+            if (av_thread_message_queue_send(ost->enc_queue, &msg, 0) >= 0)
+                ost->enc_nb_sent++;
+            continue;
         }
+#endif
+
+        if (flush_encoder(of, ost, ost->finished & MUXER_FINISHED) < 0)
+            exit_program(1);
     }
+
+#if HAVE_THREADS
+    for (i = 0; i < nb_output_streams; i++)
+        if (join_encoder_thread(output_streams[i]) < 0)
+            exit_program(1);
+#endif
 }
 
 /*
@@ -2057,7 +2652,8 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
     av_packet_unref(opkt);
     // EOF: flush output bitstream filters.
     if (!pkt) {
-        output_packet(of, opkt, ost, 1);
+        if (output_packet(of, opkt, ost, 1) < 0)
+            exit_program(1);
         return;
     }
 
@@ -2118,7 +2714,9 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
 
     opkt->duration = av_rescale_q(pkt->duration, ist->st->time_base, ost->mux_timebase);
 
-    output_packet(of, opkt, ost, 0);
+    ost->last_sent_ts = av_rescale_q(opkt->dts, ost->mux_timebase, AV_TIME_BASE_Q);
+    if (output_packet(of, opkt, ost, 0) < 0)
+        exit_program(1);
 }
 
 int guess_input_channel_layout(InputStream *ist)
@@ -2171,13 +2769,10 @@ static int ifilter_has_all_input_formats(FilterGraph *fg)
     return 1;
 }
 
-static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
+/* determine if the parameters for this input changed */
+static int ifilter_need_reinit(InputFilter *ifilter, const AVFrame *frame)
 {
-    FilterGraph *fg = ifilter->graph;
-    int need_reinit, ret, i;
-
-    /* determine if the parameters for this input changed */
-    need_reinit = ifilter->format != frame->format;
+    int need_reinit = ifilter->format != frame->format;
 
     switch (ifilter->ist->st->codecpar->codec_type) {
     case AVMEDIA_TYPE_AUDIO:
@@ -2191,13 +2786,104 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
         break;
     }
 
-    if (!ifilter->ist->reinit_filters && fg->graph)
+    if (!ifilter->ist->reinit_filters && ifilter->graph->graph)
         need_reinit = 0;
 
     if (!!ifilter->hw_frames_ctx != !!frame->hw_frames_ctx ||
         (ifilter->hw_frames_ctx && ifilter->hw_frames_ctx->data != frame->hw_frames_ctx->data))
         need_reinit = 1;
 
+    return need_reinit;
+}
+
+/* whether a change of the input parameters can be handled by an adapter
+ * converting the frames instead of reconfiguring the filtergraph */
+static int ifilter_can_adapt(InputFilter *ifilter, const AVFrame *frame)
+{
+    if (ifilter->ist->reinit_filters != 2 || !ifilter->graph->graph ||
+        ifilter->hw_frames_ctx || frame->hw_frames_ctx)
+        return 0;
+    switch (ifilter->ist->st->codecpar->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+        /* aformat cannot describe the unknown layouts */
+        return ifilter->channel_layout && frame->channel_layout;
+    case AVMEDIA_TYPE_VIDEO:
+        return 1;
+    }
+    return 0;
+}
+
+static int adapter_matches_frame(InputFilter *ifilter, const AVFrame *frame)
+{
+    if (ifilter->adapter_format != frame->format)
+        return 0;
+    if (ifilter->ist->st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+        return ifilter->adapter_sample_rate    == frame->sample_rate &&
+               ifilter->adapter_channel_layout == frame->channel_layout;
+    return ifilter->adapter_width  == frame->width &&
+           ifilter->adapter_height == frame->height;
+}
+
+/* Convert the frame with the adapter of the input and push the result into
+ * the filtergraph. A NULL frame drains the adapter. */
+static int ifilter_send_adapted(InputFilter *ifilter, AVFrame *frame)
+{
+    AVFrame *out = ifilter->adapter_frame;
+    int ret;
+
+    ret = av_buffersrc_add_frame(ifilter->adapter_src, frame);
+    if (ret < 0)
+        return ret;
+
+    while ((ret = av_buffersink_get_frame(ifilter->adapter_sink, out)) >= 0) {
+        ret = av_buffersrc_add_frame_flags(ifilter->filter, out, AV_BUFFERSRC_FLAG_PUSH);
+        av_frame_unref(out);
+        if (ret < 0)
+            return ret;
+    }
+
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+static int ifilter_close_adapter(InputFilter *ifilter)
+{
+    int ret = ifilter_send_adapted(ifilter, NULL);
+
+    avfilter_graph_free(&ifilter->adapter);
+    if (ret < 0 && ret != AVERROR_EOF)
+        av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(ret));
+    return ret;
+}
+
+static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
+{
+    FilterGraph *fg = ifilter->graph;
+    int need_reinit = ifilter_need_reinit(ifilter, frame);
+    int adapt = need_reinit && ifilter_can_adapt(ifilter, frame);
+    int ret, i;
+
+    /* finish with the frames of the previous parameters first */
+    if (ifilter->adapter && (!adapt || !adapter_matches_frame(ifilter, frame))) {
+        ret = ifilter_close_adapter(ifilter);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (adapt) {
+        if (!ifilter->adapter) {
+            av_log(NULL, AV_LOG_VERBOSE, "Input stream #%d:%d changed parameters, "
+                   "converting its frames for the filtergraph\n",
+                   ifilter->ist->file_index, ifilter->ist->st->index);
+            ret = configure_input_adapter(ifilter, frame);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_ERROR, "Error configuring the input adapter: %s\n",
+                       av_err2str(ret));
+                return ret;
+            }
+        }
+        need_reinit = 0;
+    }
+
     if (need_reinit) {
         ret = ifilter_parameters_from_frame(ifilter, frame);
         if (ret < 0)
@@ -2238,7 +2924,10 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
         }
     }
 
-    ret = av_buffersrc_add_frame_flags(ifilter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    if (ifilter->adapter)
+        ret = ifilter_send_adapted(ifilter, frame);
+    else
+        ret = av_buffersrc_add_frame_flags(ifilter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
     if (ret < 0) {
         if (ret != AVERROR_EOF)
             av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(ret));
@@ -2254,6 +2943,12 @@ static int ifilter_send_eof(InputFilter *ifilter, int64_t pts)
 
     ifilter->eof = 1;
 
+    if (ifilter->adapter) {
+        ret = ifilter_close_adapter(ifilter);
+        if (ret < 0 && ret != AVERROR_EOF)
+            return ret;
+    }
+
     if (ifilter->filter) {
         ret = av_buffersrc_close(ifilter->filter, pts, AV_BUFFERSRC_FLAG_PUSH);
         if (ret < 0)
@@ -2298,12 +2993,146 @@ static int decode(AVCodecContext *avctx, AVFrame *frame, int *got_frame, AVPacke
     return 0;
 }
 
+#if HAVE_THREADS
+typedef struct FilterMessage {
+    InputFilter *ifilter;
+    AVFrame *frame;
+    int ret;
+} FilterMessage;
+
+#define PARALLEL_PUSH_FLAGS (AV_BUFFERSRC_FLAG_PUSH | AV_BUFFERSRC_FLAG_KEEP_REF)
+
+static void *filter_push_thread(void *arg)
+{
+    FilterGraph *fg = arg;
+    FilterMessage msg;
+
+    while (av_thread_message_queue_recv(fg->push_queue, &msg, 0) >= 0) {
+        msg.ret = av_buffersrc_add_frame_flags(msg.ifilter->filter, msg.frame,
+                                               PARALLEL_PUSH_FLAGS);
+        if (av_thread_message_queue_send(fg->push_done, &msg, 0) < 0)
+            break;
+    }
+
+    return NULL;
+}
+
+static int init_filter_push_thread(FilterGraph *fg)
+{
+    int ret;
+
+    if ((ret = av_thread_message_queue_alloc(&fg->push_queue, 1, sizeof(FilterMessage))) < 0 ||
+        (ret = av_thread_message_queue_alloc(&fg->push_done, 1, sizeof(FilterMessage))) < 0)
+        goto fail;
+
+    if ((ret = pthread_create(&fg->push_thread, NULL, filter_push_thread, fg))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        ret = AVERROR(ret);
+        goto fail;
+    }
+
+    return 0;
+fail:
+    av_thread_message_queue_free(&fg->push_queue);
+    av_thread_message_queue_free(&fg->push_done);
+    return ret;
+}
+
+static void free_filter_threads(void)
+{
+    int i;
+
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+
+        if (!fg->push_queue)
+            continue;
+        av_thread_message_queue_set_err_recv(fg->push_queue, AVERROR_EOF);
+        pthread_join(fg->push_thread, NULL);
+        av_thread_message_queue_free(&fg->push_queue);
+        av_thread_message_queue_free(&fg->push_done);
+    }
+}
+
+/*
+ * A decoded frame can go to all the filtergraphs it feeds at once when each
+ * of them is its own graph and none has to be (re)configured for it, which
+ * is the case of every frame but the first when one input is encoded into
+ * several renditions.
+ */
+static int can_send_frame_in_parallel(InputStream *ist, const AVFrame *frame)
+{
+    int i, j;
+
+    if (parallel_filters <= 0 || ist->nb_filters < 2 || frame->hw_frames_ctx)
+        return 0;
+
+    for (i = 0; i < ist->nb_filters; i++) {
+        InputFilter *ifilter = ist->filters[i];
+
+        if (!ifilter->graph->graph || ifilter->adapter ||
+            ifilter_need_reinit(ifilter, frame))
+            return 0;
+        for (j = 0; j < i; j++)
+            if (ist->filters[j]->graph == ifilter->graph)
+                return 0;
+    }
+    return 1;
+}
+
+/*
+ * Push the frame into every filtergraph of the stream, all but the last one
+ * on their own thread, and wait until they are done. The filtered frames are
+ * then reaped from the sinks as usual.
+ */
+static int send_frame_in_parallel(InputStream *ist, AVFrame *frame)
+{
+    int last = ist->nb_filters - 1;
+    int i, ret, err = 0;
+
+    for (i = 0; i < last; i++) {
+        FilterGraph *fg = ist->filters[i]->graph;
+
+        if (!fg->push_queue && (ret = init_filter_push_thread(fg)) < 0)
+            return ret;
+    }
+
+    /* the queues are always empty here, so none of this blocks or fails */
+    for (i = 0; i < last; i++) {
+        FilterMessage msg = { .ifilter = ist->filters[i], .frame = frame };
+        av_thread_message_queue_send(ist->filters[i]->graph->push_queue, &msg, 0);
+    }
+    ret = av_buffersrc_add_frame_flags(ist->filters[last]->filter, frame,
+                                       PARALLEL_PUSH_FLAGS);
+
+    for (i = 0; i <= last; i++) {
+        FilterMessage msg = { .ret = ret };
+
+        if (i < last)
+            av_thread_message_queue_recv(ist->filters[i]->graph->push_done, &msg, 0);
+        if (msg.ret < 0 && msg.ret != AVERROR_EOF && !err) {
+            av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(msg.ret));
+            av_log(NULL, AV_LOG_ERROR,
+                   "Failed to inject frame into filter network: %s\n", av_err2str(msg.ret));
+            err = msg.ret;
+        }
+    }
+    av_frame_unref(frame);
+
+    return err;
+}
+#endif
+
 static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
 {
     int i, ret;
     AVFrame *f;
 
     av_assert1(ist->nb_filters > 0); /* ensure ret is initialized */
+#if HAVE_THREADS
+    if (can_send_frame_in_parallel(ist, decoded_frame))
+        return send_frame_in_parallel(ist, decoded_frame);
+#endif
     for (i = 0; i < ist->nb_filters; i++) {
         if (i < ist->nb_filters - 1) {
             f = ist->filter_frame;
@@ -2329,6 +3158,7 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
 {
     AVFrame *decoded_frame;
     AVCodecContext *avctx = ist->dec_ctx;
+    StageTime start;
     int ret, err = 0;
     AVRational decoded_frame_tb;
 
@@ -2339,7 +3169,9 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
     decoded_frame = ist->decoded_frame;
 
     update_benchmark(NULL);
+    start = stage_time_start();
     ret = decode(avctx, decoded_frame, got_output, pkt);
+    stage_time_update(&ist->decode_time, &start);
     update_benchmark("decode_audio %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -2379,7 +3211,9 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
                                               (AVRational){1, avctx->sample_rate}, decoded_frame->nb_samples, &ist->filter_in_rescale_delta_last,
                                               (AVRational){1, avctx->sample_rate});
     ist->nb_samples = decoded_frame->nb_samples;
+    start = stage_time_start();
     err = send_frame_to_filters(ist, decoded_frame);
+    stage_time_update(&ist->filter_time, &start);
 
     av_frame_unref(ist->filter_frame);
     av_frame_unref(decoded_frame);
@@ -2390,6 +3224,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
                         int *decode_failed)
 {
     AVFrame *decoded_frame;
+    StageTime start;
     int i, ret = 0, err = 0;
     int64_t best_effort_timestamp;
     int64_t dts = AV_NOPTS_VALUE;
@@ -2422,7 +3257,9 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
     }
 
     update_benchmark(NULL);
+    start = stage_time_start();
     ret = decode(ist->dec_ctx, decoded_frame, got_output, pkt);
+    stage_time_update(&ist->decode_time, &start);
     update_benchmark("decode_video %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -2509,7 +3346,9 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
     if (ist->st->sample_aspect_ratio.num)
         decoded_frame->sample_aspect_ratio = ist->st->sample_aspect_ratio;
 
+    start = stage_time_start();
     err = send_frame_to_filters(ist, decoded_frame);
+    stage_time_update(&ist->filter_time, &start);
 
 fail:
     av_frame_unref(ist->filter_frame);
@@ -3034,6 +3873,12 @@ static int check_init_output_file(OutputFile *of, int file_index)
 
     of->ctx->interrupt_callback = int_cb;
 
+#if HAVE_THREADS
+    /* have the packets of the frames already sent to the encoders queued
+     * before the muxing time bases are chosen below */
+    wait_encoders(of);
+#endif
+
     ret = avformat_write_header(of->ctx, &of->opts);
     if (ret < 0) {
         av_log(NULL, AV_LOG_ERROR,
@@ -3051,6 +3896,14 @@ static int check_init_output_file(OutputFile *of, int file_index)
     if (sdp_filename || want_sdp)
         print_sdp();
 
+    output_file_lock(of);
+    of->mux_pos = of->ctx->pb ? avio_tell(of->ctx->pb) : 0;
+    for (i = 0; i < of->ctx->nb_streams; i++) {
+        OutputStream *ost = output_streams[of->ost_index + i];
+        ost->mux_end_pts = av_stream_get_end_pts(ost->st);
+    }
+    output_file_unlock(of);
+
     /* flush the muxing queues */
     for (i = 0; i < of->ctx->nb_streams; i++) {
         OutputStream *ost = output_streams[of->ost_index + i];
@@ -3063,11 +3916,21 @@ static int check_init_output_file(OutputFile *of, int file_index)
             AVPacket *pkt;
             av_fifo_generic_read(ost->muxing_queue, &pkt, sizeof(pkt), NULL);
             ost->muxing_queue_data_size -= pkt->size;
-            write_packet(of, pkt, ost, 1);
+            output_file_lock(of);
+            ost->muxing_queue_nb_packets--;
+            output_file_unlock(of);
+            ret = write_packet(of, pkt, ost, 1);
             av_packet_free(&pkt);
+            if (ret < 0)
+                return ret;
         }
     }
 
+#if HAVE_THREADS
+    if (of->threaded)
+        return init_mux_thread(of);
+#endif
+
     return 0;
 }
 
@@ -3697,6 +4560,19 @@ static int init_output_stream(OutputStream *ost, AVFrame *frame,
     if (ret < 0)
         return ret;
 
+#if HAVE_THREADS
+    /* audio packets are counted for -frames as they are written, which has
+     * to happen in the main thread for it to stop at the same point */
+    if (output_files[ost->file_index]->threaded && ost->encoding_needed &&
+        (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO ||
+         (ost->enc_ctx->codec_type == AVMEDIA_TYPE_AUDIO &&
+          ost->max_frames == INT64_MAX))) {
+        ret = init_encoder_thread(ost);
+        if (ret < 0)
+            return ret;
+    }
+#endif
+
     ost->initialized = 1;
 
     ret = check_init_output_file(output_files[ost->file_index], ost->file_index);
@@ -3762,6 +4638,35 @@ static int transcode_init(void)
             goto dump_format;
         }
 
+#if HAVE_THREADS
+    if (parallel_filters < 0)
+        parallel_filters = av_cpu_count() > 1;
+
+    /* -vstats and -benchmark_all inspect encoding and muxing at once, -fs
+     * stops as soon as the muxer reaches the limit */
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+
+        /* the output threads are only used when asked for, as they change
+         * where -shortest and -frames cut the other streams */
+        if (of->thread_queue_size < 0)
+            of->thread_queue_size = 0;
+        if (!of->thread_queue_size || vstats_filename || do_benchmark_all ||
+            of->limit_filesize != UINT64_MAX)
+            continue;
+        if ((ret = pthread_mutex_init(&of->lock, NULL))) {
+            ret = AVERROR(ret);
+            goto dump_format;
+        }
+        if ((ret = pthread_cond_init(&of->cond, NULL))) {
+            pthread_mutex_destroy(&of->lock);
+            ret = AVERROR(ret);
+            goto dump_format;
+        }
+        of->threaded = 1;
+    }
+#endif
+
     /*
      * initialize stream copy and subtitle/data streams.
      * Encoded AVFrame based streams will get initialized as follows:
@@ -3907,15 +4812,25 @@ static int need_output(void)
 {
     int i;
 
+    check_mux_failures();
+
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost    = output_streams[i];
         OutputFile *of       = output_files[ost->file_index];
         AVFormatContext *os  = output_files[ost->file_index]->ctx;
 
+        int64_t mux_pos;
+        int frame_number;
+
+        output_file_lock(of);
+        mux_pos      = of->mux_pos;
+        frame_number = ost->frame_number;
+        output_file_unlock(of);
+
         if (ost->finished ||
-            (os->pb && avio_tell(os->pb) >= of->limit_filesize))
+            (os->pb && mux_pos >= of->limit_filesize))
             continue;
-        if (ost->frame_number >= ost->max_frames) {
+        if (frame_number >= ost->max_frames) {
             int j;
             for (j = 0; j < of->ctx->nb_streams; j++)
                 close_output_stream(output_streams[of->ost_index + j]);
@@ -3928,8 +4843,22 @@ static int need_output(void)
     return 0;
 }
 
+static int64_t output_progress(OutputStream *ost)
+{
+#if HAVE_THREADS
+    if (output_files[ost->file_index]->threaded)
+        return ost->last_sent_ts == AV_NOPTS_VALUE ? INT64_MIN :
+               ost->last_sent_ts;
+#endif
+    return ost->st->cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
+           av_rescale_q(ost->st->cur_dts, ost->st->time_base, AV_TIME_BASE_Q);
+}
+
 /**
- * Select the output stream to process.
+ * Select the output stream to process, i.e. the one behind the others.
+ * With the output threads, its progress is measured by what was sent to its
+ * encoder or muxer rather than by what was muxed, which would depend on
+ * their timing.
  *
  * @return  selected output stream, or NULL if none available
  */
@@ -3941,10 +4870,8 @@ static OutputStream *choose_output(void)
 
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost = output_streams[i];
-        int64_t opts = ost->st->cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
-                       av_rescale_q(ost->st->cur_dts, ost->st->time_base,
-                                    AV_TIME_BASE_Q);
-        if (ost->st->cur_dts == AV_NOPTS_VALUE)
+        int64_t opts = output_progress(ost);
+        if (opts == INT64_MIN)
             av_log(NULL, AV_LOG_DEBUG,
                 "cur_dts is invalid st:%d (%d) [init:%d i_done:%d finish:%d] (this is harmless if it occurs once at the start per stream)\n",
                 ost->st->index, ost->st->id, ost->initialized, ost->inputs_done, ost->finished);
@@ -4168,8 +5095,10 @@ static int init_input_thread(int i)
     if (!f->thread_queue_size)
         return 0;
 
-    if (f->ctx->pb ? !f->ctx->pb->seekable :
-        strcmp(f->ctx->iformat->name, "lavfi"))
+    /* a single input is waited for, there is nothing else to do meanwhile */
+    if (nb_input_files > 1 &&
+        (f->ctx->pb ? !f->ctx->pb->seekable :
+         strcmp(f->ctx->iformat->name, "lavfi")))
         f->non_blocking = 1;
     ret = av_thread_message_queue_alloc(&f->in_thread_queue,
                                         f->thread_queue_size, sizeof(f->pkt));
@@ -4819,6 +5748,13 @@ static int transcode(void)
     }
     flush_encoders();
 
+#if HAVE_THREADS
+    for (i = 0; i < nb_output_files; i++)
+        if (join_mux_thread(output_files[i]) < 0)
+            exit_program(1);
+#endif
+    check_mux_failures();
+
     term_exit();
 
     /* write the trailer if needed and close file */
@@ -4837,6 +5773,8 @@ static int transcode(void)
                 exit_program(1);
         }
     }
+    for (i = 0; i < nb_output_streams; i++)
+        output_streams[i]->mux_end_pts = av_stream_get_end_pts(output_streams[i]->st);
 
     /* dump report by using the first video and audio streams */
     print_report(1, timer_start, av_gettime_relative());
@@ -4979,6 +5917,14 @@ int main(int argc, char **argv)
 
     show_banner(argc, argv, options);
 
+    if (locate_option(argc, argv, options, "jobs")) {
+        run_jobs(&argc, &argv);
+        parse_loglevel(argc, argv, options);
+    } else if (locate_option(argc, argv, options, "parallel_jobs")) {
+        av_log(NULL, AV_LOG_FATAL, "Option -parallel_jobs requires -jobs\n");
+        exit_program(1);
+    }
+
     /* parse options and open all input/output files */
     ret = ffmpeg_parse_options(argc, argv);
     if (ret < 0)
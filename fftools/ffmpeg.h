@@ -258,6 +258,18 @@ typedef struct InputFilter {
 
     AVBufferRef *hw_frames_ctx;
 
+    /* with -reinit_filter 2, converts the frames to the parameters above
+     * when the input changes instead of reconfiguring the graph */
+    AVFilterGraph   *adapter;
+    AVFilterContext *adapter_src;
+    AVFilterContext *adapter_sink;
+    AVFrame         *adapter_frame;
+    // parameters of the frames the adapter was configured for
+    int adapter_format;
+    int adapter_width, adapter_height;
+    int adapter_sample_rate;
+    uint64_t adapter_channel_layout;
+
     int eof;
 } InputFilter;
 
@@ -295,8 +307,22 @@ typedef struct FilterGraph {
     int          nb_inputs;
     OutputFilter **outputs;
     int         nb_outputs;
+
+#if HAVE_THREADS
+    /* pushes the frames the graph shares with other graphs, see
+     * send_frame_to_filters() */
+    AVThreadMessageQueue *push_queue;
+    AVThreadMessageQueue *push_done;
+    pthread_t push_thread;
+#endif
 } FilterGraph;
 
+/* time spent in a processing stage, reported by -progress_json */
+typedef struct StageTime {
+    int64_t real_usec;
+    int64_t cpu_usec;      /* CPU time of the thread running the stage */
+} StageTime;
+
 typedef struct InputStream {
     int file_index;
     AVStream *st;
@@ -390,6 +416,9 @@ typedef struct InputStream {
     // number of frames/samples retrieved from the decoder
     uint64_t frames_decoded;
     uint64_t samples_decoded;
+    StageTime decode_time;
+    // time spent sending the decoded frames through the filtergraphs
+    StageTime filter_time;
 
     int64_t *dts_buffer;
     int nb_dts_buffer;
@@ -547,6 +576,12 @@ typedef struct OutputStream {
     // number of frames/samples sent to the encoder
     uint64_t frames_encoded;
     uint64_t samples_encoded;
+    // number of frames duplicated and dropped for video sync
+    int nb_frames_dup;
+    int nb_frames_drop;
+    // updated by the encoding and muxing threads under the lock of the file
+    StageTime encode_time;
+    StageTime mux_time;
 
     /* packet quality factor */
     int quality;
@@ -565,11 +600,31 @@ typedef struct OutputStream {
     /* Threshold after which max_muxing_queue_size will be in effect */
     size_t muxing_queue_data_threshold;
 
+    /* number of packets in muxing_queue, updated under the lock of the file */
+    int muxing_queue_nb_packets;
+
     /* packet picture type */
     int pict_type;
 
     /* frame encode sum of squared error values */
     int64_t error[4];
+
+    /* timestamp of the last frame or packet sent to the encoder or the muxer,
+     * in AV_TIME_BASE units */
+    int64_t last_sent_ts;
+    /* end pts of the stream after the last packet was muxed */
+    int64_t mux_end_pts;
+    /* writing a packet of this stream failed, drop the following ones */
+    int mux_error;
+
+#if HAVE_THREADS
+    AVThreadMessageQueue *enc_queue;
+    pthread_t enc_thread;       /* thread encoding this stream */
+    uint64_t enc_nb_sent;       /* number of messages sent to the thread */
+    uint64_t enc_nb_done;       /* number of messages the thread is done with */
+    int enc_finished;           /* the thread is about to exit */
+    int enc_ret;                /* return code of the thread */
+#endif
 } OutputStream;
 
 typedef struct OutputFile {
@@ -583,6 +638,20 @@ typedef struct OutputFile {
     int shortest;
 
     int header_written;
+
+    int64_t mux_pos;         /* position of the muxer in the output after the last packet */
+    OutputStream *mux_failed_ost; /* stream whose packet could not be written */
+
+#if HAVE_THREADS
+    int threaded;            /* encoders and muxer of this file run in their own threads */
+    AVThreadMessageQueue *mux_queue;
+    pthread_t mux_thread;    /* thread muxing this file */
+    int mux_ret;             /* return code of the muxing thread */
+    /* protects the statistics shared between the main, encoding and muxing threads */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int thread_queue_size;   /* maximum number of queued packets and frames */
+#endif
 } OutputFile;
 
 extern InputStream **input_streams;
@@ -626,11 +695,14 @@ extern int qp_hist;
 extern int stdin_interaction;
 extern int frame_bits_per_raw_sample;
 extern AVIOContext *progress_avio;
+extern AVIOContext *progress_json_avio;
 extern float max_error_rate;
 extern char *videotoolbox_pixfmt;
 
 extern int filter_nbthreads;
 extern int filter_complex_nbthreads;
+extern int64_t filter_pool_size;
+extern int parallel_filters;
 extern int vstats_version;
 extern int auto_conversion_filters;
 
@@ -663,9 +735,17 @@ int init_complex_filtergraph(FilterGraph *fg);
 void sub2video_update(InputStream *ist, int64_t heartbeat_pts, AVSubtitle *sub);
 
 int ifilter_parameters_from_frame(InputFilter *ifilter, const AVFrame *frame);
+int configure_input_adapter(InputFilter *ifilter, const AVFrame *frame);
 
 int ffmpeg_parse_options(int argc, char **argv);
 
+/**
+ * Run the jobs listed in the file given with -jobs, each in its own process.
+ * Only returns in these processes, with argc and argv set to the command line
+ * of the job.
+ */
+void run_jobs(int *argc, char ***argv);
+
 int videotoolbox_init(AVCodecContext *s);
 int qsv_init(AVCodecContext *s);
 
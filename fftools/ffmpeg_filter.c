@@ -990,6 +990,11 @@ int configure_filtergraph(FilterGraph *fg)
     cleanup_filtergraph(fg);
     if (!(fg->graph = avfilter_graph_alloc()))
         return AVERROR(ENOMEM);
+    if ((ret = av_opt_set_int(fg->graph, "max_pool_size", filter_pool_size, 0)) < 0)
+        return ret;
+    if (progress_json_avio &&
+        (ret = av_opt_set_int(fg->graph, "collect_stats", 1, 0)) < 0)
+        return ret;
 
     if (simple) {
         OutputStream *ost = fg->outputs[0]->ost;
@@ -1028,7 +1033,16 @@ int configure_filtergraph(FilterGraph *fg)
         if (e)
             av_opt_set(fg->graph, "threads", e->value, 0);
     } else {
+        int all_video = 1;
+
+        for (i = 0; i < fg->nb_outputs; i++)
+            all_video &= fg->outputs[i]->type == AVMEDIA_TYPE_VIDEO;
+
         fg->graph->nb_threads = filter_complex_nbthreads;
+        /* let the branches of e.g. a split into several scaled renditions
+         * run concurrently */
+        if (parallel_filters > 0 && fg->nb_outputs > 1 && all_video)
+            fg->graph->thread_type |= AVFILTER_THREAD_GRAPH;
     }
 
     if ((ret = avfilter_graph_parse2(fg->graph, graph_desc, &inputs, &outputs)) < 0)
@@ -1177,6 +1191,93 @@ int ifilter_parameters_from_frame(InputFilter *ifilter, const AVFrame *frame)
     return 0;
 }
 
+/*
+ * Set up a graph scaling or resampling the frames like the given one to the
+ * parameters the input of the filtergraph was configured with, so that the
+ * filtergraph and the state of its filters are kept across the change.
+ */
+int configure_input_adapter(InputFilter *ifilter, const AVFrame *frame)
+{
+    InputStream *ist = ifilter->ist;
+    int video = ist->st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+    AVFilterContext *conv, *fmt;
+    AVFilterGraph *graph;
+    char args[256], conv_args[64], fmt_args[128], name[255];
+    int ret;
+
+    avfilter_graph_free(&ifilter->adapter);
+    if (!ifilter->adapter_frame && !(ifilter->adapter_frame = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    if (!(graph = avfilter_graph_alloc()))
+        return AVERROR(ENOMEM);
+    graph->nb_threads = filter_nbthreads;
+    if ((ret = av_opt_set_int(graph, "max_pool_size", filter_pool_size, 0)) < 0)
+        goto fail;
+
+    if (video) {
+        AVRational tb  = ist->framerate.num ? av_inv_q(ist->framerate) :
+                                              ist->st->time_base;
+        AVRational sar = frame->sample_aspect_ratio.den ? frame->sample_aspect_ratio :
+                                                          (AVRational){ 0, 1 };
+
+        snprintf(args, sizeof(args),
+                 "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+                 frame->width, frame->height, frame->format,
+                 tb.num, tb.den, sar.num, sar.den);
+        snprintf(conv_args, sizeof(conv_args), "%d:%d",
+                 ifilter->width, ifilter->height);
+        snprintf(fmt_args, sizeof(fmt_args), "%s",
+                 av_get_pix_fmt_name(ifilter->format));
+    } else {
+        snprintf(args, sizeof(args),
+                 "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%"PRIx64,
+                 frame->sample_rate, frame->sample_rate,
+                 av_get_sample_fmt_name(frame->format), frame->channel_layout);
+        snprintf(conv_args, sizeof(conv_args), "%d", ifilter->sample_rate);
+        snprintf(fmt_args, sizeof(fmt_args),
+                 "sample_fmts=%s:channel_layouts=0x%"PRIx64,
+                 av_get_sample_fmt_name(ifilter->format), ifilter->channel_layout);
+    }
+
+    snprintf(name, sizeof(name), "adapter for stream %d:%d",
+             ist->file_index, ist->st->index);
+    if ((ret = avfilter_graph_create_filter(&ifilter->adapter_src,
+                                            avfilter_get_by_name(video ? "buffer" : "abuffer"),
+                                            name, args, NULL, graph)) < 0)
+        goto fail;
+    snprintf(name, sizeof(name), "adapter output for stream %d:%d",
+             ist->file_index, ist->st->index);
+    if ((ret = avfilter_graph_create_filter(&ifilter->adapter_sink,
+                                            avfilter_get_by_name(video ? "buffersink" : "abuffersink"),
+                                            name, NULL, NULL, graph)) < 0)
+        goto fail;
+    if ((ret = avfilter_graph_create_filter(&conv,
+                                            avfilter_get_by_name(video ? "scale" : "aresample"),
+                                            NULL, conv_args, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&fmt,
+                                            avfilter_get_by_name(video ? "format" : "aformat"),
+                                            NULL, fmt_args, NULL, graph)) < 0)
+        goto fail;
+
+    if ((ret = avfilter_link(ifilter->adapter_src, 0, conv, 0)) < 0 ||
+        (ret = avfilter_link(conv, 0, fmt, 0)) < 0 ||
+        (ret = avfilter_link(fmt, 0, ifilter->adapter_sink, 0)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto fail;
+
+    ifilter->adapter                = graph;
+    ifilter->adapter_format         = frame->format;
+    ifilter->adapter_width          = frame->width;
+    ifilter->adapter_height         = frame->height;
+    ifilter->adapter_sample_rate    = frame->sample_rate;
+    ifilter->adapter_channel_layout = frame->channel_layout;
+
+    return 0;
+fail:
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
 int filtergraph_is_simple(FilterGraph *fg)
 {
     return !fg->graph_desc;
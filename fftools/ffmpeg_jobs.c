@@ -0,0 +1,353 @@
+/*
+ * Running a list of ffmpeg command lines from one process
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#if HAVE_FORK
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+#include "libavformat/avio.h"
+
+#include "ffmpeg.h"
+
+#if HAVE_FORK
+typedef struct Job {
+    char **argv;
+    int argc;
+    int line;               ///< line of the job in the list, for messages
+    pid_t pid;
+    int64_t start_time;
+} Job;
+
+static Job *jobs;
+static int nb_jobs;
+
+/* options of the parent command line which do not get passed to the jobs */
+static const char *const job_options[] = { "jobs", "parallel_jobs", NULL };
+
+static int is_job_option(const char *arg)
+{
+    int i;
+
+    if (*arg++ != '-')
+        return 0;
+    for (i = 0; job_options[i]; i++)
+        if (!strcmp(arg, job_options[i]))
+            return 1;
+    return 0;
+}
+
+static char *read_job_list(const char *filename)
+{
+    AVIOContext *pb      = NULL;
+    AVIOContext *dyn_buf = NULL;
+    uint8_t buf[1024], *str;
+    int ret;
+
+    if (!strcmp(filename, "-"))
+        filename = "pipe:";
+    ret = avio_open(&pb, filename, AVIO_FLAG_READ);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Error opening job list %s: %s\n",
+               filename, av_err2str(ret));
+        return NULL;
+    }
+
+    ret = avio_open_dyn_buf(&dyn_buf);
+    if (ret < 0) {
+        avio_closep(&pb);
+        return NULL;
+    }
+    while ((ret = avio_read(pb, buf, sizeof(buf))) > 0)
+        avio_write(dyn_buf, buf, ret);
+    avio_w8(dyn_buf, 0);
+    avio_closep(&pb);
+
+    ret = avio_close_dyn_buf(dyn_buf, &str);
+    if (ret < 0)
+        return NULL;
+    return (char *)str;
+}
+
+static int add_arg(Job *job, char *arg)
+{
+    int ret;
+
+    if (!arg)
+        return AVERROR(ENOMEM);
+    /* keep the argument array terminated like the one given to main() */
+    if ((ret = av_dynarray_add_nofree(&job->argv, &job->argc, arg)) < 0 ||
+        (ret = av_reallocp_array(&job->argv, job->argc + 1,
+                                 sizeof(*job->argv))) < 0) {
+        av_free(arg);
+        return ret;
+    }
+    job->argv[job->argc] = NULL;
+    return 0;
+}
+
+/**
+ * Get the next argument of a command line, which may contain parts quoted
+ * with single or double quotes and characters escaped with a backslash, as
+ * in a POSIX shell.
+ */
+static char *get_arg(const char **buf)
+{
+    const char *p = *buf;
+    AVBPrint bp;
+    char *arg;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    while (*p && *p != ' ' && *p != '\t') {
+        if (*p == '\'') {
+            const char *end = strchr(p + 1, '\'');
+            size_t len = end ? end - p - 1 : strlen(p + 1);
+            av_bprint_append_data(&bp, p + 1, len);
+            p += len + 1 + !!end;
+        } else if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) {
+                if (*p == '\\' && p[1] && strchr("\\\"$`", p[1]))
+                    p++;
+                av_bprint_chars(&bp, *p, 1);
+            }
+            p += !!*p;
+        } else {
+            if (*p == '\\' && p[1])
+                p++;
+            av_bprint_chars(&bp, *p++, 1);
+        }
+    }
+    *buf = p;
+
+    if (av_bprint_finalize(&bp, &arg) < 0)
+        return NULL;
+    return arg;
+}
+
+/**
+ * Split the job list into command lines, one per non-empty line. The
+ * arguments of each line are separated by whitespace. Lines starting with '#' are ignored.
+ * The options of the parent command line are put in front of every job.
+ */
+static int parse_job_list(char *list, int argc, char **argv)
+{
+    char *line, *next;
+    int line_nb = 0, i, ret;
+
+    for (line = list; line; line = next) {
+        const char *p;
+        Job *job;
+
+        line_nb++;
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = 0;
+        line[strcspn(line, "\r")] = 0;
+
+        p = line + strspn(line, " \t");
+        if (!*p || *p == '#')
+            continue;
+
+        GROW_ARRAY(jobs, nb_jobs);
+        job = &jobs[nb_jobs - 1];
+        job->line = line_nb;
+
+        /* the banner is shown once by the parent, and the jobs run
+         * concurrently, so they must not read from the terminal */
+        if ((ret = add_arg(job, av_strdup(argv[0])))      < 0 ||
+            (ret = add_arg(job, av_strdup("-hide_banner"))) < 0 ||
+            (ret = add_arg(job, av_strdup("-nostdin")))   < 0)
+            return ret;
+        for (i = 1; i < argc; i++) {
+            if (is_job_option(argv[i])) {
+                i++;
+                continue;
+            }
+            if ((ret = add_arg(job, av_strdup(argv[i]))) < 0)
+                return ret;
+        }
+        while (*p) {
+            if ((ret = add_arg(job, get_arg(&p))) < 0)
+                return ret;
+            p += strspn(p, " \t");
+        }
+    }
+    return 0;
+}
+
+static void free_jobs(void)
+{
+    int i, j;
+
+    for (i = 0; i < nb_jobs; i++) {
+        for (j = 0; j < jobs[i].argc; j++)
+            av_free(jobs[i].argv[j]);
+        av_free(jobs[i].argv);
+    }
+    av_freep(&jobs);
+    nb_jobs = 0;
+}
+
+static volatile int jobs_interrupted;
+
+static void jobs_sigterm_handler(int sig)
+{
+    jobs_interrupted = 1;
+}
+
+static Job *start_job(Job *job)
+{
+    pid_t pid;
+
+    /* do not let the child flush what the parent has buffered */
+    fflush(stdout);
+    fflush(stderr);
+
+    job->start_time = av_gettime_relative();
+    pid = fork();
+    if (pid < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not start job %d (line %d): %s\n",
+               (int)(job - jobs) + 1, job->line, strerror(errno));
+        return NULL;
+    }
+    if (!pid) {
+        signal(SIGINT,  SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        return job;
+    }
+    job->pid = pid;
+    av_log(NULL, AV_LOG_VERBOSE, "Started job %d (line %d), pid %d\n",
+           (int)(job - jobs) + 1, job->line, (int)pid);
+    return NULL;
+}
+
+static int wait_job(int *nb_failed)
+{
+    int status, i;
+    pid_t pid;
+
+    pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+        return errno == EINTR ? 0 : AVERROR(errno);
+
+    for (i = 0; i < nb_jobs && jobs[i].pid != pid; i++)
+        ;
+    if (i == nb_jobs)
+        return 0;
+
+    if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+        av_log(NULL, AV_LOG_VERBOSE, "Job %d (line %d) done in %.3fs\n",
+               i + 1, jobs[i].line,
+               (av_gettime_relative() - jobs[i].start_time) / 1000000.0);
+    } else {
+        (*nb_failed)++;
+        if (WIFEXITED(status))
+            av_log(NULL, AV_LOG_ERROR, "Job %d (line %d) failed with exit code %d\n",
+                   i + 1, jobs[i].line, WEXITSTATUS(status));
+        else
+            av_log(NULL, AV_LOG_ERROR, "Job %d (line %d) was killed by signal %d\n",
+                   i + 1, jobs[i].line, WTERMSIG(status));
+    }
+    jobs[i].pid = 0;
+    return 1;
+}
+
+void run_jobs(int *argc, char ***argv)
+{
+    int idx = locate_option(*argc, *argv, options, "jobs");
+    int max_running = 1, nb_running = 0, nb_failed = 0, next = 0;
+    char *list;
+    int ret;
+
+    if (!(*argv)[idx + 1]) {
+        av_log(NULL, AV_LOG_FATAL, "Missing argument for option 'jobs'\n");
+        exit_program(1);
+    }
+    ret = locate_option(*argc, *argv, options, "parallel_jobs");
+    if (ret && (*argv)[ret + 1])
+        max_running = parse_number_or_die("parallel_jobs", (*argv)[ret + 1],
+                                          OPT_INT, 1, INT_MAX);
+
+    list = read_job_list((*argv)[idx + 1]);
+    if (!list)
+        exit_program(1);
+    ret = parse_job_list(list, *argc, *argv);
+    av_free(list);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Error parsing the job list: %s\n",
+               av_err2str(ret));
+        free_jobs();
+        exit_program(1);
+    }
+
+    /* the jobs get the terminal signals too, and stop by themselves */
+    signal(SIGINT,  jobs_sigterm_handler);
+    signal(SIGTERM, jobs_sigterm_handler);
+
+    while (nb_running || (next < nb_jobs && !jobs_interrupted)) {
+        if (next < nb_jobs && !jobs_interrupted && nb_running < max_running) {
+            Job *job = start_job(&jobs[next++]);
+            if (job) {
+                *argc = job->argc;
+                *argv = job->argv;
+                return;
+            }
+            if (jobs[next - 1].pid)
+                nb_running++;
+            else
+                nb_failed++;
+            continue;
+        }
+        ret = wait_job(&nb_failed);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_FATAL, "Error waiting for the jobs: %s\n",
+                   av_err2str(ret));
+            exit_program(1);
+        }
+        nb_running -= ret;
+    }
+
+    if (next < nb_jobs)
+        av_log(NULL, AV_LOG_WARNING, "Interrupted, %d jobs not run\n",
+               nb_jobs - next);
+    av_log(NULL, AV_LOG_INFO, "%d jobs run, %d failed\n", next, nb_failed);
+    free_jobs();
+    exit_program(jobs_interrupted ? 255 : !!nb_failed);
+}
+#else
+void run_jobs(int *argc, char ***argv)
+{
+    av_log(NULL, AV_LOG_FATAL, "Running jobs is not supported on this platform\n");
+    exit_program(1);
+}
+#endif
@@ -173,6 +173,8 @@ int frame_bits_per_raw_sample = 0;
 float max_error_rate  = 2.0/3;
 int filter_nbthreads = 0;
 int filter_complex_nbthreads = 0;
+int64_t filter_pool_size = 0;
+int parallel_filters = -1;
 int vstats_version = 2;
 int auto_conversion_filters = 1;
 int64_t stats_period = 500000;
@@ -1599,6 +1601,8 @@ static OutputStream *new_output_stream(OptionsContext *o, AVFormatContext *oc, e
         input_streams[source_index]->st->discard = input_streams[source_index]->user_set_discard;
     }
     ost->last_mux_dts = AV_NOPTS_VALUE;
+    ost->last_sent_ts = AV_NOPTS_VALUE;
+    ost->mux_end_pts  = AV_NOPTS_VALUE;
 
     ost->muxing_queue = av_fifo_alloc(8 * sizeof(AVPacket));
     if (!ost->muxing_queue)
@@ -2189,6 +2193,9 @@ static int open_output_file(OptionsContext *o, const char *filename)
     of->start_time     = o->start_time;
     of->limit_filesize = o->limit_filesize;
     of->shortest       = o->shortest;
+#if HAVE_THREADS
+    of->thread_queue_size = o->thread_queue_size;
+#endif
     av_dict_copy(&of->opts, o->g->format_opts, 0);
 
     if (!strcmp(filename, "-"))
@@ -3419,10 +3426,23 @@ static int opt_progress(void *optctx, const char *opt, const char *arg)
                arg, av_err2str(ret));
         return ret;
     }
-    progress_avio = avio;
+    if (!strcmp(opt, "progress_json")) {
+        avio_closep(&progress_json_avio);
+        progress_json_avio = avio;
+    } else {
+        avio_closep(&progress_avio);
+        progress_avio = avio;
+    }
     return 0;
 }
 
+static int opt_jobs(void *optctx, const char *opt, const char *arg)
+{
+    /* handled in main() before the options are parsed */
+    av_log(NULL, AV_LOG_ERROR, "Option -%s cannot be used in a job\n", opt);
+    return AVERROR(EINVAL);
+}
+
 #define OFFSET(x) offsetof(OptionsContext, x)
 const OptionDef options[] = {
     /* main options */
@@ -3501,6 +3521,12 @@ const OptionDef options[] = {
       "add timings for each task" },
     { "progress",       HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_progress },
       "write program-readable progress information", "url" },
+    { "progress_json",  HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_progress },
+      "write progress and per-stage statistics as JSON lines", "url" },
+    { "jobs",           HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_jobs },
+      "run the command lines listed in a file, one per line", "filename" },
+    { "parallel_jobs",  HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_jobs },
+      "set the number of jobs run at once", "number" },
     { "stdin",          OPT_BOOL | OPT_EXPERT,                       { &stdin_interaction },
       "enable or disable interaction on standard input" },
     { "timelimit",      HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_timelimit },
@@ -3568,14 +3594,18 @@ const OptionDef options[] = {
         "set stream filtergraph", "filter_graph" },
     { "filter_threads",  HAS_ARG | OPT_INT,                          { &filter_nbthreads },
         "number of non-complex filter threads" },
+    { "filter_pool_size", HAS_ARG | OPT_INT64 | OPT_EXPERT,          { &filter_pool_size },
+        "maximum size of the frame buffers kept for reuse by each filtergraph", "size" },
     { "filter_script",  HAS_ARG | OPT_STRING | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(filter_scripts) },
         "read stream filtergraph description from a file", "filename" },
     { "reinit_filter",  HAS_ARG | OPT_INT | OPT_SPEC | OPT_INPUT,    { .off = OFFSET(reinit_filters) },
-        "reinit filtergraph on input parameter changes", "" },
+        "reinit filtergraph on input parameter changes (2 to convert the frames instead)", "" },
     { "filter_complex", HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_threads", HAS_ARG | OPT_INT,                   { &filter_complex_nbthreads },
         "number of threads for -filter_complex" },
+    { "parallel_filters", HAS_ARG | OPT_INT | OPT_EXPERT,            { &parallel_filters },
+        "run the filtergraphs fed by the same stream concurrently (-1 for auto)", "" },
     { "lavfi",          HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_script", HAS_ARG | OPT_EXPERT,                 { .func_arg = opt_filter_complex_script },
@@ -3604,9 +3634,9 @@ const OptionDef options[] = {
     { "disposition",    OPT_STRING | HAS_ARG | OPT_SPEC |
                         OPT_OUTPUT,                                  { .off = OFFSET(disposition) },
         "disposition", "" },
-    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,
+    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT | OPT_OUTPUT,
                                                                      { .off = OFFSET(thread_queue_size) },
-        "set the maximum number of queued packets from the demuxer" },
+        "set the maximum number of queued packets from the demuxer or to the muxer" },
     { "find_stream_info", OPT_BOOL | OPT_PERFILE | OPT_INPUT | OPT_EXPERT, { &find_stream_info },
         "read and decode the streams to fill missing information with heuristics" },
 
@@ -33,6 +33,8 @@
 #include "audio.h"
 #include "internal.h"
 
+#define BATCH_SIZE 256 ///< samples evaluated per av_expr_eval_batch() call
+
 static const char * const var_names[] = {
     "ch",           ///< the value of the current channel
     "n",            ///< number of frame
@@ -275,7 +277,9 @@ static int request_frame(AVFilterLink *outlink)
 {
     EvalContext *eval = outlink->src->priv;
     AVFrame *samplesref;
-    int i, j;
+    double ns[BATCH_SIZE], ts[BATCH_SIZE];
+    const double *arrays[VAR_VARS_NB] = { [VAR_N] = ns, [VAR_T] = ts };
+    int i, j, k, ret;
     int64_t t = av_rescale(eval->n, AV_TIME_BASE, eval->sample_rate);
     int nb_samples;
 
@@ -293,15 +297,24 @@ static int request_frame(AVFilterLink *outlink)
     if (!samplesref)
         return AVERROR(ENOMEM);
 
-    /* evaluate expression for each single sample and for each channel */
-    for (i = 0; i < nb_samples; i++, eval->n++) {
-        eval->var_values[VAR_N] = eval->n;
-        eval->var_values[VAR_T] = eval->var_values[VAR_N] * (double)1/eval->sample_rate;
+    /* evaluate expression for each channel, several samples at once */
+    for (i = 0; i < nb_samples; i += BATCH_SIZE) {
+        const int n = FFMIN(BATCH_SIZE, nb_samples - i);
 
+        for (k = 0; k < n; k++) {
+            ns[k] = eval->n + k;
+            ts[k] = ns[k] * (double)1/eval->sample_rate;
+        }
         for (j = 0; j < eval->nb_channels; j++) {
-            *((double *) samplesref->extended_data[j] + i) =
-                av_expr_eval(eval->expr[j], eval->var_values, NULL);
+            ret = av_expr_eval_batch(eval->expr[j],
+                                     (double *) samplesref->extended_data[j] + i, n,
+                                     eval->var_values, arrays, NULL);
+            if (ret < 0) {
+                av_frame_free(&samplesref);
+                return ret;
+            }
         }
+        eval->n += n;
     }
 
     samplesref->pts = eval->pts;
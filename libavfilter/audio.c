@@ -35,6 +35,17 @@ AVFrame *ff_null_get_audio_buffer(AVFilterLink *link, int nb_samples)
     return ff_get_audio_buffer(link->dst->outputs[0], nb_samples);
 }
 
+static FFFramePool *audio_pool_init(AVFilterLink *link, int channels, int nb_samples)
+{
+    FFBufferPoolSet *set = link->graph ? link->graph->internal->buffer_pools : NULL;
+
+    if (set)
+        return ff_frame_pool_audio_init_shared(set, channels, nb_samples,
+                                               link->format, BUFFER_ALIGN);
+    return ff_frame_pool_audio_init(av_buffer_allocz, channels, nb_samples,
+                                    link->format, BUFFER_ALIGN);
+}
+
 AVFrame *ff_default_get_audio_buffer(AVFilterLink *link, int nb_samples)
 {
     AVFrame *frame = NULL;
@@ -43,8 +54,7 @@ AVFrame *ff_default_get_audio_buffer(AVFilterLink *link, int nb_samples)
     av_assert0(channels == av_get_channel_layout_nb_channels(link->channel_layout) || !av_get_channel_layout_nb_channels(link->channel_layout));
 
     if (!link->frame_pool) {
-        link->frame_pool = ff_frame_pool_audio_init(av_buffer_allocz, channels,
-                                                    nb_samples, link->format, BUFFER_ALIGN);
+        link->frame_pool = audio_pool_init(link, channels, nb_samples);
         if (!link->frame_pool)
             return NULL;
     } else {
@@ -63,8 +73,7 @@ AVFrame *ff_default_get_audio_buffer(AVFilterLink *link, int nb_samples)
             pool_format != link->format || pool_align != BUFFER_ALIGN) {
 
             ff_frame_pool_uninit((FFFramePool **)&link->frame_pool);
-            link->frame_pool = ff_frame_pool_audio_init(av_buffer_allocz, channels,
-                                                        nb_samples, link->format, BUFFER_ALIGN);
+            link->frame_pool = audio_pool_init(link, channels, nb_samples);
             if (!link->frame_pool)
                 return NULL;
         }
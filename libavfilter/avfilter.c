@@ -33,6 +33,7 @@
 #include "libavutil/rational.h"
 #include "libavutil/samplefmt.h"
 #include "libavutil/thread.h"
+#include "libavutil/time.h"
 
 #define FF_INTERNAL_FIELDS 1
 #include "framequeue.h"
@@ -42,6 +43,7 @@
 #include "filters.h"
 #include "formats.h"
 #include "internal.h"
+#include "thread.h"
 
 #include "libavutil/ffversion.h"
 const char av_filter_ffversion[] = "FFmpeg version " FFMPEG_VERSION;
@@ -192,7 +194,18 @@ int avfilter_link_get_channels(AVFilterLink *link)
 
 void ff_filter_set_ready(AVFilterContext *filter, unsigned priority)
 {
-    filter->ready = FFMAX(filter->ready, priority);
+    /* neighbours of several filters of a wave may be marked concurrently */
+    int in_wave = filter->graph && filter->graph->internal->in_wave;
+
+    if (in_wave)
+        ff_graph_lock(filter->graph);
+    if (priority > filter->ready) {
+        filter->ready = priority;
+        if (filter->graph)
+            ff_filter_graph_update_ready(filter->graph, filter);
+    }
+    if (in_wave)
+        ff_graph_unlock(filter->graph);
 }
 
 /**
@@ -201,10 +214,15 @@ void ff_filter_set_ready(AVFilterContext *filter, unsigned priority)
  */
 static void filter_unblock(AVFilterContext *filter)
 {
+    int in_wave = filter->graph && filter->graph->internal->in_wave;
     unsigned i;
 
+    if (in_wave)
+        ff_graph_lock(filter->graph);
     for (i = 0; i < filter->nb_outputs; i++)
         filter->outputs[i]->frame_blocked_in = 0;
+    if (in_wave)
+        ff_graph_unlock(filter->graph);
 }
 
 
@@ -550,7 +568,12 @@ int avfilter_process_command(AVFilterContext *filter, const char *cmd, const cha
         if (res == local_res)
             av_log(filter, AV_LOG_INFO, "%s", res);
         return 0;
-    }else if(!strcmp(cmd, "enable")) {
+    }
+
+    if (filter->internal->fused_into || filter->internal->nb_fused)
+        ff_filter_unfuse(filter);
+
+    if(!strcmp(cmd, "enable")) {
         return set_enable_expr(filter, arg);
     }else if(filter->filter->process_command) {
         return filter->filter->process_command(filter, cmd, arg, res, res_len, flags);
@@ -660,6 +683,17 @@ static int default_execute(AVFilterContext *ctx, avfilter_action_func *func, voi
     return 0;
 }
 
+static int stats_execute(AVFilterContext *ctx, avfilter_action_func *func, void *arg,
+                         int *ret, int nb_jobs)
+{
+    int64_t start = av_gettime_relative();
+    int r = ctx->thread_type & AVFILTER_THREAD_SLICE ?
+            ctx->graph->internal->thread_execute(ctx, func, arg, ret, nb_jobs) :
+            default_execute(ctx, func, arg, ret, nb_jobs);
+    ctx->internal->slice_time += av_gettime_relative() - start;
+    return r;
+}
+
 AVFilterContext *ff_filter_alloc(const AVFilter *filter, const char *inst_name)
 {
     AVFilterContext *ret;
@@ -795,6 +829,7 @@ void avfilter_free(AVFilterContext *filter)
     av_expr_free(filter->enable);
     filter->enable = NULL;
     av_freep(&filter->var_values);
+    av_dict_free(&filter->internal->init_options);
     av_freep(&filter->internal);
     av_free(filter);
 }
@@ -851,6 +886,13 @@ static int process_options(AVFilterContext *ctx, AVDictionary **options,
 
         av_log(ctx, AV_LOG_DEBUG, "Setting '%s' to value '%s'\n", key, value);
 
+        if (ctx->graph && ctx->graph->record_template &&
+            (ret = av_dict_set(&ctx->internal->init_options, key, value, 0)) < 0) {
+            av_free(value);
+            av_free(parsed_key);
+            return ret;
+        }
+
         if (av_opt_find(ctx, key, NULL, 0, 0)) {
             ret = av_opt_set(ctx, key, value, 0);
             if (ret < 0) {
@@ -892,10 +934,52 @@ int ff_filter_process_command(AVFilterContext *ctx, const char *cmd,
     return av_opt_set(ctx->priv, cmd, arg, 0);
 }
 
+/**
+ * Add the private options set to non-default values other than through the
+ * option strings, e.g. with av_opt_set_int(), to init_options. Only done when
+ * the graph records templates, as it walks all the options of the filter.
+ */
+static int record_set_options(AVFilterContext *ctx)
+{
+    const AVOption *o = NULL;
+    int ret;
+
+    while ((o = av_opt_next(ctx->priv, o))) {
+        const AVDictionaryEntry *e = NULL;
+        uint8_t *val;
+        int recorded = 0;
+
+        if (o->type == AV_OPT_TYPE_CONST || o->flags & AV_OPT_FLAG_READONLY ||
+            av_opt_is_set_to_default(ctx->priv, o) != 0)
+            continue;
+        /* the option may have been given under an alias */
+        while (!recorded && (e = av_dict_get(ctx->internal->init_options, "", e,
+                                             AV_DICT_IGNORE_SUFFIX))) {
+            const AVOption *set = av_opt_find(ctx->priv, e->key, NULL, 0, 0);
+            recorded = set && set->offset == o->offset;
+        }
+        if (recorded)
+            continue;
+
+        if ((ret = av_opt_get(ctx->priv, o->name, 0, &val)) < 0)
+            return ret;
+        ret = av_dict_set(&ctx->internal->init_options, o->name, val,
+                          AV_DICT_DONT_STRDUP_VAL);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
 int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
 {
+    int record = ctx->graph && ctx->graph->record_template;
     int ret = 0;
 
+    if (record && options &&
+        (ret = av_dict_copy(&ctx->internal->init_options, *options, 0)) < 0)
+        return ret;
+
     ret = av_opt_set_dict(ctx, options);
     if (ret < 0) {
         av_log(ctx, AV_LOG_ERROR, "Error applying generic filter options.\n");
@@ -910,6 +994,8 @@ int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
     } else {
         ctx->thread_type = 0;
     }
+    if (ctx->graph && ctx->graph->collect_stats)
+        ctx->internal->execute = stats_execute;
 
     if (ctx->filter->priv_class) {
         ret = av_opt_set_dict2(ctx->priv, options, AV_OPT_SEARCH_CHILDREN);
@@ -917,6 +1003,8 @@ int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
             av_log(ctx, AV_LOG_ERROR, "Error applying options to the filter.\n");
             return ret;
         }
+        if (record && (ret = record_set_options(ctx)) < 0)
+            return ret;
     }
 
     if (ctx->filter->init_opaque)
@@ -1060,6 +1148,27 @@ static int default_filter_frame(AVFilterLink *link, AVFrame *frame)
     return ff_filter_frame(link->dst->outputs[0], frame);
 }
 
+/**
+ * Check if a command queued to one of the filters fused into the destination
+ * of link is due at the time of frame. The fusion must then be undone before
+ * the frame is processed, so that the filter processes the frame and the
+ * command itself, as it would have without the fusion.
+ */
+static int fused_command_due(AVFilterLink *link, const AVFrame *frame)
+{
+    AVFilterContext *head = link->dst;
+    AVFilterGraph *graph = head->graph;
+    const double t = frame->pts * av_q2d(link->time_base);
+
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *f = graph->filters[i];
+        if (f->internal->fused_into == head && f->command_queue &&
+            f->command_queue->time <= t)
+            return 1;
+    }
+    return 0;
+}
+
 static int ff_filter_frame_framed(AVFilterLink *link, AVFrame *frame)
 {
     int (*filter_frame)(AVFilterLink *, AVFrame *);
@@ -1076,12 +1185,17 @@ static int ff_filter_frame_framed(AVFilterLink *link, AVFrame *frame)
             goto fail;
     }
 
+    if (dstctx->internal->nb_fused && fused_command_due(link, frame))
+        ff_filter_unfuse(dstctx);
     ff_inlink_process_commands(link, frame);
     dstctx->is_disabled = !ff_inlink_evaluate_timeline_at_frame(link, frame);
 
     if (dstctx->is_disabled &&
         (dstctx->filter->flags & AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC))
         filter_frame = default_filter_frame;
+    if (dstctx->internal->fused_into &&
+        link->frame_count_out < atomic_load(&dstctx->internal->fused_until))
+        filter_frame = default_filter_frame;
     ret = filter_frame(link, frame);
     link->frame_count_out++;
     return ret;
@@ -1134,6 +1248,7 @@ int ff_filter_frame(AVFilterLink *link, AVFrame *frame)
         av_frame_free(&frame);
         return ret;
     }
+    link->max_queued = FFMAX(link->max_queued, ff_framequeue_queued_frames(&link->fifo));
     ff_filter_set_ready(link->dst, 300);
     return 0;
 
@@ -1367,7 +1482,8 @@ static int ff_filter_activate_default(AVFilterContext *filter)
      ff_avfilter_link_set_out_status().
 
    Filters are activated according to the ready field, set using the
-   ff_filter_set_ready(). Eventually, a priority queue will be used.
+   ff_filter_set_ready(), which keeps the ready filters of the graph in a
+   priority queue.
    ff_filter_set_ready() is called whenever anything could cause progress to
    be possible. Marking a filter ready when it is not is not a problem,
    except for the small overhead it causes.
@@ -1431,14 +1547,30 @@ static int ff_filter_activate_default(AVFilterContext *filter)
 
 int ff_filter_activate(AVFilterContext *filter)
 {
+    int collect_stats = filter->graph && filter->graph->collect_stats;
+    int64_t start = collect_stats ? av_gettime_relative() : 0;
     int ret;
 
     /* Generic timeline support is not yet implemented but should be easy */
     av_assert1(!(filter->filter->flags & AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC &&
                  filter->filter->activate));
-    filter->ready = 0;
+    if (filter->graph) {
+        int in_wave = filter->graph->internal->in_wave;
+
+        if (in_wave)
+            ff_graph_lock(filter->graph);
+        filter->ready = 0;
+        ff_filter_graph_update_ready(filter->graph, filter);
+        if (in_wave)
+            ff_graph_unlock(filter->graph);
+    } else {
+        filter->ready = 0;
+    }
     ret = filter->filter->activate ? filter->filter->activate(filter) :
           ff_filter_activate_default(filter);
+    filter->internal->nb_activations++;
+    if (collect_stats)
+        filter->internal->activate_time += av_gettime_relative() - start;
     if (ret == FFERROR_NOT_READY)
         ret = 0;
     return ret;
@@ -1542,6 +1674,7 @@ int ff_inlink_make_frame_writable(AVFilterLink *link, AVFrame **rframe)
     if (av_frame_is_writable(frame))
         return 0;
     av_log(link->dst, AV_LOG_DEBUG, "Copying data in avfilter.\n");
+    link->dst->internal->copies++;
 
     switch (link->type) {
     case AVMEDIA_TYPE_VIDEO:
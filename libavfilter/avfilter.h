@@ -328,6 +328,36 @@ typedef struct AVFilter {
      * activation.
      */
     int (*activate)(AVFilterContext *ctx);
+
+    /**
+     * Describe the processing of the filter as one lookup table per
+     * component of its negotiated input format, so that a preceding filter
+     * can merge it with fuse().
+     *
+     * @param lut  4 tables to fill, entry v of table c being the output
+     *             value for an input value v of component c; components
+     *             are numbered as planes for planar formats and as offsets
+     *             in the pixel for packed ones
+     * @return 1 if the tables were filled, 0 if the filter currently does
+     *         more than an independent point operation on each component
+     */
+    int (*get_lut)(AVFilterContext *ctx, uint16_t (*lut)[256 * 256]);
+
+    /**
+     * Merge the processing of a following filter into this one, so that
+     * frames are only processed once.
+     *
+     * Called by avfilter_graph_config() once the links are configured.
+     *
+     * @param next  a filter with get_lut() consuming, possibly through
+     *              filters that leave frames untouched, the output of ctx
+     *              with the same format and size; NULL to drop everything
+     *              merged so far and go back to the processing of ctx
+     *              alone
+     * @return 1 if ctx now also does the processing of next, 0 if it
+     *         cannot, a negative AVERROR on failure
+     */
+    int (*fuse)(AVFilterContext *ctx, AVFilterContext *next);
 } AVFilter;
 
 /**
@@ -335,6 +365,13 @@ typedef struct AVFilter {
  */
 #define AVFILTER_THREAD_SLICE (1 << 0)
 
+/**
+ * Activate filters of the graph that are not linked to each other
+ * concurrently. Only meaningful for AVFilterGraph.thread_type, and only
+ * taken into account if set before the first filter is added to the graph.
+ */
+#define AVFILTER_THREAD_GRAPH (1 << 1)
+
 typedef struct AVFilterInternal AVFilterInternal;
 
 /** An instance of a filter */
@@ -626,6 +663,12 @@ struct AVFilterLink {
      */
     FFFrameQueue fifo;
 
+    /**
+     * Largest number of frames seen in fifo. Only updated when the source
+     * filter adds a frame, so it does not need a lock.
+     */
+    unsigned max_queued;
+
     /**
      * If set, the source filter can not generate a frame as is.
      * The goal is to avoid repeatedly calling the request_frame() method on
@@ -917,6 +960,27 @@ typedef struct AVFilterGraph {
     int sink_links_count;
 
     unsigned disable_auto_convert;
+
+    /**
+     * Maximum total size in bytes of the frame buffers kept by the graph for
+     * reuse, 0 for no limit. Buffers needed beyond it are freed on release.
+     * Access ONLY through AVOptions.
+     */
+    int64_t max_pool_size;
+
+    /**
+     * If set, record the time spent in each filter, see
+     * avfilter_get_stats(). Must be set before the filters are
+     * initialized. Access ONLY through AVOptions.
+     */
+    int collect_stats;
+
+    /**
+     * If set, keep the options the filters are initialized with, so that
+     * avfilter_graph_template_create() can be called on the graph. Must be
+     * set before the filters are initialized. Access ONLY through AVOptions.
+     */
+    int record_template;
 } AVFilterGraph;
 
 /**
@@ -1151,6 +1215,118 @@ int avfilter_graph_queue_command(AVFilterGraph *graph, const char *target, const
  */
 char *avfilter_graph_dump(AVFilterGraph *graph, const char *options);
 
+/**
+ * Processing statistics of one filter of a graph, see avfilter_get_stats().
+ *
+ * The times are only recorded when the collect_stats option of the graph
+ * is set, the other fields are always available.
+ *
+ * sizeof(AVFilterStats) is not a part of the public ABI, the structure is
+ * only allocated by libavfilter. New fields may be added to the end with a
+ * minor version bump.
+ */
+typedef struct AVFilterStats {
+    AVFilterContext *filter;  ///< the filter these statistics are for
+
+    int64_t nb_activations;   ///< number of times the filter was run
+    /**
+     * Total time spent running the filter, in microseconds, including
+     * slice_time.
+     */
+    int64_t activate_time;
+    /**
+     * Part of activate_time spent running slice jobs, in microseconds. With
+     * slice threading, this is the time until all the jobs completed.
+     */
+    int64_t slice_time;
+
+    int64_t frames_in;        ///< frames consumed from all the inputs
+    int64_t frames_out;       ///< frames sent on all the outputs
+
+    unsigned queued;          ///< frames currently queued on the inputs
+    unsigned max_queued;      ///< largest number of frames seen queued on one input
+
+    /**
+     * Frames written over their input and planes passed on by reference,
+     * instead of being copied to a new buffer.
+     */
+    int64_t copies_avoided;
+    int64_t copies;           ///< input frames copied to make them writable
+} AVFilterStats;
+
+/**
+ * Get the processing statistics of a filter of a graph. The graph must not
+ * be processing frames meanwhile.
+ *
+ * @param filter  the filter
+ * @return  the statistics, to be freed with av_free(), or NULL in case of
+ *          memory allocation failure
+ */
+AVFilterStats *avfilter_get_stats(AVFilterContext *filter);
+
+/**
+ * Dump the processing statistics of all the filters of a graph as a JSON
+ * array, with one object per filter holding the fields of AVFilterStats.
+ *
+ * @param graph  the graph
+ * @return  a string, or NULL in case of memory allocation failure;
+ *          the string must be freed using av_free
+ */
+char *avfilter_graph_dump_stats(AVFilterGraph *graph);
+
+/**
+ * A snapshot of a configured filter graph: its filters with the options
+ * they were initialized with, its links and their negotiated formats.
+ * Instantiating it creates the same graph without negotiating the formats
+ * again, which makes setting up many graphs of the same shape much faster.
+ */
+typedef struct AVFilterGraphTemplate AVFilterGraphTemplate;
+
+/**
+ * Create a template from a configured graph, including the filters inserted
+ * during format negotiation.
+ *
+ * The hardware device of the filters and the hardware frames context of the
+ * buffer sources are referenced by the template and shared by its instances.
+ *
+ * @param tmpl   set to the newly allocated template, to be freed with
+ *               avfilter_graph_template_free()
+ * @param graph  a graph successfully configured with avfilter_graph_config(),
+ *               with the record_template option set
+ * @return >= 0 on success, a negative AVERROR on failure
+ */
+int avfilter_graph_template_create(AVFilterGraphTemplate **tmpl,
+                                   const AVFilterGraph *graph);
+
+/**
+ * Create and configure the filters and links of a template in a graph.
+ *
+ * The links get the formats negotiated for the graph the template was
+ * created from; the query_formats() callbacks of the filters are not
+ * called. Options changing the formats a filter accepts, or the format
+ * of a buffer source, must therefore keep the values they had in that
+ * graph.
+ *
+ * @param tmpl     the template
+ * @param graph    an empty graph, with its threading and other options set;
+ *                 it is configured on success
+ * @param options  options overriding the ones of the template, with keys of
+ *                 the form "<filter instance name>:<option name>", may be
+ *                 NULL
+ * @param log_ctx  context used for logging
+ * @return >= 0 on success, a negative AVERROR on failure; the graph must then
+ *         be freed, it may contain some of the filters
+ */
+int avfilter_graph_template_instantiate(const AVFilterGraphTemplate *tmpl,
+                                        AVFilterGraph *graph,
+                                        const AVDictionary *options,
+                                        void *log_ctx);
+
+/**
+ * Free a template and set the pointer to NULL.
+ */
+void avfilter_graph_template_free(AVFilterGraphTemplate **tmpl);
+
 /**
  * Request a frame on the oldest sink link.
  *
@@ -50,12 +50,19 @@ static const AVOption filtergraph_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
         { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, F|V|A, "thread_type" },
         { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = F|V|A, .unit = "thread_type" },
+        { "graph", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_GRAPH }, .flags = F|V|A, .unit = "thread_type" },
     { "threads",     "Maximum number of threads", OFFSET(nb_threads),
         AV_OPT_TYPE_INT,   { .i64 = 0 }, 0, INT_MAX, F|V|A },
     {"scale_sws_opts"       , "default scale filter options"        , OFFSET(scale_sws_opts)        ,
         AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, F|V },
     {"aresample_swr_opts"   , "default aresample filter options"    , OFFSET(aresample_swr_opts)    ,
         AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, F|A },
+    { "max_pool_size", "Maximum size of the frame buffers kept for reuse", OFFSET(max_pool_size),
+        AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, F|V|A },
+    { "collect_stats", "Record the time spent in each filter", OFFSET(collect_stats),
+        AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, F|V|A },
+    { "record_template", "Keep the filter options for graph templates", OFFSET(record_template),
+        AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, F|V|A },
     { NULL },
 };
 
@@ -78,6 +85,19 @@ int ff_graph_thread_init(AVFilterGraph *graph)
     graph->nb_threads  = 1;
     return 0;
 }
+
+int ff_graph_run_wave(AVFilterGraph *graph, int nb_filters)
+{
+    return AVERROR(ENOSYS);
+}
+
+void ff_graph_lock(AVFilterGraph *graph)
+{
+}
+
+void ff_graph_unlock(AVFilterGraph *graph)
+{
+}
 #endif
 
 AVFilterGraph *avfilter_graph_alloc(void)
@@ -104,9 +124,15 @@ void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter
     int i, j;
     for (i = 0; i < graph->nb_filters; i++) {
         if (graph->filters[i] == filter) {
+            filter->ready = 0;
+            ff_filter_graph_update_ready(graph, filter);
             FFSWAP(AVFilterContext*, graph->filters[i],
                    graph->filters[graph->nb_filters - 1]);
             graph->nb_filters--;
+            if (i < graph->nb_filters) {
+                graph->filters[i]->internal->graph_index = i;
+                ff_filter_graph_update_ready(graph, graph->filters[i]);
+            }
             filter->graph = NULL;
             for (j = 0; j<filter->nb_outputs; j++)
                 if (filter->outputs[j])
@@ -127,6 +153,18 @@ void avfilter_graph_free(AVFilterGraph **graph)
 
     ff_graph_thread_free(*graph);
 
+    if ((*graph)->internal->buffer_pools) {
+        FFBufferPoolSetStats stats;
+
+        ff_buffer_pool_set_get_stats((*graph)->internal->buffer_pools, &stats);
+        av_log(*graph, AV_LOG_VERBOSE,
+               "Frame pool: %u buffers in %u size classes, %"PRId64" bytes, "
+               "%u allocated outside the pool\n",
+               stats.nb_pooled, stats.nb_classes, stats.pooled_size,
+               stats.nb_transient);
+        ff_buffer_pool_set_uninit(&(*graph)->internal->buffer_pools);
+    }
+
     av_freep(&(*graph)->sink_links);
 
     av_freep(&(*graph)->scale_sws_opts);
@@ -135,6 +173,7 @@ void avfilter_graph_free(AVFilterGraph **graph)
     av_freep(&(*graph)->resample_lavr_opts);
 #endif
     av_freep(&(*graph)->filters);
+    av_freep(&(*graph)->internal->ready_heap);
     av_freep(&(*graph)->internal);
     av_freep(graph);
 }
@@ -194,8 +233,18 @@ AVFilterContext *avfilter_graph_alloc_filter(AVFilterGraph *graph,
         avfilter_free(s);
         return NULL;
     }
-
     graph->filters = filters;
+
+    filters = av_realloc(graph->internal->ready_heap,
+                         sizeof(*filters) * (graph->nb_filters + 1));
+    if (!filters) {
+        avfilter_free(s);
+        return NULL;
+    }
+    graph->internal->ready_heap = filters;
+
+    s->internal->graph_index = graph->nb_filters;
+    s->internal->ready_index = -1;
     graph->filters[graph->nb_filters++] = s;
 
     s->graph = graph;
@@ -1173,6 +1222,115 @@ static int graph_config_formats(AVFilterGraph *graph, AVClass *log_ctx)
     return 0;
 }
 
+static int leaves_frames_untouched(AVFilterContext *f)
+{
+    return f->nb_inputs == 1 && f->nb_outputs == 1 && !f->enable_str &&
+           (!strcmp(f->filter->name, "format")   ||
+            !strcmp(f->filter->name, "noformat") ||
+            !strcmp(f->filter->name, "null"));
+}
+
+/**
+ * Follow the output of a filter through the filters that leave frames
+ * untouched, and return the filter that processes them next, if any.
+ */
+static AVFilterContext *next_processing_filter(AVFilterContext *f)
+{
+    while (f->nb_outputs == 1 && f->outputs[0]) {
+        f = f->outputs[0]->dst;
+        if (!leaves_frames_untouched(f))
+            return f;
+    }
+    return NULL;
+}
+
+static AVFilterContext *prev_processing_filter(AVFilterContext *f)
+{
+    while (f->nb_inputs == 1 && f->inputs[0]) {
+        f = f->inputs[0]->src;
+        if (!leaves_frames_untouched(f))
+            return f;
+    }
+    return NULL;
+}
+
+/**
+ * Tell if the processing of next, the filter following tail, can be
+ * merged into head, the first filter of the chain ending with tail.
+ */
+static int can_fuse(AVFilterContext *head, AVFilterContext *tail,
+                    AVFilterContext *next)
+{
+    AVFilterLink *out = head->outputs[0], *in;
+
+    if (!head->filter->fuse || head->enable_str || head->nb_inputs != 1 ||
+        head->nb_outputs != 1 || head->internal->fused_into)
+        return 0;
+    if (!next || next_processing_filter(tail) != next ||
+        !next->filter->get_lut || next->enable_str ||
+        next->nb_inputs != 1 || next->nb_outputs != 1 ||
+        next->internal->fused_into || next->internal->nb_fused)
+        return 0;
+    in = next->inputs[0];
+    return out->type == AVMEDIA_TYPE_VIDEO && in->format == out->format &&
+           in->w == out->w && in->h == out->h;
+}
+
+void ff_filter_unfuse(AVFilterContext *filter)
+{
+    AVFilterContext *head = filter->internal->fused_into ?
+                            filter->internal->fused_into : filter;
+    AVFilterGraph *graph = head->graph;
+    int64_t frame_count;
+
+    if (!head->internal->nb_fused)
+        return;
+    head->filter->fuse(head, NULL);
+    /* the frames sent so far were processed for the whole chain */
+    frame_count = head->outputs[0]->frame_count_in;
+    for (unsigned i = 0; i < graph->nb_filters; i++)
+        if (graph->filters[i]->internal->fused_into == head)
+            atomic_store(&graph->filters[i]->internal->fused_until, frame_count);
+    head->internal->nb_fused = 0;
+    av_log(head, AV_LOG_VERBOSE, "Filters are no longer fused\n");
+}
+
+/**
+ * Merge chains of point operations on pixels into their first filter, so
+ * that each frame goes through memory once for the whole chain.
+ */
+static int graph_fuse_filters(AVFilterGraph *graph)
+{
+    for (unsigned i = 0; i < graph->nb_filters; i++)
+        ff_filter_unfuse(graph->filters[i]);
+    for (unsigned i = 0; i < graph->nb_filters; i++)
+        graph->filters[i]->internal->fused_into = NULL;
+
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *f = graph->filters[i], *prev, *tail, *next;
+        int ret;
+
+        /* start from the first filter of the chain */
+        prev = prev_processing_filter(f);
+        if (prev && can_fuse(prev, prev, f))
+            continue;
+
+        for (tail = f; (next = next_processing_filter(tail)) &&
+                       can_fuse(f, tail, next); tail = next) {
+            ret = f->filter->fuse(f, next);
+            if (ret < 0)
+                return ret;
+            if (!ret)
+                break;
+            next->internal->fused_into = f;
+            atomic_store(&next->internal->fused_until, INT64_MAX);
+            f->internal->nb_fused++;
+            av_log(f, AV_LOG_VERBOSE, "Fused %s into %s\n", next->name, f->name);
+        }
+    }
+    return 0;
+}
+
 static int graph_config_pointers(AVFilterGraph *graph,
                                              AVClass *log_ctx)
 {
@@ -1215,24 +1373,78 @@ static int graph_config_pointers(AVFilterGraph *graph,
     return 0;
 }
 
-int avfilter_graph_config(AVFilterGraph *graphctx, void *log_ctx)
+/* configure a graph whose link formats are all set */
+static int graph_config_negotiated(AVFilterGraph *graphctx, void *log_ctx)
 {
     int ret;
 
-    if ((ret = graph_check_validity(graphctx, log_ctx)))
-        return ret;
-    if ((ret = graph_config_formats(graphctx, log_ctx)))
-        return ret;
+    if (!graphctx->internal->buffer_pools) {
+        graphctx->internal->buffer_pools = ff_buffer_pool_set_alloc(graphctx->max_pool_size);
+        if (!graphctx->internal->buffer_pools)
+            return AVERROR(ENOMEM);
+    } else {
+        /* no buffer is got while configuring, release the unused sizes */
+        ff_buffer_pool_set_trim(graphctx->internal->buffer_pools);
+    }
     if ((ret = graph_config_links(graphctx, log_ctx)))
         return ret;
     if ((ret = graph_check_links(graphctx, log_ctx)))
         return ret;
     if ((ret = graph_config_pointers(graphctx, log_ctx)))
         return ret;
+    if ((ret = graph_fuse_filters(graphctx)) < 0)
+        return ret;
 
     return 0;
 }
 
+int avfilter_graph_config(AVFilterGraph *graphctx, void *log_ctx)
+{
+    int ret;
+
+    if ((ret = graph_check_validity(graphctx, log_ctx)))
+        return ret;
+    if ((ret = graph_config_formats(graphctx, log_ctx)))
+        return ret;
+    return graph_config_negotiated(graphctx, log_ctx);
+}
+
+int ff_graph_config_negotiated(AVFilterGraph *graph, void *log_ctx)
+{
+    int ret;
+
+    if ((ret = graph_check_validity(graph, log_ctx)))
+        return ret;
+    return graph_config_negotiated(graph, log_ctx);
+}
+
+AVFilterStats *avfilter_get_stats(AVFilterContext *f)
+{
+    AVFilterStats *s = av_mallocz(sizeof(*s));
+
+    if (!s)
+        return NULL;
+
+    s->filter         = f;
+    s->nb_activations = f->internal->nb_activations;
+    s->activate_time  = f->internal->activate_time;
+    s->slice_time     = f->internal->slice_time;
+    s->copies_avoided = f->internal->copies_avoided;
+    s->copies         = f->internal->copies;
+    for (unsigned j = 0; j < f->nb_inputs; j++) {
+        if (!f->inputs[j])
+            continue;
+        s->frames_in += f->inputs[j]->frame_count_out;
+        s->queued    += ff_framequeue_queued_frames(&f->inputs[j]->fifo);
+        s->max_queued = FFMAX(s->max_queued, f->inputs[j]->max_queued);
+    }
+    for (unsigned j = 0; j < f->nb_outputs; j++)
+        if (f->outputs[j])
+            s->frames_out += f->outputs[j]->frame_count_in;
+
+    return s;
+}
+
 int avfilter_graph_send_command(AVFilterGraph *graph, const char *target, const char *cmd, const char *arg, char *res, int res_len, int flags)
 {
     int i, r = AVERROR(ENOSYS);
@@ -1339,8 +1551,14 @@ static void heap_bubble_down(AVFilterGraph *graph,
 
 void ff_avfilter_graph_update_heap(AVFilterGraph *graph, AVFilterLink *link)
 {
+    int in_wave = graph->internal->in_wave;
+
+    if (in_wave)
+        ff_graph_lock(graph);
     heap_bubble_up  (graph, link, link->age_index);
     heap_bubble_down(graph, link, link->age_index);
+    if (in_wave)
+        ff_graph_unlock(graph);
 }
 
 int avfilter_graph_request_oldest(AVFilterGraph *graph)
@@ -1388,17 +1606,153 @@ int avfilter_graph_request_oldest(AVFilterGraph *graph)
     return 0;
 }
 
+static int ready_before(AVFilterContext *a, AVFilterContext *b)
+{
+    if (a->ready != b->ready)
+        return a->ready > b->ready;
+    return a->internal->graph_index < b->internal->graph_index;
+}
+
+static void ready_heap_bubble_up(AVFilterGraphInternal *gi,
+                                 AVFilterContext *filter, int index)
+{
+    AVFilterContext **heap = gi->ready_heap;
+
+    while (index) {
+        int parent = (index - 1) >> 1;
+        if (!ready_before(filter, heap[parent]))
+            break;
+        heap[index] = heap[parent];
+        heap[index]->internal->ready_index = index;
+        index = parent;
+    }
+    heap[index] = filter;
+    filter->internal->ready_index = index;
+}
+
+static void ready_heap_bubble_down(AVFilterGraphInternal *gi,
+                                   AVFilterContext *filter, int index)
+{
+    AVFilterContext **heap = gi->ready_heap;
+
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= gi->nb_ready)
+            break;
+        if (child + 1 < gi->nb_ready &&
+            ready_before(heap[child + 1], heap[child]))
+            child++;
+        if (ready_before(filter, heap[child]))
+            break;
+        heap[index] = heap[child];
+        heap[index]->internal->ready_index = index;
+        index = child;
+    }
+    heap[index] = filter;
+    filter->internal->ready_index = index;
+}
+
+void ff_filter_graph_update_ready(AVFilterGraph *graph, AVFilterContext *filter)
+{
+    AVFilterGraphInternal *gi = graph->internal;
+    int index = filter->internal->ready_index;
+
+    if (!filter->ready) {
+        AVFilterContext *last;
+
+        if (index < 0)
+            return;
+        filter->internal->ready_index = -1;
+        last = gi->ready_heap[--gi->nb_ready];
+        if (last == filter)
+            return;
+        ready_heap_bubble_up  (gi, last, index);
+        ready_heap_bubble_down(gi, last, last->internal->ready_index);
+        return;
+    }
+    if (index < 0) {
+        av_assert1(gi->nb_ready < graph->nb_filters);
+        index = gi->nb_ready++;
+    }
+    ready_heap_bubble_up  (gi, filter, index);
+    ready_heap_bubble_down(gi, filter, filter->internal->ready_index);
+}
+
+static int is_in_wave(AVFilterContext *filter, unsigned wave_id)
+{
+    return filter && filter->internal->wave_id == wave_id;
+}
+
+/**
+ * Check if a filter is linked to a filter of the current wave.
+ */
+static int is_linked_to_wave(AVFilterContext *filter, unsigned wave_id)
+{
+    unsigned i;
+
+    for (i = 0; i < filter->nb_inputs; i++)
+        if (filter->inputs[i] && is_in_wave(filter->inputs[i]->src, wave_id))
+            return 1;
+    for (i = 0; i < filter->nb_outputs; i++)
+        if (filter->outputs[i] && is_in_wave(filter->outputs[i]->dst, wave_id))
+            return 1;
+    return 0;
+}
+
+/**
+ * Add the filters of the ready heap subtree at index with the given ready
+ * status to the wave, skipping the ones linked to a filter of the wave.
+ */
+static int wave_collect(AVFilterGraph *graph, unsigned ready, int index, int nb)
+{
+    AVFilterGraphInternal *gi = graph->internal;
+    AVFilterContext *filter;
+    int exclusive;
+
+    if (index >= gi->nb_ready || nb >= gi->max_wave)
+        return nb;
+    filter = gi->ready_heap[index];
+    if (filter->ready != ready)
+        return nb;
+    exclusive = filter->filter->flags_internal & FF_FILTER_FLAG_GRAPH_EXCLUSIVE;
+    if (!exclusive && !is_linked_to_wave(filter, gi->wave_id)) {
+        filter->internal->wave_id = gi->wave_id;
+        gi->wave_filters[nb++] = filter;
+    }
+    nb = wave_collect(graph, ready, 2 * index + 1, nb);
+    return wave_collect(graph, ready, 2 * index + 2, nb);
+}
+
+/**
+ * Activate all the filters with the highest ready status that are not
+ * linked to each other, up to max_wave of them, concurrently.
+ */
+static int graph_run_wave(AVFilterGraph *graph, AVFilterContext *first)
+{
+    AVFilterGraphInternal *gi = graph->internal;
+    int nb = 1;
+
+    gi->wave_filters[0] = first;
+    first->internal->wave_id = ++gi->wave_id;
+    if (!(first->filter->flags_internal & FF_FILTER_FLAG_GRAPH_EXCLUSIVE)) {
+        nb = wave_collect(graph, first->ready, 1, nb);
+        nb = wave_collect(graph, first->ready, 2, nb);
+    }
+
+    if (nb == 1)
+        return ff_filter_activate(first);
+    return ff_graph_run_wave(graph, nb);
+}
+
 int ff_filter_graph_run_once(AVFilterGraph *graph)
 {
     AVFilterContext *filter;
-    unsigned i;
 
     av_assert0(graph->nb_filters);
-    filter = graph->filters[0];
-    for (i = 1; i < graph->nb_filters; i++)
-        if (graph->filters[i]->ready > filter->ready)
-            filter = graph->filters[i];
-    if (!filter->ready)
+    if (!graph->internal->nb_ready)
         return AVERROR(EAGAIN);
+    filter = graph->internal->ready_heap[0];
+    if (graph->internal->max_wave > 1)
+        return graph_run_wave(graph, filter);
     return ff_filter_activate(filter);
 }
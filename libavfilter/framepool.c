@@ -18,6 +18,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdatomic.h>
+
 #include "framepool.h"
 #include "libavutil/avassert.h"
 #include "libavutil/avutil.h"
@@ -27,6 +29,25 @@
 #include "libavutil/mem.h"
 #include "libavutil/pixfmt.h"
 
+/* size classes: 64 bytes, then 4 classes per power of two up to INT_MAX */
+#define MIN_CLASS_SIZE   64
+#define NB_SIZE_CLASSES  (1 + 4 * (31 - 6))
+
+/*
+ * The pools are created on first use and only released by trims and uninit,
+ * which are not run concurrently with gets, so that a get needs no lock.
+ */
+struct FFBufferPoolSet {
+    atomic_uintptr_t pools[NB_SIZE_CLASSES];            ///< AVBufferPool pointers
+    atomic_uint_least8_t used[NB_SIZE_CLASSES];         ///< buffers got since the last trim
+    atomic_uint class_nb_pooled[NB_SIZE_CLASSES];       ///< buffers owned by each pool
+    int64_t max_size;
+
+    atomic_int_least64_t pooled_size;
+    atomic_uint nb_pooled;
+    atomic_uint nb_transient;
+};
+
 struct FFFramePool {
 
     enum AVMediaType type;
@@ -44,15 +65,187 @@ struct FFFramePool {
     int format;
     int align;
     int linesize[4];
+    int sizes[4];
     AVBufferPool *pools[4];
+    FFBufferPoolSet *set;
 
 };
 
-FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(buffer_size_t size),
-                                      int width,
-                                      int height,
-                                      enum AVPixelFormat format,
-                                      int align)
+/**
+ * Get the size class of a buffer size and the buffer size of this class.
+ */
+static int size_class(size_t size, size_t *class_size)
+{
+    size_t step;
+    int k;
+
+    if (size <= MIN_CLASS_SIZE) {
+        *class_size = MIN_CLASS_SIZE;
+        return 0;
+    }
+    k    = av_log2(size - 1);
+    step = (size_t)1 << (k - 2);
+    *class_size = ((size - 1) / step + 1) * step;
+    return (k - 6) * 4 + *class_size / step - 4;
+}
+
+/**
+ * Get the buffer size of a size class.
+ */
+static size_t class_buffer_size(int idx)
+{
+    if (!idx)
+        return MIN_CLASS_SIZE;
+    return (size_t)((idx - 1) % 4 + 5) << (4 + (idx - 1) / 4);
+}
+
+FFBufferPoolSet *ff_buffer_pool_set_alloc(int64_t max_size)
+{
+    FFBufferPoolSet *set = av_mallocz(sizeof(*set));
+
+    if (!set)
+        return NULL;
+    set->max_size = max_size;
+    atomic_init(&set->pooled_size, 0);
+    atomic_init(&set->nb_pooled, 0);
+    atomic_init(&set->nb_transient, 0);
+    for (int i = 0; i < NB_SIZE_CLASSES; i++) {
+        atomic_init(&set->pools[i], 0);
+        atomic_init(&set->used[i], 0);
+        atomic_init(&set->class_nb_pooled[i], 0);
+    }
+    return set;
+}
+
+static AVBufferRef *pool_set_alloc(void *opaque, buffer_size_t size)
+{
+    FFBufferPoolSet *set = opaque;
+    int64_t total = atomic_fetch_add(&set->pooled_size, size) + size;
+    AVBufferRef *buf = NULL;
+    size_t class_size;
+
+    if (!set->max_size || total <= set->max_size)
+        buf = av_buffer_allocz(size);
+    if (!buf) {
+        atomic_fetch_sub(&set->pooled_size, size);
+        return NULL;
+    }
+    atomic_fetch_add(&set->nb_pooled, 1);
+    atomic_fetch_add(&set->class_nb_pooled[size_class(size, &class_size)], 1);
+    return buf;
+}
+
+/**
+ * Get the pool of a size class, creating it on first use.
+ */
+static AVBufferPool *get_class_pool(FFBufferPoolSet *set, int idx, size_t class_size)
+{
+    uintptr_t pool = atomic_load_explicit(&set->pools[idx], memory_order_acquire);
+    AVBufferPool *new_pool;
+
+    if (pool)
+        return (AVBufferPool *)pool;
+
+    new_pool = av_buffer_pool_init2(FFMIN(class_size, INT_MAX), set,
+                                    pool_set_alloc, NULL);
+    if (!new_pool)
+        return NULL;
+    /* another thread may have created the pool of this class meanwhile */
+    if (!atomic_compare_exchange_strong_explicit(&set->pools[idx], &pool,
+                                                 (uintptr_t)new_pool,
+                                                 memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+        av_buffer_pool_uninit(&new_pool);
+        return (AVBufferPool *)pool;
+    }
+    return new_pool;
+}
+
+AVBufferRef *ff_buffer_pool_set_get(FFBufferPoolSet *set, size_t size)
+{
+    AVBufferPool *pool;
+    AVBufferRef *buf;
+    size_t class_size;
+    int idx;
+
+    if (!size || size > INT_MAX)
+        return NULL;
+    idx = size_class(size, &class_size);
+    av_assert1(idx < NB_SIZE_CLASSES && class_size >= size);
+
+    if (!(pool = get_class_pool(set, idx, class_size)))
+        return NULL;
+    /* only written once per trim, to keep the cache line shared */
+    if (!atomic_load_explicit(&set->used[idx], memory_order_relaxed))
+        atomic_store_explicit(&set->used[idx], 1, memory_order_relaxed);
+    buf = av_buffer_pool_get(pool);
+
+    if (!buf && set->max_size) {
+        /* the pools are full, allocate a buffer freed on release */
+        buf = av_buffer_allocz(size);
+        if (buf)
+            atomic_fetch_add(&set->nb_transient, 1);
+    }
+    return buf;
+}
+
+void ff_buffer_pool_set_get_stats(FFBufferPoolSet *set, FFBufferPoolSetStats *stats)
+{
+    int i;
+
+    stats->pooled_size  = atomic_load(&set->pooled_size);
+    stats->nb_pooled    = atomic_load(&set->nb_pooled);
+    stats->nb_transient = atomic_load(&set->nb_transient);
+    stats->nb_classes   = 0;
+    for (i = 0; i < NB_SIZE_CLASSES; i++)
+        stats->nb_classes += !!atomic_load(&set->pools[i]);
+}
+
+void ff_buffer_pool_set_trim(FFBufferPoolSet *set)
+{
+    for (int i = 0; i < NB_SIZE_CLASSES; i++) {
+        AVBufferPool *pool = (AVBufferPool *)atomic_load(&set->pools[i]);
+
+        if (pool && !atomic_load(&set->used[i])) {
+            /* the buffers in use are freed when released */
+            unsigned nb = atomic_exchange(&set->class_nb_pooled[i], 0);
+
+            atomic_fetch_sub(&set->pooled_size, (int64_t)nb * FFMIN(class_buffer_size(i), INT_MAX));
+            atomic_fetch_sub(&set->nb_pooled, nb);
+            atomic_store(&set->pools[i], 0);
+            av_buffer_pool_uninit(&pool);
+        }
+        atomic_store(&set->used[i], 0);
+    }
+}
+
+void ff_buffer_pool_set_uninit(FFBufferPoolSet **pset)
+{
+    FFBufferPoolSet *set = *pset;
+    int i;
+
+    if (!set)
+        return;
+
+    for (i = 0; i < NB_SIZE_CLASSES; i++) {
+        AVBufferPool *pool = (AVBufferPool *)atomic_load(&set->pools[i]);
+        av_buffer_pool_uninit(&pool);
+    }
+    av_freep(pset);
+}
+
+static AVBufferRef *pool_get(FFFramePool *pool, int i)
+{
+    return pool->set ? ff_buffer_pool_set_get(pool->set, pool->sizes[i]) :
+                       av_buffer_pool_get(pool->pools[i]);
+}
+
+static FFFramePool *frame_pool_video_init(AVBufferRef* (*alloc)(buffer_size_t size),
+                                          FFBufferPoolSet *set,
+                                          int width,
+                                          int height,
+                                          enum AVPixelFormat format,
+                                          int align)
 {
     int i, ret;
     FFFramePool *pool;
@@ -66,6 +259,7 @@ FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(buffer_size_t size),
         return NULL;
 
     pool->type = AVMEDIA_TYPE_VIDEO;
+    pool->set = set;
     pool->width = width;
     pool->height = height;
     pool->format = format;
@@ -96,16 +290,16 @@ FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(buffer_size_t size),
         if (i == 1 || i == 2)
             h = AV_CEIL_RSHIFT(h, desc->log2_chroma_h);
 
-        pool->pools[i] = av_buffer_pool_init(pool->linesize[i] * h + 16 + 16 - 1,
-                                             alloc);
-        if (!pool->pools[i])
-            goto fail;
+        pool->sizes[i] = pool->linesize[i] * h + 16 + 16 - 1;
     }
 
     if (desc->flags & AV_PIX_FMT_FLAG_PAL ||
-        desc->flags & FF_PSEUDOPAL) {
-        pool->pools[1] = av_buffer_pool_init(AVPALETTE_SIZE, alloc);
-        if (!pool->pools[1])
+        desc->flags & FF_PSEUDOPAL)
+        pool->sizes[1] = AVPALETTE_SIZE;
+
+    for (i = 0; i < 4 && pool->sizes[i] && !set; i++) {
+        pool->pools[i] = av_buffer_pool_init(pool->sizes[i], alloc);
+        if (!pool->pools[i])
             goto fail;
     }
 
@@ -116,11 +310,30 @@ fail:
     return NULL;
 }
 
-FFFramePool *ff_frame_pool_audio_init(AVBufferRef* (*alloc)(buffer_size_t size),
-                                      int channels,
-                                      int nb_samples,
-                                      enum AVSampleFormat format,
+FFFramePool *ff_frame_pool_video_init(AVBufferRef* (*alloc)(buffer_size_t size),
+                                      int width,
+                                      int height,
+                                      enum AVPixelFormat format,
                                       int align)
+{
+    return frame_pool_video_init(alloc, NULL, width, height, format, align);
+}
+
+FFFramePool *ff_frame_pool_video_init_shared(FFBufferPoolSet *set,
+                                             int width,
+                                             int height,
+                                             enum AVPixelFormat format,
+                                             int align)
+{
+    return frame_pool_video_init(NULL, set, width, height, format, align);
+}
+
+static FFFramePool *frame_pool_audio_init(AVBufferRef* (*alloc)(buffer_size_t size),
+                                          FFBufferPoolSet *set,
+                                          int channels,
+                                          int nb_samples,
+                                          enum AVSampleFormat format,
+                                          int align)
 {
     int ret, planar;
     FFFramePool *pool;
@@ -132,6 +345,7 @@ FFFramePool *ff_frame_pool_audio_init(AVBufferRef* (*alloc)(buffer_size_t size),
     planar = av_sample_fmt_is_planar(format);
 
     pool->type = AVMEDIA_TYPE_AUDIO;
+    pool->set = set;
     pool->planes = planar ? channels : 1;
     pool->channels = channels;
     pool->nb_samples = nb_samples;
@@ -143,9 +357,13 @@ FFFramePool *ff_frame_pool_audio_init(AVBufferRef* (*alloc)(buffer_size_t size),
     if (ret < 0)
         goto fail;
 
-    pool->pools[0] = av_buffer_pool_init(pool->linesize[0], NULL);
-    if (!pool->pools[0])
-        goto fail;
+    pool->sizes[0] = pool->linesize[0];
+
+    if (!set) {
+        pool->pools[0] = av_buffer_pool_init(pool->sizes[0], NULL);
+        if (!pool->pools[0])
+            goto fail;
+    }
 
     return pool;
 
@@ -154,6 +372,24 @@ fail:
     return NULL;
 }
 
+FFFramePool *ff_frame_pool_audio_init(AVBufferRef* (*alloc)(buffer_size_t size),
+                                      int channels,
+                                      int nb_samples,
+                                      enum AVSampleFormat format,
+                                      int align)
+{
+    return frame_pool_audio_init(alloc, NULL, channels, nb_samples, format, align);
+}
+
+FFFramePool *ff_frame_pool_audio_init_shared(FFBufferPoolSet *set,
+                                             int channels,
+                                             int nb_samples,
+                                             enum AVSampleFormat format,
+                                             int align)
+{
+    return frame_pool_audio_init(NULL, set, channels, nb_samples, format, align);
+}
+
 int ff_frame_pool_get_video_config(FFFramePool *pool,
                                    int *width,
                                    int *height,
@@ -216,10 +452,10 @@ AVFrame *ff_frame_pool_get(FFFramePool *pool)
 
         for (i = 0; i < 4; i++) {
             frame->linesize[i] = pool->linesize[i];
-            if (!pool->pools[i])
+            if (!pool->sizes[i])
                 break;
 
-            frame->buf[i] = av_buffer_pool_get(pool->pools[i]);
+            frame->buf[i] = pool_get(pool, i);
             if (!frame->buf[i])
                 goto fail;
 
@@ -258,13 +494,13 @@ AVFrame *ff_frame_pool_get(FFFramePool *pool)
         }
 
         for (i = 0; i < FFMIN(pool->planes, AV_NUM_DATA_POINTERS); i++) {
-            frame->buf[i] = av_buffer_pool_get(pool->pools[0]);
+            frame->buf[i] = pool_get(pool, 0);
             if (!frame->buf[i])
                 goto fail;
             frame->extended_data[i] = frame->data[i] = frame->buf[i]->data;
         }
         for (i = 0; i < frame->nb_extended_buf; i++) {
-            frame->extended_buf[i] = av_buffer_pool_get(pool->pools[0]);
+            frame->extended_buf[i] = pool_get(pool, 0);
             if (!frame->extended_buf[i])
                 goto fail;
             frame->extended_data[i + AV_NUM_DATA_POINTERS] = frame->extended_buf[i]->data;
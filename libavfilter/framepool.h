@@ -32,6 +32,62 @@
  */
 typedef struct FFFramePool FFFramePool;
 
+/**
+ * Set of buffer pools, one per size class, that frame pools with different
+ * configurations can share. This structure is opaque and not meant to be
+ * accessed directly. It is allocated with ff_buffer_pool_set_alloc() and
+ * freed with ff_buffer_pool_set_uninit().
+ */
+typedef struct FFBufferPoolSet FFBufferPoolSet;
+
+typedef struct FFBufferPoolSetStats {
+    int64_t  pooled_size;   ///< total size of the buffers owned by the pools
+    unsigned nb_pooled;     ///< number of buffers owned by the pools
+    unsigned nb_classes;    ///< number of size classes in use
+    unsigned nb_transient;  ///< number of buffers allocated outside the pools
+} FFBufferPoolSetStats;
+
+/**
+ * Allocate a set of buffer pools.
+ *
+ * @param max_size maximum total size of the buffers kept in the pools, 0 for
+ * no limit. Once reached, the buffers that cannot be taken from a pool are
+ * allocated on their own and freed when released.
+ * @return newly created set on success, NULL on error.
+ */
+FFBufferPoolSet *ff_buffer_pool_set_alloc(int64_t max_size);
+
+/**
+ * Get a zero-initialized (on first use) buffer of at least size bytes from
+ * the pool of the matching size class.
+ * This function may be called simultaneously from multiple threads.
+ *
+ * @return a new buffer on success, NULL on error.
+ */
+AVBufferRef *ff_buffer_pool_set_get(FFBufferPoolSet *set, size_t size);
+
+/**
+ * Release the pools of the size classes no buffer was got from since the
+ * previous trim. The buffers of these classes still in use are freed when
+ * released.
+ * This function must not be called while buffers may be got from the set.
+ */
+void ff_buffer_pool_set_trim(FFBufferPoolSet *set);
+
+/**
+ * Get the statistics of a set of buffer pools.
+ */
+void ff_buffer_pool_set_get_stats(FFBufferPoolSet *set, FFBufferPoolSetStats *stats);
+
+/**
+ * Deallocate the set of buffer pools. It is safe to call this function
+ * while some of the buffers are still in use, but not while frame pools
+ * using it may still allocate frames.
+ *
+ * @param set pointer to the set to be freed. It will be set to NULL.
+ */
+void ff_buffer_pool_set_uninit(FFBufferPoolSet **set);
+
 /**
  * Allocate and initialize a video frame pool.
  *
@@ -68,6 +124,30 @@ FFFramePool *ff_frame_pool_audio_init(AVBufferRef* (*alloc)(buffer_size_t size),
                                       enum AVSampleFormat format,
                                       int align);
 
+/**
+ * Allocate and initialize a video frame pool taking its buffers from a set
+ * of buffer pools.
+ *
+ * @see ff_frame_pool_video_init()
+ */
+FFFramePool *ff_frame_pool_video_init_shared(FFBufferPoolSet *set,
+                                             int width,
+                                             int height,
+                                             enum AVPixelFormat format,
+                                             int align);
+
+/**
+ * Allocate and initialize an audio frame pool taking its buffers from a set
+ * of buffer pools.
+ *
+ * @see ff_frame_pool_audio_init()
+ */
+FFFramePool *ff_frame_pool_audio_init_shared(FFBufferPoolSet *set,
+                                             int channels,
+                                             int samples,
+                                             enum AVSampleFormat format,
+                                             int align);
+
 /**
  * Deallocate the frame pool. It is safe to call this function while
  * some of the allocated frame are still in use.
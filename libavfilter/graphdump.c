@@ -151,6 +151,58 @@ static void avfilter_graph_dump_to_buf(AVBPrint *buf, AVFilterGraph *graph)
     }
 }
 
+static void print_json_string(AVBPrint *buf, const char *str)
+{
+    av_bprint_chars(buf, '"', 1);
+    for (; str && *str; str++) {
+        if (*str == '"' || *str == '\\')
+            av_bprintf(buf, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            av_bprintf(buf, "\\u%04x", *str);
+        else
+            av_bprint_chars(buf, *str, 1);
+    }
+    av_bprint_chars(buf, '"', 1);
+}
+
+char *avfilter_graph_dump_stats(AVFilterGraph *graph)
+{
+    AVBPrint buf;
+    char *dump = NULL;
+
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&buf, "[");
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        AVFilterStats *s = avfilter_get_stats(graph->filters[i]);
+
+        if (!s) {
+            av_bprint_finalize(&buf, NULL);
+            return NULL;
+        }
+        av_bprintf(&buf, "%s\n  { \"name\": ", i ? "," : "");
+        print_json_string(&buf, s->filter->name);
+        av_bprintf(&buf, ", \"filter\": ");
+        print_json_string(&buf, s->filter->filter->name);
+        av_bprintf(&buf, ", \"nb_activations\": %"PRId64
+                   ", \"activate_time\": %"PRId64", \"slice_time\": %"PRId64
+                   ", \"frames_in\": %"PRId64", \"frames_out\": %"PRId64
+                   ", \"queued\": %u, \"max_queued\": %u"
+                   ", \"copies_avoided\": %"PRId64", \"copies\": %"PRId64" }",
+                   s->nb_activations, s->activate_time, s->slice_time,
+                   s->frames_in, s->frames_out, s->queued, s->max_queued,
+                   s->copies_avoided, s->copies);
+        av_free(s);
+    }
+    av_bprintf(&buf, "%s]\n", graph->nb_filters ? "\n" : "");
+
+    if (!av_bprint_is_complete(&buf)) {
+        av_bprint_finalize(&buf, NULL);
+        return NULL;
+    }
+    av_bprint_finalize(&buf, &dump);
+    return dump;
+}
+
 char *avfilter_graph_dump(AVFilterGraph *graph, const char *options)
 {
     AVBPrint buf;
@@ -0,0 +1,263 @@
+/*
+ * Filter graph templates
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "libavutil/avassert.h"
+#include "libavutil/avstring.h"
+#include "libavutil/buffer.h"
+#include "libavutil/dict.h"
+#include "libavutil/mem.h"
+#include "avfilter.h"
+#include "buffersrc.h"
+#include "internal.h"
+
+typedef struct TemplateFilter {
+    const AVFilter *filter;
+    char *name;
+    AVDictionary *options;
+    AVBufferRef *hw_device_ctx;
+    AVBufferRef *hw_frames_ctx;     ///< of a buffer source, not an option
+} TemplateFilter;
+
+typedef struct TemplateLink {
+    unsigned src, srcpad;           ///< source filter and output pad indices
+    unsigned dst, dstpad;           ///< destination filter and input pad indices
+    int format;
+    int sample_rate;
+    uint64_t channel_layout;
+    int channels;
+} TemplateLink;
+
+struct AVFilterGraphTemplate {
+    TemplateFilter *filters;
+    unsigned nb_filters;
+    TemplateLink *links;
+    unsigned nb_links;
+};
+
+void avfilter_graph_template_free(AVFilterGraphTemplate **tmpl)
+{
+    AVFilterGraphTemplate *t = *tmpl;
+
+    if (!t)
+        return;
+    for (unsigned i = 0; i < t->nb_filters; i++) {
+        av_freep(&t->filters[i].name);
+        av_dict_free(&t->filters[i].options);
+        av_buffer_unref(&t->filters[i].hw_device_ctx);
+        av_buffer_unref(&t->filters[i].hw_frames_ctx);
+    }
+    av_freep(&t->filters);
+    av_freep(&t->links);
+    av_freep(tmpl);
+}
+
+int avfilter_graph_template_create(AVFilterGraphTemplate **tmpl,
+                                   const AVFilterGraph *graph)
+{
+    AVFilterGraphTemplate *t;
+    unsigned nb_links = 0;
+    int ret;
+
+    *tmpl = NULL;
+    /* the options of the filters were not kept */
+    if (!graph->record_template)
+        return AVERROR(EINVAL);
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        const AVFilterContext *f = graph->filters[i];
+
+        for (unsigned j = 0; j < f->nb_outputs; j++) {
+            const AVFilterLink *link = f->outputs[j];
+            /* the graph must have been configured */
+            if (!link || link->format < 0)
+                return AVERROR(EINVAL);
+        }
+        nb_links += f->nb_outputs;
+    }
+
+    t = av_mallocz(sizeof(*t));
+    if (!t)
+        return AVERROR(ENOMEM);
+    t->filters = av_calloc(graph->nb_filters, sizeof(*t->filters));
+    t->links   = av_calloc(nb_links, sizeof(*t->links));
+    if (!t->filters || (nb_links && !t->links)) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        const AVFilterContext *f = graph->filters[i];
+        TemplateFilter *tf = &t->filters[t->nb_filters++];
+
+        tf->filter = f->filter;
+        if (f->name && !(tf->name = av_strdup(f->name))) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        if ((ret = av_dict_copy(&tf->options, f->internal->init_options, 0)) < 0)
+            goto fail;
+        if (f->hw_device_ctx && !(tf->hw_device_ctx = av_buffer_ref(f->hw_device_ctx))) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        if (!strcmp(f->filter->name, "buffer") && f->outputs[0]->hw_frames_ctx &&
+            !(tf->hw_frames_ctx = av_buffer_ref(f->outputs[0]->hw_frames_ctx))) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+
+        for (unsigned j = 0; j < f->nb_outputs; j++) {
+            const AVFilterLink *link = f->outputs[j];
+            TemplateLink *tl = &t->links[t->nb_links++];
+
+            av_assert0(graph->filters[link->dst->internal->graph_index] == link->dst);
+            tl->src            = i;
+            tl->srcpad         = j;
+            tl->dst            = link->dst->internal->graph_index;
+            tl->dstpad         = FF_INLINK_IDX(link);
+            tl->format         = link->format;
+            tl->sample_rate    = link->sample_rate;
+            tl->channel_layout = link->channel_layout;
+            tl->channels       = link->channels;
+        }
+    }
+
+    *tmpl = t;
+    return 0;
+
+fail:
+    avfilter_graph_template_free(&t);
+    return ret;
+}
+
+/**
+ * Add the options of the dictionary prefixed with the name of the filter to
+ * its options.
+ */
+static int apply_overrides(AVDictionary **dst, const char *name,
+                           const AVDictionary *options)
+{
+    const AVDictionaryEntry *e = NULL;
+    size_t len = name ? strlen(name) : 0;
+    int ret;
+
+    while ((e = av_dict_get(options, "", e, AV_DICT_IGNORE_SUFFIX))) {
+        if (!name || strncmp(e->key, name, len) || e->key[len] != ':')
+            continue;
+        if ((ret = av_dict_set(dst, e->key + len + 1, e->value, 0)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static int check_overrides(const AVFilterGraphTemplate *tmpl,
+                           const AVDictionary *options, void *log_ctx)
+{
+    const AVDictionaryEntry *e = NULL;
+
+    while ((e = av_dict_get(options, "", e, AV_DICT_IGNORE_SUFFIX))) {
+        const char *sep = strchr(e->key, ':');
+        unsigned i;
+
+        for (i = 0; sep && i < tmpl->nb_filters; i++) {
+            const char *name = tmpl->filters[i].name;
+            if (name && strlen(name) == sep - e->key &&
+                !strncmp(name, e->key, sep - e->key))
+                break;
+        }
+        if (!sep || i == tmpl->nb_filters) {
+            av_log(log_ctx, AV_LOG_ERROR,
+                   "Option '%s' does not name a filter of the template\n", e->key);
+            return AVERROR(EINVAL);
+        }
+    }
+    return 0;
+}
+
+int avfilter_graph_template_instantiate(const AVFilterGraphTemplate *tmpl,
+                                        AVFilterGraph *graph,
+                                        const AVDictionary *options,
+                                        void *log_ctx)
+{
+    int ret;
+
+    if (graph->nb_filters) {
+        av_log(log_ctx, AV_LOG_ERROR, "Templates are instantiated in empty graphs\n");
+        return AVERROR(EINVAL);
+    }
+    if ((ret = check_overrides(tmpl, options, log_ctx)) < 0)
+        return ret;
+
+    for (unsigned i = 0; i < tmpl->nb_filters; i++) {
+        const TemplateFilter *tf = &tmpl->filters[i];
+        AVDictionary *opts = NULL;
+        const AVDictionaryEntry *e;
+        AVFilterContext *f;
+
+        f = avfilter_graph_alloc_filter(graph, tf->filter, tf->name);
+        if (!f)
+            return AVERROR(ENOMEM);
+        if (tf->hw_device_ctx && !(f->hw_device_ctx = av_buffer_ref(tf->hw_device_ctx)))
+            return AVERROR(ENOMEM);
+        if (tf->hw_frames_ctx) {
+            AVBufferSrcParameters *par = av_buffersrc_parameters_alloc();
+
+            if (!par)
+                return AVERROR(ENOMEM);
+            par->hw_frames_ctx = tf->hw_frames_ctx;
+            ret = av_buffersrc_parameters_set(f, par);
+            av_free(par);
+            if (ret < 0)
+                return ret;
+        }
+
+        if ((ret = av_dict_copy(&opts, tf->options, 0)) < 0 ||
+            (ret = apply_overrides(&opts, tf->name, options)) < 0 ||
+            (ret = avfilter_init_dict(f, &opts)) < 0) {
+            av_dict_free(&opts);
+            return ret;
+        }
+        e = av_dict_get(opts, "", NULL, AV_DICT_IGNORE_SUFFIX);
+        if (e) {
+            av_log(f, AV_LOG_ERROR, "No such option: %s.\n", e->key);
+            av_dict_free(&opts);
+            return AVERROR_OPTION_NOT_FOUND;
+        }
+        av_dict_free(&opts);
+    }
+
+    for (unsigned i = 0; i < tmpl->nb_links; i++) {
+        const TemplateLink *tl = &tmpl->links[i];
+        AVFilterLink *link;
+
+        ret = avfilter_link(graph->filters[tl->src], tl->srcpad,
+                            graph->filters[tl->dst], tl->dstpad);
+        if (ret < 0)
+            return ret;
+        link = graph->filters[tl->src]->outputs[tl->srcpad];
+        link->format         = tl->format;
+        link->sample_rate    = tl->sample_rate;
+        link->channel_layout = tl->channel_layout;
+        link->channels       = tl->channels;
+    }
+
+    return ff_graph_config_negotiated(graph, log_ctx);
+}
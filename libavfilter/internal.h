@@ -24,6 +24,8 @@
  * internal API functions
  */
 
+#include <stdatomic.h>
+
 #include "libavutil/internal.h"
 #include "avfilter.h"
 #include "formats.h"
@@ -48,6 +50,12 @@ typedef struct AVFilterCommand {
  */
 void ff_avfilter_graph_update_heap(AVFilterGraph *graph, AVFilterLink *link);
 
+/**
+ * Update the position of a filter in the ready heap after its ready field
+ * changed.
+ */
+void ff_filter_graph_update_ready(AVFilterGraph *graph, AVFilterContext *filter);
+
 /**
  * A filter pad used for either input or output.
  */
@@ -124,16 +132,89 @@ struct AVFilterPad {
      * input pads only.
      */
     int needs_writable;
+
+    /**
+     * The filter may write its output for this input over the input frame
+     * when that is writable, see ff_get_video_output().
+     *
+     * input pads only.
+     */
+    int inplace;
 };
 
 struct AVFilterGraphInternal {
     void *thread;
     avfilter_execute_func *thread_execute;
     FFFrameQueueGlobal frame_queues;
+
+    /**
+     * Maximum number of filters activated concurrently by
+     * ff_filter_graph_run_once(), 0 if the graph is not threaded.
+     */
+    int max_wave;
+
+    /**
+     * Set while a wave of filters is running. The filters of a wave are
+     * never linked to each other, so each link and its frame queue are only
+     * accessed by one of them; the state they may share through a common
+     * neighbour (ready status, blocked outputs, sink heap) must be accessed
+     * with ff_graph_lock() held.
+     */
+    int in_wave;
+
+    unsigned wave_id;               ///< id of the last wave
+    AVFilterContext **wave_filters; ///< max_wave filters to activate, see ff_graph_run_wave()
+
+    /**
+     * Filters with a non-zero ready field, as a binary heap ordered by
+     * decreasing ready and then by increasing index in the graph, so that
+     * the top is the filter a linear scan of graph->filters would pick.
+     * Allocated for graph->nb_filters entries.
+     */
+    AVFilterContext **ready_heap;
+    unsigned nb_ready;
+
+    /**
+     * Buffers shared by the frame pools of all the links, so that memory
+     * follows the number of frames in flight rather than of links.
+     */
+    FFBufferPoolSet *buffer_pools;
 };
 
 struct AVFilterInternal {
     avfilter_execute_func *execute;
+
+    unsigned wave_id;               ///< id of the last wave the filter was part of
+
+    unsigned graph_index;           ///< index of the filter in graph->filters
+    int ready_index;                ///< index in the graph ready heap, -1 if absent
+
+    /**
+     * Statistics, the times are only updated with
+     * AVFilterGraph.collect_stats set, see AVFilterStats.
+     */
+    int64_t nb_activations;
+    int64_t activate_time;
+    int64_t slice_time;
+    int64_t copies_avoided;
+    int64_t copies;
+
+    /**
+     * Filter doing the processing of this one, see AVFilter.fuse. The frames
+     * consumed on the input before the fused_until-th one were processed by
+     * fused_into and are passed through unchanged. fused_until is only
+     * lowered from INT64_MAX by fused_into when the fusion is undone.
+     */
+    AVFilterContext *fused_into;
+    atomic_int_least64_t fused_until;
+    int nb_fused;                   ///< number of filters fused into this one
+
+    /**
+     * Options the filter was initialized with, as strings; used to create
+     * the same filter again from an AVFilterGraphTemplate. Only kept when
+     * the record_template option of the graph is set.
+     */
+    AVDictionary *init_options;
 };
 
 /**
@@ -332,17 +413,39 @@ int ff_filter_activate(AVFilterContext *filter);
  */
 void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter);
 
+/**
+ * Undo the fusion of a filter with the filters it is fused with, so that
+ * each of them processes frames on its own again. The frames the first
+ * filter of the chain already sent are still passed through by the others.
+ *
+ * Must be called from the first filter of the chain, or while no filter of
+ * the graph is running.
+ */
+void ff_filter_unfuse(AVFilterContext *filter);
+
 /**
  * The filter is aware of hardware frames, and any hardware frame context
  * should not be automatically propagated through it.
  */
 #define FF_FILTER_FLAG_HWFRAME_AWARE (1 << 0)
 
+/**
+ * The filter accesses other filters of the graph than its neighbours, for
+ * example to send them commands: never activate it concurrently with others.
+ */
+#define FF_FILTER_FLAG_GRAPH_EXCLUSIVE (1 << 1)
+
 /**
  * Run one round of processing on a filter graph.
  */
 int ff_filter_graph_run_once(AVFilterGraph *graph);
 
+/**
+ * Configure a graph like avfilter_graph_config(), for links whose formats
+ * are already set: the formats are not negotiated.
+ */
+int ff_graph_config_negotiated(AVFilterGraph *graph, void *log_ctx);
+
 /**
  * Normalize the qscale factor
  * FIXME the H264 qscale is a log based scale, mpeg1/2 is not, the code below
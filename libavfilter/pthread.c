@@ -23,6 +23,7 @@
 
 #include "config.h"
 
+#include "libavutil/avassert.h"
 #include "libavutil/common.h"
 #include "libavutil/cpu.h"
 #include "libavutil/mem.h"
@@ -42,6 +43,14 @@ typedef struct ThreadContext {
     AVFilterContext *ctx;
     void *arg;
     int   *rets;
+
+    /* graph threading, see ff_graph_run_wave() */
+    AVSliceThread *graph_thread;
+    int nb_graph_threads;
+    pthread_mutex_t execute_lock;   ///< the slice threads are shared by all filters
+    pthread_mutex_t lock;           ///< protects the state shared between filters
+    AVFilterContext **wave;         ///< AVFilterGraphInternal.wave_filters
+    int *wave_rets;
 } ThreadContext;
 
 static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
@@ -52,9 +61,23 @@ static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb
         c->rets[jobnr] = ret;
 }
 
+static void graph_worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    ThreadContext *c = priv;
+
+    c->wave_rets[jobnr] = ff_filter_activate(c->wave[jobnr]);
+}
+
 static void slice_thread_uninit(ThreadContext *c)
 {
     avpriv_slicethread_free(&c->thread);
+    if (c->graph_thread) {
+        avpriv_slicethread_free(&c->graph_thread);
+        pthread_mutex_destroy(&c->execute_lock);
+        pthread_mutex_destroy(&c->lock);
+    }
+    av_freep(&c->wave);
+    av_freep(&c->wave_rets);
 }
 
 static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
@@ -64,12 +87,49 @@ static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
 
     if (nb_jobs <= 0)
         return 0;
+    /* filters of the same wave may request slice threads concurrently */
+    if (c->graph_thread)
+        pthread_mutex_lock(&c->execute_lock);
+
     c->ctx         = ctx;
     c->arg         = arg;
     c->func        = func;
     c->rets        = ret;
 
     avpriv_slicethread_execute(c->thread, nb_jobs, 0);
+
+    if (c->graph_thread)
+        pthread_mutex_unlock(&c->execute_lock);
+    return 0;
+}
+
+static int graph_thread_init(AVFilterGraph *graph, ThreadContext *c, int nb_threads)
+{
+    int ret;
+
+    c->wave      = av_malloc_array(nb_threads, sizeof(*c->wave));
+    c->wave_rets = av_malloc_array(nb_threads, sizeof(*c->wave_rets));
+    if (!c->wave || !c->wave_rets)
+        return AVERROR(ENOMEM);
+
+    ret = avpriv_slicethread_create(&c->graph_thread, c, graph_worker_func, NULL, nb_threads);
+    if (ret <= 1) {
+        avpriv_slicethread_free(&c->graph_thread);
+        return ret < 0 ? ret : 0;
+    }
+    c->nb_graph_threads = ret;
+    graph->internal->wave_filters = c->wave;
+
+    if ((ret = pthread_mutex_init(&c->execute_lock, NULL))) {
+        avpriv_slicethread_free(&c->graph_thread);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_mutex_init(&c->lock, NULL))) {
+        pthread_mutex_destroy(&c->execute_lock);
+        avpriv_slicethread_free(&c->graph_thread);
+        return AVERROR(ret);
+    }
+
     return 0;
 }
 
@@ -105,6 +165,18 @@ int ff_graph_thread_init(AVFilterGraph *graph)
 
     graph->internal->thread_execute = thread_execute;
 
+    if (graph->thread_type & AVFILTER_THREAD_GRAPH) {
+        ThreadContext *c = graph->internal->thread;
+
+        ret = graph_thread_init(graph, c, graph->nb_threads);
+        if (ret < 0) {
+            ff_graph_thread_free(graph);
+            graph->internal->thread_execute = NULL;
+            return ret;
+        }
+        graph->internal->max_wave = c->nb_graph_threads;
+    }
+
     return 0;
 }
 
@@ -113,4 +185,36 @@ void ff_graph_thread_free(AVFilterGraph *graph)
     if (graph->internal->thread)
         slice_thread_uninit(graph->internal->thread);
     av_freep(&graph->internal->thread);
+    graph->internal->max_wave     = 0;
+    graph->internal->wave_filters = NULL;
+}
+
+int ff_graph_run_wave(AVFilterGraph *graph, int nb_filters)
+{
+    ThreadContext *c = graph->internal->thread;
+    int i, ret = 0;
+
+    av_assert1(nb_filters <= c->nb_graph_threads);
+
+    graph->internal->in_wave = 1;
+    avpriv_slicethread_execute(c->graph_thread, nb_filters, 0);
+    graph->internal->in_wave = 0;
+
+    for (i = 0; i < nb_filters && ret >= 0; i++)
+        ret = c->wave_rets[i];
+    return ret;
+}
+
+void ff_graph_lock(AVFilterGraph *graph)
+{
+    ThreadContext *c = graph->internal->thread;
+
+    pthread_mutex_lock(&c->lock);
+}
+
+void ff_graph_unlock(AVFilterGraph *graph)
+{
+    ThreadContext *c = graph->internal->thread;
+
+    pthread_mutex_unlock(&c->lock);
 }
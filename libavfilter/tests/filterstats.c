@@ -0,0 +1,166 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run a graph with two branches, the frames of the second one piling up
+ * while the first one is drained, and print the statistics of its filters.
+ * The times are not printed, only checked to be consistent. The JSON dump
+ * of the statistics is checked to be well-formed.
+ */
+
+#include <stdio.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/frame.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+
+#define GRAPH "testsrc=s=32x24:r=25:d=0.4,split[a][b];" \
+              "[a]null,buffersink@a;[b]hflip,buffersink@b"
+
+static const char *skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\n')
+        p++;
+    return p;
+}
+
+/**
+ * Parse one JSON value, counting the objects found.
+ *
+ * @return the end of the value, or NULL if it is not well-formed
+ */
+static const char *parse_value(const char *p, int *nb_objects)
+{
+    p = skip_space(p);
+    switch (*p) {
+    case '{':
+    case '[': {
+        const char end = *p == '{' ? '}' : ']';
+
+        *nb_objects += *p == '{';
+        p = skip_space(p + 1);
+        if (*p == end)
+            return p + 1;
+        while (1) {
+            p = skip_space(p);
+            if (end == '}') {
+                if (*p != '"' || !(p = parse_value(p, nb_objects)))
+                    return NULL;
+                p = skip_space(p);
+                if (*p++ != ':')
+                    return NULL;
+            }
+            if (!(p = parse_value(p, nb_objects)))
+                return NULL;
+            p = skip_space(p);
+            if (*p == end)
+                return p + 1;
+            if (*p++ != ',')
+                return NULL;
+        }
+    }
+    case '"':
+        for (p++; *p != '"'; p++) {
+            if (!*p || (unsigned char)*p < 0x20)
+                return NULL;
+            if (*p == '\\' && !*++p)
+                return NULL;
+        }
+        return p + 1;
+    default:
+        if (*p == '-')
+            p++;
+        if (!av_isdigit(*p))
+            return NULL;
+        while (av_isdigit(*p))
+            p++;
+        return p;
+    }
+}
+
+static int check_dump(AVFilterGraph *graph)
+{
+    char *dump = avfilter_graph_dump_stats(graph);
+    const char *end;
+    int nb_objects = 0, valid;
+
+    if (!dump)
+        return 1;
+    end   = parse_value(dump, &nb_objects);
+    valid = end && !*skip_space(end);
+    printf("json dump: %s, %d objects\n", valid ? "well-formed" : "malformed", nb_objects);
+    av_free(dump);
+    return !valid || nb_objects != graph->nb_filters;
+}
+
+static int drain(AVFilterContext *sink, AVFrame *frame)
+{
+    int ret;
+
+    while ((ret = av_buffersink_get_frame(sink, frame)) >= 0)
+        av_frame_unref(frame);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+int main(void)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int failed = 0;
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    if (!graph || !frame)
+        return 1;
+    graph->nb_threads = 1;
+    if (av_opt_set_int(graph, "collect_stats", 1, 0) < 0 ||
+        avfilter_graph_parse_ptr(graph, GRAPH, NULL, NULL, NULL) < 0 ||
+        avfilter_graph_config(graph, NULL) < 0) {
+        printf("failed to configure the graph\n");
+        return 1;
+    }
+
+    /* the frames of the second branch are queued until the first one ends */
+    if (drain(avfilter_graph_get_filter(graph, "buffersink@a"), frame) < 0 ||
+        drain(avfilter_graph_get_filter(graph, "buffersink@b"), frame) < 0) {
+        printf("failed to run the graph\n");
+        return 1;
+    }
+
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        AVFilterStats *s = avfilter_get_stats(graph->filters[i]);
+
+        if (!s)
+            return 1;
+        printf("%-14s frames in %2"PRId64" out %2"PRId64" queued %u max %2u activations %s\n",
+               s->filter->name, s->frames_in, s->frames_out, s->queued, s->max_queued,
+               s->nb_activations > 0 ? "some" : "none");
+        failed |= s->filter != graph->filters[i] || s->nb_activations <= 0 ||
+                  s->activate_time < 0 || s->slice_time < 0 ||
+                  s->slice_time > s->activate_time;
+        av_free(s);
+    }
+    failed |= check_dump(graph);
+
+    av_frame_free(&frame);
+    avfilter_graph_free(&graph);
+    return failed;
+}
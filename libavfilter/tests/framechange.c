@@ -0,0 +1,139 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Send gray frames with rectangles drawn in them to framechange with
+ * regions of interest enabled, and print the blocks changed and the
+ * regions exported for each frame.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/frame.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+
+#define WIDTH  72
+#define HEIGHT 40
+
+typedef struct Rect {
+    int x, y, w, h;
+} Rect;
+
+/* rectangles drawn on top of the previous frame, ended by an empty one */
+static const Rect frames[][4] = {
+    { { 0 } },
+    /* two blocks of the first row and the partial last block of the last row */
+    { { 4, 2, 24, 4 }, { 66, 34, 4, 4 } },
+    { { 0 } },
+    /* three blocks of the second row, the middle one barely changed */
+    { { 20, 18, 4, 4 }, { 36, 18, 1, 1 }, { 52, 18, 4, 4 } },
+    /* the whole frame */
+    { { 0, 0, WIDTH, HEIGHT } },
+};
+
+static int send_frame(AVFilterContext *src, AVFrame *canvas, const Rect *rects,
+                      int64_t pts)
+{
+    AVFrame *frame = av_frame_alloc();
+    int ret;
+
+    if (!frame)
+        return AVERROR(ENOMEM);
+    for (; rects->w; rects++)
+        for (int y = rects->y; y < rects->y + rects->h; y++)
+            memset(canvas->data[0] + y * canvas->linesize[0] + rects->x,
+                   pts & 1 ? 235 : 16, rects->w);
+    if ((ret = av_frame_ref(frame, canvas)) >= 0 &&
+        (ret = av_frame_make_writable(frame)) >= 0) {
+        frame->pts = pts;
+        ret = av_buffersrc_add_frame(src, frame);
+    }
+    av_frame_free(&frame);
+    return ret;
+}
+
+static void print_frame(const AVFrame *frame)
+{
+    const AVDictionaryEntry *e = av_dict_get(frame->metadata,
+                                             "lavfi.framechange.blocks_changed", NULL, 0);
+    const AVFrameSideData *sd = av_frame_get_side_data(frame,
+                                                       AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+    printf("frame %"PRId64": blocks changed %s\n", frame->pts, e ? e->value : "none");
+    if (!sd)
+        return;
+    for (size_t i = 0; i < sd->size / sizeof(AVRegionOfInterest); i++) {
+        const AVRegionOfInterest *roi = (const AVRegionOfInterest *)sd->data + i;
+        printf("  roi %d,%d - %d,%d qoffset %d/%d\n", roi->left, roi->top,
+               roi->right, roi->bottom, roi->qoffset.num, roi->qoffset.den);
+    }
+}
+
+int main(void)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *src, *sink;
+    AVFrame *canvas = av_frame_alloc(), *frame = av_frame_alloc();
+    char args[64];
+    int ret = 0;
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    if (!graph || !canvas || !frame)
+        return 1;
+    canvas->format = AV_PIX_FMT_GRAY8;
+    canvas->width  = WIDTH;
+    canvas->height = HEIGHT;
+    if (av_frame_get_buffer(canvas, 0) < 0)
+        return 1;
+    for (int y = 0; y < HEIGHT; y++)
+        memset(canvas->data[0] + y * canvas->linesize[0], 128, WIDTH);
+
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=gray:time_base=1/25",
+             WIDTH, HEIGHT);
+    if (avfilter_graph_create_filter(&src, avfilter_get_by_name("buffer"), "in",
+                                     args, NULL, graph) < 0 ||
+        avfilter_graph_parse_ptr(graph, "framechange@f=block_size=16:block_threshold=0.01:"
+                                 "roi=1:roi_qoffset=-1/4,buffersink@out", NULL, NULL, NULL) < 0 ||
+        avfilter_link(src, 0, avfilter_graph_get_filter(graph, "framechange@f"), 0) < 0 ||
+        avfilter_graph_config(graph, NULL) < 0) {
+        printf("failed to configure the graph\n");
+        return 1;
+    }
+    sink = avfilter_graph_get_filter(graph, "buffersink@out");
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(frames); i++) {
+        if (send_frame(src, canvas, frames[i], i) < 0)
+            return 1;
+        while ((ret = av_buffersink_get_frame(sink, frame)) >= 0) {
+            print_frame(frame);
+            av_frame_unref(frame);
+        }
+        if (ret != AVERROR(EAGAIN))
+            return 1;
+    }
+
+    av_frame_free(&frame);
+    av_frame_free(&canvas);
+    avfilter_graph_free(&graph);
+    return 0;
+}
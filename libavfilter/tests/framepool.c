@@ -0,0 +1,163 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavfilter/framepool.c"
+
+#include "libavutil/intreadwrite.h"
+#include "libavutil/thread.h"
+
+#undef printf
+
+#define NB_THREADS 4
+#define HOLD       3  ///< buffers held by each thread at once
+
+typedef struct ThreadContext {
+    FFBufferPoolSet *set;
+    int id;
+    int failed;
+} ThreadContext;
+
+static void print_stats(const char *step, FFBufferPoolSet *set)
+{
+    FFBufferPoolSetStats stats;
+
+    ff_buffer_pool_set_get_stats(set, &stats);
+    printf("%-28s size %7"PRId64" pooled %u classes %u transient %u\n", step,
+           stats.pooled_size, stats.nb_pooled, stats.nb_classes, stats.nb_transient);
+}
+
+static int get_and_release(FFBufferPoolSet *set, size_t size, int nb)
+{
+    for (int i = 0; i < nb; i++) {
+        AVBufferRef *buf = ff_buffer_pool_set_get(set, size);
+        if (!buf)
+            return AVERROR(ENOMEM);
+        av_buffer_unref(&buf);
+    }
+    return 0;
+}
+
+/* get buffers of all the sizes at once, so that the classes are created concurrently */
+static void *thread_main(void *arg)
+{
+    static const size_t sizes[HOLD] = { 100, 3000, 70000 };
+    ThreadContext *t = arg;
+    AVBufferRef *bufs[HOLD];
+
+    for (int i = 0; i < 2000; i++) {
+        for (int j = 0; j < HOLD; j++) {
+            if (!(bufs[j] = ff_buffer_pool_set_get(t->set, sizes[j]))) {
+                t->failed = 1;
+                return NULL;
+            }
+            AV_WN32(bufs[j]->data, t->id * HOLD + j);
+        }
+        for (int j = 0; j < HOLD; j++) {
+            if (AV_RN32(bufs[j]->data) != t->id * HOLD + j)
+                t->failed = 1;
+            av_buffer_unref(&bufs[j]);
+        }
+    }
+    return NULL;
+}
+
+static int get_concurrently(FFBufferPoolSet *set)
+{
+    ThreadContext threads[NB_THREADS];
+    FFBufferPoolSetStats stats;
+    int failed = 0;
+#if HAVE_THREADS
+    pthread_t tids[NB_THREADS];
+#endif
+
+    for (int i = 0; i < NB_THREADS; i++)
+        threads[i] = (ThreadContext){ .set = set, .id = i };
+#if HAVE_THREADS
+    for (int i = 0; i < NB_THREADS; i++)
+        if (pthread_create(&tids[i], NULL, thread_main, &threads[i]))
+            return 1;
+    for (int i = 0; i < NB_THREADS; i++)
+        pthread_join(tids[i], NULL);
+#else
+    for (int i = 0; i < NB_THREADS; i++)
+        thread_main(&threads[i]);
+#endif
+    for (int i = 0; i < NB_THREADS; i++)
+        failed |= threads[i].failed;
+
+    ff_buffer_pool_set_get_stats(set, &stats);
+    printf("concurrent gets              classes %u %s\n", stats.nb_classes,
+           failed ? "corrupted" : stats.nb_pooled > NB_THREADS * HOLD ?
+           "too many buffers" : "ok");
+    return failed || stats.nb_pooled > NB_THREADS * HOLD;
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 1000, 5000, 100000 };
+    AVBufferRef *bufs[3] = { NULL };
+    FFBufferPoolSet *set;
+    int ret = 0;
+
+    /* unused classes are released by explicit trims */
+    if (!(set = ff_buffer_pool_set_alloc(0)))
+        return 1;
+    for (int i = 0; i < FF_ARRAY_ELEMS(sizes); i++)
+        if (!(bufs[i] = ff_buffer_pool_set_get(set, sizes[i])))
+            ret = 1;
+    av_buffer_unref(&bufs[0]);
+    av_buffer_unref(&bufs[1]);
+    print_stats("three classes", set);
+    ff_buffer_pool_set_trim(set);
+    print_stats("trim after use", set);
+    if (get_and_release(set, sizes[0], 1) < 0)
+        ret = 1;
+    ff_buffer_pool_set_trim(set);
+    print_stats("trim with one class used", set);
+    av_buffer_unref(&bufs[2]);
+    print_stats("release of a trimmed buffer", set);
+    ff_buffer_pool_set_trim(set);
+    print_stats("trim without use", set);
+    ff_buffer_pool_set_uninit(&set);
+
+    /* gets need no lock, trims are only done between them */
+    if (!(set = ff_buffer_pool_set_alloc(0)))
+        return 1;
+    if (get_and_release(set, sizes[1], 1) < 0 ||
+        get_and_release(set, sizes[0], 1000) < 0)
+        ret = 1;
+    print_stats("without trims", set);
+    ret |= get_concurrently(set);
+    ff_buffer_pool_set_trim(set);
+    ff_buffer_pool_set_trim(set);
+    print_stats("trims after the threads", set);
+    ff_buffer_pool_set_uninit(&set);
+
+    /* buffers beyond the maximum size are not kept */
+    if (!(set = ff_buffer_pool_set_alloc(2 * 1024)))
+        return 1;
+    for (int i = 0; i < FF_ARRAY_ELEMS(bufs); i++)
+        if (!(bufs[i] = ff_buffer_pool_set_get(set, sizes[0])))
+            ret = 1;
+    print_stats("above the maximum size", set);
+    for (int i = 0; i < FF_ARRAY_ELEMS(bufs); i++)
+        av_buffer_unref(&bufs[i]);
+    ff_buffer_pool_set_uninit(&set);
+
+    return ret;
+}
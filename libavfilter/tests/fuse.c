@@ -0,0 +1,164 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run chains of lookup filters with commands queued to them, once fused
+ * and once with the fusion prevented by a timeline expression, and check
+ * that every frame is the same.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/common.h"
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+
+#define MAX_FRAMES 8
+
+typedef struct Command {
+    const char *target, *cmd, *arg;
+    double time;
+} Command;
+
+static const struct {
+    const char *chain;
+    Command commands[2];
+} tests[] = {
+    { "lutyuv@a=y=val,lutyuv@b=y=negval",
+      { { "lutyuv@b", "y", "val", 1 } } },
+    { "lutyuv@a=y=val/2,format=yuv420p,negate@b,lutyuv@c=u=val/2",
+      { { "lutyuv@a", "y", "val", 1 }, { "lutyuv@c", "u", "maxval", 2 } } },
+    { "lutrgb@a=r=val/2,lutrgb@b=g=negval,lutrgb@c=b=val*2",
+      { { "lutrgb@b", "g", "val", 2 } } },
+};
+
+/**
+ * Add a timeline expression to the lookup filters of a chain, which prevents
+ * their fusion without changing what they do.
+ */
+static void unfused_chain(char *dst, size_t size, const char *chain)
+{
+    const char *p = chain;
+
+    *dst = 0;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        const char *eq = memchr(p, '=', len);
+
+        snprintf(dst + strlen(dst), size - strlen(dst), "%.*s%s%s", (int)len, p,
+                 strncmp(p, "lut", 3) && strncmp(p, "negate", 6) ? "" :
+                 eq ? ":enable=1" : "=enable=1", p[len] ? "," : "");
+        p += len + !!p[len];
+    }
+}
+
+static uint32_t frame_crc(const AVFrame *frame)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    uint32_t crc = 0;
+
+    for (int p = 0; p < 4 && frame->data[p]; p++) {
+        const int w = av_image_get_linesize(frame->format, frame->width, p);
+        const int h = p == 1 || p == 2 ?
+                      AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+
+        for (int y = 0; y < h; y++)
+            crc = av_adler32_update(crc, frame->data[p] + y * frame->linesize[p], w);
+    }
+    return crc;
+}
+
+static int run_chain(const char *chain, const Command *commands,
+                     uint32_t *crcs, int *nb_frames)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *sink;
+    AVFrame *frame = av_frame_alloc();
+    char desc[1024];
+    int ret;
+
+    if (!graph || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    /* sources generating the format directly, without conversion */
+    snprintf(desc, sizeof(desc), "%s=s=64x64:r=1:d=4,format=%s,%s,buffersink@out",
+             strstr(chain, "lutrgb") ? "testsrc"  : "testsrc2",
+             strstr(chain, "lutrgb") ? "rgb24" : "yuv420p", chain);
+    if ((ret = avfilter_graph_parse_ptr(graph, desc, NULL, NULL, NULL)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+    sink = avfilter_graph_get_filter(graph, "buffersink@out");
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(tests[0].commands) && commands[i].target; i++)
+        if ((ret = avfilter_graph_queue_command(graph, commands[i].target,
+                                                commands[i].cmd, commands[i].arg,
+                                                0, commands[i].time)) < 0)
+            goto end;
+
+    *nb_frames = 0;
+    while ((ret = av_buffersink_get_frame(sink, frame)) >= 0) {
+        if (*nb_frames < MAX_FRAMES)
+            crcs[(*nb_frames)++] = frame_crc(frame);
+        av_frame_unref(frame);
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+end:
+    av_frame_free(&frame);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+int main(void)
+{
+    int ret = 0;
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(tests); i++) {
+        uint32_t fused[MAX_FRAMES], unfused[MAX_FRAMES];
+        int nb_fused, nb_unfused;
+        char chain[512];
+
+        unfused_chain(chain, sizeof(chain), tests[i].chain);
+        if (run_chain(tests[i].chain, tests[i].commands, fused,   &nb_fused)   < 0 ||
+            run_chain(chain,          tests[i].commands, unfused, &nb_unfused) < 0) {
+            printf("%s: failed to run\n", tests[i].chain);
+            return 1;
+        }
+
+        printf("%s:", tests[i].chain);
+        for (int j = 0; j < nb_fused; j++)
+            printf(" %08x", fused[j]);
+        printf("\n");
+        if (nb_fused != nb_unfused || memcmp(fused, unfused, nb_fused * sizeof(*fused))) {
+            printf("  mismatch with the unfused chain:");
+            for (int j = 0; j < nb_unfused; j++)
+                printf(" %08x", unfused[j]);
+            printf("\n");
+            ret = 1;
+        }
+    }
+    return ret;
+}
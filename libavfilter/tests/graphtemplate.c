@@ -0,0 +1,194 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Create a template from a configured graph, instantiate it with and without
+ * option overrides, and check that the instances have the same filters and
+ * link formats and output the same frames as graphs configured normally.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/common.h"
+#include "libavutil/dict.h"
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+
+#define MAX_FRAMES 8
+
+/* the source outputs gray directly, no scaler is inserted */
+#define GRAPH "testsrc2=s=64x48:r=5:d=1,crop@c=32:24,format@f=gray,hflip,buffersink@out"
+
+typedef struct Output {
+    uint32_t crcs[MAX_FRAMES];
+    int nb_frames;
+} Output;
+
+static uint32_t frame_crc(const AVFrame *frame)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    uint32_t crc = 0;
+
+    for (int p = 0; p < 4 && frame->data[p]; p++) {
+        const int w = av_image_get_linesize(frame->format, frame->width, p);
+        const int h = p == 1 || p == 2 ?
+                      AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+
+        for (int y = 0; y < h; y++)
+            crc = av_adler32_update(crc, frame->data[p] + y * frame->linesize[p], w);
+    }
+    return crc;
+}
+
+static int run_graph(AVFilterGraph *graph, Output *out)
+{
+    AVFilterContext *sink = avfilter_graph_get_filter(graph, "buffersink@out");
+    AVFrame *frame = av_frame_alloc();
+    int ret;
+
+    if (!frame)
+        return AVERROR(ENOMEM);
+    out->nb_frames = 0;
+    while ((ret = av_buffersink_get_frame(sink, frame)) >= 0) {
+        if (out->nb_frames < MAX_FRAMES)
+            out->crcs[out->nb_frames++] = frame_crc(frame);
+        av_frame_unref(frame);
+    }
+    av_frame_free(&frame);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static void print_graph(const AVFilterGraph *graph)
+{
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        const AVFilterContext *f = graph->filters[i];
+
+        for (unsigned j = 0; j < f->nb_outputs; j++) {
+            const AVFilterLink *link = f->outputs[j];
+            printf("  %s -> %s: %s %dx%d\n", f->filter->name, link->dst->filter->name,
+                   av_get_pix_fmt_name(link->format), link->w, link->h);
+        }
+    }
+}
+
+static int compare(const char *name, const Output *a, const Output *b)
+{
+    if (a->nb_frames != b->nb_frames ||
+        memcmp(a->crcs, b->crcs, a->nb_frames * sizeof(*a->crcs))) {
+        printf("%s: mismatch\n", name);
+        return 1;
+    }
+    printf("%s: %d frames match\n", name, a->nb_frames);
+    return 0;
+}
+
+/**
+ * Configure a graph normally, without recording a template.
+ */
+static int run_configured(const char *desc, Output *out)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    int ret;
+
+    if (!graph)
+        return AVERROR(ENOMEM);
+    if ((ret = avfilter_graph_parse_ptr(graph, desc, NULL, NULL, NULL)) >= 0 &&
+        (ret = avfilter_graph_config(graph, NULL)) >= 0)
+        ret = run_graph(graph, out);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+static int run_instance(const AVFilterGraphTemplate *tmpl, const char *options,
+                        Output *out)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVDictionary *opts = NULL;
+    int ret;
+
+    if (!graph)
+        return AVERROR(ENOMEM);
+    if (options && (ret = av_dict_parse_string(&opts, options, "=", ",", 0)) < 0)
+        goto end;
+    if ((ret = avfilter_graph_template_instantiate(tmpl, graph, opts, NULL)) < 0)
+        goto end;
+    print_graph(graph);
+    ret = run_graph(graph, out);
+end:
+    av_dict_free(&opts);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+int main(void)
+{
+    AVFilterGraphTemplate *tmpl = NULL;
+    AVFilterGraph *graph;
+    Output ref, out;
+    int ret, failed = 0;
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    /* the options are only kept when recording is enabled */
+    if (!(graph = avfilter_graph_alloc()))
+        return 1;
+    if (avfilter_graph_parse_ptr(graph, GRAPH, NULL, NULL, NULL) < 0 ||
+        avfilter_graph_config(graph, NULL) < 0)
+        return 1;
+    ret = avfilter_graph_template_create(&tmpl, graph);
+    printf("template of a graph not recording: %s\n", ret < 0 ? "rejected" : "created");
+    failed |= ret >= 0;
+    avfilter_graph_template_free(&tmpl);
+    avfilter_graph_free(&graph);
+
+    if (!(graph = avfilter_graph_alloc()))
+        return 1;
+    if (av_opt_set_int(graph, "record_template", 1, 0) < 0 ||
+        avfilter_graph_parse_ptr(graph, GRAPH, NULL, NULL, NULL) < 0 ||
+        avfilter_graph_config(graph, NULL) < 0 ||
+        avfilter_graph_template_create(&tmpl, graph) < 0) {
+        printf("failed to create the template\n");
+        return 1;
+    }
+    avfilter_graph_free(&graph);
+
+    printf("instance:\n");
+    if (run_configured(GRAPH, &ref) < 0 || run_instance(tmpl, NULL, &out) < 0)
+        return 1;
+    failed |= compare("instance", &ref, &out);
+
+    printf("instance with overrides:\n");
+    if (run_configured("testsrc2=s=64x48:r=5:d=1,crop@c=48:36,format@f=gray,"
+                       "hflip,buffersink@out", &ref) < 0 ||
+        run_instance(tmpl, "crop@c:w=48,crop@c:h=36", &out) < 0)
+        return 1;
+    failed |= compare("instance with overrides", &ref, &out);
+
+    ret = run_instance(tmpl, "hflip:w=48", &out);
+    printf("override of an unknown filter: %s\n", ret < 0 ? "rejected" : "accepted");
+    failed |= ret >= 0;
+
+    avfilter_graph_template_free(&tmpl);
+    return failed;
+}
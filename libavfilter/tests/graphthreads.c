@@ -0,0 +1,158 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run a graph with independent branches, one of them with sendcmd changing
+ * the filters of another, with graph threading, and check that its outputs
+ * are the ones of single-threaded runs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+
+#define GRAPH \
+    "testsrc2=s=64x48:r=25:d=0.8,format=yuv420p," \
+    "sendcmd=c='0.32 drawbox@box w 40;0.56 drawbox@box t fill'," \
+    "drawbox@box=x=8:y=8:w=16:h=16:t=2,hflip,buffersink@a;" \
+    "testsrc2=s=64x48:r=25:d=0.8,format=yuv420p,negate,vflip,buffersink@b;" \
+    "testsrc2=s=32x24:r=10:d=0.8,format=gray,drawgrid=w=8:h=8:t=1,buffersink@c"
+
+#define NB_SINKS 3
+
+typedef struct Config {
+    const char *name;
+    int thread_type;
+    int nb_threads;
+} Config;
+
+static const Config configs[] = {
+    { "single-threaded",  0,                                             1 },
+    { "graph",            AVFILTER_THREAD_GRAPH,                         4 },
+    { "slice and graph",  AVFILTER_THREAD_SLICE | AVFILTER_THREAD_GRAPH, 4 },
+    { "graph, 2 threads", AVFILTER_THREAD_GRAPH,                         2 },
+};
+
+typedef struct Output {
+    int nb_frames;
+    uint32_t sum;
+} Output;
+
+static void add_frame(Output *out, const AVFrame *frame)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+
+    for (int p = 0; p < av_pix_fmt_count_planes(frame->format); p++) {
+        const int shift = p == 1 || p == 2 ? desc->log2_chroma_h : 0;
+        const int w = av_image_get_linesize(frame->format, frame->width, p);
+
+        for (int y = 0; y < AV_CEIL_RSHIFT(frame->height, shift); y++)
+            out->sum = av_adler32_update(out->sum,
+                                         frame->data[p] + y * frame->linesize[p], w);
+    }
+    out->nb_frames++;
+}
+
+static int run(const Config *config, Output *outputs)
+{
+    static const char *const sinks[NB_SINKS] = { "buffersink@a", "buffersink@b", "buffersink@c" };
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int ret = AVERROR(ENOMEM);
+
+    if (!graph || !frame)
+        goto end;
+    graph->thread_type = config->thread_type;
+    graph->nb_threads  = config->nb_threads;
+    if ((ret = avfilter_graph_parse_ptr(graph, GRAPH, NULL, NULL, NULL)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+
+    for (int i = 0; i < NB_SINKS; i++)
+        outputs[i] = (Output){ 0, av_adler32_update(0, NULL, 0) };
+
+    do {
+        ret = avfilter_graph_request_oldest(graph);
+        for (int i = 0; i < NB_SINKS; i++) {
+            AVFilterContext *sink = avfilter_graph_get_filter(graph, sinks[i]);
+            int err;
+
+            while ((err = av_buffersink_get_frame_flags(sink, frame,
+                                                        AV_BUFFERSINK_FLAG_NO_REQUEST)) >= 0) {
+                add_frame(&outputs[i], frame);
+                av_frame_unref(frame);
+            }
+            if (err != AVERROR(EAGAIN) && err != AVERROR_EOF) {
+                ret = err;
+                goto end;
+            }
+        }
+    } while (ret >= 0 || ret == AVERROR(EAGAIN));
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+end:
+    av_frame_free(&frame);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+int main(void)
+{
+    Output ref[NB_SINKS], outputs[NB_SINKS];
+    int failed = 0;
+
+    av_log_set_level(AV_LOG_QUIET);
+    av_force_cpu_flags(0);
+
+    if (run(&configs[0], ref) < 0) {
+        printf("%s: failed\n", configs[0].name);
+        return 1;
+    }
+    for (int i = 0; i < NB_SINKS; i++)
+        printf("sink %c: %d frames, adler32 0x%08"PRIx32"\n",
+               'a' + i, ref[i].nb_frames, ref[i].sum);
+
+    for (int c = 1; c < FF_ARRAY_ELEMS(configs); c++) {
+        int differs = 0;
+
+        /* the order the filters of a wave run in changes between runs */
+        for (int run_nr = 0; run_nr < 4 && !differs; run_nr++) {
+            int ret = run(&configs[c], outputs);
+
+            if (ret < 0 || memcmp(outputs, ref, sizeof(ref))) {
+                printf("%s: run %d %s\n", configs[c].name, run_nr,
+                       ret < 0 ? "failed" : "differs");
+                differs = 1;
+            }
+        }
+        if (!differs)
+            printf("%s: same as single-threaded\n", configs[c].name);
+        failed |= differs;
+    }
+
+    return failed;
+}
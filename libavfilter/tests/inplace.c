@@ -0,0 +1,220 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run filters writing over their input or sharing its planes twice: once
+ * with writable input frames, and once with the input frames kept
+ * referenced, so that they must not be written over. The outputs of both
+ * runs must be the same, and the planes the filters do not write must be
+ * those of the input.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/frame.h"
+#include "libavutil/opt.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+
+#define WIDTH     32
+#define HEIGHT    24
+#define NB_FRAMES 3
+
+typedef struct Test {
+    const char *filter;
+    const char *args;
+    int write_planes;       ///< bitmask of the planes changed by the filter
+} Test;
+
+static const Test tests[] = {
+    { "lutyuv",      "y=negval:u=val:v=val",        1 },
+    { "eq",          "contrast=1.5:brightness=0.1", 1 },
+    { "framechange", "show=1:planes=1",             1 },
+};
+
+static AVFrame *make_frame(int n)
+{
+    AVFrame *frame = av_frame_alloc();
+
+    if (!frame)
+        return NULL;
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width  = WIDTH;
+    frame->height = HEIGHT;
+    frame->pts    = n;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return NULL;
+    }
+    for (int p = 0; p < 3; p++) {
+        const int shift = p ? 1 : 0;
+
+        for (int y = 0; y < HEIGHT >> shift; y++)
+            for (int x = 0; x < WIDTH >> shift; x++)
+                frame->data[p][y * frame->linesize[p] + x] =
+                    x * (3 + p) + y * 5 + n * (17 + 40 * p);
+    }
+    return frame;
+}
+
+static int planes_equal(const AVFrame *a, const AVFrame *b, int p)
+{
+    const int shift = p ? 1 : 0;
+
+    for (int y = 0; y < HEIGHT >> shift; y++)
+        if (memcmp(a->data[p] + y * a->linesize[p],
+                   b->data[p] + y * b->linesize[p], WIDTH >> shift))
+            return 0;
+    return 1;
+}
+
+static uint32_t checksum(const AVFrame *frame)
+{
+    uint32_t sum = av_adler32_update(0, NULL, 0);
+
+    for (int p = 0; p < 3; p++) {
+        const int shift = p ? 1 : 0;
+
+        for (int y = 0; y < HEIGHT >> shift; y++)
+            sum = av_adler32_update(sum, frame->data[p] + y * frame->linesize[p],
+                                    WIDTH >> shift);
+    }
+    return sum;
+}
+
+/**
+ * Run a filter on NB_FRAMES frames.
+ *
+ * @param keep_ref      keep a reference to the input frames until they are
+ *                      all filtered
+ * @param sums          set to the checksums of the output frames
+ * @param kept_planes   set to whether the planes not written are the ones
+ *                      of the input for all the frames
+ * @return the number of copies avoided by the filter, negative on error
+ */
+static int64_t run(const Test *test, int keep_ref, uint32_t *sums, int *kept_planes)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *src, *filter, *sink;
+    AVFrame *in[NB_FRAMES] = { NULL }, *out = av_frame_alloc();
+    AVFilterStats *stats = NULL;
+    char name[32], args[128];
+    int64_t ret = AVERROR(ENOMEM);
+    int nb_out = 0;
+
+    if (!graph || !out)
+        goto end;
+    snprintf(name, sizeof(name), "%s@f", test->filter);
+    snprintf(args, sizeof(args), "%s=%s,buffersink@out", name, test->args);
+    if ((ret = av_opt_set_int(graph, "collect_stats", 1, 0)) < 0 ||
+        (ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("buffer"), "in",
+                                            "video_size=32x24:pix_fmt=yuv420p:time_base=1/25",
+                                            NULL, graph)) < 0 ||
+        (ret = avfilter_graph_parse_ptr(graph, args, NULL, NULL, NULL)) < 0 ||
+        (ret = avfilter_link(src, 0, filter = avfilter_graph_get_filter(graph, name), 0)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+    sink = avfilter_graph_get_filter(graph, "buffersink@out");
+
+    *kept_planes = 1;
+    for (int i = 0; i < NB_FRAMES; i++) {
+        AVFrame *frame = make_frame(i), *ref = make_frame(i);
+
+        if (!frame || !ref ||
+            (ret = av_buffersrc_add_frame_flags(src, frame,
+                                                keep_ref ? AV_BUFFERSRC_FLAG_KEEP_REF : 0)) < 0) {
+            av_frame_free(&frame);
+            av_frame_free(&ref);
+            ret = ret < 0 ? ret : AVERROR(ENOMEM);
+            goto end;
+        }
+        if (keep_ref)
+            in[i] = frame;
+        else
+            av_frame_free(&frame);
+
+        while ((ret = av_buffersink_get_frame(sink, out)) >= 0) {
+            for (int p = 0; p < 3; p++)
+                if (!(test->write_planes & 1 << p))
+                    *kept_planes &= planes_equal(out, ref, p);
+            if (nb_out < NB_FRAMES)
+                sums[nb_out++] = checksum(out);
+            av_frame_unref(out);
+        }
+        av_frame_free(&ref);
+        if (ret != AVERROR(EAGAIN))
+            goto end;
+    }
+    if (nb_out != NB_FRAMES) {
+        ret = AVERROR_BUG;
+        goto end;
+    }
+
+    stats = avfilter_get_stats(filter);
+    ret   = stats ? stats->copies_avoided : AVERROR(ENOMEM);
+
+end:
+    av_free(stats);
+    for (int i = 0; i < NB_FRAMES; i++)
+        av_frame_free(&in[i]);
+    av_frame_free(&out);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    av_log_set_level(AV_LOG_QUIET);
+    /* the checksums must not depend on the SIMD functions used */
+    av_force_cpu_flags(0);
+
+    for (int t = 0; t < FF_ARRAY_ELEMS(tests); t++) {
+        const Test *test = &tests[t];
+        uint32_t sums[2][NB_FRAMES];
+        int kept_planes[2];
+        int64_t avoided[2];
+
+        for (int keep_ref = 0; keep_ref < 2; keep_ref++)
+            avoided[keep_ref] = run(test, keep_ref, sums[keep_ref], &kept_planes[keep_ref]);
+        if (avoided[0] < 0 || avoided[1] < 0) {
+            printf("%s: failed\n", test->filter);
+            failed = 1;
+            continue;
+        }
+
+        printf("%s:", test->filter);
+        for (int i = 0; i < NB_FRAMES; i++)
+            printf(" 0x%08"PRIx32, sums[0][i]);
+        printf("\n  copies avoided %"PRId64" writable, %"PRId64" referenced\n",
+               avoided[0], avoided[1]);
+        printf("  outputs %s, unwritten planes %s\n",
+               memcmp(sums[0], sums[1], sizeof(sums[0])) ? "differ" : "identical",
+               kept_planes[0] && kept_planes[1] ? "kept" : "changed");
+        failed |= memcmp(sums[0], sums[1], sizeof(sums[0])) ||
+                  !kept_planes[0] || !kept_planes[1] || !avoided[0];
+    }
+
+    return failed;
+}
@@ -0,0 +1,185 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run chains of null filters, picking the filter to activate from the ready
+ * heap and by scanning all the filters of the graph as was done before it,
+ * and check that both pick the same filters.
+ *
+ * With the number of filters and of frames as arguments, time both instead:
+ * the cost of the scan grows with the square of the length of the chain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libavutil/bprint.h"
+#include "libavutil/frame.h"
+#include "libavutil/time.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/filters.h"
+#include "libavfilter/internal.h"
+
+static int nb_mismatches;
+
+static int run_once_heap(AVFilterGraph *graph)
+{
+    return ff_filter_graph_run_once(graph);
+}
+
+/* the selection done before the ready heap */
+static int run_once_scan(AVFilterGraph *graph)
+{
+    AVFilterContext *filter = graph->filters[0];
+
+    for (unsigned i = 1; i < graph->nb_filters; i++)
+        if (graph->filters[i]->ready > filter->ready)
+            filter = graph->filters[i];
+    if (!filter->ready)
+        return AVERROR(EAGAIN);
+    return ff_filter_activate(filter);
+}
+
+static int run_once_check(AVFilterGraph *graph)
+{
+    AVFilterContext *top = graph->internal->nb_ready ?
+                           graph->internal->ready_heap[0] : NULL;
+    AVFilterContext *filter = graph->filters[0];
+
+    for (unsigned i = 1; i < graph->nb_filters; i++)
+        if (graph->filters[i]->ready > filter->ready)
+            filter = graph->filters[i];
+    if (filter->ready ? filter != top : !!top)
+        nb_mismatches++;
+    return ff_filter_graph_run_once(graph);
+}
+
+/**
+ * Pull all the frames out of a chain of null filters, running the graph
+ * with the given function, as av_buffersink_get_frame() does.
+ */
+static int run_chain(int nb_filters, int nb_frames,
+                     int (*run_once)(AVFilterGraph *graph),
+                     int *nb_out, int64_t *nb_activations)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFrame *frame = av_frame_alloc();
+    AVFilterContext *sink;
+    AVBPrint desc;
+    int ret;
+
+    av_bprint_init(&desc, 0, AV_BPRINT_SIZE_UNLIMITED);
+    if (!graph || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    graph->nb_threads = 1;
+
+    av_bprintf(&desc, "color=s=16x16:r=1:d=%d", nb_frames);
+    for (int i = 0; i < nb_filters; i++)
+        av_bprintf(&desc, ",null");
+    av_bprintf(&desc, ",buffersink@out");
+    if (!av_bprint_is_complete(&desc)) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = avfilter_graph_parse_ptr(graph, desc.str, NULL, NULL, NULL)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+    sink = avfilter_graph_get_filter(graph, "buffersink@out");
+
+    *nb_out = 0;
+    while (1) {
+        ret = av_buffersink_get_frame_flags(sink, frame, AV_BUFFERSINK_FLAG_NO_REQUEST);
+        if (ret >= 0) {
+            (*nb_out)++;
+            av_frame_unref(frame);
+            continue;
+        }
+        if (ret != AVERROR(EAGAIN))
+            break;
+        if (!sink->inputs[0]->frame_wanted_out)
+            ff_inlink_request_frame(sink->inputs[0]);
+        if ((ret = run_once(graph)) < 0)
+            break;
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+    *nb_activations = 0;
+    for (unsigned i = 0; i < graph->nb_filters; i++)
+        *nb_activations += graph->filters[i]->internal->nb_activations;
+
+end:
+    av_bprint_finalize(&desc, NULL);
+    av_frame_free(&frame);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+static int bench(int nb_filters, int nb_frames)
+{
+    static const struct {
+        const char *name;
+        int (*run_once)(AVFilterGraph *graph);
+    } modes[] = {
+        { "scan", run_once_scan },
+        { "heap", run_once_heap },
+    };
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(modes); i++) {
+        int64_t start = av_gettime_relative(), nb_activations;
+        int nb_out, ret;
+
+        ret = run_chain(nb_filters, nb_frames, modes[i].run_once,
+                        &nb_out, &nb_activations);
+        if (ret < 0) {
+            fprintf(stderr, "Error running the graph: %s\n", av_err2str(ret));
+            return 1;
+        }
+        printf("%s: %d filters, %d frames, %"PRId64" activations: %.3fs\n",
+               modes[i].name, nb_filters, nb_out, nb_activations,
+               (av_gettime_relative() - start) / 1000000.0);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const int lengths[] = { 1, 10, 100 };
+    int ret = 0;
+
+    if (argc == 3)
+        return bench(atoi(argv[1]), atoi(argv[2]));
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(lengths); i++) {
+        int64_t nb_activations;
+        int nb_out;
+
+        nb_mismatches = 0;
+        if (run_chain(lengths[i], 5, run_once_check, &nb_out, &nb_activations) < 0) {
+            printf("%d filters: failed to run\n", lengths[i]);
+            return 1;
+        }
+        printf("%d filters: %d frames, %"PRId64" activations, %d mismatches\n",
+               lengths[i], nb_out, nb_activations, nb_mismatches);
+        ret |= !!nb_mismatches;
+    }
+    return ret;
+}
@@ -25,4 +25,22 @@ int ff_graph_thread_init(AVFilterGraph *graph);
 
 void ff_graph_thread_free(AVFilterGraph *graph);
 
+/**
+ * Activate the first nb_filters filters of AVFilterGraphInternal.wave_filters
+ * concurrently and wait for all of them.
+ *
+ * The filters must not be linked to each other, and there must be at most
+ * AVFilterGraphInternal.max_wave of them.
+ *
+ * @return 0 or the first error returned by the activations, in order
+ */
+int ff_graph_run_wave(AVFilterGraph *graph, int nb_filters);
+
+/**
+ * Lock and unlock the state shared between filters of a wave, see
+ * AVFilterGraphInternal.in_wave.
+ */
+void ff_graph_lock(AVFilterGraph *graph);
+void ff_graph_unlock(AVFilterGraph *graph);
+
 #endif /* AVFILTER_THREAD_H */
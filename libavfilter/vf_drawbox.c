@@ -75,6 +75,28 @@ enum var_name {
     VARS_NB
 };
 
+enum expr_name {
+    EXPR_W,
+    EXPR_H,
+    EXPR_X,
+    EXPR_Y,
+    EXPR_T,
+    NB_GEOM_EXPRS,
+    EXPR_COLOR_A = NB_GEOM_EXPRS,
+    EXPR_COLOR_R, EXPR_COLOR_G, EXPR_COLOR_B,
+    EXPR_COLOR_Y, EXPR_COLOR_U, EXPR_COLOR_V,
+    EXPR_NB
+};
+
+/* variable set by each of the geometry expressions */
+static const int geom_expr_vars[NB_GEOM_EXPRS] = {
+    [EXPR_W] = VAR_W,
+    [EXPR_H] = VAR_H,
+    [EXPR_X] = VAR_X,
+    [EXPR_Y] = VAR_Y,
+    [EXPR_T] = VAR_THICKNESS,
+};
+
 typedef struct DrawBoxContext {
     const AVClass *class;
     int x, y, w, h;
@@ -96,6 +118,14 @@ typedef struct DrawBoxContext {
     char *color_alpha_expr; /// < expression for alpha
     char *color_red_expr, *color_green_expr, *color_blue_expr; /// < expression for dynamic color RGB
     char *color_y_expr, *color_u_expr, *color_v_expr; /// < expression for dynamic color YUV
+
+    AVExpr *exprs[EXPR_NB];           ///< parsed expressions, NULL if unset
+    int expr_order[NB_GEOM_EXPRS];    ///< evaluation order of the geometry expressions
+    int nb_eval_passes;               ///< 1 unless the geometry expressions depend on each other cyclically
+    int exprs_constant;               ///< results do not change from frame to frame
+    int exprs_evaluated;              ///< results for the current configuration are available
+
+    uint8_t lut[3][5][256];           ///< blending tables, see update_blend_luts()
 } DrawBoxContext;
 
 static const int NUM_EXPR_EVALS = 5;
@@ -115,6 +145,108 @@ static void apply_color_yuva (DrawBoxContext *s, uint8_t yuva_color[4])
     s->yuv_color[A] = yuva_color[A];
 }
 
+static av_cold void free_exprs(AVExpr **exprs)
+{
+    int i;
+
+    for (i = 0; i < EXPR_NB; i++) {
+        av_expr_free(exprs[i]);
+        exprs[i] = NULL;
+    }
+}
+
+/**
+ * Parse all the expressions and work out the order in which the geometry
+ * ones have to be evaluated so that each is evaluated exactly once per
+ * frame. The current expressions are only replaced if all of them parse.
+ */
+static av_cold int parse_exprs(AVFilterContext *ctx)
+{
+    DrawBoxContext *s = ctx->priv;
+    const char *expr_strs[EXPR_NB] = {
+        [EXPR_W]       = s->w_expr,
+        [EXPR_H]       = s->h_expr,
+        [EXPR_X]       = s->x_expr,
+        [EXPR_Y]       = s->y_expr,
+        [EXPR_T]       = s->t_expr,
+        [EXPR_COLOR_A] = s->color_alpha_expr,
+        [EXPR_COLOR_R] = s->color_red_expr,
+        [EXPR_COLOR_G] = s->color_green_expr,
+        [EXPR_COLOR_B] = s->color_blue_expr,
+        [EXPR_COLOR_Y] = s->color_y_expr,
+        [EXPR_COLOR_U] = s->color_u_expr,
+        [EXPR_COLOR_V] = s->color_v_expr,
+    };
+    AVExpr *exprs[EXPR_NB] = { NULL };
+    unsigned deps[NB_GEOM_EXPRS] = { 0 };
+    unsigned done = 0;
+    int time_dependent = 0, cyclic = 0, impure = 0;
+    int i, j, n, ret;
+
+    for (i = 0; i < EXPR_NB; i++) {
+        unsigned counter[VARS_NB] = { 0 };
+
+        if (!expr_strs[i] || !expr_strs[i][0])
+            continue;
+
+        ret = av_expr_parse(&exprs[i], expr_strs[i], var_names,
+                            NULL, NULL, NULL, NULL, 0, ctx);
+        if (ret < 0) {
+            av_log(ctx, AV_LOG_ERROR,
+                   "Error when parsing the expression '%s' (%d).\n",
+                   expr_strs[i], ret);
+            free_exprs(exprs);
+            return ret;
+        }
+
+        av_expr_count_vars(exprs[i], counter, VARS_NB);
+        time_dependent |= counter[VAR_T] || counter[VAR_TIME];
+        /* ld(), st() and random() may give another result for each frame */
+        impure |= !av_expr_is_pure(exprs[i]);
+
+        if (i >= NB_GEOM_EXPRS)
+            continue;
+        /* "fill" is bounded by the box position for the size expressions */
+        if (counter[VAR_MAX] && i == EXPR_W)
+            counter[VAR_X]++;
+        if (counter[VAR_MAX] && i == EXPR_H)
+            counter[VAR_Y]++;
+        for (j = 0; j < NB_GEOM_EXPRS; j++)
+            if (counter[geom_expr_vars[j]])
+                deps[i] |= 1U << j;
+    }
+
+    /* topological sort, keeping the historical w, h, x, y, t order on ties */
+    for (n = 0; n < NB_GEOM_EXPRS; n++) {
+        for (i = 0; i < NB_GEOM_EXPRS; i++)
+            if (!(done & (1U << i)) && !(deps[i] & ~done))
+                break;
+        if (i == NB_GEOM_EXPRS) {
+            cyclic = 1;
+            break;
+        }
+        s->expr_order[n] = i;
+        done |= 1U << i;
+    }
+
+    /* expressions referring to each other in a cycle (or to themselves) are
+     * iterated as before, starting from the values of the previous frame */
+    if (cyclic) {
+        for (i = 0; i < NB_GEOM_EXPRS; i++)
+            s->expr_order[i] = i;
+        s->nb_eval_passes = NUM_EXPR_EVALS + 1;
+    } else {
+        s->nb_eval_passes = 1;
+    }
+
+    free_exprs(s->exprs);
+    memcpy(s->exprs, exprs, sizeof(exprs));
+    s->exprs_constant = !time_dependent && !cyclic && !impure;
+    s->exprs_evaluated = 0;
+
+    return 0;
+}
+
 static av_cold int init(AVFilterContext *ctx)
 {
     DrawBoxContext *s = ctx->priv;
@@ -128,7 +260,7 @@ static av_cold int init(AVFilterContext *ctx)
         apply_color_rgba(s, s->rgba_color);
     }
 
-    return 0;
+    return parse_exprs(ctx);
 }
 
 static int query_formats(AVFilterContext *ctx)
@@ -147,17 +279,23 @@ static int query_formats(AVFilterContext *ctx)
     return ff_set_common_formats(ctx, fmts_list);
 }
 
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    DrawBoxContext *s = ctx->priv;
+
+    free_exprs(s->exprs);
+}
+
 static int parse_data(AVFilterLink *inlink)
 {
-    // fixme optimize this routine
-    // parse_and_eval should only be eval (parsing should be done at init)
-    // there is no need to eval 5 times
     AVFilterContext *ctx = inlink->dst;
     DrawBoxContext *s = ctx->priv;
     double var_values[VARS_NB], res;
-    char *expr;
-    int ret;
-    int i;
+    int i, n;
+
+    /* nothing changes between frames, keep the previous results */
+    if (s->exprs_constant && s->exprs_evaluated)
+        return 0;
 
     var_values[VAR_IN_H] = var_values[VAR_IH] = inlink->h;
     var_values[VAR_IN_W] = var_values[VAR_IW] = inlink->w;
@@ -173,122 +311,76 @@ static int parse_data(AVFilterLink *inlink)
     var_values[VAR_T] = s->time;
     var_values[VAR_TIME] = s->time;
 
-    for (i = 0; i <= NUM_EXPR_EVALS; i++) {
-        /* evaluate expressions, fail on last iteration */
-        var_values[VAR_MAX] = inlink->w - s->x;
-        if ((ret = av_expr_parse_and_eval(&res, (expr = s->w_expr),
-                                          var_names, var_values,
-                                          NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-            goto fail;
-        s->w = var_values[VAR_W] = res;
-
-        var_values[VAR_MAX] = inlink->h - s->y;
-        if ((ret = av_expr_parse_and_eval(&res, (expr = s->h_expr),
-                                          var_names, var_values,
-                                          NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-            goto fail;
-        s->h = var_values[VAR_H] = res;
-
-        var_values[VAR_MAX] = inlink->w;
-        if ((ret = av_expr_parse_and_eval(&res, (expr = s->x_expr),
-                                          var_names, var_values,
-                                          NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-            goto fail;
-        s->x = var_values[VAR_X] = res;
-
-        var_values[VAR_MAX] = inlink->h;
-        if ((ret = av_expr_parse_and_eval(&res, (expr = s->y_expr),
-                                          var_names, var_values,
-                                          NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-            goto fail;
-        s->y = var_values[VAR_Y] = res;
-
-        var_values[VAR_MAX] = INT_MAX;
-        if ((ret = av_expr_parse_and_eval(&res, (expr = s->t_expr),
-                                          var_names, var_values,
-                                          NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-            goto fail;
-        s->thickness = var_values[VAR_THICKNESS] = res;
-
-        // parse expression for A
-        if(s->color_alpha_expr && s->color_alpha_expr[0])
-        {
-            av_log(s, AV_LOG_VERBOSE, "Enabled dynamic color on A! \n");
-
-            if ((ret = av_expr_parse_and_eval(&res, (expr = s->color_alpha_expr),
-                                              var_names, var_values,
-                                              NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-                goto fail;
-            s->yuv_color[A] = s->rgba_color[A] = av_clip_uint8_c(res);
-            av_log(s, AV_LOG_VERBOSE, "A: %d \n", s->rgba_color[A]);
+    for (i = 0; i < s->nb_eval_passes; i++) {
+        for (n = 0; n < NB_GEOM_EXPRS; n++) {
+            switch (s->expr_order[n]) {
+            case EXPR_W:
+                var_values[VAR_MAX] = inlink->w - s->x;
+                res = s->exprs[EXPR_W] ? av_expr_eval(s->exprs[EXPR_W], var_values, NULL) : 0;
+                s->w = var_values[VAR_W] = res;
+                break;
+            case EXPR_H:
+                var_values[VAR_MAX] = inlink->h - s->y;
+                res = s->exprs[EXPR_H] ? av_expr_eval(s->exprs[EXPR_H], var_values, NULL) : 0;
+                s->h = var_values[VAR_H] = res;
+                break;
+            case EXPR_X:
+                var_values[VAR_MAX] = inlink->w;
+                res = s->exprs[EXPR_X] ? av_expr_eval(s->exprs[EXPR_X], var_values, NULL) : 0;
+                s->x = var_values[VAR_X] = res;
+                break;
+            case EXPR_Y:
+                var_values[VAR_MAX] = inlink->h;
+                res = s->exprs[EXPR_Y] ? av_expr_eval(s->exprs[EXPR_Y], var_values, NULL) : 0;
+                s->y = var_values[VAR_Y] = res;
+                break;
+            case EXPR_T:
+                var_values[VAR_MAX] = INT_MAX;
+                res = s->exprs[EXPR_T] ? av_expr_eval(s->exprs[EXPR_T], var_values, NULL) : 0;
+                s->thickness = var_values[VAR_THICKNESS] = res;
+                break;
+            }
         }
+    }
+    var_values[VAR_MAX] = INT_MAX;
 
-        // parse expressions for RGB
-        if(
-            (s->color_red_expr && s->color_red_expr[0]) ||
-            (s->color_green_expr && s->color_green_expr[0]) ||
-            (s->color_blue_expr && s->color_blue_expr[0])
-        )
-        {
-            uint8_t rgba[4];
-            rgba[A] = s->yuv_color[A];
-            av_log(s, AV_LOG_VERBOSE, "Enabled dynamic color on RGB! \n");
-
-            for(uint8_t component = 0; component < 3; component++)
-            {
-                char *c_expr = component == 0 ? s->color_red_expr   :
-                               component == 1 ? s->color_green_expr :
-                                         /* 2 */s->color_blue_expr  ;
-
-                if(c_expr[0]){
-                    if ((ret = av_expr_parse_and_eval(&res, (expr = c_expr),
-                                                      var_names, var_values,
-                                                      NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-                        goto fail;
-                    rgba[component] = av_clip_uint8_c(res);
-                } else {
-                    rgba[component] = s->rgba_color[component];
-                }
-            }
+    // evaluate expression for A
+    if (s->exprs[EXPR_COLOR_A]) {
+        res = av_expr_eval(s->exprs[EXPR_COLOR_A], var_values, NULL);
+        s->yuv_color[A] = s->rgba_color[A] = av_clip_uint8_c(res);
+        av_log(s, AV_LOG_DEBUG, "A: %d \n", s->rgba_color[A]);
+    }
 
-            av_log(s, AV_LOG_VERBOSE, "R: %d G: %d G: %d\n", rgba[R], rgba[G], rgba[R]);
+    // evaluate expressions for RGB
+    if (s->exprs[EXPR_COLOR_R] || s->exprs[EXPR_COLOR_G] || s->exprs[EXPR_COLOR_B]) {
+        uint8_t rgba[4];
+        rgba[A] = s->yuv_color[A];
 
-            apply_color_rgba(s, rgba);
+        for (i = 0; i < 3; i++) {
+            AVExpr *e = s->exprs[EXPR_COLOR_R + i];
+            rgba[i] = e ? av_clip_uint8_c(av_expr_eval(e, var_values, NULL))
+                        : s->rgba_color[i];
         }
 
-        // parse expressions for YUV
-        if(
-            (s->color_y_expr && s->color_y_expr[0]) ||
-            (s->color_u_expr && s->color_u_expr[0]) ||
-            (s->color_v_expr && s->color_v_expr[0])
-        )
-        {
-            uint8_t yuva[4];
-            yuva[A] = s->yuv_color[A];
-            av_log(s, AV_LOG_VERBOSE, "Enabled dynamic color on YUV! \n");
-
-            for(uint8_t component = 0; component < 3; component++)
-            {
-                char *c_expr = component == 0 ? s->color_y_expr   :
-                               component == 1 ? s->color_u_expr :
-                                         /* 2 */s->color_v_expr  ;
-
-                if(c_expr[0]){
-                    if ((ret = av_expr_parse_and_eval(&res, (expr = c_expr),
-                                                      var_names, var_values,
-                                                      NULL, NULL, NULL, NULL, NULL, 0, ctx)) < 0 && i == NUM_EXPR_EVALS)
-                        goto fail;
-                    yuva[component] = av_clip_uint8_c(res);
-                } else {
-                    yuva[component] = s->yuv_color[component];
-                }
-            }
+        av_log(s, AV_LOG_DEBUG, "R: %d G: %d B: %d\n", rgba[R], rgba[G], rgba[B]);
+
+        apply_color_rgba(s, rgba);
+    }
 
-            av_log(s, AV_LOG_VERBOSE, "Y: %d U: %d V: %d\n", yuva[R], yuva[G], yuva[R]);
+    // evaluate expressions for YUV
+    if (s->exprs[EXPR_COLOR_Y] || s->exprs[EXPR_COLOR_U] || s->exprs[EXPR_COLOR_V]) {
+        uint8_t yuva[4];
+        yuva[A] = s->yuv_color[A];
 
-            apply_color_yuva(s, yuva);
+        for (i = 0; i < 3; i++) {
+            AVExpr *e = s->exprs[EXPR_COLOR_Y + i];
+            yuva[i] = e ? av_clip_uint8_c(av_expr_eval(e, var_values, NULL))
+                        : s->yuv_color[i];
         }
 
+        av_log(s, AV_LOG_DEBUG, "Y: %d U: %d V: %d\n", yuva[Y], yuva[U], yuva[V]);
+
+        apply_color_yuva(s, yuva);
     }
 
     /* if w or h are zero, use the input w/h */
@@ -305,14 +397,11 @@ static int parse_data(AVFilterLink *inlink)
            s->x, s->y, s->w, s->h,
            s->yuv_color[Y], s->yuv_color[U], s->yuv_color[V], s->yuv_color[A]);
 
-    return 0;
+    s->exprs_evaluated = 1;
 
-    fail:
-    av_log(ctx, AV_LOG_ERROR,
-           "Error when evaluating the expression '%s' (%d).\n",
-           expr, ret);
-    return ret;
+    return 0;
 }
+
 static int config_input(AVFilterLink *inlink)
 {
     AVFilterContext *ctx = inlink->dst;
@@ -322,79 +411,182 @@ static int config_input(AVFilterLink *inlink)
     s->hsub = desc->log2_chroma_w;
     s->vsub = desc->log2_chroma_h;
     s->have_alpha = desc->flags & AV_PIX_FMT_FLAG_ALPHA;
+    s->exprs_evaluated = 0;
 
     return parse_data(inlink);
 }
 
-static av_pure av_always_inline int pixel_belongs_to_box(DrawBoxContext *s, int x, int y)
+typedef struct ThreadData {
+    AVFrame *frame;
+    int y0, y1;     ///< luma rows to draw
+} ThreadData;
+
+/**
+ * Build the blending tables for the current color. lut[p][n][v] is the
+ * result of blending v with the color n times in a row, which is what
+ * happens to a chroma sample covered by n luma samples of the same row.
+ */
+static void update_blend_luts(DrawBoxContext *s)
 {
-    return (y - s->y < s->thickness) || (s->y + s->h - 1 - y < s->thickness) ||
-           (x - s->x < s->thickness) || (s->x + s->w - 1 - x < s->thickness);
+    double alpha = (double)s->yuv_color[A] / 255;
+    int plane, n, v;
+
+    for (plane = 0; plane < 3; plane++) {
+        int max_n = plane ? 1 << s->hsub : 1;
+
+        for (v = 0; v < 256; v++)
+            s->lut[plane][0][v] = v;
+        for (n = 1; n <= max_n; n++)
+            for (v = 0; v < 256; v++) {
+                int prev = s->lut[plane][n - 1][v];
+                s->lut[plane][n][v] = (1 - alpha) * prev + alpha * s->yuv_color[plane];
+            }
+    }
 }
 
-static int filter_frame(AVFilterLink *inlink, AVFrame *frame)
+static av_always_inline void blend_span(uint8_t *dst, const uint8_t *lut, int len)
 {
-    DrawBoxContext *s = inlink->dst->priv;
+    int x;
 
-    s->time = frame->pts == AV_NOPTS_VALUE ?
-              NAN : frame->pts * av_q2d(inlink->time_base);
-    av_log(s, AV_LOG_DEBUG, "pts: %lld time base:%f time: %f\n", frame->pts, av_q2d(inlink->time_base), s->time);
-    parse_data(inlink);
+    for (x = 0; x < len; x++)
+        dst[x] = lut[dst[x]];
+}
 
-    int plane, x, y, xb = s->x, yb = s->y;
-    unsigned char *row[4];
+static av_always_inline void invert_span(uint8_t *dst, int len)
+{
+    int x;
 
-    if (s->have_alpha && s->replace) {
-        for (y = FFMAX(yb, 0); y < frame->height && y < (yb + s->h); y++) {
-            row[0] = frame->data[0] + y * frame->linesize[0];
-            row[3] = frame->data[3] + y * frame->linesize[3];
+    for (x = 0; x < len; x++)
+        dst[x] = 0xff - dst[x];
+}
 
-            for (plane = 1; plane < 3; plane++)
-                row[plane] = frame->data[plane] +
-                     frame->linesize[plane] * (y >> s->vsub);
+/**
+ * Blend the chroma samples covered by the luma span [x0, x1). Samples at
+ * the span ends may be covered by fewer luma samples than the inner ones.
+ */
+static void blend_chroma_span(DrawBoxContext *s, uint8_t *dst, int plane, int x0, int x1)
+{
+    const int hsub = s->hsub;
+    int cx0 = x0 >> hsub, cx1 = (x1 - 1) >> hsub;
 
-            if (s->invert_color) {
-                for (x = FFMAX(xb, 0); x < xb + s->w && x < frame->width; x++)
-                    if (pixel_belongs_to_box(s, x, y))
-                        row[0][x] = 0xff - row[0][x];
-            } else {
-                for (x = FFMAX(xb, 0); x < xb + s->w && x < frame->width; x++) {
-                    if (pixel_belongs_to_box(s, x, y)) {
-                        row[0][x           ] = s->yuv_color[Y];
-                        row[1][x >> s->hsub] = s->yuv_color[U];
-                        row[2][x >> s->hsub] = s->yuv_color[V];
-                        row[3][x           ] = s->yuv_color[A];
-                    }
-                }
-            }
-        }
+    if (cx0 == cx1) {
+        dst[cx0] = s->lut[plane][x1 - x0][dst[cx0]];
+        return;
+    }
+    dst[cx0] = s->lut[plane][((cx0 + 1) << hsub) - x0][dst[cx0]];
+    blend_span(dst + cx0 + 1, s->lut[plane][1 << hsub], cx1 - cx0 - 1);
+    dst[cx1] = s->lut[plane][x1 - (cx1 << hsub)][dst[cx1]];
+}
+
+/**
+ * Draw the luma span [x0, x1) of row y, with the matching chroma and alpha.
+ */
+static void draw_span(DrawBoxContext *s, AVFrame *frame, int y, int x0, int x1)
+{
+    uint8_t *row[4];
+    int plane;
+
+    if (x0 >= x1)
+        return;
+
+    row[0] = frame->data[0] + y * frame->linesize[0];
+    for (plane = 1; plane < 3; plane++)
+        row[plane] = frame->data[plane] +
+             frame->linesize[plane] * (y >> s->vsub);
+
+    if (s->invert_color) {
+        invert_span(row[0] + x0, x1 - x0);
+    } else if (s->have_alpha && s->replace) {
+        int cx0 = x0 >> s->hsub, cx1 = ((x1 - 1) >> s->hsub) + 1;
+
+        row[3] = frame->data[3] + y * frame->linesize[3];
+        memset(row[0] + x0,  s->yuv_color[Y], x1 - x0);
+        memset(row[1] + cx0, s->yuv_color[U], cx1 - cx0);
+        memset(row[2] + cx0, s->yuv_color[V], cx1 - cx0);
+        memset(row[3] + x0,  s->yuv_color[A], x1 - x0);
     } else {
-        for (y = FFMAX(yb, 0); y < frame->height && y < (yb + s->h); y++) {
-            row[0] = frame->data[0] + y * frame->linesize[0];
+        blend_span(row[0] + x0, s->lut[Y][1], x1 - x0);
+        blend_chroma_span(s, row[1], U, x0, x1);
+        blend_chroma_span(s, row[2], V, x0, x1);
+    }
+}
+
+/**
+ * Split the rows [y0, y1) between the jobs so that rows sharing the same
+ * chroma row are always drawn by the same job, in order.
+ */
+static void get_slice_rows(DrawBoxContext *s, const ThreadData *td,
+                           int jobnr, int nb_jobs, int *y0, int *y1)
+{
+    int first = td->y0 >> s->vsub;
+    int nb    = ((td->y1 - 1) >> s->vsub) + 1 - first;
+
+    *y0 = FFMAX((first + nb *  jobnr      / nb_jobs) << s->vsub, td->y0);
+    *y1 = FFMIN((first + nb * (jobnr + 1) / nb_jobs) << s->vsub, td->y1);
+}
+
+static int draw_slices(AVFilterContext *ctx, AVFrame *frame, int y0, int y1,
+                       int (*slice)(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs))
+{
+    DrawBoxContext *s = ctx->priv;
+    ThreadData td = { .frame = frame, .y0 = y0, .y1 = y1 };
+    int nb_rows = y1 > y0 ? ((y1 - 1) >> s->vsub) - (y0 >> s->vsub) + 1 : 0;
+
+    if (!nb_rows)
+        return 0;
+
+    if (!s->invert_color && !(s->have_alpha && s->replace))
+        update_blend_luts(s);
 
-            for (plane = 1; plane < 3; plane++)
-                row[plane] = frame->data[plane] +
-                     frame->linesize[plane] * (y >> s->vsub);
+    return ctx->internal->execute(ctx, slice, &td, NULL,
+                                  FFMIN(nb_rows, ff_filter_get_nb_threads(ctx)));
+}
 
-            if (s->invert_color) {
-                for (x = FFMAX(xb, 0); x < xb + s->w && x < frame->width; x++)
-                    if (pixel_belongs_to_box(s, x, y))
-                        row[0][x] = 0xff - row[0][x];
+static int draw_box_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    DrawBoxContext *s = ctx->priv;
+    ThreadData *td = arg;
+    AVFrame *frame = td->frame;
+    const int x0 = FFMAX(s->x, 0);
+    const int x1 = FFMIN(s->x + s->w, frame->width);
+    int y, y0, y1;
+
+    get_slice_rows(s, td, jobnr, nb_jobs, &y0, &y1);
+
+    for (y = y0; y < y1; y++) {
+        if (y - s->y < s->thickness || s->y + s->h - 1 - y < s->thickness) {
+            draw_span(s, frame, y, x0, x1);
+        } else {
+            int left_end    = FFMIN(s->x + s->thickness, x1);
+            int right_start = FFMAX(s->x + s->w - s->thickness, x0);
+
+            if (left_end >= right_start) {
+                draw_span(s, frame, y, x0, x1);
             } else {
-                for (x = FFMAX(xb, 0); x < xb + s->w && x < frame->width; x++) {
-                    double alpha = (double)s->yuv_color[A] / 255;
-
-                    if (pixel_belongs_to_box(s, x, y)) {
-                        row[0][x                 ] = (1 - alpha) * row[0][x                 ] + alpha * s->yuv_color[Y];
-                        row[1][x >> s->hsub] = (1 - alpha) * row[1][x >> s->hsub] + alpha * s->yuv_color[U];
-                        row[2][x >> s->hsub] = (1 - alpha) * row[2][x >> s->hsub] + alpha * s->yuv_color[V];
-                    }
-                }
+                draw_span(s, frame, y, x0, left_end);
+                draw_span(s, frame, y, right_start, x1);
             }
         }
     }
 
-    return ff_filter_frame(inlink->dst->outputs[0], frame);
+    return 0;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *frame)
+{
+    AVFilterContext *ctx = inlink->dst;
+    DrawBoxContext *s = ctx->priv;
+
+    s->time = frame->pts == AV_NOPTS_VALUE ?
+              NAN : frame->pts * av_q2d(inlink->time_base);
+    av_log(s, AV_LOG_DEBUG, "pts: %lld time base:%f time: %f\n", frame->pts, av_q2d(inlink->time_base), s->time);
+    parse_data(inlink);
+
+    if (s->x < frame->width && s->x + s->w > 0)
+        draw_slices(ctx, frame, FFMAX(s->y, 0), FFMIN(s->y + s->h, frame->height),
+                    draw_box_slice);
+
+    return ff_filter_frame(ctx->outputs[0], frame);
 }
 
 static int process_command(AVFilterContext *ctx, const char *cmd, const char *args, char *res, int res_len, int flags)
@@ -488,96 +680,60 @@ AVFilter ff_vf_drawbox = {
     .priv_size     = sizeof(DrawBoxContext),
     .priv_class    = &drawbox_class,
     .init          = init,
+    .uninit        = uninit,
     .query_formats = query_formats,
     .inputs        = drawbox_inputs,
     .outputs       = drawbox_outputs,
     .process_command = process_command,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
 #endif /* CONFIG_DRAWBOX_FILTER */
 
 #if CONFIG_DRAWGRID_FILTER
-static av_pure av_always_inline int pixel_belongs_to_grid(DrawBoxContext *drawgrid, int x, int y)
+static int draw_grid_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    // x is horizontal (width) coord,
-    // y is vertical (height) coord
-    int x_modulo;
-    int y_modulo;
-
-    // Abstract from the offset
-    x -= drawgrid->x;
-    y -= drawgrid->y;
-
-    x_modulo = x % drawgrid->w;
-    y_modulo = y % drawgrid->h;
-
-    // If x or y got negative, fix values to preserve logics
-    if (x_modulo < 0)
-        x_modulo += drawgrid->w;
-    if (y_modulo < 0)
-        y_modulo += drawgrid->h;
-
-    return x_modulo < drawgrid->thickness  // Belongs to vertical line
-        || y_modulo < drawgrid->thickness;  // Belongs to horizontal line
+    DrawBoxContext *drawgrid = ctx->priv;
+    ThreadData *td = arg;
+    AVFrame *frame = td->frame;
+    const int w = drawgrid->w, t = drawgrid->thickness;
+    int x_offset, y, y0, y1;
+
+    get_slice_rows(drawgrid, td, jobnr, nb_jobs, &y0, &y1);
+
+    // Offset of the first vertical line at or right of x = 0
+    x_offset = drawgrid->x % w;
+    if (x_offset < 0)
+        x_offset += w;
+
+    for (y = y0; y < y1; y++) {
+        int y_modulo = (y - drawgrid->y) % drawgrid->h;
+
+        // If y got negative, fix value to preserve logics
+        if (y_modulo < 0)
+            y_modulo += drawgrid->h;
+
+        if (y_modulo < t || t >= w) {
+            // Belongs to horizontal line
+            draw_span(drawgrid, frame, y, 0, frame->width);
+        } else {
+            // Vertical lines, the one left of x = 0 may still reach into the frame
+            int x;
+
+            for (x = x_offset - w; x < frame->width; x += w)
+                draw_span(drawgrid, frame, y, FFMAX(x, 0), FFMIN(x + t, frame->width));
+        }
+    }
+
+    return 0;
 }
 
 static int drawgrid_filter_frame(AVFilterLink *inlink, AVFrame *frame)
 {
-    DrawBoxContext *drawgrid = inlink->dst->priv;
-    int plane, x, y;
-    uint8_t *row[4];
-
-    if (drawgrid->have_alpha && drawgrid->replace) {
-        for (y = 0; y < frame->height; y++) {
-            row[0] = frame->data[0] + y * frame->linesize[0];
-            row[3] = frame->data[3] + y * frame->linesize[3];
-
-            for (plane = 1; plane < 3; plane++)
-                row[plane] = frame->data[plane] +
-                     frame->linesize[plane] * (y >> drawgrid->vsub);
-
-            if (drawgrid->invert_color) {
-                for (x = 0; x < frame->width; x++)
-                    if (pixel_belongs_to_grid(drawgrid, x, y))
-                        row[0][x] = 0xff - row[0][x];
-            } else {
-                for (x = 0; x < frame->width; x++) {
-                    if (pixel_belongs_to_grid(drawgrid, x, y)) {
-                        row[0][x                  ] = drawgrid->yuv_color[Y];
-                        row[1][x >> drawgrid->hsub] = drawgrid->yuv_color[U];
-                        row[2][x >> drawgrid->hsub] = drawgrid->yuv_color[V];
-                        row[3][x                  ] = drawgrid->yuv_color[A];
-                    }
-                }
-            }
-        }
-    } else {
-        for (y = 0; y < frame->height; y++) {
-            row[0] = frame->data[0] + y * frame->linesize[0];
-
-            for (plane = 1; plane < 3; plane++)
-                row[plane] = frame->data[plane] +
-                     frame->linesize[plane] * (y >> drawgrid->vsub);
+    AVFilterContext *ctx = inlink->dst;
 
-            if (drawgrid->invert_color) {
-                for (x = 0; x < frame->width; x++)
-                    if (pixel_belongs_to_grid(drawgrid, x, y))
-                        row[0][x] = 0xff - row[0][x];
-            } else {
-                for (x = 0; x < frame->width; x++) {
-                    double alpha = (double)drawgrid->yuv_color[A] / 255;
-
-                    if (pixel_belongs_to_grid(drawgrid, x, y)) {
-                        row[0][x                  ] = (1 - alpha) * row[0][x                  ] + alpha * drawgrid->yuv_color[Y];
-                        row[1][x >> drawgrid->hsub] = (1 - alpha) * row[1][x >> drawgrid->hsub] + alpha * drawgrid->yuv_color[U];
-                        row[2][x >> drawgrid->hsub] = (1 - alpha) * row[2][x >> drawgrid->hsub] + alpha * drawgrid->yuv_color[V];
-                    }
-                }
-            }
-        }
-    }
+    draw_slices(ctx, frame, 0, frame->height, draw_grid_slice);
 
-    return ff_filter_frame(inlink->dst->outputs[0], frame);
+    return ff_filter_frame(ctx->outputs[0], frame);
 }
 
 static const AVOption drawgrid_options[] = {
@@ -622,10 +778,11 @@ AVFilter ff_vf_drawgrid = {
     .priv_size     = sizeof(DrawBoxContext),
     .priv_class    = &drawgrid_class,
     .init          = init,
+    .uninit        = uninit,
     .query_formats = query_formats,
     .inputs        = drawgrid_inputs,
     .outputs       = drawgrid_outputs,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
     .process_command = process_command,
 };
 
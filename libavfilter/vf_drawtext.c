@@ -51,6 +51,7 @@
 #include "../libavutil/opt.h"
 #include "../libavutil/random_seed.h"
 #include "../libavutil/parseutils.h"
+#include "../libavutil/pixdesc.h"
 #include "../libavutil/timecode.h"
 #include "../libavutil/time_internal.h"
 #include "../libavutil/tree.h"
@@ -142,12 +143,69 @@ enum var_name {
     VAR_VARS_NB
 };
 
+enum expr_name {
+    EXPR_OFFSETX,
+    EXPR_OFFSETY,
+    EXPR_FONTSIZE,
+    EXPR_X,
+    EXPR_Y,
+    EXPR_CLIP_ENABLE,
+    EXPR_CLIP_TOP,
+    EXPR_CLIP_BOTTOM,
+    EXPR_CLIP_LEFT,
+    EXPR_CLIP_RIGHT,
+    EXPR_ALPHA,
+    EXPR_NB
+};
+
+#define DRAWTEXT_RUN_CACHE_SIZE 8
+#define RUN_CELL_SIZE  4    ///< granularity of the mask coverage map
+#define RUN_TILE_SIZE  4    ///< blending granularity, a multiple of any chroma subsampling
+
+enum text_run_layer {
+    LAYER_TEXT,
+    LAYER_BORDER,
+    LAYER_NB
+};
+
+/**
+ * Alpha mask of all the glyphs of a text run, in run coordinates.
+ */
+typedef struct TextRunMask {
+    uint8_t *data;
+    int x, y;           ///< position of the mask in the run
+    int w, h;           ///< size and linesize of the mask
+    uint8_t *cells;     ///< non-zero if the RUN_CELL_SIZE square cell has any coverage
+    int cells_w, cells_h;
+} TextRunMask;
+
+/**
+ * A laid out and rasterized text, reused as long as the expanded text and
+ * the font size do not change.
+ */
+typedef struct TextRun {
+    char *text;
+    unsigned int fontsize;
+    int text_w, text_h;
+    int max_glyph_w, max_glyph_h;
+    int y_min, y_max;
+    TextRunMask masks[LAYER_NB];
+    int64_t last_used;
+} TextRun;
+
 enum expansion_mode {
     EXP_NONE,
     EXP_NORMAL,
     EXP_STRFTIME,
 };
 
+typedef struct ThreadData {
+    AVFrame *frame;
+    const TextRun *run;
+    FFDrawColor fontcolor, shadowcolor, bordercolor, boxcolor;
+    int y0, y1;     ///< frame rows touched by the box or any text layer
+} ThreadData;
+
 typedef struct DrawTextContext {
     const AVClass *class;
     int exp_mode;                   ///< expansion mode to use for the text
@@ -178,6 +236,7 @@ typedef struct DrawTextContext {
     AVExpr *fontsize_pexpr;         ///< parsed expressions for fontsize
     unsigned int fontsize;          ///< font size to use
     unsigned int default_fontsize;  ///< default font size to use
+    unsigned int face_fontsize;     ///< font size the FreeType face is set to
 
     int line_spacing;               ///< lines spacing in pixels
     int word_spacing;               ///< word spacing in pixels
@@ -222,6 +281,9 @@ typedef struct DrawTextContext {
     char   *a_expr;
     AVExpr *a_pexpr;
     int alpha;
+    unsigned const_exprs;           ///< expr_name bitmask of the expressions not changing between frames
+    unsigned cached_exprs;          ///< expr_name bitmask of the constant expressions already evaluated
+    double expr_values[EXPR_NB];    ///< cached results of the constant expressions
     AVLFG  prng;                    ///< random
     char       *tc_opt_string;      ///< specified timecode option string
     AVRational  tc_rate;            ///< frame rate for timecode
@@ -233,6 +295,9 @@ typedef struct DrawTextContext {
     int text_shaping;               ///< 1 to shape the text before drawing it
 #endif
     AVDictionary *metadata;
+
+    TextRun runs[DRAWTEXT_RUN_CACHE_SIZE]; ///< most recently used text runs
+    int64_t run_clock;
 } DrawTextContext;
 
 #define OFFSET(x) offsetof(DrawTextContext, x)
@@ -420,22 +485,84 @@ error:
     return ret;
 }
 
-static av_cold int set_fontsize(AVFilterContext *ctx, unsigned int fontsize)
+static void text_run_free(TextRun *run)
+{
+    for (int i = 0; i < LAYER_NB; i++) {
+        av_freep(&run->masks[i].data);
+        av_freep(&run->masks[i].cells);
+    }
+    av_freep(&run->text);
+    memset(run, 0, sizeof(*run));
+}
+
+/**
+ * Set the FreeType face to the current font size. This is only needed
+ * before loading glyphs or computing kerning, so it is deferred until a text
+ * run has to be built.
+ */
+static int set_face_size(AVFilterContext *ctx)
 {
     int err;
     DrawTextContext *s = ctx->priv;
 
-    if ((err = FT_Set_Pixel_Sizes(s->face, 0, fontsize))) {
+    if (s->face_fontsize == s->fontsize)
+        return 0;
+
+    if ((err = FT_Set_Pixel_Sizes(s->face, 0, s->fontsize))) {
         av_log(ctx, AV_LOG_ERROR, "Could not set font size to %d pixels: %s\n",
-               fontsize, FT_ERRMSG(err));
+               s->fontsize, FT_ERRMSG(err));
         return AVERROR(EINVAL);
     }
 
-    s->fontsize = fontsize;
+    s->face_fontsize = s->fontsize;
 
     return 0;
 }
 
+/**
+ * Check if an expression only depends on the input link properties, which
+ * only change in config_input().
+ */
+static int expr_is_constant(AVExpr *e)
+{
+    unsigned counter[VAR_VARS_NB] = { 0 };
+    int i;
+
+    /* rand() is a user function, so it is caught here as well */
+    if (!av_expr_is_pure(e))
+        return 0;
+
+    av_expr_count_vars(e, counter, VAR_VARS_NB);
+    for (i = 0; i < VAR_VARS_NB; i++) {
+        switch (i) {
+        case VAR_DAR:
+        case VAR_HSUB:   case VAR_VSUB:
+        case VAR_MAIN_H: case VAR_h: case VAR_H:
+        case VAR_MAIN_W: case VAR_w: case VAR_W:
+        case VAR_SAR:
+            break;
+        default:
+            if (counter[i])
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Evaluate an expression, or return the cached result if it is constant.
+ */
+static double eval_expr(DrawTextContext *s, enum expr_name name, AVExpr *e)
+{
+    if (!(s->const_exprs & (1 << name)) || !(s->cached_exprs & (1 << name))) {
+        s->expr_values[name] = av_expr_eval(e, s->var_values, &s->prng);
+        s->cached_exprs |= 1 << name;
+    }
+
+    return s->expr_values[name];
+}
+
 static av_cold int parse_fontsize(AVFilterContext *ctx)
 {
     DrawTextContext *s = ctx->priv;
@@ -466,7 +593,7 @@ static av_cold int update_fontsize(AVFilterContext *ctx)
         if ((err = parse_fontsize(ctx)) < 0)
            return err;
 
-        size = av_expr_eval(s->fontsize_pexpr, s->var_values, &s->prng);
+        size = eval_expr(s, EXPR_FONTSIZE, s->fontsize_pexpr);
 
         if (!isnan(size)) {
             roundedsize = round(size);
@@ -483,11 +610,9 @@ static av_cold int update_fontsize(AVFilterContext *ctx)
     if (fontsize == 0)
         fontsize = 1;
 
-    // no change
-    if (fontsize == s->fontsize)
-        return 0;
+    s->fontsize = fontsize;
 
-    return set_fontsize(ctx, fontsize);
+    return 0;
 }
 
 static int load_font_file(AVFilterContext *ctx, const char *path, int index)
@@ -791,7 +916,8 @@ static av_cold int init(AVFilterContext *ctx)
     if ((err = load_font(ctx)) < 0)
         return err;
 
-    if ((err = update_fontsize(ctx)) < 0)
+    if ((err = update_fontsize(ctx)) < 0 ||
+        (err = set_face_size(ctx)) < 0)
         return err;
 
     if (s->borderw) {
@@ -862,6 +988,9 @@ static av_cold void uninit(AVFilterContext *ctx)
     av_freep(&s->positions);
     s->nb_positions = 0;
 
+    for (int i = 0; i < DRAWTEXT_RUN_CACHE_SIZE; i++)
+        text_run_free(&s->runs[i]);
+
     av_tree_enumerate(s->glyphs, NULL, NULL, glyph_enu_free);
     av_tree_destroy(s->glyphs);
     s->glyphs = NULL;
@@ -946,6 +1075,20 @@ static int config_input(AVFilterLink *inlink)
         return AVERROR(EINVAL);
     }
 
+    s->const_exprs = (expr_is_constant(s->offsetx_pexpr)     << EXPR_OFFSETX)     |
+                     (expr_is_constant(s->offsety_pexpr)     << EXPR_OFFSETY)     |
+                     (expr_is_constant(s->x_pexpr)           << EXPR_X)           |
+                     (expr_is_constant(s->y_pexpr)           << EXPR_Y)           |
+                     (expr_is_constant(s->clip_enable_pexpr) << EXPR_CLIP_ENABLE) |
+                     (expr_is_constant(s->clip_top_pexpr)    << EXPR_CLIP_TOP)    |
+                     (expr_is_constant(s->clip_bottom_pexpr) << EXPR_CLIP_BOTTOM) |
+                     (expr_is_constant(s->clip_left_pexpr)   << EXPR_CLIP_LEFT)   |
+                     (expr_is_constant(s->clip_right_pexpr)  << EXPR_CLIP_RIGHT)  |
+                     (expr_is_constant(s->a_pexpr)           << EXPR_ALPHA);
+    if (s->fontsize_pexpr)
+        s->const_exprs |= expr_is_constant(s->fontsize_pexpr) << EXPR_FONTSIZE;
+    s->cached_exprs = 0;
+
     return 0;
 }
 
@@ -1294,188 +1437,439 @@ static int expand_text(AVFilterContext *ctx, char *text, AVBPrint *bp)
     return 0;
 }
 
-static int draw_glyphs(DrawTextContext *s, AVFrame *frame,
-                       int width, int height,
-                       int box_w, int box_h,
-                       FFDrawColor *color,
-                       int x, int y, int borderw)
+/**
+ * Merge the glyph bitmaps of one layer into a single alpha mask, using the
+ * glyph positions computed by build_text_run().
+ */
+static int rasterize_text_run(DrawTextContext *s, TextRun *run, const char *text, int layer)
 {
-    char *text = s->expanded_text.str;
+    TextRunMask *mask = &run->masks[layer];
+    int x_min = INT_MAX, y_min = INT_MAX, x_max = INT_MIN, y_max = INT_MIN;
     uint32_t code = 0;
-    int i, x1, y1;
-    uint8_t *p;
-    Glyph *glyph = NULL;
+    const uint8_t *p;
+    int pass, i;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0, p = text; *p; i++) {
+            FT_Bitmap bitmap;
+            Glyph *glyph;
+            Glyph dummy = { 0 };
+            int gx, gy, x, y;
+
+            GET_UTF8(code, *p ? *p++ : 0, code = 0xfffd; goto continue_on_invalid;);
+continue_on_invalid:
+
+            /* skip new line chars, just go to new line */
+            if (is_newline(code) || code == '\t')
+                continue;
+
+            dummy.code = code;
+            dummy.fontsize = s->fontsize;
+            glyph = av_tree_find(s->glyphs, &dummy, glyph_cmp, NULL);
+
+            bitmap = layer == LAYER_BORDER ? glyph->border_bitmap : glyph->bitmap;
+
+            if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_MONO &&
+                glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY)
+                return AVERROR(EINVAL);
+
+            if (!bitmap.width || !bitmap.rows)
+                continue;
+
+            gx = s->positions[i].x;
+            gy = s->positions[i].y;
+
+            if (!pass) {
+                x_min = FFMIN(x_min, gx);
+                y_min = FFMIN(y_min, gy);
+                x_max = FFMAX(x_max, gx + (int)bitmap.width);
+                y_max = FFMAX(y_max, gy + (int)bitmap.rows);
+                continue;
+            }
 
-    int clip_top    = s->clip_top;
-    int clip_left   = s->clip_left;
-    int clip_right  = s->clip_right;
-    int clip_bottom = s->clip_bottom;
-    short int clip_enable = s->clip_enable;
+            /* overlapping glyphs are merged as if they were blended in turn */
+            for (y = 0; y < bitmap.rows; y++) {
+                const uint8_t *src = bitmap.buffer + y * bitmap.pitch;
+                uint8_t *dst = mask->data + (gy - mask->y + y) * mask->w + gx - mask->x;
+
+                for (x = 0; x < bitmap.width; x++) {
+                    unsigned v = bitmap.pixel_mode == FT_PIXEL_MODE_MONO ?
+                                 ((src[x >> 3] >> (7 - (x & 7))) & 1) * 255 : src[x];
+
+                    if (!v)
+                        continue;
+                    dst[x] = dst[x] ? dst[x] + v - (dst[x] * v + 127) / 255 : v;
+                    mask->cells[(gy - mask->y + y) / RUN_CELL_SIZE * mask->cells_w +
+                                (gx - mask->x + x) / RUN_CELL_SIZE] = 1;
+                }
+            }
+        }
 
+        if (!pass) {
+            if (x_min >= x_max)
+                return 0;
+
+            mask->cells_w = (x_max - x_min + RUN_CELL_SIZE - 1) / RUN_CELL_SIZE;
+            mask->cells_h = (y_max - y_min + RUN_CELL_SIZE - 1) / RUN_CELL_SIZE;
+            mask->cells = av_mallocz_array(mask->cells_h, mask->cells_w);
+            if (!mask->cells)
+                return AVERROR(ENOMEM);
+
+            mask->x = x_min;
+            mask->y = y_min;
+            mask->w = x_max - x_min;
+            mask->h = y_max - y_min;
+            mask->data = av_mallocz_array(mask->h, mask->w);
+            if (!mask->data)
+                return AVERROR(ENOMEM);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Load the glyphs of text, lay them out and rasterize them.
+ */
+static int build_text_run(AVFilterContext *ctx, TextRun *run, const char *text)
+{
+    DrawTextContext *s = ctx->priv;
+    uint32_t code = 0, prev_code = 0;
+    int x = 0, y = 0, i = 0, ret;
+    int max_text_line_w = 0, len = strlen(text);
+    const uint8_t *p;
+    int y_min = 32000, y_max = -32000;
+    int x_min = 32000, x_max = -32000;
+    FT_Vector delta;
+    Glyph *glyph = NULL, *prev_glyph = NULL;
+    Glyph dummy = { 0 };
+
+    if ((ret = set_face_size(ctx)) < 0)
+        return ret;
+
+    if (len > s->nb_positions) {
+        if (!(s->positions =
+              av_realloc(s->positions, len*sizeof(*s->positions))))
+            return AVERROR(ENOMEM);
+        s->nb_positions = len;
+    }
+
+    /* load and cache glyphs */
     for (i = 0, p = text; *p; i++) {
-        FT_Bitmap bitmap;
-        Glyph dummy = { 0 };
         GET_UTF8(code, *p ? *p++ : 0, code = 0xfffd; goto continue_on_invalid;);
 continue_on_invalid:
 
-        /* skip new line chars, just go to new line */
-        if (code == '\n' || code == '\r' || code == '\t')
-            continue;
-
+        /* get glyph */
         dummy.code = code;
         dummy.fontsize = s->fontsize;
         glyph = av_tree_find(s->glyphs, &dummy, glyph_cmp, NULL);
+        if (!glyph) {
+            ret = load_glyph(ctx, &glyph, code);
+            if (ret < 0)
+                return ret;
+        }
 
-        bitmap = borderw ? glyph->border_bitmap : glyph->bitmap;
+        y_min = FFMIN(glyph->bbox.yMin, y_min);
+        y_max = FFMAX(glyph->bbox.yMax, y_max);
+        x_min = FFMIN(glyph->bbox.xMin, x_min);
+        x_max = FFMAX(glyph->bbox.xMax, x_max);
+    }
+    run->max_glyph_h = y_max - y_min;
+    run->max_glyph_w = x_max - x_min;
+    run->y_min = y_min;
+    run->y_max = y_max;
 
-        if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_MONO &&
-            glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY)
-            return AVERROR(EINVAL);
+    /* compute and save position for each glyph */
+    glyph = NULL;
+    for (i = 0, p = text; *p; i++) {
+        GET_UTF8(code, *p ? *p++ : 0, code = 0xfffd; goto continue_on_invalid2;);
+continue_on_invalid2:
 
-        x1 = s->positions[i].x + s->x + x - borderw;
-        y1 = s->positions[i].y + s->y + y - borderw;
-
-        // if clipping is not enabled, just blend and continue
-        if(!clip_enable) {
-            ff_blend_mask(&s->dc, color,
-                          frame->data, frame->linesize, width, height,
-                          bitmap.buffer, bitmap.pitch,
-                          bitmap.width, bitmap.rows,
-                          bitmap.pixel_mode == FT_PIXEL_MODE_MONO ? 0 : 3,
-                          0, x1, y1);
+        /* skip the \n in the sequence \r\n */
+        if (prev_code == '\r' && code == '\n')
+            continue;
+
+        prev_code = code;
+        if (is_newline(code)) {
+
+            max_text_line_w = FFMAX(max_text_line_w, x);
+            y += run->max_glyph_h + s->line_spacing;
+            x = 0;
             continue;
         }
 
+        /* get glyph */
+        prev_glyph = glyph;
+        dummy.code = code;
+        dummy.fontsize = s->fontsize;
+        glyph = av_tree_find(s->glyphs, &dummy, glyph_cmp, NULL);
 
-        int bit_w = bitmap.width;
-        int bit_h = bitmap.rows;
+        /* kerning */
+        if (s->use_kerning && prev_glyph && glyph->code) {
+            FT_Get_Kerning(s->face, prev_glyph->code, glyph->code,
+                           ft_kerning_default, &delta);
+            x += delta.x >> 6;
+        }
 
-        int delete_from_top    = FFMAX(clip_top  - s->positions[i].y, 0);
-        int delete_from_left   = FFMAX(clip_left - s->positions[i].x, 0);
+        /* save position, the offsets are applied when drawing */
+        s->positions[i].x = x + glyph->bitmap_left;
+        s->positions[i].y = y - glyph->bitmap_top + y_max;
 
-        int delete_from_bottom = FFMAX((s->positions[i].y + bit_h) - (box_h - clip_bottom), 0);
-        int delete_from_right  = FFMAX((s->positions[i].x + bit_w) - (box_w -  clip_right), 0);
+        if((code == ' ' || code == '\t') && s->word_spacing > 0)
+            x += s->word_spacing;
+        else if (code == '\t')
+            x  = (x / s->tabsize + 1) * s->tabsize;
+        else
+            x += glyph->advance;
+    }
 
-        unsigned short int should_draw  = !(
-            delete_from_top  >= bit_h || delete_from_bottom >= bit_h ||
-            delete_from_left >= bit_w || delete_from_right  >= bit_w
-        );
+    max_text_line_w = FFMAX(x, max_text_line_w);
 
-        av_log(s, AV_LOG_DEBUG, "drawing \"%c\" at x:%ld y:%ld (w:%d h:%d) delete(top:%d left:%d bottom:%d right:%d) visible:%d box(w:%d h:%d)\n",
-               code,
-               s->positions[i].x, s->positions[i].y,
-               bitmap.width, bitmap.rows,
-               delete_from_top,delete_from_left,delete_from_bottom,delete_from_right,
-               should_draw,
-               box_w, box_h
-        );
+    run->text_w = max_text_line_w;
+    run->text_h = y + run->max_glyph_h;
 
-        if(!should_draw)
-            continue;
+    if ((ret = rasterize_text_run(s, run, text, LAYER_TEXT)) < 0)
+        return ret;
+    if (s->borderw && (ret = rasterize_text_run(s, run, text, LAYER_BORDER)) < 0)
+        return ret;
 
-                 int    bitmap_pitch = bitmap.pitch;
-        unsigned int    bitmap_rows = bitmap.rows;
-        unsigned int    bitmap_width = bitmap.width;
-        unsigned int    bitmap_size = bitmap_width * bitmap_rows;
-        unsigned char*  bitmap_buffer = bitmap.buffer;
+    return 0;
+}
 
-        unsigned short  should_copy_buff = (
-            delete_from_top    || delete_from_right ||
-            delete_from_bottom || delete_from_left
-        );
+/**
+ * Get the text run of text at the current font size, from the cache if
+ * possible, else built in place of the least recently used one.
+ */
+static int get_text_run(AVFilterContext *ctx, const char *text, TextRun **run_ptr)
+{
+    DrawTextContext *s = ctx->priv;
+    TextRun *slot = &s->runs[0];
+    int ret;
 
-        if(should_copy_buff) {
-            bitmap_buffer = av_malloc(bitmap_size);
-            if(!bitmap_buffer)
-                return AVERROR(ENOMEM);
+    for (int i = 0; i < DRAWTEXT_RUN_CACHE_SIZE; i++) {
+        TextRun *run = &s->runs[i];
 
-            memcpy(bitmap_buffer, bitmap.buffer, bitmap_size);
+        if (run->text && run->fontsize == s->fontsize && !strcmp(run->text, text)) {
+            run->last_used = ++s->run_clock;
+            *run_ptr = run;
+            return 0;
         }
 
-        if(delete_from_top > 0){
-            // adjust Y
-            y1 += delete_from_top;
-            // adjust rows
-            bitmap_rows -= delete_from_top;
-            // adjust size
-            bitmap_size = bitmap_width * bitmap_rows;
-
-            // copy "up" the bitmap
-            memcpy(
-                bitmap_buffer,
-                bitmap_buffer + (bitmap_width * delete_from_top),
-                bitmap_size
-            );
-        }
-        if(delete_from_bottom > 0){
-            bitmap_rows -= delete_from_bottom;
-            bitmap_size = bitmap_width * bitmap_rows;
-        }
+        // pick an empty slot or evict the least recently used one
+        if (slot->text && (!run->text || run->last_used < slot->last_used))
+            slot = run;
+    }
 
-        if(delete_from_left > 0) {
-            // adjust X
-            x1 += delete_from_left;
-
-            unsigned int new_bitmap_width = bitmap_width - delete_from_left;
-            // for each for row
-            for(unsigned int row = 0; row < bitmap_rows; row ++){
-                memcpy(
-                    bitmap_buffer + (new_bitmap_width * row),
-                    bitmap_buffer + (bitmap_width     * row) + delete_from_left,
-                    new_bitmap_width
-                );
-            }
+    text_run_free(slot);
+    if ((ret = build_text_run(ctx, slot, text)) < 0 ||
+        !(slot->text = av_strdup(text))) {
+        text_run_free(slot);
+        return ret < 0 ? ret : AVERROR(ENOMEM);
+    }
+    slot->fontsize  = s->fontsize;
+    slot->last_used = ++s->run_clock;
 
-            // adjust rows
-            bitmap_width = new_bitmap_width;
-            // adjust pitch
-            bitmap_pitch += bitmap_pitch > 0 ?
-                            // if pitch > 0 (down draw) decrease
-                            -delete_from_left :
-                            // if pitch >= 0 (up draw) increase
-                            +delete_from_left;
-            // adjust size
-            bitmap_size = bitmap_width * bitmap_rows;
-        }
-        if(delete_from_right > 0) {
-
-            unsigned int new_bitmap_width = bitmap_width - delete_from_right;
-            // for each for row
-            for(unsigned int row = 0; row < bitmap_rows; row ++){
-                memcpy(
-                        bitmap_buffer + (new_bitmap_width * row),
-                        bitmap_buffer + (bitmap_width     * row),
-                        new_bitmap_width
-                );
-            }
+    *run_ptr = slot;
+    return 0;
+}
+
+/**
+ * Check if any pixel of the [x0, x1) x [y0, y1) run area has coverage.
+ */
+static int text_run_area_used(const TextRunMask *mask, int x0, int y0, int x1, int y1)
+{
+    const int cx0 = (x0 - mask->x) / RUN_CELL_SIZE, cx1 = (x1 - 1 - mask->x) / RUN_CELL_SIZE;
+    const int cy0 = (y0 - mask->y) / RUN_CELL_SIZE, cy1 = (y1 - 1 - mask->y) / RUN_CELL_SIZE;
+
+    for (int cy = cy0; cy <= cy1; cy++)
+        for (int cx = cx0; cx <= cx1; cx++)
+            if (mask->cells[cy * mask->cells_w + cx])
+                return 1;
+    return 0;
+}
+
+/**
+ * Blend the [x0, x1) x [y0, y1) area of a run mask placed at ox, oy in the
+ * frame. For 8-bit formats, this gives the same result as ff_blend_mask()
+ * but skips uncovered pixels and sums the mask only once per sample.
+ */
+static void blend_text_run_area(DrawTextContext *s, AVFrame *frame,
+                                int width, int height, FFDrawColor *color,
+                                const TextRunMask *mask, int x0, int y0, int x1, int y1,
+                                int ox, int oy)
+{
+    FFDrawContext *draw = &s->dc;
+    unsigned alpha, nb_planes, plane, comp;
 
-            // adjust rows
-            bitmap_width = new_bitmap_width;
-            // adjust pitch
-            bitmap_pitch += bitmap_pitch > 0 ?
-                            // if pitch > 0 (down draw) decrease
-                            -delete_from_right :
-                            // if pitch >= 0 (up draw) increase
-                            +delete_from_right;
-            // adjust size
-            bitmap_size = bitmap_width * bitmap_rows;
+    if (draw->desc->comp[0].depth > 8) {
+        ff_blend_mask(draw, color, frame->data, frame->linesize, width, height,
+                      mask->data + (y0 - mask->y) * mask->w + x0 - mask->x, mask->w,
+                      x1 - x0, y1 - y0, 3, 0, ox + x0, oy + y0);
+        return;
+    }
+    if (!color->rgba[3])
+        return;
+
+    alpha = (0x10307 * color->rgba[3] + 0x3) >> 8;
+    nb_planes = draw->nb_planes - !!(draw->desc->flags & AV_PIX_FMT_FLAG_ALPHA && !(draw->flags & FF_DRAW_PROCESS_ALPHA));
+    nb_planes += !nb_planes;
+
+    for (plane = 0; plane < nb_planes; plane++) {
+        const int hsub = draw->hsub[plane], vsub = draw->vsub[plane];
+        const int step = draw->pixelstep[plane], comp_mask = draw->comp_mask[plane];
+        const int fx0 = ox + x0, fx1 = ox + x1, fy0 = oy + y0, fy1 = oy + y1;
+        const int cx0 = fx0 >> hsub, cx1 = ((fx1 - 1) >> hsub) + 1;
+        const int cy0 = fy0 >> vsub, cy1 = ((fy1 - 1) >> vsub) + 1;
+        const uint8_t *mdata = mask->data - (oy + mask->y) * mask->w - (ox + mask->x);
+        const ptrdiff_t mlinesize = mask->w, linesize = frame->linesize[plane];
+        uint8_t src[16];
+
+        /* local copies, as the frame stores could alias them */
+        for (comp = 0; comp < step; comp++)
+            src[comp] = color->comp[plane].u8[comp];
+
+        for (int cy = cy0; cy < cy1; cy++) {
+            const int my0 = FFMAX(cy << vsub, fy0), my1 = FFMIN((cy + 1) << vsub, fy1);
+            uint8_t *dst = frame->data[plane] + cy * linesize;
+
+            for (int cx = cx0; cx < cx1; cx++) {
+                unsigned t = 0, a;
+
+                if (!hsub && !vsub) {
+                    t = mdata[cy * mlinesize + cx];
+                } else {
+                    const int mx0 = FFMAX(cx << hsub, fx0), mx1 = FFMIN((cx + 1) << hsub, fx1);
+
+                    /* partially covered samples count the missing pixels as 0 */
+                    for (int my = my0; my < my1; my++)
+                        for (int mx = mx0; mx < mx1; mx++)
+                            t += mdata[my * mlinesize + mx];
+                    t >>= hsub + vsub;
+                }
+                a = t * alpha;
+                for (comp = 0; comp < step; comp++) {
+                    uint8_t *d = dst + cx * step + comp;
+
+                    if ((comp_mask >> comp) & 1)
+                        *d = ((0x1010101 - a) * *d + a * src[comp]) >> 24;
+                }
+            }
         }
+    }
+}
+
+/**
+ * Blend one layer of a text run, with its top left corner at x, y and
+ * clipped as requested by the clip_* expressions and to the frame rows
+ * [slice_y0, slice_y1).
+ *
+ * The mask is blended in runs of RUN_TILE_SIZE tiles aligned on the frame,
+ * skipping the empty ones. Chroma samples are never shared between tiles,
+ * so the result is the same as blending the whole mask at once.
+ */
+static void draw_text_run(DrawTextContext *s, AVFrame *frame,
+                          int width, int height, const TextRun *run, int layer,
+                          FFDrawColor *color, int x, int y, int slice_y0, int slice_y1)
+{
+    const TextRunMask *mask = &run->masks[layer];
+    const int ox = s->x + s->offsetx + x, oy = s->y + s->offsety + y;
+    int x0 = mask->x, y0 = mask->y;
+    int x1 = mask->x + mask->w, y1 = mask->y + mask->h;
+    int tx, ty;
+
+    if (!mask->data)
+        return;
 
-        ff_blend_mask(
-                &s->dc, color,
-                frame->data, frame->linesize, width, height,
-                bitmap_buffer, bitmap_pitch, bitmap_width, bitmap_rows,
-                bitmap.pixel_mode == FT_PIXEL_MODE_MONO ? 0 : 3,
-                0, x1, y1);
+    /* the clipping area is relative to the text box, before the offsets */
+    if (s->clip_enable) {
+        x0 = FFMAX(x0, s->clip_left - s->offsetx);
+        y0 = FFMAX(y0, s->clip_top  - s->offsety);
+        x1 = FFMIN(x1, run->text_w - s->clip_right  - s->offsetx);
+        y1 = FFMIN(y1, run->text_h - s->clip_bottom - s->offsety);
+    }
+    x0 = FFMAX(x0, -ox);
+    y0 = FFMAX(y0, slice_y0 - oy);
+    x1 = FFMIN(x1, width  - ox);
+    y1 = FFMIN(y1, slice_y1 - oy);
+    if (x0 >= x1 || y0 >= y1)
+        return;
 
-        if(should_copy_buff) {
-            av_free(bitmap_buffer);
+    for (ty = (oy + y0) & ~(RUN_TILE_SIZE - 1); ty < oy + y1; ty += RUN_TILE_SIZE) {
+        const int ry0 = FFMAX(ty - oy, y0), ry1 = FFMIN(ty + RUN_TILE_SIZE - oy, y1);
+        int start = INT_MIN;
+
+        for (tx = (ox + x0) & ~(RUN_TILE_SIZE - 1); ; tx += RUN_TILE_SIZE) {
+            const int rx0 = FFMAX(tx - ox, x0), rx1 = FFMIN(tx + RUN_TILE_SIZE - ox, x1);
+            const int done = rx0 >= x1;
+            const int used = !done && text_run_area_used(mask, rx0, ry0, rx1, ry1);
+
+            if (used && start == INT_MIN)
+                start = rx0;
+            if (!used && start != INT_MIN) {
+                blend_text_run_area(s, frame, width, height, color, mask,
+                                    start, ry0, FFMIN(rx0, x1), ry1, ox, oy);
+                start = INT_MIN;
+            }
+            if (done)
+                break;
         }
     }
+}
 
-    return 0;
+/**
+ * Extend [*y0, *y1) to the frame rows covered by one layer of a text run.
+ */
+static void text_run_rows(DrawTextContext *s, const TextRun *run, int layer,
+                          int y, int *y0, int *y1)
+{
+    const TextRunMask *mask = &run->masks[layer];
+    const int oy = s->y + s->offsety + y;
+
+    if (!mask->data)
+        return;
+    *y0 = FFMIN(*y0, oy + mask->y);
+    *y1 = FFMAX(*y1, oy + mask->y + mask->h);
 }
 
+static int draw_text_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    DrawTextContext *s = ctx->priv;
+    ThreadData *td = arg;
+    AVFrame *frame = td->frame;
+    const int vsub = s->dc.vsub_max;
+    const int first = td->y0 >> vsub;
+    const int nb = ((td->y1 - 1) >> vsub) + 1 - first;
+    /* rows sharing a chroma row are always drawn by the same job */
+    const int y0 = FFMAX((first + nb *  jobnr      / nb_jobs) << vsub, td->y0);
+    const int y1 = FFMIN((first + nb * (jobnr + 1) / nb_jobs) << vsub, td->y1);
+
+    if (y0 >= y1)
+        return 0;
+
+    if (s->draw_box) {
+        const int box_y0 = FFMAX(s->y - s->boxborderw, y0);
+        const int box_y1 = FFMIN(s->y + td->run->text_h + s->boxborderw, y1);
+
+        if (box_y0 < box_y1)
+            ff_blend_rectangle(&s->dc, &td->boxcolor,
+                               frame->data, frame->linesize, frame->width, frame->height,
+                               s->x - s->boxborderw, box_y0,
+                               td->run->text_w + s->boxborderw * 2, box_y1 - box_y0);
+    }
+
+    if (s->shadowx || s->shadowy)
+        draw_text_run(s, frame, frame->width, frame->height, td->run, LAYER_TEXT,
+                      &td->shadowcolor, s->shadowx, s->shadowy, y0, y1);
+
+    if (s->borderw)
+        draw_text_run(s, frame, frame->width, frame->height, td->run, LAYER_BORDER,
+                      &td->bordercolor, -s->borderw, -s->borderw, y0, y1);
+
+    draw_text_run(s, frame, frame->width, frame->height, td->run, LAYER_TEXT,
+                  &td->fontcolor, 0, 0, y0, y1);
+
+    return 0;
+}
 
 static void update_color_with_alpha(DrawTextContext *s, FFDrawColor *color, const FFDrawColor incolor)
 {
@@ -1486,7 +1880,7 @@ static void update_color_with_alpha(DrawTextContext *s, FFDrawColor *color, cons
 
 static void update_alpha(DrawTextContext *s)
 {
-    double alpha = av_expr_eval(s->a_pexpr, s->var_values, &s->prng);
+    double alpha = eval_expr(s, EXPR_ALPHA, s->a_pexpr);
 
     if (isnan(alpha))
         return;
@@ -1505,32 +1899,17 @@ static int draw_text(AVFilterContext *ctx, AVFrame *frame,
     DrawTextContext *s = ctx->priv;
     AVFilterLink *inlink = ctx->inputs[0];
 
-    uint32_t code = 0, prev_code = 0;
-    int x = 0, y = 0, i = 0, ret;
-    int max_text_line_w = 0, len;
-    int box_w, box_h;
-    char *text;
-    uint8_t *p;
-    int y_min = 32000, y_max = -32000;
-    int x_min = 32000, x_max = -32000;
-    FT_Vector delta;
-    Glyph *glyph = NULL, *prev_glyph = NULL;
-    Glyph dummy = { 0 };
+    int ret;
+    int box_w, box_h, nb_rows;
+    TextRun *run;
+    ThreadData td = { 0 };
 
     time_t now = time(0);
     struct tm ltime;
     AVBPrint *bp = &s->expanded_text;
 
-    s->offsetx = s->var_values[VAR_OFFSETX] = av_expr_eval(s->offsetx_pexpr, s->var_values, &s->prng);
-    s->offsety = s->var_values[VAR_OFFSETY] = av_expr_eval(s->offsety_pexpr, s->var_values, &s->prng);
-
-    int offset_x = s->offsetx;
-    int offset_y = s->offsety;
-
-    FFDrawColor fontcolor;
-    FFDrawColor shadowcolor;
-    FFDrawColor bordercolor;
-    FFDrawColor boxcolor;
+    s->offsetx = s->var_values[VAR_OFFSETX] = eval_expr(s, EXPR_OFFSETX, s->offsetx_pexpr);
+    s->offsety = s->var_values[VAR_OFFSETY] = eval_expr(s, EXPR_OFFSETY, s->offsety_pexpr);
 
     av_bprint_clear(bp);
 
@@ -1560,14 +1939,6 @@ static int draw_text(AVFilterContext *ctx, AVFrame *frame,
 
     if (!av_bprint_is_complete(bp))
         return AVERROR(ENOMEM);
-    text = s->expanded_text.str;
-    if ((len = s->expanded_text.len) > s->nb_positions) {
-        if (!(s->positions =
-              av_realloc(s->positions, len*sizeof(*s->positions))))
-            return AVERROR(ENOMEM);
-        s->nb_positions = len;
-    }
-
     if (s->fontcolor_expr[0]) {
         /* If expression is set, evaluate and replace the static value */
         av_bprint_clear(&s->expanded_fontcolor);
@@ -1582,110 +1953,44 @@ static int draw_text(AVFilterContext *ctx, AVFrame *frame,
         ff_draw_color(&s->dc, &s->fontcolor, s->fontcolor.rgba);
     }
 
-    x = 0;
-    y = 0;
-
     if ((ret = update_fontsize(ctx)) < 0)
         return ret;
 
-    /* load and cache glyphs */
-    for (i = 0, p = text; *p; i++) {
-        GET_UTF8(code, *p ? *p++ : 0, code = 0xfffd; goto continue_on_invalid;);
-continue_on_invalid:
-
-        /* get glyph */
-        dummy.code = code;
-        dummy.fontsize = s->fontsize;
-        glyph = av_tree_find(s->glyphs, &dummy, glyph_cmp, NULL);
-        if (!glyph) {
-            ret = load_glyph(ctx, &glyph, code);
-            if (ret < 0)
-                return ret;
-        }
-
-        y_min = FFMIN(glyph->bbox.yMin, y_min);
-        y_max = FFMAX(glyph->bbox.yMax, y_max);
-        x_min = FFMIN(glyph->bbox.xMin, x_min);
-        x_max = FFMAX(glyph->bbox.xMax, x_max);
-    }
-    s->max_glyph_h = y_max - y_min;
-    s->max_glyph_w = x_max - x_min;
-
-    /* compute and save position for each glyph */
-    glyph = NULL;
-    for (i = 0, p = text; *p; i++) {
-        GET_UTF8(code, *p ? *p++ : 0, code = 0xfffd; goto continue_on_invalid2;);
-continue_on_invalid2:
-
-        /* skip the \n in the sequence \r\n */
-        if (prev_code == '\r' && code == '\n')
-            continue;
-
-        prev_code = code;
-        if (is_newline(code)) {
-
-            max_text_line_w = FFMAX(max_text_line_w, x);
-            y += s->max_glyph_h + s->line_spacing;
-            x = 0;
-            continue;
-        }
-
-        /* get glyph */
-        prev_glyph = glyph;
-        dummy.code = code;
-        dummy.fontsize = s->fontsize;
-        glyph = av_tree_find(s->glyphs, &dummy, glyph_cmp, NULL);
-
-        /* kerning */
-        if (s->use_kerning && prev_glyph && glyph->code) {
-            FT_Get_Kerning(s->face, prev_glyph->code, glyph->code,
-                           ft_kerning_default, &delta);
-            x += delta.x >> 6;
-        }
-
-        /* save position */
-        s->positions[i].x = x + glyph->bitmap_left + offset_x;
-        s->positions[i].y = y - glyph->bitmap_top + y_max + offset_y;
-
-        if((code == ' ' || code == '\t') && s->word_spacing > 0)
-            x += s->word_spacing;
-        else if (code == '\t')
-            x  = (x / s->tabsize + 1) * s->tabsize;
-        else
-            x += glyph->advance;
-    }
+    if ((ret = get_text_run(ctx, s->expanded_text.str, &run)) < 0)
+        return ret;
 
-    max_text_line_w = FFMAX(x, max_text_line_w);
+    s->max_glyph_w = run->max_glyph_w;
+    s->max_glyph_h = run->max_glyph_h;
 
-    s->var_values[VAR_TW] = s->var_values[VAR_TEXT_W] = max_text_line_w;
-    s->var_values[VAR_TH] = s->var_values[VAR_TEXT_H] = y + s->max_glyph_h;
+    s->var_values[VAR_TW] = s->var_values[VAR_TEXT_W] = run->text_w;
+    s->var_values[VAR_TH] = s->var_values[VAR_TEXT_H] = run->text_h;
 
     s->var_values[VAR_MAX_GLYPH_W] = s->max_glyph_w;
     s->var_values[VAR_MAX_GLYPH_H] = s->max_glyph_h;
-    s->var_values[VAR_MAX_GLYPH_A] = s->var_values[VAR_ASCENT ] = y_max;
-    s->var_values[VAR_MAX_GLYPH_D] = s->var_values[VAR_DESCENT] = y_min;
+    s->var_values[VAR_MAX_GLYPH_A] = s->var_values[VAR_ASCENT ] = run->y_max;
+    s->var_values[VAR_MAX_GLYPH_D] = s->var_values[VAR_DESCENT] = run->y_min;
 
     s->var_values[VAR_LINE_H] = s->var_values[VAR_LH] = s->max_glyph_h;
 
-    s->x = s->var_values[VAR_X] = av_expr_eval(s->x_pexpr, s->var_values, &s->prng);
-    s->y = s->var_values[VAR_Y] = av_expr_eval(s->y_pexpr, s->var_values, &s->prng);
+    s->x = s->var_values[VAR_X] = eval_expr(s, EXPR_X, s->x_pexpr);
+    s->y = s->var_values[VAR_Y] = eval_expr(s, EXPR_Y, s->y_pexpr);
     /* It is necessary if x is expressed from y  */
-    s->x = s->var_values[VAR_X] = av_expr_eval(s->x_pexpr, s->var_values, &s->prng);
+    s->x = s->var_values[VAR_X] = eval_expr(s, EXPR_X, s->x_pexpr);
 
-    s->clip_enable = s->var_values[VAR_CLIP_ENABLE] = av_expr_eval(s->clip_enable_pexpr, s->var_values, &s->prng);
-    s->clip_top = s->var_values[VAR_CLIP_TOP] = av_expr_eval(s->clip_top_pexpr, s->var_values, &s->prng);
-    s->clip_bottom = s->var_values[VAR_CLIP_BOTTOM] = av_expr_eval(s->clip_bottom_pexpr, s->var_values, &s->prng);
-    s->clip_left = s->var_values[VAR_CLIP_LEFT] = av_expr_eval(s->clip_left_pexpr, s->var_values, &s->prng);
-    s->clip_right = s->var_values[VAR_CLIP_RIGHT] = av_expr_eval(s->clip_right_pexpr, s->var_values, &s->prng);
+    s->clip_enable = s->var_values[VAR_CLIP_ENABLE] = eval_expr(s, EXPR_CLIP_ENABLE, s->clip_enable_pexpr);
+    s->clip_top = s->var_values[VAR_CLIP_TOP] = eval_expr(s, EXPR_CLIP_TOP, s->clip_top_pexpr);
+    s->clip_bottom = s->var_values[VAR_CLIP_BOTTOM] = eval_expr(s, EXPR_CLIP_BOTTOM, s->clip_bottom_pexpr);
+    s->clip_left = s->var_values[VAR_CLIP_LEFT] = eval_expr(s, EXPR_CLIP_LEFT, s->clip_left_pexpr);
+    s->clip_right = s->var_values[VAR_CLIP_RIGHT] = eval_expr(s, EXPR_CLIP_RIGHT, s->clip_right_pexpr);
 
     update_alpha(s);
-    update_color_with_alpha(s, &fontcolor  , s->fontcolor  );
-    update_color_with_alpha(s, &shadowcolor, s->shadowcolor);
-    update_color_with_alpha(s, &bordercolor, s->bordercolor);
-    update_color_with_alpha(s, &boxcolor   , s->boxcolor   );
+    update_color_with_alpha(s, &td.fontcolor  , s->fontcolor  );
+    update_color_with_alpha(s, &td.shadowcolor, s->shadowcolor);
+    update_color_with_alpha(s, &td.bordercolor, s->bordercolor);
+    update_color_with_alpha(s, &td.boxcolor   , s->boxcolor   );
 
-    box_w = max_text_line_w;
-    box_h = y + s->max_glyph_h;
+    box_w = run->text_w;
+    box_h = run->text_h;
 
     if (s->fix_bounds) {
 
@@ -1713,27 +2018,28 @@ continue_on_invalid2:
             s->y = FFMAX(height - box_h - offsetbottom, 0);
     }
 
-    /* draw box */
-    if (s->draw_box)
-        ff_blend_rectangle(&s->dc, &boxcolor,
-                           frame->data, frame->linesize, width, height,
-                           s->x - s->boxborderw, s->y - s->boxborderw,
-                           box_w + s->boxborderw * 2, box_h + s->boxborderw * 2);
-
-    if (s->shadowx || s->shadowy) {
-        if ((ret = draw_glyphs(s, frame, width, height, box_w, box_h,
-                               &shadowcolor, s->shadowx, s->shadowy, 0)) < 0)
-            return ret;
+    /* find the rows touched by the box and the text layers */
+    td.frame = frame;
+    td.run   = run;
+    td.y0    = INT_MAX;
+    td.y1    = INT_MIN;
+    if (s->draw_box) {
+        td.y0 = s->y - s->boxborderw;
+        td.y1 = s->y + box_h + s->boxborderw;
     }
+    if (s->shadowx || s->shadowy)
+        text_run_rows(s, run, LAYER_TEXT, s->shadowy, &td.y0, &td.y1);
+    if (s->borderw)
+        text_run_rows(s, run, LAYER_BORDER, -s->borderw, &td.y0, &td.y1);
+    text_run_rows(s, run, LAYER_TEXT, 0, &td.y0, &td.y1);
+    td.y0 = FFMAX(td.y0, 0);
+    td.y1 = FFMIN(td.y1, height);
+    if (td.y0 >= td.y1)
+        return 0;
 
-    if (s->borderw) {
-        if ((ret = draw_glyphs(s, frame, width, height, box_w, box_h,
-                               &bordercolor, 0, 0, s->borderw)) < 0)
-            return ret;
-    }
-    if ((ret = draw_glyphs(s, frame, width, height, box_w, box_h,
-                           &fontcolor, 0, 0, 0)) < 0)
-        return ret;
+    nb_rows = ((td.y1 - 1) >> s->dc.vsub_max) - (td.y0 >> s->dc.vsub_max) + 1;
+    ctx->internal->execute(ctx, draw_text_slice, &td, NULL,
+                           FFMIN(nb_rows, ff_filter_get_nb_threads(ctx)));
 
     return 0;
 }
@@ -1809,5 +2115,5 @@ AVFilter ff_vf_drawtext = {
     .inputs        = avfilter_vf_drawtext_inputs,
     .outputs       = avfilter_vf_drawtext_outputs,
     .process_command = command,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
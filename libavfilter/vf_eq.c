@@ -259,13 +259,12 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
     const AVPixFmtDescriptor *desc;
     int i;
 
-    out = ff_get_video_buffer(outlink, inlink->w, inlink->h);
+    out = ff_get_video_output(inlink, outlink, in);
     if (!out) {
         av_frame_free(&in);
         return AVERROR(ENOMEM);
     }
 
-    av_frame_copy_props(out, in);
     desc = av_pix_fmt_desc_get(inlink->format);
 
     eq->var_values[VAR_N]   = inlink->frame_count_out;
@@ -288,19 +287,41 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
             h = AV_CEIL_RSHIFT(h, desc->log2_chroma_h);
         }
 
-        if (i == 3 || !eq->param[i].adjust)
-            av_image_copy_plane(out->data[i], out->linesize[i],
-                                in->data[i], in->linesize[i], w, h);
-
-        else
+        if (i == 3 || !eq->param[i].adjust) {
+            if (out != in)
+                av_image_copy_plane(out->data[i], out->linesize[i],
+                                    in->data[i], in->linesize[i], w, h);
+        } else
             eq->param[i].adjust(&eq->param[i], out->data[i], out->linesize[i],
                                  in->data[i], in->linesize[i], w, h);
     }
 
-    av_frame_free(&in);
+    if (out != in)
+        av_frame_free(&in);
     return ff_filter_frame(outlink, out);
 }
 
+static int get_lut(AVFilterContext *ctx, uint16_t (*lut)[256 * 256])
+{
+    EQContext *eq = ctx->priv;
+    uint8_t ramp[256], out[256];
+
+    if (eq->eval_mode != EVAL_MODE_INIT)
+        return 0;
+
+    for (int i = 0; i < 256; i++)
+        ramp[i] = i;
+    for (int i = 0; i < 4; i++) {
+        if (i < 3 && eq->param[i].adjust)
+            eq->param[i].adjust(&eq->param[i], out, 0, ramp, 0, 256, 1);
+        else
+            memcpy(out, ramp, sizeof(out));
+        for (int v = 0; v < 256 * 256; v++)
+            lut[i][v] = out[FFMIN(v, 255)];
+    }
+    return 1;
+}
+
 static inline int set_param(AVExpr **pexpr, const char *args, const char *cmd,
                             void (*set_fn)(EQContext *eq), AVFilterContext *ctx)
 {
@@ -338,6 +359,7 @@ static const AVFilterPad eq_inputs[] = {
         .type = AVMEDIA_TYPE_VIDEO,
         .filter_frame = filter_frame,
         .config_props = config_props,
+        .inplace      = 1,
     },
     { NULL }
 };
@@ -386,6 +408,7 @@ AVFilter ff_vf_eq = {
     .inputs          = eq_inputs,
     .outputs         = eq_outputs,
     .process_command = process_command,
+    .get_lut         = get_lut,
     .query_formats   = query_formats,
     .init            = initialize,
     .uninit          = uninit,
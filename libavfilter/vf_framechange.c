@@ -24,33 +24,52 @@
  */
 
 #include "../libavutil/avassert.h"
+#include "../libavutil/imgutils.h"
 #include "../libavutil/opt.h"
+#include "../libavutil/pixdesc.h"
 #include "avfilter.h"
 #include "formats.h"
 #include "internal.h"
 #include "video.h"
 #include <stdatomic.h>
 
-#define ABSDIFF(a,b) (abs((int)(a)-(int)(b)))
+typedef uint64_t (*diff_plane_fn)(const uint8_t *cur, ptrdiff_t cur_linesize,
+                                  const uint8_t *prev, ptrdiff_t prev_linesize,
+                                  uint8_t *dst, ptrdiff_t dst_linesize,
+                                  int width, int height, int threshold);
 
 typedef struct ThreadData {
-    uint8_t* current;
-    uint8_t* previous;
-    uint8_t* show_frame;
+    AVFrame *current;
+    AVFrame *previous;
+    AVFrame *show_frame;
 
-    int width, height, stride;
-    atomic_uint_least64_t atomic_pixels_changed;
+    atomic_uint_least64_t atomic_pixels_changed[4];
 } ThreadData;
 
 typedef struct FrameChangeContext {
     const AVClass *class;
     int threshold;
     int show;
+    int planes;
 
     AVFrame *frame_prev;
     unsigned int frame_nr;
 
     int count_mode;
+
+    int nb_planes;
+    int planewidth[4];
+    int planeheight[4];
+    char comps[4];        ///< component names used in the metadata keys
+    diff_plane_fn diff_plane;
+
+    int block_size;
+    double block_threshold;
+    int roi;
+    AVRational roi_qoffset;
+
+    int nb_blocks_w, nb_blocks_h;
+    uint32_t *block_changed;  ///< change sum of each luma block, like the frame total
 } FrameChangeContext;
 
 enum {
@@ -63,6 +82,11 @@ enum {
 static const AVOption framechange_options[] = {
     { "threshold",          "threshold after which a pixel counts as change",                       OFFSET(threshold),  AV_OPT_TYPE_INT,   { .i64 = 10 }, 0, 255, FLAGS },
     { "show",               "show changes",                                                         OFFSET(show),       AV_OPT_TYPE_BOOL,  { .i64 =  0 }, 0,   1, FLAGS },
+    { "planes",             "set planes to compare",                                                OFFSET(planes),     AV_OPT_TYPE_INT,   { .i64 =  1 }, 1,  15, FLAGS },
+    { "block_size",         "set size of the luma blocks to compute the change of, 0 to disable",   OFFSET(block_size), AV_OPT_TYPE_INT,   { .i64 =  0 }, 0, 256, FLAGS },
+    { "block_threshold",    "change after which a block counts as changed",                         OFFSET(block_threshold), AV_OPT_TYPE_DOUBLE, { .dbl = 0 }, 0, 1, FLAGS },
+    { "roi",                "export changed blocks as regions of interest",                         OFFSET(roi),        AV_OPT_TYPE_BOOL,  { .i64 =  0 }, 0,   1, FLAGS },
+    { "roi_qoffset",        "quantisation offset to apply in changed blocks",                       OFFSET(roi_qoffset), AV_OPT_TYPE_RATIONAL, { .dbl = -0.1 }, -1, 1, FLAGS },
 
     { "mode",               "how to count changes",                                                 OFFSET(count_mode), AV_OPT_TYPE_INT,   { .i64 =  COUNT_MODE_ABSOLUTE },  0, 1, FLAGS, "mode" },
         { "absolute",       "count pixel change above threshold as 1, below as 0",                  OFFSET(count_mode), AV_OPT_TYPE_CONST, { .i64 = COUNT_MODE_ABSOLUTE },   0, 0, FLAGS, "mode" },
@@ -86,6 +110,11 @@ static int query_formats(AVFilterContext *ctx)
     static const enum AVPixelFormat pix_fmts[] = {
             AV_PIX_FMT_YUV420P,
             AV_PIX_FMT_GRAY8,
+            AV_PIX_FMT_YUV410P, AV_PIX_FMT_YUV411P,
+            AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV440P, AV_PIX_FMT_YUV444P,
+            AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUVJ422P,
+            AV_PIX_FMT_YUVJ440P, AV_PIX_FMT_YUVJ444P,
+            AV_PIX_FMT_YUVA420P, AV_PIX_FMT_YUVA422P, AV_PIX_FMT_YUVA444P,
             AV_PIX_FMT_NONE
     };
 
@@ -95,134 +124,368 @@ static int query_formats(AVFilterContext *ctx)
     return ff_set_common_formats(ctx, fmts_list);
 }
 
-static int config_props(AVFilterLink *inlink)
+/**
+ * Sum the changes of one plane. The mode and show arguments are constants
+ * in each of the instances below, so the inner loop is branchless and can
+ * be vectorized by the compiler.
+ */
+static av_always_inline uint64_t diff_plane(const uint8_t *cur, ptrdiff_t cur_linesize,
+                                            const uint8_t *prev, ptrdiff_t prev_linesize,
+                                            uint8_t *dst, ptrdiff_t dst_linesize,
+                                            int width, int height, int threshold,
+                                            int count_mode, int show)
 {
-//    AVFilterContext *ctx = inlink->dst;
-//    FrameChangeContext *framechange = ctx->priv;
+    uint64_t pixels_changed = 0;
+    int x, y;
 
-    return 0;
-}
+    for (y = 0; y < height; y++) {
+        unsigned row_changed = 0;
 
-static int filter_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
-{
-    FrameChangeContext *s = ctx->priv;
-    ThreadData *td = arg;
+        for (x = 0; x < width; x++) {
+            int change  = FFABS(cur[x] - prev[x]);
+            int changed = change > threshold;
 
-    const int threshold = s->threshold;
-    const int show = s->show;
-    const int count_mode = s->count_mode;
+            if (count_mode == COUNT_MODE_ABSOLUTE) {
+                row_changed += changed;
+                if (show)
+                    dst[x] = -changed;
+            } else {
+                int value = changed ? change : 0;
+
+                row_changed += value;
+                if (show)
+                    dst[x] = value;
+            }
+        }
 
-          uint8_t *a = td->current;
-    const uint8_t *b = td->previous;
+        // absolute mode counts a changed pixel as 255
+        pixels_changed += count_mode == COUNT_MODE_ABSOLUTE ? row_changed * 255ULL : row_changed;
 
-    const int height = td->height;
-    const int width  = td->width;
-    const int stride = td->stride;
+        cur  += cur_linesize;
+        prev += prev_linesize;
+        if (show)
+            dst += dst_linesize;
+    }
 
+    return pixels_changed;
+}
 
-    const int slice_start = (height *  jobnr   ) / nb_jobs;
-    const int slice_end   = (height * (jobnr+1)) / nb_jobs;
+#define DEFINE_DIFF_PLANE(name, count_mode, show)                                       \
+static uint64_t diff_plane_##name(const uint8_t *cur, ptrdiff_t cur_linesize,           \
+                                  const uint8_t *prev, ptrdiff_t prev_linesize,         \
+                                  uint8_t *dst, ptrdiff_t dst_linesize,                 \
+                                  int width, int height, int threshold)                 \
+{                                                                                       \
+    return diff_plane(cur, cur_linesize, prev, prev_linesize, dst, dst_linesize,        \
+                      width, height, threshold, count_mode, show);                      \
+}
 
-          uint8_t *ptr_a = a + slice_start * stride;
-    const uint8_t *ptr_b = b + slice_start * stride;
+DEFINE_DIFF_PLANE(absolute,        COUNT_MODE_ABSOLUTE,   0)
+DEFINE_DIFF_PLANE(absolute_show,   COUNT_MODE_ABSOLUTE,   1)
+DEFINE_DIFF_PLANE(percentage,      COUNT_MODE_PERCENTAGE, 0)
+DEFINE_DIFF_PLANE(percentage_show, COUNT_MODE_PERCENTAGE, 1)
 
-    int x, y;
+static int config_props(AVFilterLink *inlink)
+{
+    AVFilterContext *ctx = inlink->dst;
+    FrameChangeContext *framechange = ctx->priv;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
+    int p;
+
+    framechange->nb_planes = av_pix_fmt_count_planes(inlink->format);
+    framechange->planewidth[1]  = framechange->planewidth[2]  = AV_CEIL_RSHIFT(inlink->w, desc->log2_chroma_w);
+    framechange->planewidth[0]  = framechange->planewidth[3]  = inlink->w;
+    framechange->planeheight[1] = framechange->planeheight[2] = AV_CEIL_RSHIFT(inlink->h, desc->log2_chroma_h);
+    framechange->planeheight[0] = framechange->planeheight[3] = inlink->h;
+    for (p = 0; p < 4; p++)
+        framechange->comps[p] = "YUVA"[p];
+
+    if (!(framechange->planes & ((1 << framechange->nb_planes) - 1))) {
+        av_log(ctx, AV_LOG_ERROR, "None of the selected planes exist in format %s.\n",
+               desc->name);
+        return AVERROR(EINVAL);
+    }
 
-    uint64_t pixels_changed_on_slice = 0;
+    if (framechange->block_size) {
+        if (!(framechange->planes & 1)) {
+            av_log(ctx, AV_LOG_ERROR, "Block change needs the luma plane to be compared.\n");
+            return AVERROR(EINVAL);
+        }
+        framechange->nb_blocks_w = (inlink->w + framechange->block_size - 1) / framechange->block_size;
+        framechange->nb_blocks_h = (inlink->h + framechange->block_size - 1) / framechange->block_size;
+
+        av_freep(&framechange->block_changed);
+        framechange->block_changed = av_malloc_array(framechange->nb_blocks_w * framechange->nb_blocks_h,
+                                                     sizeof(*framechange->block_changed));
+        if (!framechange->block_changed)
+            return AVERROR(ENOMEM);
+    } else if (framechange->roi) {
+        av_log(ctx, AV_LOG_ERROR, "Regions of interest need a block_size.\n");
+        return AVERROR(EINVAL);
+    }
 
-    // fixme split functions based on count_mode
-    if(count_mode == COUNT_MODE_ABSOLUTE) {
+    if (framechange->count_mode == COUNT_MODE_ABSOLUTE)
+        framechange->diff_plane = framechange->show ? diff_plane_absolute_show   : diff_plane_absolute;
+    else
+        framechange->diff_plane = framechange->show ? diff_plane_percentage_show : diff_plane_percentage;
 
-        for (y = slice_start; y < slice_end; y++) {
-            for (x = 0; x < width; x++) {
-                int change = ABSDIFF(ptr_a[x], ptr_b[x]);
-                int changed = (change > threshold);
+    return 0;
+}
 
-                if(changed) {
-                    pixels_changed_on_slice += 255;
-                }
+/**
+ * Compare the luma rows of whole block rows, keeping the sum of each block.
+ */
+static uint64_t diff_blocks(FrameChangeContext *s, ThreadData *td, int jobnr, int nb_jobs)
+{
+    const AVFrame *a = td->current, *b = td->previous, *out = td->show_frame;
+    const int bs = s->block_size;
+    const int by_start = (s->nb_blocks_h *  jobnr   ) / nb_jobs;
+    const int by_end   = (s->nb_blocks_h * (jobnr+1)) / nb_jobs;
+    uint64_t pixels_changed = 0;
+    int bx, by;
+
+    for (by = by_start; by < by_end; by++) {
+        const int y = by * bs;
+        const int h = FFMIN(bs, s->planeheight[0] - y);
+
+        for (bx = 0; bx < s->nb_blocks_w; bx++) {
+            const int x = bx * bs;
+            const int w = FFMIN(bs, s->planewidth[0] - x);
+            uint64_t block_changed;
+
+            block_changed = s->diff_plane(a->data[0] + y * a->linesize[0] + x, a->linesize[0],
+                                          b->data[0] + y * b->linesize[0] + x, b->linesize[0],
+                                          out ? out->data[0] + y * out->linesize[0] + x : NULL,
+                                          out ? out->linesize[0] : 0,
+                                          w, h, s->threshold);
+
+            s->block_changed[by * s->nb_blocks_w + bx] = block_changed;
+            pixels_changed += block_changed;
+        }
+    }
 
-                if(show) {
-                    ptr_a[x] = changed ? 255 : 0;
-                }
-            }
+    return pixels_changed;
+}
 
-            ptr_a += stride;
-            ptr_b += stride;
+static int filter_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FrameChangeContext *s = ctx->priv;
+    ThreadData *td = arg;
+    int p;
+
+    for (p = 0; p < s->nb_planes; p++) {
+        const int height = s->planeheight[p];
+        const int slice_start = (height *  jobnr   ) / nb_jobs;
+        const int slice_end   = (height * (jobnr+1)) / nb_jobs;
+        const AVFrame *a = td->current, *b = td->previous, *out = td->show_frame;
+        uint64_t pixels_changed_on_slice;
+
+        if (!(s->planes & (1 << p)))
+            continue;
+
+        if (!p && s->block_size) {
+            pixels_changed_on_slice = diff_blocks(s, td, jobnr, nb_jobs);
+            atomic_fetch_add_explicit(&td->atomic_pixels_changed[p], pixels_changed_on_slice, memory_order_relaxed);
+            continue;
         }
 
-    }else if(count_mode == COUNT_MODE_PERCENTAGE) {
+        if (slice_start == slice_end)
+            continue;
 
-        for (y = slice_start; y < slice_end; y++) {
-            for (x = 0; x < width; x++) {
-                int change = ABSDIFF(ptr_a[x], ptr_b[x]);
-                int changed = (change > threshold);
+        pixels_changed_on_slice = s->diff_plane(a->data[p] + slice_start * a->linesize[p], a->linesize[p],
+                                                b->data[p] + slice_start * b->linesize[p], b->linesize[p],
+                                                out ? out->data[p] + slice_start * out->linesize[p] : NULL,
+                                                out ? out->linesize[p] : 0,
+                                                s->planewidth[p], slice_end - slice_start,
+                                                s->threshold);
 
-                if(changed) {
-                    pixels_changed_on_slice += change;
-                }
+        atomic_fetch_add_explicit(&td->atomic_pixels_changed[p], pixels_changed_on_slice, memory_order_relaxed);
+    }
 
-                if(show) {
-                    ptr_a[x] = changed ? change : 0;
-                }
-            }
+    return 0;
+}
 
-            ptr_a += stride;
-            ptr_b += stride;
-        }
+static void set_meta(AVDictionary **metadata, const char *key, char comp, double d)
+{
+    char value[128];
+    snprintf(value, sizeof(value), "%f", d);
+    if (comp) {
+        char key2[128];
+        snprintf(key2, sizeof(key2), "%s.%c", key, comp);
+        av_dict_set(metadata, key2, value, 0);
+    } else {
+        av_dict_set(metadata, key, value, 0);
     }
+}
 
-    atomic_fetch_add_explicit(&td->atomic_pixels_changed, pixels_changed_on_slice, memory_order_relaxed);
+/**
+ * Export the changed blocks, merging horizontally adjacent ones, as regions
+ * of interest, replacing any existing ones.
+ */
+static int export_roi(FrameChangeContext *s, AVFrame *frame, const uint8_t *changed)
+{
+    const int bs = s->block_size;
+    AVFrameSideData *sd;
+    AVRegionOfInterest *roi;
+    int nb_roi = 0, bx, by;
+
+    for (by = 0; by < s->nb_blocks_h; by++)
+        for (bx = 0; bx < s->nb_blocks_w; bx++)
+            nb_roi += changed[by * s->nb_blocks_w + bx] &&
+                      (!bx || !changed[by * s->nb_blocks_w + bx - 1]);
+
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    if (!nb_roi)
+        return 0;
+
+    sd = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                                nb_roi * sizeof(*roi));
+    if (!sd)
+        return AVERROR(ENOMEM);
+    roi = (AVRegionOfInterest*)sd->data;
+
+    for (by = 0; by < s->nb_blocks_h; by++) {
+        for (bx = 0; bx < s->nb_blocks_w; bx++) {
+            int end;
+
+            if (!changed[by * s->nb_blocks_w + bx])
+                continue;
+            for (end = bx + 1; end < s->nb_blocks_w && changed[by * s->nb_blocks_w + end]; end++)
+                ;
+
+            *roi++ = (AVRegionOfInterest) {
+                .self_size = sizeof(*roi),
+                .top       = by * bs,
+                .bottom    = FFMIN((by + 1) * bs, s->planeheight[0]),
+                .left      = bx * bs,
+                .right     = FFMIN(end * bs, s->planewidth[0]),
+                .qoffset   = s->roi_qoffset,
+            };
+            bx = end;
+        }
+    }
 
     return 0;
 }
 
+/**
+ * Classify the blocks of the last compared frame and export the result.
+ */
+static int export_blocks(FrameChangeContext *s, AVFrame *frame)
+{
+    const int nb_blocks = s->nb_blocks_w * s->nb_blocks_h;
+    uint8_t *changed = NULL;
+    int nb_changed = 0, i, ret = 0;
+
+    if (s->roi) {
+        changed = av_malloc(nb_blocks);
+        if (!changed)
+            return AVERROR(ENOMEM);
+    }
+
+    for (i = 0; i < nb_blocks; i++) {
+        const int bx = i % s->nb_blocks_w, by = i / s->nb_blocks_w;
+        const int w  = FFMIN(s->block_size, s->planewidth[0]  - bx * s->block_size);
+        const int h  = FFMIN(s->block_size, s->planeheight[0] - by * s->block_size);
+        const int is_changed = s->block_changed[i] / 255.0 / (w * h) > s->block_threshold;
+
+        nb_changed += is_changed;
+        if (changed)
+            changed[i] = is_changed;
+    }
+
+    set_meta(&frame->metadata, "lavfi.framechange.blocks_changed", 0, (double)nb_changed / nb_blocks);
+
+    if (changed)
+        ret = export_roi(s, frame, changed);
+    av_free(changed);
+
+    return ret;
+}
+
 static int filter_frame(AVFilterLink *inlink, AVFrame *in)
 {
     AVFilterContext *ctx = inlink->dst;
     FrameChangeContext *framechange = ctx->priv;
     AVFilterLink *outlink = ctx->outputs[0];
+    AVFrame *out = in;
 
     unsigned int frame_nr = framechange->frame_nr ++;
     const int show = framechange->show;
 
-    // if we will mutate the in by showing changes
-    // make a copy for later use as previous frame
-    AVFrame* original_in = show ? ff_get_video_buffer(ctx->outputs[0], in->width, in->height) : NULL;
-    if(show){
-        av_frame_copy(original_in, in);
-    }
-
-    if(framechange->frame_prev) {
+    if (framechange->frame_prev &&
+        framechange->frame_prev->width  == in->width &&
+        framechange->frame_prev->height == in->height) {
 
         ThreadData td;
+        uint64_t pixels_changed = 0, nb_pixels = 0;
+        int p;
+
+        // the changes are written to a new frame, so that the input
+        // can be kept as previous frame without copying it; the planes
+        // that are not compared are shared with the input
+        if (show) {
+            out = ff_get_video_buffer_shared(outlink, in, framechange->planes);
+            if (!out) {
+                av_frame_free(&in);
+                return AVERROR(ENOMEM);
+            }
+        }
 
-        td.current  = in->data[0];
-        td.previous = framechange->frame_prev->data[0];
-
-        td.width = in->width;
-        td.height = in->height;
-        td.stride = in->linesize[0];
+        td.current    = in;
+        td.previous   = framechange->frame_prev;
+        td.show_frame = show ? out : NULL;
 
-        td.atomic_pixels_changed = 0;
+        for (p = 0; p < 4; p++)
+            atomic_init(&td.atomic_pixels_changed[p], 0);
         ctx->internal->execute(ctx, filter_slice, &td, NULL, FFMIN(in->height, ff_filter_get_nb_threads(ctx)));
         emms_c();
 
+        for (p = 0; p < framechange->nb_planes; p++) {
+            uint64_t plane_changed = atomic_load_explicit(&td.atomic_pixels_changed[p], memory_order_relaxed);
+            uint64_t plane_pixels  = (uint64_t)framechange->planewidth[p] * framechange->planeheight[p];
+
+            if (!(framechange->planes & (1 << p)))
+                continue;
+
+            set_meta(&out->metadata, "lavfi.framechange.change", framechange->comps[p],
+                     plane_changed / 255.0 / plane_pixels);
+            pixels_changed += plane_changed;
+            nb_pixels      += plane_pixels;
+        }
+        set_meta(&out->metadata, "lavfi.framechange.change", 0, pixels_changed / 255.0 / nb_pixels);
+
+        if (framechange->block_size) {
+            int ret = export_blocks(framechange, out);
+            if (ret < 0) {
+                if (out != in)
+                    av_frame_free(&out);
+                av_frame_free(&in);
+                return ret;
+            }
+        }
+
         av_log(framechange, AV_LOG_INFO, "frame: %d change: %f\n",
                frame_nr,
-               td.atomic_pixels_changed / 255.0 / (td.width * td.height)
+               pixels_changed / 255.0 / nb_pixels
         );
 
     }
 
-    if(framechange->frame_prev)
-        av_frame_free(&framechange->frame_prev);
+    av_frame_free(&framechange->frame_prev);
 
-    // if frame was altered, keep the original as previous
-    // else clone the in image
-    framechange->frame_prev = show ? original_in : av_frame_clone(in);
+    // keep a reference to the unaltered input as previous frame
+    if (out != in) {
+        framechange->frame_prev = in;
+    } else {
+        framechange->frame_prev = av_frame_clone(in);
+        if (!framechange->frame_prev) {
+            av_frame_free(&in);
+            return AVERROR(ENOMEM);
+        }
+    }
 
-    return ff_filter_frame(outlink, in);
+    return ff_filter_frame(outlink, out);
 }
 
 static av_cold void uninit(AVFilterContext *ctx)
@@ -230,6 +493,7 @@ static av_cold void uninit(AVFilterContext *ctx)
     FrameChangeContext *framechange = ctx->priv;
 
     av_frame_free(&framechange->frame_prev);
+    av_freep(&framechange->block_changed);
 }
 
 static const AVFilterPad framechange_inputs[] = {
@@ -35,6 +35,7 @@
 
 #define MAX_NB_THREADS 32
 #define NB_PLANES 4
+#define BATCH_SIZE 256 ///< pixels evaluated per av_expr_eval_batch() call
 
 enum InterpolationMethods {
     INTERP_NEAREST,
@@ -377,9 +378,11 @@ static int slice_geq_filter(AVFilterContext *ctx, void *arg, int jobnr, int nb_j
     const int linesize = td->linesize;
     const int slice_start = (height *  jobnr) / nb_jobs;
     const int slice_end = (height * (jobnr+1)) / nb_jobs;
-    int x, y;
+    int x, y, i, ret;
 
     double values[VAR_VARS_NB];
+    double xs[BATCH_SIZE], res[BATCH_SIZE];
+    const double *arrays[VAR_VARS_NB] = { [VAR_X] = xs };
     values[VAR_W] = geq->values[VAR_W];
     values[VAR_H] = geq->values[VAR_H];
     values[VAR_N] = geq->values[VAR_N];
@@ -387,26 +390,26 @@ static int slice_geq_filter(AVFilterContext *ctx, void *arg, int jobnr, int nb_j
     values[VAR_SH] = geq->values[VAR_SH];
     values[VAR_T] = geq->values[VAR_T];
 
-    if (geq->bps == 8) {
-        uint8_t *ptr = geq->dst + linesize * slice_start;
-        for (y = slice_start; y < slice_end; y++) {
-            values[VAR_Y] = y;
+    for (y = slice_start; y < slice_end; y++) {
+        uint8_t  *ptr   = geq->dst   + linesize * y;
+        uint16_t *ptr16 = geq->dst16 + (linesize/2) * y;
 
-            for (x = 0; x < width; x++) {
-                values[VAR_X] = x;
-                ptr[x] = av_expr_eval(geq->e[plane][jobnr], values, geq);
-            }
-            ptr += linesize;
-        }
-    } else {
-        uint16_t *ptr16 = geq->dst16 + (linesize/2) * slice_start;
-        for (y = slice_start; y < slice_end; y++) {
-            values[VAR_Y] = y;
-            for (x = 0; x < width; x++) {
-                values[VAR_X] = x;
-                ptr16[x] = av_expr_eval(geq->e[plane][jobnr], values, geq);
+        values[VAR_Y] = y;
+        for (x = 0; x < width; x += BATCH_SIZE) {
+            const int n = FFMIN(BATCH_SIZE, width - x);
+
+            for (i = 0; i < n; i++)
+                xs[i] = x + i;
+            ret = av_expr_eval_batch(geq->e[plane][jobnr], res, n, values, arrays, geq);
+            if (ret < 0)
+                return ret;
+            if (geq->bps == 8) {
+                for (i = 0; i < n; i++)
+                    ptr[x + i] = res[i];
+            } else {
+                for (i = 0; i < n; i++)
+                    ptr16[x + i] = res[i];
             }
-            ptr16 += linesize/2;
         }
     }
 
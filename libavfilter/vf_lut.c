@@ -61,6 +61,7 @@ enum var_name {
 typedef struct LutContext {
     const AVClass *class;
     uint16_t lut[4][256 * 256];  ///< lookup table for each component
+    uint16_t (*own_lut)[256 * 256]; ///< lut of this filter alone, when others are fused into it
     char   *comp_expr_str[4];
     AVExpr *comp_expr[4];
     int hsub, vsub;
@@ -108,6 +109,7 @@ static av_cold void uninit(AVFilterContext *ctx)
         s->comp_expr[i] = NULL;
         av_freep(&s->comp_expr_str[i]);
     }
+    av_freep(&s->own_lut);
 }
 
 #define YUV_FORMATS                                         \
@@ -220,6 +222,8 @@ static int config_props(AVFilterLink *inlink)
     int min[4], max[4];
     int val, color, ret;
 
+    av_freep(&s->own_lut);
+
     s->hsub = desc->log2_chroma_w;
     s->vsub = desc->log2_chroma_h;
 
@@ -524,18 +528,11 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
     LutContext *s = ctx->priv;
     AVFilterLink *outlink = ctx->outputs[0];
     AVFrame *out;
-    int direct = 0;
 
-    if (av_frame_is_writable(in)) {
-        direct = 1;
-        out = in;
-    } else {
-        out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
-        if (!out) {
-            av_frame_free(&in);
-            return AVERROR(ENOMEM);
-        }
-        av_frame_copy_props(out, in);
+    out = ff_get_video_output(inlink, outlink, in);
+    if (!out) {
+        av_frame_free(&in);
+        return AVERROR(ENOMEM);
     }
 
     if (s->is_rgb && s->is_16bit && !s->is_planar) {
@@ -560,7 +557,7 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
                                FFMIN(in->height, ff_filter_get_nb_threads(ctx)));
     }
 
-    if (!direct)
+    if (out != in)
         av_frame_free(&in);
 
     return ff_filter_frame(outlink, out);
@@ -577,11 +574,51 @@ static int process_command(AVFilterContext *ctx, const char *cmd, const char *ar
     return config_props(ctx->inputs[0]);
 }
 
+static int get_lut(AVFilterContext *ctx, uint16_t (*lut)[256 * 256])
+{
+    LutContext *s = ctx->priv;
+
+    memcpy(lut, s->lut, sizeof(s->lut));
+    return 1;
+}
+
+static int fuse(AVFilterContext *ctx, AVFilterContext *next)
+{
+    LutContext *s = ctx->priv;
+    uint16_t (*lut)[256 * 256];
+    int ret;
+
+    if (!next) {
+        if (s->own_lut)
+            memcpy(s->lut, s->own_lut, sizeof(s->lut));
+        av_freep(&s->own_lut);
+        return 0;
+    }
+
+    lut = av_malloc(sizeof(s->lut));
+    if (!lut)
+        return AVERROR(ENOMEM);
+    ret = next->filter->get_lut(next, lut);
+    if (ret > 0 && !s->own_lut) {
+        s->own_lut = av_memdup(s->lut, sizeof(s->lut));
+        if (!s->own_lut)
+            ret = AVERROR(ENOMEM);
+    }
+    if (ret > 0) {
+        for (int comp = 0; comp < 4; comp++)
+            for (int val = 0; val < FF_ARRAY_ELEMS(s->lut[comp]); val++)
+                s->lut[comp][val] = lut[comp][s->lut[comp][val]];
+    }
+    av_free(lut);
+    return ret;
+}
+
 static const AVFilterPad inputs[] = {
     { .name         = "default",
       .type         = AVMEDIA_TYPE_VIDEO,
       .filter_frame = filter_frame,
       .config_props = config_props,
+      .inplace      = 1,
     },
     { NULL }
 };
@@ -606,6 +643,8 @@ static const AVFilterPad outputs[] = {
         .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC |       \
                          AVFILTER_FLAG_SLICE_THREADS,                   \
         .process_command = process_command,                             \
+        .get_lut       = get_lut,                                       \
+        .fuse          = fuse,                                          \
     }
 
 #if CONFIG_LUT_FILTER
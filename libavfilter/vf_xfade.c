@@ -207,6 +207,8 @@ static const AVOption xfade_options[] = {
 
 AVFILTER_DEFINE_CLASS(xfade);
 
+#define BATCH_SIZE 256 ///< pixels evaluated per av_expr_eval_batch() call
+
 #define CUSTOM_TRANSITION(name, type, div)                                           \
 static void custom##name##_transition(AVFilterContext *ctx,                          \
                             const AVFrame *a, const AVFrame *b, AVFrame *out,        \
@@ -217,6 +219,10 @@ static void custom##name##_transition(AVFilterContext *ctx,
     const int height = slice_end - slice_start;                                      \
                                                                                      \
     double values[VAR_VARS_NB];                                                      \
+    double xs[BATCH_SIZE], as[BATCH_SIZE], bs[BATCH_SIZE], res[BATCH_SIZE];          \
+    const double *arrays[VAR_VARS_NB] = {                                            \
+        [VAR_X] = xs, [VAR_A] = as, [VAR_B] = bs,                                    \
+    };                                                                               \
     values[VAR_W] = out->width;                                                      \
     values[VAR_H] = out->height;                                                     \
     values[VAR_PROGRESS] = progress;                                                 \
@@ -230,11 +236,23 @@ static void custom##name##_transition(AVFilterContext *ctx,
                                                                                      \
         for (int y = 0; y < height; y++) {                                           \
             values[VAR_Y] = slice_start + y;                                         \
-            for (int x = 0; x < out->width; x++) {                                   \
-                values[VAR_X] = x;                                                   \
-                values[VAR_A] = xf0[x];                                              \
-                values[VAR_B] = xf1[x];                                              \
-                dst[x] = av_expr_eval(s->e, values, s);                              \
+            for (int x = 0; x < out->width; x += BATCH_SIZE) {                       \
+                const int n = FFMIN(BATCH_SIZE, out->width - x);                     \
+                int ret;                                                             \
+                                                                                     \
+                for (int i = 0; i < n; i++) {                                        \
+                    xs[i] = x + i;                                                   \
+                    as[i] = xf0[x + i];                                              \
+                    bs[i] = xf1[x + i];                                              \
+                }                                                                    \
+                ret = av_expr_eval_batch(s->e, res, n, values, arrays, s);           \
+                if (ret < 0) {                                                       \
+                    av_log(ctx, AV_LOG_ERROR, "Error evaluating expression: %s\n",   \
+                           av_err2str(ret));                                         \
+                    return;                                                          \
+                }                                                                    \
+                for (int i = 0; i < n; i++)                                          \
+                    dst[x + i] = res[i];                                             \
             }                                                                        \
                                                                                      \
             dst += out->linesize[p] / div;                                           \
@@ -27,12 +27,14 @@
 #include "../libavutil/opt.h"
 #include "../libavutil/avstring.h"
 #include "../libavutil/eval.h"
+#include "../libavutil/file.h"
 #include "../libavutil/pixdesc.h"
 #include "./drawutils.h"
 #include "./avfilter.h"
 #include "./formats.h"
 #include "./internal.h"
 #include "./video.h"
+#include "./framepool.h"
 #include "../libswscale/swscale.h"
 #include <stdio.h>
 #include <string.h>
@@ -52,6 +54,67 @@ enum var_name {
     VAR_VARS_NB
 };
 
+#define ZOOM_SCALER_CACHE_SIZE 8
+
+enum ZoomEngine {
+    ENGINE_SWS,
+    ENGINE_NATIVE
+};
+
+enum ZoomKernel {
+    KERNEL_POINT,
+    KERNEL_BILINEAR,
+    KERNEL_BICUBIC,
+    KERNEL_LANCZOS
+};
+
+// kernel radius in source samples when upscaling
+static const double kernel_support[] = {
+    [KERNEL_POINT]    = 0.5,
+    [KERNEL_BILINEAR] = 1,
+    [KERNEL_BICUBIC]  = 2,
+    [KERNEL_LANCZOS]  = 3,
+};
+
+/**
+ * One dimensional resampling filter of the native engine. Destination samples
+ * [start, end) are computed from source samples pos[i] .. pos[i] + taps - 1.
+ */
+typedef struct ZoomFilter {
+    int*            pos;
+    unsigned int    pos_size;
+    float*          coeffs;
+    unsigned int    coeffs_size;
+    int             taps;
+    int             start, end;
+} ZoomFilter;
+
+enum KeyframeInterp {
+    KEYFRAME_LINEAR,
+    KEYFRAME_CUBIC,
+    KEYFRAME_EASE
+};
+
+/**
+ * Keyframe as stored in the keyframes file, native endian doubles.
+ * Keyframes must be sorted by time.
+ */
+typedef struct ZoomKeyframe {
+    double t, x, y, z;
+} ZoomKeyframe;
+
+typedef struct ZoomThreadData {
+    AVFrame *in, *out;
+} ZoomThreadData;
+
+typedef struct ZoomScaler {
+    struct SwsContext *sws;
+    int     src_w, src_h, src_format;
+    int     dst_w, dst_h, dst_format;
+    int     flags;
+    int64_t last_used;
+} ZoomScaler;
+
 typedef struct ZoomContext {
     const AVClass *class;
 
@@ -63,7 +126,17 @@ typedef struct ZoomContext {
     unsigned long   schedule_size;
     unsigned long   schedule_index;
 
+    char*               keyframes_path;
+    uint8_t*            keyframes_map;
+    size_t              keyframes_map_size;
+    const ZoomKeyframe* keyframes;
+    size_t              nb_keyframes;
+    size_t              keyframe_index;
+    int                 keyframe_interp;
+
     double          zoom_max;
+    // quantization step of the zoom value, 0 to disable
+    double          zoom_step;
     // used for actual zoom
     double          zoom;
     // used to determine if we need to adjust the zoom when w/h are set & different than expected
@@ -71,6 +144,7 @@ typedef struct ZoomContext {
     double          x;
     double          y;
     int             interpolation;
+    int             engine;
     FFDrawColor     fillcolor;
 
     int             desiredWidth;
@@ -89,7 +163,20 @@ typedef struct ZoomContext {
     int     nb_components;
     double  var_values[VAR_VARS_NB];
 
-    struct SwsContext* sws;
+    ZoomScaler      scalers[ZOOM_SCALER_CACHE_SIZE];
+    int64_t         scaler_clock;
+    FFFramePool*    temp_pool;
+
+    // native engine
+    int             native;
+    int             kernel;
+    int             bytes_per_sample;
+    int             max_value;
+    int             nb_threads;
+    ZoomFilter      hfilter[4];
+    ZoomFilter      vfilter[4];
+    float*          tmp;
+    int             tmp_stride;
 
     int hsub, vsub;
 } ZoomContext;
@@ -110,8 +197,14 @@ enum {
 
 #define OFFSET(x) offsetof(ZoomContext, x)
 #define FLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_VIDEO_PARAM
+#define RFLAGS FLAGS|AV_OPT_FLAG_RUNTIME_PARAM
 static const AVOption zoom_options[] = {
     { "schedule",           "binary file of <double> xyzxyzxyz...", OFFSET(schedule_file_path), AV_OPT_TYPE_STRING, {.str=""},       CHAR_MIN, CHAR_MAX, FLAGS },
+    { "keyframes",          "binary file of <double> txyztxyz...",  OFFSET(keyframes_path), AV_OPT_TYPE_STRING, {.str=""},           CHAR_MIN, CHAR_MAX, RFLAGS },
+    { "keyframe_interp",    "set keyframe interpolation",           OFFSET(keyframe_interp),AV_OPT_TYPE_INT,    {.i64=KEYFRAME_LINEAR}, KEYFRAME_LINEAR, KEYFRAME_EASE, RFLAGS, "keyframe_interp"},
+      { "linear",                                             0,                        0,  AV_OPT_TYPE_CONST,  {.i64=KEYFRAME_LINEAR}, 0,                      0, RFLAGS, "keyframe_interp"},
+      { "cubic",                                              0,                        0,  AV_OPT_TYPE_CONST,  {.i64=KEYFRAME_CUBIC }, 0,                      0, RFLAGS, "keyframe_interp"},
+      { "ease",                                               0,                        0,  AV_OPT_TYPE_CONST,  {.i64=KEYFRAME_EASE  }, 0,                      0, RFLAGS, "keyframe_interp"},
     { "zoom",               "set zoom offset expression",           OFFSET(zoom_expr_str),  AV_OPT_TYPE_STRING, {.str="1"},          CHAR_MIN, CHAR_MAX, FLAGS },
     { "z",                  "set zoom offset expression",           OFFSET(zoom_expr_str),  AV_OPT_TYPE_STRING, {.str="1"},          CHAR_MIN, CHAR_MAX, FLAGS },
     { "x",                  "set x offset expression",              OFFSET(x_expr_str),     AV_OPT_TYPE_STRING, {.str="0.5"},        CHAR_MIN, CHAR_MAX, FLAGS },
@@ -121,6 +214,11 @@ static const AVOption zoom_options[] = {
     { "height",             "set desired height",                   OFFSET(desiredHeight),  AV_OPT_TYPE_INT   , {.i64=-1},           -1      ,   65536 , FLAGS },
     { "exact",              "set frame size is exact or div by 2",  OFFSET(exact),          AV_OPT_TYPE_BOOL  , {.i64=0},            0       ,   1     , FLAGS },
     { "fillcolor",          "set color for background",             OFFSET(fillcolor.rgba), AV_OPT_TYPE_COLOR,  {.str="black@0"},    CHAR_MIN, CHAR_MAX, FLAGS },
+    { "zoom_step",          "quantize zoom to reuse scalers",       OFFSET(zoom_step),      AV_OPT_TYPE_DOUBLE, {.dbl=0},            0       ,   1     , FLAGS },
+
+    { "engine",             "set the scaling engine",               OFFSET(engine),         AV_OPT_TYPE_INT,    {.i64=ENGINE_SWS},   ENGINE_SWS, ENGINE_NATIVE, FLAGS, "engine"},
+      { "sws",              "swscale, integer crop",                                    0,  AV_OPT_TYPE_CONST,  {.i64=ENGINE_SWS   }, 0,                        0, FLAGS, "engine"},
+      { "native",           "slice threaded resampler, sub-pixel crop",                 0,  AV_OPT_TYPE_CONST,  {.i64=ENGINE_NATIVE}, 0,                        0, FLAGS, "engine"},
 
     { "interpolation",      "enable interpolation when scaling",    OFFSET(interpolation),  AV_OPT_TYPE_INT,    {.i64=FAST_BILINEAR}, SWS_FAST_BILINEAR,   SPLINE, FLAGS, "interpolation"},
       { "fast_bilinear",                                      0,                        0,  AV_OPT_TYPE_CONST,  {.i64=FAST_BILINEAR}, 0,                        0, FLAGS, "interpolation"},
@@ -140,15 +238,200 @@ static const AVOption zoom_options[] = {
 
 AVFILTER_DEFINE_CLASS(zoom);
 
-static av_cold int init(AVFilterContext *ctx)
+/**
+ * Map the keyframes file and replace the current keyframes with it.
+ * The current keyframes are kept if the new file is invalid.
+ */
+static int load_keyframes(AVFilterContext *ctx)
 {
+    ZoomContext *zoom = ctx->priv;
+    const ZoomKeyframe *keyframes;
+    uint8_t *map = NULL;
+    size_t map_size = 0, nb_keyframes;
+    int ret;
+
+    if (!zoom->keyframes_path || !zoom->keyframes_path[0]) {
+        av_file_unmap(zoom->keyframes_map, zoom->keyframes_map_size);
+        zoom->keyframes_map      = NULL;
+        zoom->keyframes_map_size = 0;
+        zoom->keyframes          = NULL;
+        zoom->nb_keyframes       = 0;
+        return 0;
+    }
+
+    ret = av_file_map(zoom->keyframes_path, &map, &map_size, 0, ctx);
+    if (ret < 0) {
+        av_log(ctx, AV_LOG_ERROR, "Cannot map file '%s' for reading keyframes\n", zoom->keyframes_path);
+        return ret;
+    }
+
+    if (!map_size || map_size % sizeof(ZoomKeyframe)) {
+        av_log(ctx, AV_LOG_ERROR, "File '%s' size %zu is not a non zero multiple of %zu (<double> txyz)\n",
+               zoom->keyframes_path, map_size, sizeof(ZoomKeyframe));
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+
+    keyframes    = (const ZoomKeyframe *)map;
+    nb_keyframes = map_size / sizeof(ZoomKeyframe);
+
+    for (size_t i = 1; i < nb_keyframes; i++) {
+        if (!(keyframes[i].t >= keyframes[i - 1].t)) {
+            av_log(ctx, AV_LOG_ERROR, "File '%s' keyframe %zu at %f is not sorted by time\n",
+                   zoom->keyframes_path, i, keyframes[i].t);
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+    }
+
+    av_file_unmap(zoom->keyframes_map, zoom->keyframes_map_size);
+    zoom->keyframes_map      = map;
+    zoom->keyframes_map_size = map_size;
+    zoom->keyframes          = keyframes;
+    zoom->nb_keyframes       = nb_keyframes;
+    zoom->keyframe_index     = 0;
+
+    av_log(ctx, AV_LOG_VERBOSE, "loaded %zu keyframes from '%s'\n", nb_keyframes, zoom->keyframes_path);
+
     return 0;
+
+fail:
+    av_file_unmap(map, map_size);
+    return ret;
+}
+
+/**
+ * Find the keyframe at or before t. Playback is mostly sequential, so the
+ * previous position is checked before falling back to a binary search.
+ */
+static size_t find_keyframe(ZoomContext *zoom, double t)
+{
+    const ZoomKeyframe *k = zoom->keyframes;
+    size_t i = zoom->keyframe_index, lo = 0, hi = zoom->nb_keyframes - 1;
+
+    if (isnan(t))
+        return i;
+    if (k[i].t <= t && (i == hi || t < k[i + 1].t))
+        return i;
+    if (i < hi && k[i + 1].t <= t && (i + 1 == hi || t < k[i + 2].t))
+        return i + 1;
+
+    if (t < k[0].t)
+        return 0;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo + 1) / 2;
+        if (k[mid].t <= t)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/**
+ * Cubic Hermite tangent at keyframe i, in units per second.
+ */
+static void keyframe_tangent(const ZoomKeyframe *k, size_t nb, size_t i, double m[3])
+{
+    const ZoomKeyframe *a = &k[i > 0 ? i - 1 : i];
+    const ZoomKeyframe *b = &k[i + 1 < nb ? i + 1 : i];
+    const double dt = b->t - a->t;
+
+    m[0] = dt > 0 ? (b->x - a->x) / dt : 0;
+    m[1] = dt > 0 ? (b->y - a->y) / dt : 0;
+    m[2] = dt > 0 ? (b->z - a->z) / dt : 0;
+}
+
+static void interpolate_keyframes(ZoomContext *zoom, double t, double *x, double *y, double *z)
+{
+    const ZoomKeyframe *k = zoom->keyframes;
+    const size_t i = zoom->keyframe_index = find_keyframe(zoom, t);
+    const ZoomKeyframe *a = &k[i], *b;
+    double h, u;
+
+    if (i + 1 >= zoom->nb_keyframes || t <= a->t || isnan(t)) {
+        *x = a->x;
+        *y = a->y;
+        *z = a->z;
+        return;
+    }
+
+    b = &k[i + 1];
+    h = b->t - a->t;
+    u = (t - a->t) / h;
+
+    switch (zoom->keyframe_interp) {
+    case KEYFRAME_CUBIC: {
+        const double u2 = u * u, u3 = u2 * u;
+        const double h00 =  2 * u3 - 3 * u2 + 1;
+        const double h10 =      u3 - 2 * u2 + u;
+        const double h01 = -2 * u3 + 3 * u2;
+        const double h11 =      u3 -     u2;
+        double ma[3], mb[3];
+
+        keyframe_tangent(k, zoom->nb_keyframes, i,     ma);
+        keyframe_tangent(k, zoom->nb_keyframes, i + 1, mb);
+
+        *x = h00 * a->x + h10 * h * ma[0] + h01 * b->x + h11 * h * mb[0];
+        *y = h00 * a->y + h10 * h * ma[1] + h01 * b->y + h11 * h * mb[1];
+        *z = h00 * a->z + h10 * h * ma[2] + h01 * b->z + h11 * h * mb[2];
+        return;
+    }
+    case KEYFRAME_EASE:
+        u = u * u * (3 - 2 * u);
+        break;
+    }
+
+    *x = a->x + (b->x - a->x) * u;
+    *y = a->y + (b->y - a->y) * u;
+    *z = a->z + (b->z - a->z) * u;
+}
+
+static av_cold int init(AVFilterContext *ctx)
+{
+    return load_keyframes(ctx);
 }
 
 static int query_formats(AVFilterContext *ctx)
 {
     return ff_set_common_formats(ctx, ff_draw_supported_pixel_formats(0));
 }
+
+/**
+ * The native engine only handles formats where every component lives in its
+ * own plane with native endian 8 to 16 bit samples.
+ */
+static int native_supported(const AVPixFmtDescriptor *desc)
+{
+    const int bytes = (desc->comp[0].depth + 7) >> 3;
+
+    if (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL |
+                       AV_PIX_FMT_FLAG_HWACCEL   | AV_PIX_FMT_FLAG_FLOAT))
+        return 0;
+    if (bytes > 2 || (bytes == 2 && !!(desc->flags & AV_PIX_FMT_FLAG_BE) != HAVE_BIGENDIAN))
+        return 0;
+
+    for (int i = 0; i < desc->nb_components; i++) {
+        const AVComponentDescriptor *comp = &desc->comp[i];
+        if (comp->step != bytes || comp->offset || comp->shift ||
+            ((comp->depth + 7) >> 3) != bytes)
+            return 0;
+    }
+    return 1;
+}
+
+static int native_kernel(int interpolation)
+{
+    switch (interpolation) {
+    case POINT:         return KERNEL_POINT;
+    case FAST_BILINEAR:
+    case BILINEAR:      return KERNEL_BILINEAR;
+    case LANCZOS:
+    case SINC:          return KERNEL_LANCZOS;
+    default:            return KERNEL_BICUBIC;
+    }
+}
 static int config_props(AVFilterLink *inlink)
 {
     AVFilterContext *ctx = inlink->dst;
@@ -162,6 +445,26 @@ static int config_props(AVFilterLink *inlink)
     zoom->nb_planes = av_pix_fmt_count_planes(inlink->format);
     zoom->nb_components = zoom->desc->nb_components;
 
+    zoom->native = 0;
+    if (zoom->engine == ENGINE_NATIVE) {
+        if (!native_supported(zoom->desc)) {
+            av_log(ctx, AV_LOG_WARNING, "Pixel format %s is not supported by the native engine, using swscale\n",
+                   zoom->desc->name);
+        } else {
+            zoom->native           = 1;
+            zoom->kernel           = native_kernel(zoom->interpolation);
+            zoom->bytes_per_sample = (zoom->desc->comp[0].depth + 7) >> 3;
+            zoom->max_value        = (1 << zoom->desc->comp[0].depth) - 1;
+            zoom->nb_threads       = ff_filter_get_nb_threads(ctx);
+            zoom->tmp_stride       = FFALIGN(inlink->w, 16);
+
+            av_freep(&zoom->tmp);
+            zoom->tmp = av_malloc_array(zoom->nb_threads * zoom->tmp_stride, sizeof(*zoom->tmp));
+            if (!zoom->tmp)
+                return AVERROR(ENOMEM);
+        }
+    }
+
     ff_draw_init(&zoom->dc,  inlink->format,     FF_DRAW_PROCESS_ALPHA);
     ff_draw_color(&zoom->dc, &zoom->fillcolor,   zoom->fillcolor.rgba );
 
@@ -294,21 +597,32 @@ static int config_output(AVFilterLink *outlink)
     return 0;
 }
 
-static AVFrame* alloc_frame(enum AVPixelFormat pixfmt, int w, int h)
+static AVFrame* get_temp_frame(ZoomContext *zoom, enum AVPixelFormat pixfmt, int w, int h)
 {
-    AVFrame *frame = av_frame_alloc();
+    AVFrame *frame;
+    int pool_w = 0, pool_h = 0, pool_align;
+    enum AVPixelFormat pool_format = AV_PIX_FMT_NONE;
+
+    if (zoom->temp_pool)
+        ff_frame_pool_get_video_config(zoom->temp_pool, &pool_w, &pool_h, &pool_format, &pool_align);
+
+    // the pool only ever grows, smaller frames reuse the bigger buffers
+    if (!zoom->temp_pool || pool_format != pixfmt || pool_w < w || pool_h < h) {
+        ff_frame_pool_uninit(&zoom->temp_pool);
+        zoom->temp_pool = ff_frame_pool_video_init(av_buffer_allocz,
+                                                   FFMAX(w, pool_w), FFMAX(h, pool_h),
+                                                   pixfmt, 32);
+        if (!zoom->temp_pool)
+            return NULL;
+    }
+
+    frame = ff_frame_pool_get(zoom->temp_pool);
     if (!frame)
         return NULL;
 
-    frame->format = pixfmt;
     frame->width  = w;
     frame->height = h;
 
-    if (av_frame_get_buffer(frame, 32) < 0) {
-        av_frame_free(&frame);
-        return NULL;
-    }
-
     return frame;
 }
 
@@ -319,17 +633,37 @@ static inline int normalize_xy(double d, int chroma_sub)
   return (int)d & ~((1 << chroma_sub) - 1);
 }
 
-static int scale(const uint8_t* const* src, int src_w, int src_h, int* src_linesize, int src_format,
-                       uint8_t* const* dst, int dst_w, int dst_h, int* dst_linesize, int dst_format,
-                 int sws_flags) {
-
-    struct SwsContext *sws = sws_alloc_context();
-    int ret = 0;
+static struct SwsContext* get_scaler(ZoomContext *zoom,
+                                     int src_w, int src_h, int src_format,
+                                     int dst_w, int dst_h, int dst_format,
+                                     int sws_flags)
+{
+    ZoomScaler *slot = &zoom->scalers[0];
+    struct SwsContext *sws;
+
+    for (int i = 0; i < ZOOM_SCALER_CACHE_SIZE; i++) {
+        ZoomScaler *s = &zoom->scalers[i];
+
+        if (s->sws &&
+            s->src_w == src_w && s->src_h == src_h && s->src_format == src_format &&
+            s->dst_w == dst_w && s->dst_h == dst_h && s->dst_format == dst_format &&
+            s->flags == sws_flags) {
+            s->last_used = ++zoom->scaler_clock;
+            return s->sws;
+        }
 
-    if (!sws) {
-        return AVERROR(ENOMEM);
+        // pick an empty slot or evict the least recently used one
+        if (slot->sws && (!s->sws || s->last_used < slot->last_used))
+            slot = s;
     }
 
+    sws_freeContext(slot->sws);
+    slot->sws = NULL;
+
+    sws = sws_alloc_context();
+    if (!sws)
+        return NULL;
+
     av_opt_set_int(sws, "srcw", src_w, 0);
     av_opt_set_int(sws, "srch", src_h, 0);
     av_opt_set_int(sws, "src_format", src_format, 0);
@@ -339,15 +673,325 @@ static int scale(const uint8_t* const* src, int src_w, int src_h, int* src_lines
     if (sws_flags)
         av_opt_set_int(sws, "sws_flags", sws_flags, 0);
 
-    if ((ret = sws_init_context(sws, NULL, NULL)) < 0) {
-        return ret;
+    if (sws_init_context(sws, NULL, NULL) < 0) {
+        sws_freeContext(sws);
+        return NULL;
+    }
+
+    av_log(zoom, AV_LOG_DEBUG, "new scaler: %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
+
+    slot->sws        = sws;
+    slot->src_w      = src_w;
+    slot->src_h      = src_h;
+    slot->src_format = src_format;
+    slot->dst_w      = dst_w;
+    slot->dst_h      = dst_h;
+    slot->dst_format = dst_format;
+    slot->flags      = sws_flags;
+    slot->last_used  = ++zoom->scaler_clock;
+
+    return sws;
+}
+
+static int scale(ZoomContext *zoom,
+                 const uint8_t* const* src, int src_w, int src_h, int* src_linesize, int src_format,
+                       uint8_t* const* dst, int dst_w, int dst_h, int* dst_linesize, int dst_format,
+                 int sws_flags) {
+
+    struct SwsContext *sws = get_scaler(zoom,
+                                        src_w, src_h, src_format,
+                                        dst_w, dst_h, dst_format,
+                                        sws_flags);
+
+    if (!sws) {
+        return AVERROR(ENOMEM);
     }
 
     sws_scale(sws, src, src_linesize, 0, src_h, dst, dst_linesize);
 
-    sws_freeContext(sws);
+    return 0;
+}
 
-    return ret;
+static double kernel_weight(int kernel, double t)
+{
+    t = fabs(t);
+
+    switch (kernel) {
+    case KERNEL_POINT:
+        return t <= 0.5;
+    case KERNEL_BILINEAR:
+        return t < 1 ? 1 - t : 0;
+    case KERNEL_BICUBIC:
+        // Keys cubic, a = -0.5
+        if (t < 1)
+            return (1.5 * t - 2.5) * t * t + 1;
+        if (t < 2)
+            return ((-0.5 * t + 2.5) * t - 4) * t + 2;
+        return 0;
+    case KERNEL_LANCZOS:
+        if (t == 0)
+            return 1;
+        if (t < 3) {
+            const double pt = M_PI * t;
+            return 3 * sin(pt) * sin(pt / 3) / (pt * pt);
+        }
+        return 0;
+    }
+    return 0;
+}
+
+/**
+ * Build the filter that maps the source segment [src_pos, src_pos + src_size)
+ * onto the destination segment [dst_pos, dst_pos + dst_size), and computes the
+ * destination samples [dst_start, dst_end). Positions are fractional. Taps
+ * falling outside of the source are folded onto its edges.
+ */
+static int build_filter(ZoomContext *zoom, ZoomFilter *f,
+                        int dst_start, int dst_end, double dst_pos, double dst_size,
+                        int src_len, double src_pos, double src_size)
+{
+    const double scale    = src_size / dst_size;
+    const double fscale   = zoom->kernel == KERNEL_POINT ? 1 : FFMAX(scale, 1);
+    const double support  = kernel_support[zoom->kernel] * fscale;
+    const int    raw_taps = FFMAX((int)ceil(support) * 2, 1);
+    int n;
+
+    f->taps  = FFMIN(raw_taps, src_len);
+    f->start = dst_start;
+    f->end   = FFMAX(dst_end, dst_start);
+    n = f->end - f->start;
+
+    if (!n)
+        return 0;
+
+    av_fast_malloc(&f->pos, &f->pos_size, n * sizeof(*f->pos));
+    av_fast_malloc(&f->coeffs, &f->coeffs_size, n * f->taps * sizeof(*f->coeffs));
+    if (!f->pos || !f->coeffs)
+        return AVERROR(ENOMEM);
+
+    for (int i = 0; i < n; i++) {
+        const double center = src_pos + (f->start + i + 0.5 - dst_pos) * scale - 0.5;
+        const int    first  = (int)floor(center - support) + 1;
+        const int    pos    = av_clip(first, 0, src_len - f->taps);
+        float *coeffs = f->coeffs + i * f->taps;
+        double sum = 0;
+
+        memset(coeffs, 0, f->taps * sizeof(*coeffs));
+
+        for (int j = 0; j < raw_taps; j++) {
+            const int    idx = av_clip(first + j, 0, src_len - 1);
+            const double w   = kernel_weight(zoom->kernel, (first + j - center) / fscale);
+
+            coeffs[idx - pos] += w;
+            sum += w;
+        }
+
+        for (int j = 0; j < f->taps; j++)
+            coeffs[j] /= sum;
+
+        f->pos[i] = pos;
+    }
+
+    return 0;
+}
+
+#define DEFINE_RESAMPLE_ROW(name, type)                                             \
+static void name(const ZoomFilter *hf, const ZoomFilter *vf, int y,                 \
+                 const uint8_t *src, int src_linesize,                              \
+                 uint8_t *dst, int dst_linesize,                                    \
+                 float *tmp, int max_value)                                         \
+{                                                                                   \
+    const int    vi    = y - vf->start;                                             \
+    const int    vpos  = vf->pos[vi];                                               \
+    const float *vc    = vf->coeffs + vi * vf->taps;                                \
+    const int    x_min = hf->pos[0];                                                \
+    const int    x_max = hf->pos[hf->end - hf->start - 1] + hf->taps;               \
+    type *out = (type *)(dst + y * dst_linesize);                                   \
+                                                                                    \
+    /* vertical pass over the source columns the row needs */                      \
+    {                                                                               \
+        const type *in = (const type *)(src + vpos * src_linesize);                 \
+        for (int x = x_min; x < x_max; x++)                                         \
+            tmp[x] = vc[0] * in[x];                                                 \
+    }                                                                               \
+    for (int k = 1; k < vf->taps; k++) {                                            \
+        const type *in = (const type *)(src + (vpos + k) * src_linesize);           \
+        const float c  = vc[k];                                                     \
+        for (int x = x_min; x < x_max; x++)                                         \
+            tmp[x] += c * in[x];                                                    \
+    }                                                                               \
+                                                                                    \
+    /* horizontal pass */                                                           \
+    for (int x = hf->start; x < hf->end; x++) {                                     \
+        const int    i  = x - hf->start;                                            \
+        const float *hc = hf->coeffs + i * hf->taps;                                \
+        const float *t  = tmp + hf->pos[i];                                         \
+        float sum = 0;                                                              \
+                                                                                    \
+        for (int k = 0; k < hf->taps; k++)                                          \
+            sum += hc[k] * t[k];                                                    \
+                                                                                    \
+        out[x] = av_clip((int)(sum + 0.5f), 0, max_value);                          \
+    }                                                                               \
+}
+
+DEFINE_RESAMPLE_ROW(resample_row8,  uint8_t)
+DEFINE_RESAMPLE_ROW(resample_row16, uint16_t)
+
+static int resample_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ZoomContext *zoom = ctx->priv;
+    ZoomThreadData *td = arg;
+    float *tmp = zoom->tmp + jobnr * zoom->tmp_stride;
+
+    for (int p = 0; p < zoom->nb_planes; p++) {
+        const ZoomFilter *hf = &zoom->hfilter[p];
+        const ZoomFilter *vf = &zoom->vfilter[p];
+        const int rows        = vf->end - vf->start;
+        const int slice_start = vf->start + (rows *  jobnr     ) / nb_jobs;
+        const int slice_end   = vf->start + (rows * (jobnr + 1)) / nb_jobs;
+
+        if (hf->end <= hf->start)
+            continue;
+
+        for (int y = slice_start; y < slice_end; y++) {
+            if (zoom->bytes_per_sample == 1)
+                resample_row8(hf, vf, y, td->in->data[p], td->in->linesize[p],
+                              td->out->data[p], td->out->linesize[p], tmp, zoom->max_value);
+            else
+                resample_row16(hf, vf, y, td->in->data[p], td->in->linesize[p],
+                               td->out->data[p], td->out->linesize[p], tmp, zoom->max_value);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Fill the background of out around the rectangle the picture is drawn to
+ * afterwards, rather than the whole frame. The rectangle is in luma
+ * samples; an empty one fills everything.
+ */
+static void fill_around(ZoomContext *zoom, AVFrame *out, int x, int y, int w, int h)
+{
+    int x1, y1;
+
+    x = av_clip(x, 0, out->width);
+    y = av_clip(y, 0, out->height);
+    x1 = av_clip(x + w, x, out->width);
+    y1 = av_clip(y + h, y, out->height);
+
+    /* Shrink the rectangle to whole chroma samples, so that the strips
+     * leave no subsampled sample uncovered at its edges. */
+    if (x1 < out->width)
+        x1 &= ~((1 << zoom->dc.hsub_max) - 1);
+    if (y1 < out->height)
+        y1 &= ~((1 << zoom->dc.vsub_max) - 1);
+    x = FFALIGN(x, 1 << zoom->dc.hsub_max);
+    y = FFALIGN(y, 1 << zoom->dc.vsub_max);
+    w = x1 - x;
+    h = y1 - y;
+
+    if (w <= 0 || h <= 0) {
+        ff_fill_rectangle(&zoom->dc, &zoom->fillcolor, out->data, out->linesize,
+                          0, 0, out->width, out->height);
+        return;
+    }
+    if (y > 0)
+        ff_fill_rectangle(&zoom->dc, &zoom->fillcolor, out->data, out->linesize,
+                          0, 0, out->width, y);
+    if (y + h < out->height)
+        ff_fill_rectangle(&zoom->dc, &zoom->fillcolor, out->data, out->linesize,
+                          0, y + h, out->width, out->height - y - h);
+    if (x > 0)
+        ff_fill_rectangle(&zoom->dc, &zoom->fillcolor, out->data, out->linesize,
+                          0, y, x, h);
+    if (x + w < out->width)
+        ff_fill_rectangle(&zoom->dc, &zoom->fillcolor, out->data, out->linesize,
+                          x + w, y, out->width - x - w, h);
+}
+
+/**
+ * Zoom with the native engine. Unlike the swscale path the source crop and
+ * the destination placement are not snapped to the chroma grid, so slow pans
+ * and zooms move smoothly.
+ */
+static int zoom_native(AVFilterContext *ctx, AVFrame *in, AVFrame *out)
+{
+    ZoomContext *zoom = ctx->priv;
+    ZoomThreadData td = { .in = in, .out = out };
+    // source and destination rectangles, in luma samples
+    double sx, sy, sw, sh;
+    double dx, dy, dw, dh;
+    // luma samples whose center falls in the destination rectangle
+    int x0, y0, x1, y1;
+    int ret;
+
+    if (zoom->zoom >= 1) {
+        sw = in->width  / zoom->zoom;
+        sh = in->height / zoom->zoom;
+        if (sw / sh < zoom->outAspectRatio)
+            sh = sw / zoom->outAspectRatio;
+        else
+            sw = sh * zoom->outAspectRatio;
+
+        sx = av_clipd(in->width  * zoom->x - sw / 2, 0, FFMAX(in->width  - sw, 0));
+        sy = av_clipd(in->height * zoom->y - sh / 2, 0, FFMAX(in->height - sh, 0));
+
+        dx = dy = 0;
+        dw = out->width;
+        dh = out->height;
+    } else {
+        sx = sy = 0;
+        sw = in->width;
+        sh = in->height;
+
+        dw = in->width  * zoom->zoom * zoom->shadowZoom;
+        dh = in->height * zoom->zoom * zoom->shadowZoom;
+
+        dx = dw <= out->width  ? av_clipd(out->width  * zoom->x - dw / 2, 0, out->width  - dw) :
+                                 (out->width  - dw) * zoom->x;
+        dy = dh <= out->height ? av_clipd(out->height * zoom->y - dh / 2, 0, out->height - dh) :
+                                 (out->height - dh) * zoom->y;
+    }
+
+    if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) {
+        fill_around(zoom, out, 0, 0, 0, 0);
+        return 0;
+    }
+
+    av_log(zoom, AV_LOG_DEBUG, "native: %.3fx%.3f+%.3f+%.3f -> %.3fx%.3f+%.3f+%.3f\n",
+           sw, sh, sx, sy, dw, dh, dx, dy);
+
+    x0 = av_clip((int)ceil(dx - 0.5), 0, out->width);
+    y0 = av_clip((int)ceil(dy - 0.5), 0, out->height);
+    x1 = av_clip((int)ceil(dx + dw - 0.5), x0, out->width);
+    y1 = av_clip((int)ceil(dy + dh - 0.5), y0, out->height);
+
+    /* The subsampled planes cover every chroma sample overlapping these luma
+     * samples, including the last partial one of odd sizes. */
+    for (int p = 0; p < zoom->nb_planes; p++) {
+        const int hsub = (p == 1 || p == 2) ? zoom->hsub : 0;
+        const int vsub = (p == 1 || p == 2) ? zoom->vsub : 0;
+        const double hs = 1 << hsub;
+        const double vs = 1 << vsub;
+
+        if ((ret = build_filter(zoom, &zoom->hfilter[p],
+                                x0 >> hsub, AV_CEIL_RSHIFT(x1, hsub), dx / hs, dw / hs,
+                                AV_CEIL_RSHIFT(in->width,  hsub), sx / hs, sw / hs)) < 0 ||
+            (ret = build_filter(zoom, &zoom->vfilter[p],
+                                y0 >> vsub, AV_CEIL_RSHIFT(y1, vsub), dy / vs, dh / vs,
+                                AV_CEIL_RSHIFT(in->height, vsub), sy / vs, sh / vs)) < 0)
+            return ret;
+    }
+
+    if (zoom->zoom < 1)
+        fill_around(zoom, out, x0, y0, x1 - x0, y1 - y0);
+
+    ctx->internal->execute(ctx, resample_slice, &td, NULL,
+                           FFMIN(out->height, zoom->nb_threads));
+
+    return 0;
 }
 
 static int zoom_out(ZoomContext *zoom, AVFrame *in, AVFrame *out, AVFilterLink *outlink)
@@ -385,18 +1029,23 @@ static int zoom_out(ZoomContext *zoom, AVFrame *in, AVFrame *out, AVFilterLink *
     uint8_t out_chroma_h = out_f_desc->log2_chroma_h;
 
 
-    if(out_h <= 0 || out_w <= 0)
+    if(out_h <= 0 || out_w <= 0) {
+        fill_around(zoom, out, 0, 0, 0, 0);
         goto bypass;
+    }
 
     // todo there's surely a way to implement this without a temp frame
-    AVFrame* temp_frame = alloc_frame(out_f, out_w, out_h);
+    AVFrame* temp_frame = get_temp_frame(zoom, out_f, out_w, out_h);
+    if (!temp_frame)
+        return AVERROR(ENOMEM);
     av_log(zoom, AV_LOG_DEBUG, "zoom: %.6f y: %.3f\n", zoom->zoom);
     av_log(zoom, AV_LOG_DEBUG, "scaling: %dx%d -> %dx%d\n", in_w, in_h, out_w, out_h);
 
-    ret = scale((const uint8_t *const *)in->data, in_w, in_h, in->linesize, in_f,
+    ret = scale(zoom, (const uint8_t *const *)in->data, in_w, in_h, in->linesize, in_f,
                 temp_frame->data, out_w, out_h, temp_frame->linesize, out_f,
                 zoom->interpolation);
     if (ret < 0) {
+        av_frame_free(&temp_frame);
         goto error;
     }
 
@@ -442,6 +1091,9 @@ static int zoom_out(ZoomContext *zoom, AVFrame *in, AVFrame *out, AVFilterLink *
     for (int k = 0; temp_frame->data[k]; k++)
         input[k] = temp_frame->data[k] + py[k] * temp_frame->linesize[k] + px[k];
 
+    fill_around(zoom, out, FFMAX(dx, 0), FFMAX(dy, 0),
+                FFMIN(out_w, has_space_w ? fout_w - dx : fout_w),
+                FFMIN(out_h, has_space_h ? fout_h - dy : fout_h));
     ff_copy_rectangle2(&zoom->dc,
                        out->data, out->linesize,
                        (const uint8_t *const *)&input, temp_frame->linesize,
@@ -535,7 +1187,7 @@ static int zoom_in (ZoomContext *zoom, AVFrame *in, AVFrame *out, AVFilterLink *
     for (int k = 0; in->data[k]; k++)
         input[k] = in->data[k] + py[k] * in->linesize[k] + px[k];
 
-    ret = scale((const uint8_t *const *)&input, in_w, in_h, in->linesize, in_f,
+    ret = scale(zoom, (const uint8_t *const *)&input, in_w, in_h, in->linesize, in_f,
                 out->data, out_w, out_h, out->linesize, out_f,
                 zoom->interpolation);
     if (ret < 0) {
@@ -575,7 +1227,17 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
                             NAN :
                             in->pts * av_q2d(inlink->time_base);
 
-    if(zoom->schedule){
+    if(zoom->keyframes){
+      double x, y, z;
+
+      interpolate_keyframes(zoom, zoom->var_values[VAR_T], &x, &y, &z);
+
+      zoom->x = zoom->var_values[VAR_X] = x;
+      zoom->y = zoom->var_values[VAR_Y] = y;
+      zoom_val = zoom->zoom = zoom->var_values[VAR_Z] = zoom->var_values[VAR_ZOOM] = z;
+      av_log(zoom, AV_LOG_DEBUG, "keyframe index %zu x:%.3f y:%.3f z:%.3f\n", zoom->keyframe_index, zoom->x, zoom->y, zoom->zoom);
+
+    }else if(zoom->schedule){
       unsigned long offset = zoom->schedule_index * 3;
       zoom->schedule_index += 1;
 
@@ -614,14 +1276,18 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
 				av_log(zoom, AV_LOG_WARNING, "y position %.2f is out of range of [0-1]\n", zoom->y);
         zoom->y = av_clipd_c(zoom->y, 0, 1);
 		}
-    // copy in the background
-    ff_fill_rectangle(&zoom->dc, &zoom->fillcolor,
-                      out->data, out->linesize,
-                      0, 0,
-                      out_w, out_h);
-
+    // snap the zoom so that nearby values share the same scaler
+    if (zoom->zoom_step > 0) {
+        zoom_val = zoom->zoom = round(zoom->zoom / zoom->zoom_step) * zoom->zoom_step;
+    }
+    // the background is only filled where the picture does not cover the
+    // frame, by the zoom out paths and when there is nothing to draw
     // scale
-    if(zoom_val == 1 && zoom->shadowZoom == 1) {
+    if (zoom->native && zoom_val > 0) {
+        ret = zoom_native(ctx, in, out);
+        if(ret)
+            goto error;
+    } else if(zoom_val == 1 && zoom->shadowZoom == 1) {
         // it's 1 with no extra fancy zooming, just copy
         // the area that is in view
         ff_copy_rectangle2(&zoom->dc,
@@ -632,8 +1298,8 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
                            av_clip_c(in_h * zoom->y - out_h / 2.0, 0, in_h - out_h),
                            out_w, out_h);
     } else if (zoom_val <= 0) {
-        // if it's 0 or lower do nothing
-        // noop
+        // if it's 0 or lower only draw the background
+        fill_around(zoom, out, 0, 0, 0, 0);
     } else if (zoom_val < 1) {
         // zoom in (0, 1)
         ret = zoom_out(zoom, in, out, outlink);
@@ -664,6 +1330,46 @@ static av_cold void uninit(AVFilterContext *ctx)
     zoom->zoom_expr = NULL;
     if (zoom->schedule != NULL)
       av_free(zoom->schedule);
+    av_file_unmap(zoom->keyframes_map, zoom->keyframes_map_size);
+    zoom->keyframes_map = NULL;
+
+    for (int i = 0; i < ZOOM_SCALER_CACHE_SIZE; i++) {
+        sws_freeContext(zoom->scalers[i].sws);
+        zoom->scalers[i].sws = NULL;
+    }
+    ff_frame_pool_uninit(&zoom->temp_pool);
+
+    for (int i = 0; i < 4; i++) {
+        av_freep(&zoom->hfilter[i].pos);
+        av_freep(&zoom->hfilter[i].coeffs);
+        av_freep(&zoom->vfilter[i].pos);
+        av_freep(&zoom->vfilter[i].coeffs);
+    }
+    av_freep(&zoom->tmp);
+}
+
+static int process_command(AVFilterContext *ctx, const char *cmd, const char *args,
+                           char *res, int res_len, int flags)
+{
+    ZoomContext *zoom = ctx->priv;
+    const int is_keyframes = !strcmp(cmd, "keyframes");
+    char *old_path = NULL;
+    int ret;
+
+    // the option keeps naming the current keyframes if the new file is rejected
+    if (is_keyframes && zoom->keyframes_path &&
+        !(old_path = av_strdup(zoom->keyframes_path)))
+        return AVERROR(ENOMEM);
+
+    ret = ff_filter_process_command(ctx, cmd, args, res, res_len, flags);
+    if (ret >= 0 && is_keyframes && (ret = load_keyframes(ctx)) < 0) {
+        av_freep(&zoom->keyframes_path);
+        zoom->keyframes_path = old_path;
+        old_path = NULL;
+    }
+
+    av_free(old_path);
+    return ret < 0 ? ret : 0;
 }
 
 static const AVFilterPad zoom_inputs[] = {
@@ -695,5 +1401,6 @@ AVFilter ff_vf_zoom = {
     .inputs        = zoom_inputs,
     .outputs       = zoom_outputs,
     .priv_class    = &zoom_class,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .process_command = process_command,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
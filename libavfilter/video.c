@@ -28,6 +28,7 @@
 #include "libavutil/hwcontext.h"
 #include "libavutil/imgutils.h"
 #include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
 
 #include "avfilter.h"
 #include "internal.h"
@@ -41,6 +42,15 @@ AVFrame *ff_null_get_video_buffer(AVFilterLink *link, int w, int h)
     return ff_get_video_buffer(link->dst->outputs[0], w, h);
 }
 
+static FFFramePool *video_pool_init(AVFilterLink *link, int w, int h)
+{
+    FFBufferPoolSet *set = link->graph ? link->graph->internal->buffer_pools : NULL;
+
+    if (set)
+        return ff_frame_pool_video_init_shared(set, w, h, link->format, BUFFER_ALIGN);
+    return ff_frame_pool_video_init(av_buffer_allocz, w, h, link->format, BUFFER_ALIGN);
+}
+
 AVFrame *ff_default_get_video_buffer(AVFilterLink *link, int w, int h)
 {
     AVFrame *frame = NULL;
@@ -65,8 +75,7 @@ AVFrame *ff_default_get_video_buffer(AVFilterLink *link, int w, int h)
     }
 
     if (!link->frame_pool) {
-        link->frame_pool = ff_frame_pool_video_init(av_buffer_allocz, w, h,
-                                                    link->format, BUFFER_ALIGN);
+        link->frame_pool = video_pool_init(link, w, h);
         if (!link->frame_pool)
             return NULL;
     } else {
@@ -80,8 +89,7 @@ AVFrame *ff_default_get_video_buffer(AVFilterLink *link, int w, int h)
             pool_format != link->format || pool_align != BUFFER_ALIGN) {
 
             ff_frame_pool_uninit((FFFramePool **)&link->frame_pool);
-            link->frame_pool = ff_frame_pool_video_init(av_buffer_allocz, w, h,
-                                                        link->format, BUFFER_ALIGN);
+            link->frame_pool = video_pool_init(link, w, h);
             if (!link->frame_pool)
                 return NULL;
         }
@@ -110,3 +118,91 @@ AVFrame *ff_get_video_buffer(AVFilterLink *link, int w, int h)
 
     return ret;
 }
+
+AVFrame *ff_get_video_output(AVFilterLink *inlink, AVFilterLink *outlink, AVFrame *in)
+{
+    AVFrame *out;
+
+    if (inlink->dstpad->inplace && av_frame_is_writable(in) &&
+        in->format == outlink->format &&
+        in->width  == outlink->w && in->height == outlink->h) {
+        inlink->dst->internal->copies_avoided++;
+        return in;
+    }
+
+    out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+    if (!out)
+        return NULL;
+    if (av_frame_copy_props(out, in) < 0) {
+        av_frame_free(&out);
+        return NULL;
+    }
+    return out;
+}
+
+/* index of the buffer of frame holding the data of plane, if no other plane uses it */
+static int plane_buffer_index(AVFrame *frame, int plane)
+{
+    AVBufferRef *buf = av_frame_get_plane_buffer(frame, plane);
+
+    if (!buf)
+        return -1;
+    for (int p = 0; p < FF_ARRAY_ELEMS(frame->data) && frame->data[p]; p++)
+        if (p != plane && av_frame_get_plane_buffer(frame, p) == buf)
+            return -1;
+    for (int i = 0; i < FF_ARRAY_ELEMS(frame->buf); i++)
+        if (frame->buf[i] == buf)
+            return i;
+    return -1;
+}
+
+AVFrame *ff_get_video_buffer_shared(AVFilterLink *link, AVFrame *in, int write_planes)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(link->format);
+    int nb_planes = av_pix_fmt_count_planes(link->format);
+    AVFrame *out = ff_get_video_buffer(link, link->w, link->h);
+
+    if (!out)
+        return NULL;
+    if (av_frame_copy_props(out, in) < 0)
+        goto fail;
+
+    for (int p = 0; p < nb_planes; p++) {
+        const int hsub = p == 1 || p == 2 ? desc->log2_chroma_w : 0;
+        const int vsub = p == 1 || p == 2 ? desc->log2_chroma_h : 0;
+        AVBufferRef *buf = av_frame_get_plane_buffer(in, p);
+        int idx;
+
+        if (write_planes & (1 << p))
+            continue;
+
+        if (buf && (idx = plane_buffer_index(out, p)) >= 0) {
+            int shared = 0, last = idx;
+
+            /* a buffer holding several planes is referenced only once */
+            for (int i = 0; i < FF_ARRAY_ELEMS(out->buf) && out->buf[i]; i++) {
+                shared |= i != idx && out->buf[i]->buffer == buf->buffer;
+                last    = i;
+            }
+            av_buffer_unref(&out->buf[idx]);
+            if (shared) {
+                FFSWAP(AVBufferRef *, out->buf[idx], out->buf[last]);
+            } else if (!(out->buf[idx] = av_buffer_ref(buf))) {
+                goto fail;
+            }
+            out->data[p]      = in->data[p];
+            out->linesize[p]  = in->linesize[p];
+            link->src->internal->copies_avoided++;
+        } else {
+            av_image_copy_plane(out->data[p], out->linesize[p],
+                                in->data[p], in->linesize[p],
+                                av_image_get_linesize(link->format, AV_CEIL_RSHIFT(link->w, hsub), p),
+                                AV_CEIL_RSHIFT(link->h, vsub));
+        }
+    }
+    return out;
+
+fail:
+    av_frame_free(&out);
+    return NULL;
+}
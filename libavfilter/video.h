@@ -38,4 +38,37 @@ AVFrame *ff_null_get_video_buffer(AVFilterLink *link, int w, int h);
  */
 AVFrame *ff_get_video_buffer(AVFilterLink *link, int w, int h);
 
+/**
+ * Get the frame to write the result of processing a frame to.
+ *
+ * If the input pad allows it (AVFilterPad.inplace) and the input frame is
+ * writable and has the format and size of the output link, the input frame
+ * itself is returned, to be overwritten. Otherwise a new buffer holding the
+ * properties of the input frame is returned, and the input is left
+ * untouched.
+ *
+ * @param inlink   the link the frame was received on
+ * @param outlink  the link the result will be sent on
+ * @param in       the received frame
+ * @return the frame to write to, NULL on allocation failure
+ */
+AVFrame *ff_get_video_output(AVFilterLink *inlink, AVFilterLink *outlink, AVFrame *in);
+
+/**
+ * Get a new frame for a link holding the properties of another frame, in
+ * which the planes that are not to be written share the data of the frame.
+ *
+ * A whole frame is got from the buffer pool of the link. For each of the
+ * other planes, the buffer of the new frame is replaced by a reference to
+ * the buffer holding the plane in the other frame, which is therefore
+ * read-only. The plane is copied instead if the new frame does not hold it
+ * in a buffer of its own, e.g. when all the planes are in one buffer.
+ *
+ * @param link          the output link to allocate the frame for
+ * @param in            a frame with the format and size of link
+ * @param write_planes  bitmask of the planes the caller will write
+ * @return the new frame, NULL on allocation failure
+ */
+AVFrame *ff_get_video_buffer_shared(AVFilterLink *link, AVFrame *in, int write_planes);
+
 #endif /* AVFILTER_VIDEO_H */
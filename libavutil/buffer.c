@@ -26,16 +26,11 @@
 #include "mem.h"
 #include "thread.h"
 
-AVBufferRef *av_buffer_create(uint8_t *data, buffer_size_t size,
-                              void (*free)(void *opaque, uint8_t *data),
-                              void *opaque, int flags)
+static AVBufferRef *buffer_create(AVBuffer *buf, uint8_t *data, buffer_size_t size,
+                                  void (*free)(void *opaque, uint8_t *data),
+                                  void *opaque, int flags)
 {
     AVBufferRef *ref = NULL;
-    AVBuffer    *buf = NULL;
-
-    buf = av_mallocz(sizeof(*buf));
-    if (!buf)
-        return NULL;
 
     buf->data     = data;
     buf->size     = size;
@@ -47,10 +42,8 @@ AVBufferRef *av_buffer_create(uint8_t *data, buffer_size_t size,
     buf->flags = flags;
 
     ref = av_mallocz(sizeof(*ref));
-    if (!ref) {
-        av_freep(&buf);
+    if (!ref)
         return NULL;
-    }
 
     ref->buffer = buf;
     ref->data   = data;
@@ -59,6 +52,23 @@ AVBufferRef *av_buffer_create(uint8_t *data, buffer_size_t size,
     return ref;
 }
 
+AVBufferRef *av_buffer_create(uint8_t *data, buffer_size_t size,
+                              void (*free)(void *opaque, uint8_t *data),
+                              void *opaque, int flags)
+{
+    AVBufferRef *ret;
+    AVBuffer *buf = av_mallocz(sizeof(*buf));
+    if (!buf)
+        return NULL;
+
+    ret = buffer_create(buf, data, size, free, opaque, flags);
+    if (!ret) {
+        av_free(buf);
+        return NULL;
+    }
+    return ret;
+}
+
 void av_buffer_default_free(void *opaque, uint8_t *data)
 {
     av_free(data);
@@ -117,8 +127,12 @@ static void buffer_replace(AVBufferRef **dst, AVBufferRef **src)
         av_freep(dst);
 
     if (atomic_fetch_sub_explicit(&b->refcount, 1, memory_order_acq_rel) == 1) {
+        /* b->free below might already free the structure containing *b,
+         * so we have to read the flag now to avoid use-after-free. */
+        int free_avbuffer = !(b->flags_internal & BUFFER_FLAG_NO_FREE);
         b->free(b->opaque, b->data);
-        av_freep(&b);
+        if (free_avbuffer)
+            av_free(b);
     }
 }
 
@@ -259,6 +273,7 @@ AVBufferPool *av_buffer_pool_init2(buffer_size_t size, void *opaque,
     pool->pool_free = pool_free;
 
     atomic_init(&pool->refcount, 1);
+    atomic_init(&pool->head, 0);
 
     return pool;
 }
@@ -275,18 +290,56 @@ AVBufferPool *av_buffer_pool_init(buffer_size_t size, AVBufferRef* (*alloc)(buff
     pool->alloc    = alloc ? alloc : av_buffer_alloc;
 
     atomic_init(&pool->refcount, 1);
+    atomic_init(&pool->head, 0);
 
     return pool;
 }
 
+static BufferPoolEntry *pool_entry(AVBufferPool *pool, uintptr_t index)
+{
+    uintptr_t i = index - 1;
+    int k = av_log2((i >> POOL_CHUNK_BITS) + 1);
+    return &pool->entries[k][i - (((uintptr_t)1 << k) - 1) * POOL_CHUNK_SIZE];
+}
+
+static void pool_push(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    uintptr_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+    uintptr_t new_head;
+
+    do {
+        atomic_store_explicit(&buf->next, head & POOL_INDEX_MASK, memory_order_relaxed);
+        new_head = ((head + POOL_INDEX_MASK + 1) & ~POOL_INDEX_MASK) | buf->index;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+static BufferPoolEntry *pool_pop(AVBufferPool *pool)
+{
+    uintptr_t head = atomic_load_explicit(&pool->head, memory_order_acquire);
+    uintptr_t new_head;
+    BufferPoolEntry *buf;
+
+    do {
+        if (!(head & POOL_INDEX_MASK))
+            return NULL;
+        buf      = pool_entry(pool, head & POOL_INDEX_MASK);
+        new_head = ((head + POOL_INDEX_MASK + 1) & ~POOL_INDEX_MASK) |
+                   atomic_load_explicit(&buf->next, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+    return buf;
+}
+
 static void buffer_pool_flush(AVBufferPool *pool)
 {
-    while (pool->pool) {
-        BufferPoolEntry *buf = pool->pool;
-        pool->pool = buf->next;
+    BufferPoolEntry *buf;
 
+    while ((buf = pool_pop(pool))) {
         buf->free(buf->opaque, buf->data);
-        av_freep(&buf);
+        buf->data = NULL;
     }
 }
 
@@ -302,6 +355,8 @@ static void buffer_pool_free(AVBufferPool *pool)
     if (pool->pool_free)
         pool->pool_free(pool->opaque);
 
+    for (int i = 0; i < FF_ARRAY_ELEMS(pool->entries); i++)
+        av_freep(&pool->entries[i]);
     av_freep(&pool);
 }
 
@@ -314,9 +369,7 @@ void av_buffer_pool_uninit(AVBufferPool **ppool)
     pool   = *ppool;
     *ppool = NULL;
 
-    ff_mutex_lock(&pool->mutex);
     buffer_pool_flush(pool);
-    ff_mutex_unlock(&pool->mutex);
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
@@ -330,15 +383,39 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
     if(CONFIG_MEMORY_POISONING)
         memset(buf->data, FF_MEMORY_POISON, pool->size);
 
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    if (buf->index) {
+        pool_push(pool, buf);
+    } else {
+        buf->free(buf->opaque, buf->data);
+        av_free(buf);
+    }
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
 }
 
+/* get a slot for a new entry, must be called with the pool mutex held */
+static BufferPoolEntry *pool_new_entry(AVBufferPool *pool)
+{
+    uintptr_t i = pool->nb_entries;
+    int k = av_log2((i >> POOL_CHUNK_BITS) + 1);
+    BufferPoolEntry *buf;
+
+    if (k >= FF_ARRAY_ELEMS(pool->entries))
+        return av_mallocz(sizeof(*buf));
+
+    if (!pool->entries[k]) {
+        pool->entries[k] = av_calloc((size_t)POOL_CHUNK_SIZE << k,
+                                     sizeof(*pool->entries[k]));
+        if (!pool->entries[k])
+            return NULL;
+    }
+
+    buf = pool_entry(pool, i + 1);
+    buf->index = ++pool->nb_entries;
+    return buf;
+}
+
 /* allocate a new buffer and override its free() callback so that
  * it is returned to the pool on free */
 static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
@@ -353,7 +430,7 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
     if (!ret)
         return NULL;
 
-    buf = av_mallocz(sizeof(*buf));
+    buf = pool_new_entry(pool);
     if (!buf) {
         av_buffer_unref(&ret);
         return NULL;
@@ -375,19 +452,20 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
     AVBufferRef *ret;
     BufferPoolEntry *buf;
 
-    ff_mutex_lock(&pool->mutex);
-    buf = pool->pool;
+    buf = pool_pop(pool);
     if (buf) {
-        ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
-                               buf, 0);
-        if (ret) {
-            pool->pool = buf->next;
-            buf->next = NULL;
-        }
+        memset(&buf->buffer, 0, sizeof(buf->buffer));
+        ret = buffer_create(&buf->buffer, buf->data, pool->size,
+                            pool_release_buffer, buf, 0);
+        if (ret)
+            buf->buffer.flags_internal |= BUFFER_FLAG_NO_FREE;
+        else
+            pool_push(pool, buf);
     } else {
+        ff_mutex_lock(&pool->mutex);
         ret = pool_alloc_buffer(pool);
+        ff_mutex_unlock(&pool->mutex);
     }
-    ff_mutex_unlock(&pool->mutex);
 
     if (ret)
         atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
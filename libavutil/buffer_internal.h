@@ -30,6 +30,11 @@
  * The buffer was av_realloc()ed, so it is reallocatable.
  */
 #define BUFFER_FLAG_REALLOCATABLE (1 << 0)
+/**
+ * The AVBuffer structure is part of a larger structure
+ * and should not be freed.
+ */
+#define BUFFER_FLAG_NO_FREE       (1 << 1)
 
 struct AVBuffer {
     uint8_t *data; /**< data described by this buffer */
@@ -72,12 +77,54 @@ typedef struct BufferPoolEntry {
     void (*free)(void *opaque, uint8_t *data);
 
     AVBufferPool *pool;
-    struct BufferPoolEntry *next;
+
+    /*
+     * Free list link: the 1-based index of the next free entry, 0 at the
+     * end of the list. Atomic since a pop may read it while another thread
+     * takes the same entry.
+     */
+    atomic_uintptr_t next;
+
+    /*
+     * 1-based index of this entry in AVBufferPool.entries, 0 if the pool ran
+     * out of indices and the entry was allocated on its own. Such entries
+     * are not recycled.
+     */
+    uintptr_t index;
+
+    /* Used to avoid allocating an AVBuffer on every av_buffer_pool_get() */
+    AVBuffer buffer;
 } BufferPoolEntry;
 
+/*
+ * Free list entries are addressed by index rather than by pointer, so that
+ * an index and an update counter fit together in the atomic list head.
+ * Entries live in chunks that are never moved, chunk k holding
+ * POOL_CHUNK_SIZE << k entries.
+ */
+#define POOL_INDEX_BITS (sizeof(uintptr_t) * 4)
+#define POOL_INDEX_MASK (((uintptr_t)1 << POOL_INDEX_BITS) - 1)
+#define POOL_CHUNK_BITS 4
+#define POOL_CHUNK_SIZE (1 << POOL_CHUNK_BITS)
+#define POOL_NB_CHUNKS  (POOL_INDEX_BITS - POOL_CHUNK_BITS)
+
 struct AVBufferPool {
+    /*
+     * Serializes the allocation of new buffers. Getting and releasing
+     * pooled buffers does not take it.
+     */
     AVMutex mutex;
-    BufferPoolEntry *pool;
+
+    /*
+     * Head of the free list, a lock-free stack. The low POOL_INDEX_BITS hold
+     * the 1-based index of the top entry (0 when empty) and the high bits a
+     * counter bumped on every update, so that a pop cannot succeed against
+     * a head that was popped and pushed back in the meantime.
+     */
+    atomic_uintptr_t head;
+
+    BufferPoolEntry *entries[POOL_NB_CHUNKS];
+    uintptr_t     nb_entries;
 
     /*
      * This is used to track when the pool is to be freed.
@@ -174,6 +174,11 @@ struct AVExpr {
     } a;
     struct AVExpr *param[3];
     double *var;
+    struct ExprInsn *code;  ///< compiled form of the expression, root only
+    int nb_code;
+    struct ExprInsn *batch_code; ///< compiled form for av_expr_eval_batch(), if possible
+    int nb_batch_code;
+    int nb_consts;          ///< highest constant index used + 1
 };
 
 static double etime(double v)
@@ -331,6 +336,430 @@ static double eval_expr(Parser *p, AVExpr *e)
     return NAN;
 }
 
+/*
+ * Parsed expressions are lowered into a flat list of instructions working on
+ * an array of registers, which is faster to run than walking the tree.
+ * A node is computed into the register given to it, and its parameters into
+ * the following ones, so the instructions only need to know their first
+ * register. Subtrees without any variable part are folded into values, and
+ * the nodes running loops or needing more registers than available are
+ * evaluated by calling eval_expr() on them.
+ *
+ * When possible, a second list is made for av_expr_eval_batch(), where each
+ * register holds BATCH_SIZE values and each instruction loops over them.
+ * It has no jumps, if() and ifnot() compute both branches and select, so it
+ * cannot be made for expressions with side effects or state, nor for
+ * branches calling the functions of the caller, which are only called for
+ * the values av_expr_eval() would call them with.
+ */
+
+#define MAX_REGS 32
+#define BATCH_SIZE 32
+
+enum ExprOp {
+    op_value = e_sgn + 1, op_tree, op_jz, op_jnz, op_jmp, op_scale,
+};
+
+typedef struct ExprInsn {
+    int op;         ///< one of the AVExpr types or ExprOp
+    int reg;        ///< register of the result, followed by the parameters
+    int arg;        ///< constant index or jump target
+    double value;
+    union {
+        double (*func0)(double);
+        double (*func1)(void *, double);
+        double (*func2)(void *, double, double);
+        AVExpr *tree;
+    } a;
+} ExprInsn;
+
+typedef struct Compiler {
+    Parser *p;
+    int batch;
+    ExprInsn *code;
+    int nb_code;
+    int size;
+} Compiler;
+
+/**
+ * Check if the expression is pure and does not depend on any constant.
+ */
+static int is_constant(AVExpr *e)
+{
+    int i;
+
+    if (!e)
+        return 1;
+    switch (e->type) {
+    case e_const:
+        return 0;
+    case e_func0:
+        if (e->a.func0 == etime)
+            return 0;
+        break;
+    case e_func1:
+    case e_func2:
+    case e_ld:
+    case e_st:
+    case e_random:
+    case e_while:
+    case e_print:
+        return 0;
+    }
+    for (i = 0; i < 3; i++)
+        if (!is_constant(e->param[i]))
+            return 0;
+    return 1;
+}
+
+/**
+ * Check if evaluating the expression changes the state of the evaluator,
+ * so that skipping or repeating its evaluation is not equivalent.
+ * Functions provided by the caller are assumed not to.
+ */
+static int has_side_effects(AVExpr *e)
+{
+    int i;
+
+    if (!e)
+        return 0;
+    if (e->type == e_st || e->type == e_random || e->type == e_print)
+        return 1;
+    for (i = 0; i < 3; i++)
+        if (has_side_effects(e->param[i]))
+            return 1;
+    return 0;
+}
+
+/**
+ * Check if the expression calls functions provided by the caller, which
+ * may not expect to be called for values whose result is not used.
+ */
+static int has_calls(AVExpr *e)
+{
+    int i;
+
+    if (!e)
+        return 0;
+    if (e->type == e_func1 || e->type == e_func2)
+        return 1;
+    for (i = 0; i < 3; i++)
+        if (has_calls(e->param[i]))
+            return 1;
+    return 0;
+}
+
+static ExprInsn *emit(Compiler *c, int op, int reg, double value)
+{
+    ExprInsn *insn;
+
+    if (c->nb_code == c->size) {
+        int size = c->size ? 2 * c->size : 16;
+        insn = av_realloc_array(c->code, size, sizeof(*insn));
+        if (!insn)
+            return NULL;
+        c->code = insn;
+        c->size = size;
+    }
+    insn = &c->code[c->nb_code++];
+    memset(insn, 0, sizeof(*insn));
+    insn->op    = op;
+    insn->reg   = reg;
+    insn->value = value;
+    return insn;
+}
+
+static int compile_expr(Compiler *c, AVExpr *e, int reg)
+{
+    ExprInsn *insn;
+    int nb_params, i, ret;
+
+    if (e->type != e_value && is_constant(e))
+        return emit(c, op_value, reg, eval_expr(c->p, e)) ? 0 : AVERROR(ENOMEM);
+
+    switch (e->type) {
+    case e_value:
+        return emit(c, op_value, reg, e->value) ? 0 : AVERROR(ENOMEM);
+    case e_const:
+        if (!(insn = emit(c, e_const, reg, e->value)))
+            return AVERROR(ENOMEM);
+        insn->arg = e->const_index;
+        return 0;
+    case e_if:
+    case e_ifnot: {
+        int jump, end;
+
+        if (c->batch) {
+            /* both branches are computed, keep calls to the taken one */
+            if (has_calls(e->param[1]) || has_calls(e->param[2]))
+                return AVERROR(ENOSYS);
+            break;
+        }
+        if ((ret = compile_expr(c, e->param[0], reg)) < 0)
+            return ret;
+        jump = c->nb_code;
+        if (!emit(c, e->type == e_if ? op_jz : op_jnz, reg, 0))
+            return AVERROR(ENOMEM);
+        if ((ret = compile_expr(c, e->param[1], reg)) < 0)
+            return ret;
+        end = c->nb_code;
+        if (!emit(c, op_jmp, reg, 0))
+            return AVERROR(ENOMEM);
+        c->code[jump].arg = c->nb_code;
+        if (e->param[2])
+            ret = compile_expr(c, e->param[2], reg);
+        else
+            ret = emit(c, op_value, reg, 0) ? 0 : AVERROR(ENOMEM);
+        if (ret < 0)
+            return ret;
+        c->code[end].arg = c->nb_code;
+        return emit(c, op_scale, reg, e->value) ? 0 : AVERROR(ENOMEM);
+    }
+    case e_func2:
+    case e_between:
+    case e_clip:
+    case e_sgn:
+        /* parameters evaluated in an unspecified order, conditionally or twice */
+        if (has_side_effects(e))
+            goto tree;
+        /* the upper bound of between() is only evaluated when needed */
+        if (e->type == e_between && has_calls(e->param[2]))
+            goto tree;
+        break;
+    case e_ld:
+    case e_st:
+    case e_random:
+        if (c->batch)
+            return AVERROR(ENOSYS);
+        break;
+    case e_while:
+    case e_taylor:
+    case e_root:
+    case e_print:
+        goto tree;
+    }
+
+    for (nb_params = 0; nb_params < 3 && e->param[nb_params]; nb_params++);
+    if (reg + nb_params > MAX_REGS)
+        goto tree;
+    for (i = 0; i < nb_params; i++)
+        if ((ret = compile_expr(c, e->param[i], reg + i)) < 0)
+            return ret;
+    if (!(insn = emit(c, e->type, reg, e->value)))
+        return AVERROR(ENOMEM);
+    insn->arg = nb_params;
+    switch (e->type) {
+    case e_func0: insn->a.func0 = e->a.func0; break;
+    case e_func1: insn->a.func1 = e->a.func1; break;
+    case e_func2: insn->a.func2 = e->a.func2; break;
+    }
+    return 0;
+
+tree:
+    if (c->batch)
+        return AVERROR(ENOSYS);
+    if (!(insn = emit(c, op_tree, reg, 1)))
+        return AVERROR(ENOMEM);
+    insn->a.tree = e;
+    return 0;
+}
+
+static double run_code(Parser *p, const ExprInsn *code, int nb_code)
+{
+    double regs[MAX_REGS];
+    int pc;
+
+    for (pc = 0; pc < nb_code; pc++) {
+        const ExprInsn *insn = &code[pc];
+        double *r = regs + insn->reg;
+        double v = insn->value;
+
+        switch (insn->op) {
+        case op_value:  r[0] = v; break;
+        case op_tree:   r[0] = eval_expr(p, insn->a.tree); break;
+        case op_jz:     if (!r[0]) pc = insn->arg - 1; break;
+        case op_jnz:    if ( r[0]) pc = insn->arg - 1; break;
+        case op_jmp:    pc = insn->arg - 1; break;
+        case op_scale:  r[0] = v * r[0]; break;
+        case e_const:   r[0] = v * p->const_values[insn->arg]; break;
+        case e_func0:   r[0] = v * insn->a.func0(r[0]); break;
+        case e_func1:   r[0] = v * insn->a.func1(p->opaque, r[0]); break;
+        case e_func2:   r[0] = v * insn->a.func2(p->opaque, r[0], r[1]); break;
+        case e_squish:  r[0] = 1/(1+exp(4*r[0])); break;
+        case e_gauss:   r[0] = exp(-r[0]*r[0]/2)/sqrt(2*M_PI); break;
+        case e_ld:      r[0] = v * p->var[av_clip(r[0], 0, VARS-1)]; break;
+        case e_isnan:   r[0] = v * !!isnan(r[0]); break;
+        case e_isinf:   r[0] = v * !!isinf(r[0]); break;
+        case e_floor:   r[0] = v * floor(r[0]); break;
+        case e_ceil:    r[0] = v * ceil (r[0]); break;
+        case e_trunc:   r[0] = v * trunc(r[0]); break;
+        case e_round:   r[0] = v * round(r[0]); break;
+        case e_sgn:     r[0] = v * FFDIFFSIGN(r[0], 0); break;
+        case e_sqrt:    r[0] = v * sqrt (r[0]); break;
+        case e_not:     r[0] = v * (r[0] == 0); break;
+        case e_random: {
+            int idx= av_clip(r[0], 0, VARS-1);
+            uint64_t x= isnan(p->var[idx]) ? 0 : p->var[idx];
+            x= x*1664525+1013904223;
+            p->var[idx]= x;
+            r[0] = v * (x * (1.0/UINT64_MAX));
+            break;
+        }
+        case e_clip:
+            if (isnan(r[1]) || isnan(r[2]) || isnan(r[0]) || r[1] > r[2])
+                r[0] = NAN;
+            else
+                r[0] = v * av_clipd(r[0], r[1], r[2]);
+            break;
+        case e_between: r[0] = v * (r[0] >= r[1] && r[0] <= r[2]); break;
+        case e_lerp:    r[0] = r[0] + (r[1] - r[0]) * r[2]; break;
+        case e_mod:     r[0] = v * (r[0] - floor(r[1] ? r[0] / r[1] : r[0] * INFINITY) * r[1]); break;
+        case e_gcd:     r[0] = v * av_gcd(r[0], r[1]); break;
+        case e_max:     r[0] = v * (r[0] >  r[1] ? r[0] : r[1]); break;
+        case e_min:     r[0] = v * (r[0] <  r[1] ? r[0] : r[1]); break;
+        case e_eq:      r[0] = v * (r[0] == r[1] ? 1.0 : 0.0); break;
+        case e_gt:      r[0] = v * (r[0] >  r[1] ? 1.0 : 0.0); break;
+        case e_gte:     r[0] = v * (r[0] >= r[1] ? 1.0 : 0.0); break;
+        case e_lt:      r[0] = v * (r[0] <  r[1] ? 1.0 : 0.0); break;
+        case e_lte:     r[0] = v * (r[0] <= r[1] ? 1.0 : 0.0); break;
+        case e_pow:     r[0] = v * pow(r[0], r[1]); break;
+        case e_mul:     r[0] = v * (r[0] * r[1]); break;
+        case e_div:     r[0] = v * (r[1] ? (r[0] / r[1]) : r[0] * INFINITY); break;
+        case e_add:     r[0] = v * (r[0] + r[1]); break;
+        case e_last:    r[0] = v * r[1]; break;
+        case e_st:      r[0] = v * (p->var[av_clip(r[0], 0, VARS-1)]= r[1]); break;
+        case e_hypot:   r[0] = v * hypot(r[0], r[1]); break;
+        case e_atan2:   r[0] = v * atan2(r[0], r[1]); break;
+        case e_bitand:  r[0] = isnan(r[0]) || isnan(r[1]) ? NAN : v * ((long int)r[0] & (long int)r[1]); break;
+        case e_bitor:   r[0] = isnan(r[0]) || isnan(r[1]) ? NAN : v * ((long int)r[0] | (long int)r[1]); break;
+        default:        r[0] = NAN; break;
+        }
+    }
+    return regs[0];
+}
+
+#define BATCH_OP(type, expr)            \
+    case type:                          \
+        for (j = 0; j < n; j++)         \
+            r0[j] = expr;               \
+        break;
+
+static void run_batch_code(Parser *p, const ExprInsn *code, int nb_code,
+                           double *dst, int offset, int n,
+                           const double * const *const_arrays)
+{
+    double regs[MAX_REGS + 2][BATCH_SIZE];
+    int pc, j;
+
+    for (pc = 0; pc < nb_code; pc++) {
+        const ExprInsn *insn = &code[pc];
+        double *r0 = regs[insn->reg], *r1 = regs[insn->reg + 1], *r2 = regs[insn->reg + 2];
+        double v = insn->value;
+
+        switch (insn->op) {
+        case e_const: {
+            const double *src = const_arrays ? const_arrays[insn->arg] : NULL;
+            if (src) {
+                for (j = 0; j < n; j++)
+                    r0[j] = v * src[offset + j];
+            } else {
+                double c = v * p->const_values[insn->arg];
+                for (j = 0; j < n; j++)
+                    r0[j] = c;
+            }
+            break;
+        }
+        case e_if:
+        case e_ifnot:
+            for (j = 0; j < n; j++)
+                r0[j] = v * ((insn->op == e_if ? r0[j] != 0 : r0[j] == 0) ? r1[j] :
+                             insn->arg > 2 ? r2[j] : 0);
+            break;
+        BATCH_OP(op_value, v)
+        BATCH_OP(e_func0,  v * insn->a.func0(r0[j]))
+        BATCH_OP(e_func1,  v * insn->a.func1(p->opaque, r0[j]))
+        BATCH_OP(e_func2,  v * insn->a.func2(p->opaque, r0[j], r1[j]))
+        BATCH_OP(e_squish, 1/(1+exp(4*r0[j])))
+        BATCH_OP(e_gauss,  exp(-r0[j]*r0[j]/2)/sqrt(2*M_PI))
+        BATCH_OP(e_isnan,  v * !!isnan(r0[j]))
+        BATCH_OP(e_isinf,  v * !!isinf(r0[j]))
+        BATCH_OP(e_floor,  v * floor(r0[j]))
+        BATCH_OP(e_ceil,   v * ceil (r0[j]))
+        BATCH_OP(e_trunc,  v * trunc(r0[j]))
+        BATCH_OP(e_round,  v * round(r0[j]))
+        BATCH_OP(e_sgn,    v * FFDIFFSIGN(r0[j], 0))
+        BATCH_OP(e_sqrt,   v * sqrt (r0[j]))
+        BATCH_OP(e_not,    v * (r0[j] == 0))
+        BATCH_OP(e_clip,   isnan(r1[j]) || isnan(r2[j]) || isnan(r0[j]) || r1[j] > r2[j] ? NAN :
+                           v * av_clipd(r0[j], r1[j], r2[j]))
+        BATCH_OP(e_between, v * (r0[j] >= r1[j] && r0[j] <= r2[j]))
+        BATCH_OP(e_lerp,   r0[j] + (r1[j] - r0[j]) * r2[j])
+        BATCH_OP(e_mod,    v * (r0[j] - floor(r1[j] ? r0[j] / r1[j] : r0[j] * INFINITY) * r1[j]))
+        BATCH_OP(e_gcd,    v * av_gcd(r0[j], r1[j]))
+        BATCH_OP(e_max,    v * (r0[j] >  r1[j] ? r0[j] : r1[j]))
+        BATCH_OP(e_min,    v * (r0[j] <  r1[j] ? r0[j] : r1[j]))
+        BATCH_OP(e_eq,     v * (r0[j] == r1[j] ? 1.0 : 0.0))
+        BATCH_OP(e_gt,     v * (r0[j] >  r1[j] ? 1.0 : 0.0))
+        BATCH_OP(e_gte,    v * (r0[j] >= r1[j] ? 1.0 : 0.0))
+        BATCH_OP(e_lt,     v * (r0[j] <  r1[j] ? 1.0 : 0.0))
+        BATCH_OP(e_lte,    v * (r0[j] <= r1[j] ? 1.0 : 0.0))
+        BATCH_OP(e_pow,    v * pow(r0[j], r1[j]))
+        BATCH_OP(e_mul,    v * (r0[j] * r1[j]))
+        BATCH_OP(e_div,    v * (r1[j] ? (r0[j] / r1[j]) : r0[j] * INFINITY))
+        BATCH_OP(e_add,    v * (r0[j] + r1[j]))
+        BATCH_OP(e_last,   v * r1[j])
+        BATCH_OP(e_hypot,  v * hypot(r0[j], r1[j]))
+        BATCH_OP(e_atan2,  v * atan2(r0[j], r1[j]))
+        BATCH_OP(e_bitand, isnan(r0[j]) || isnan(r1[j]) ? NAN : v * ((long int)r0[j] & (long int)r1[j]))
+        BATCH_OP(e_bitor,  isnan(r0[j]) || isnan(r1[j]) ? NAN : v * ((long int)r0[j] | (long int)r1[j]))
+        default:
+            for (j = 0; j < n; j++)
+                r0[j] = NAN;
+            break;
+        }
+    }
+    memcpy(dst, regs[0], n * sizeof(*dst));
+}
+
+static int count_consts(AVExpr *e)
+{
+    int i, nb = 0;
+
+    if (!e)
+        return 0;
+    if (e->type == e_const)
+        nb = e->const_index + 1;
+    for (i = 0; i < 3; i++) {
+        int nb_param = count_consts(e->param[i]);
+        nb = FFMAX(nb, nb_param);
+    }
+    return nb;
+}
+
+static int compile(AVExpr *e, Parser *p)
+{
+    Compiler c = { .p = p };
+    int ret = compile_expr(&c, e, 0);
+
+    if (ret < 0) {
+        av_free(c.code);
+        return ret;
+    }
+    e->code      = c.code;
+    e->nb_code   = c.nb_code;
+    e->nb_consts = count_consts(e);
+
+    c = (Compiler){ .p = p, .batch = 1 };
+    ret = compile_expr(&c, e, 0);
+    if (ret < 0) {
+        av_free(c.code);
+        return ret == AVERROR(ENOSYS) ? 0 : ret;
+    }
+    e->batch_code    = c.code;
+    e->nb_batch_code = c.nb_code;
+    return 0;
+}
+
 static int parse_expr(AVExpr **e, Parser *p);
 
 void av_expr_free(AVExpr *e)
@@ -340,6 +769,8 @@ void av_expr_free(AVExpr *e)
     av_expr_free(e->param[1]);
     av_expr_free(e->param[2]);
     av_freep(&e->var);
+    av_freep(&e->code);
+    av_freep(&e->batch_code);
     av_freep(&e);
 }
 
@@ -729,6 +1160,9 @@ int av_expr_parse(AVExpr **expr, const char *s,
         ret = AVERROR(ENOMEM);
         goto end;
     }
+    p.var = e->var;
+    if ((ret = compile(e, &p)) < 0)
+        goto end;
     *expr = e;
     e = NULL;
 end:
@@ -763,6 +1197,35 @@ int av_expr_count_func(AVExpr *e, unsigned *counter, int size, int arg)
     return expr_count(e, counter, size, ((int[]){e_const, e_func1, e_func2})[arg]);
 }
 
+int av_expr_is_pure(AVExpr *e)
+{
+    int i;
+
+    if (!e)
+        return 1;
+
+    switch (e->type) {
+    case e_func0:
+        if (e->a.func0 == etime)
+            return 0;
+        break;
+    case e_func1:
+    case e_func2:
+    case e_ld:
+    case e_st:
+    case e_random:
+    case e_while:
+    case e_print:
+        return 0;
+    }
+
+    for (i = 0; i < 3; i++)
+        if (!av_expr_is_pure(e->param[i]))
+            return 0;
+
+    return 1;
+}
+
 double av_expr_eval(AVExpr *e, const double *const_values, void *opaque)
 {
     Parser p = { 0 };
@@ -770,7 +1233,46 @@ double av_expr_eval(AVExpr *e, const double *const_values, void *opaque)
 
     p.const_values = const_values;
     p.opaque     = opaque;
-    return eval_expr(&p, e);
+    return run_code(&p, e->code, e->nb_code);
+}
+
+int av_expr_eval_batch(AVExpr *e, double *dst, int nb_values,
+                       const double *const_values,
+                       const double * const *const_arrays, void *opaque)
+{
+    Parser p = { 0 };
+    double buf[64], *values = buf;
+    int i, j;
+
+    p.var        = e->var;
+    p.opaque     = opaque;
+
+    if (e->batch_code) {
+        p.const_values = const_values;
+        for (i = 0; i < nb_values; i += BATCH_SIZE)
+            run_batch_code(&p, e->batch_code, e->nb_batch_code, dst + i, i,
+                           FFMIN(nb_values - i, BATCH_SIZE), const_arrays);
+        return 0;
+    }
+
+    /* evaluate the values one at a time, in order */
+    if (e->nb_consts > FF_ARRAY_ELEMS(buf)) {
+        values = av_malloc_array(e->nb_consts, sizeof(*values));
+        if (!values)
+            return AVERROR(ENOMEM);
+    }
+    if (e->nb_consts)
+        memcpy(values, const_values, e->nb_consts * sizeof(*values));
+    p.const_values = values;
+    for (i = 0; i < nb_values; i++) {
+        for (j = 0; const_arrays && j < e->nb_consts; j++)
+            if (const_arrays[j])
+                values[j] = const_arrays[j][i];
+        dst[i] = run_code(&p, e->code, e->nb_code);
+    }
+    if (values != buf)
+        av_free(values);
+    return 0;
 }
 
 int av_expr_parse_and_eval(double *d, const char *s,
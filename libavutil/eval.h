@@ -86,6 +86,30 @@ int av_expr_parse(AVExpr **expr, const char *s,
  */
 double av_expr_eval(AVExpr *e, const double *const_values, void *opaque);
 
+/**
+ * Evaluate a previously parsed expression for several values of some of the
+ * identifiers.
+ *
+ * The results are the same as calling av_expr_eval() nb_values times, the
+ * identifiers i for which const_arrays[i] is not NULL being set to
+ * const_arrays[i][n] for the n-th evaluation, but are computed several
+ * values at once when the expression allows it. The functions from funcs1
+ * and funcs2 are called with the same arguments as by av_expr_eval(), but
+ * not necessarily in the same order, so they must not depend on it.
+ *
+ * @param dst          array where the nb_values results are stored
+ * @param nb_values    number of evaluations
+ * @param const_values array of values for the identifiers from av_expr_parse()
+ *                     const_names, the ones set from const_arrays are ignored
+ * @param const_arrays NULL or array with an entry per identifier, either NULL
+ *                     or an array of nb_values values for the identifier
+ * @param opaque a pointer which will be passed to all functions from funcs1 and funcs2
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int av_expr_eval_batch(AVExpr *e, double *dst, int nb_values,
+                       const double *const_values,
+                       const double * const *const_arrays, void *opaque);
+
 /**
  * Track the presence of variables and their number of occurrences in a parsed expression
  *
@@ -110,6 +134,17 @@ int av_expr_count_vars(AVExpr *e, unsigned *counter, int size);
  */
 int av_expr_count_func(AVExpr *e, unsigned *counter, int size, int arg);
 
+/**
+ * Check if the result of a parsed expression only depends on the values of
+ * the constants it is evaluated with, so that it can be cached.
+ *
+ * Expressions using the internal variables (ld(), st(), random()), while(),
+ * print() or time(), or any user provided function, are not considered pure.
+ *
+ * @return 1 if the expression is pure, 0 otherwise
+ */
+int av_expr_is_pure(AVExpr *e);
+
 /**
  * Free a parsed expression previously created with av_expr_parse().
  */
@@ -0,0 +1,162 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Several threads getting and releasing buffers from the same AVBufferPool.
+ * Checks that no buffer is handed out twice and that the pool does not
+ * allocate more buffers than are ever in use at once.
+ *
+ * Usage: buffer_pool [threads [iterations]]
+ * When arguments are given, the time per get/release pair is printed, which
+ * makes this usable as a contention benchmark.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/internal.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#define MAX_THREADS 64
+#define HOLD        4  ///< buffers held by each thread at once
+#define BUF_SIZE    64
+
+typedef struct PoolStats {
+    atomic_int nb_allocated;
+    atomic_int nb_freed;
+} PoolStats;
+
+typedef struct ThreadContext {
+    AVBufferPool *pool;
+    int id;
+    int iterations;
+    int failed;
+} ThreadContext;
+
+static void buf_free(void *opaque, uint8_t *data)
+{
+    PoolStats *stats = opaque;
+    atomic_fetch_add(&stats->nb_freed, 1);
+    av_free(data);
+}
+
+static AVBufferRef *buf_alloc(void *opaque, buffer_size_t size)
+{
+    PoolStats *stats = opaque;
+    uint8_t *data = av_malloc(size);
+    AVBufferRef *ref;
+
+    if (!data)
+        return NULL;
+    ref = av_buffer_create(data, size, buf_free, stats, 0);
+    if (!ref) {
+        av_free(data);
+        return NULL;
+    }
+    atomic_fetch_add(&stats->nb_allocated, 1);
+    return ref;
+}
+
+static void *thread_main(void *arg)
+{
+    ThreadContext *t = arg;
+    AVBufferRef *bufs[HOLD];
+
+    for (int i = 0; i < t->iterations; i++) {
+        for (int j = 0; j < HOLD; j++) {
+            bufs[j] = av_buffer_pool_get(t->pool);
+            if (!bufs[j]) {
+                t->failed = 1;
+                return NULL;
+            }
+            AV_WN32(bufs[j]->data,     t->id);
+            AV_WN32(bufs[j]->data + 4, i * HOLD + j);
+        }
+        for (int j = 0; j < HOLD; j++) {
+            if (AV_RN32(bufs[j]->data)     != t->id ||
+                AV_RN32(bufs[j]->data + 4) != i * HOLD + j)
+                t->failed = 1;
+            av_buffer_unref(&bufs[j]);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    ThreadContext threads[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    PoolStats stats = { 0 };
+    AVBufferPool *pool;
+    int nb_threads = argc > 1 ? atoi(argv[1]) : 4;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20000;
+    int64_t t0, t1;
+    int ret = 0;
+
+    if (nb_threads < 1 || nb_threads > MAX_THREADS || iterations < 1) {
+        fprintf(stderr, "Usage: %s [threads (1-%d) [iterations]]\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    pool = av_buffer_pool_init2(BUF_SIZE, &stats, buf_alloc, NULL);
+    if (!pool)
+        return 1;
+
+    t0 = av_gettime_relative();
+    for (int i = 0; i < nb_threads; i++) {
+        threads[i] = (ThreadContext){ .pool = pool, .id = i,
+                                      .iterations = iterations };
+        if ((ret = pthread_create(&tids[i], NULL, thread_main, &threads[i]))) {
+            fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+            return 1;
+        }
+    }
+    for (int i = 0; i < nb_threads; i++) {
+        pthread_join(tids[i], NULL);
+        if (threads[i].failed) {
+            fprintf(stderr, "thread %d saw a corrupted buffer\n", i);
+            ret = 2;
+        }
+    }
+    t1 = av_gettime_relative();
+
+    if (atomic_load(&stats.nb_allocated) > nb_threads * HOLD) {
+        fprintf(stderr, "%d buffers allocated for at most %d in use\n",
+                atomic_load(&stats.nb_allocated), nb_threads * HOLD);
+        ret = 3;
+    }
+
+    av_buffer_pool_uninit(&pool);
+    if (atomic_load(&stats.nb_freed) != atomic_load(&stats.nb_allocated)) {
+        fprintf(stderr, "%d buffers allocated, %d freed\n",
+                atomic_load(&stats.nb_allocated), atomic_load(&stats.nb_freed));
+        ret = 4;
+    }
+
+    if (argc > 1)
+        printf("%d threads: %.1f ns per get/unref\n", nb_threads,
+               (t1 - t0) * 1000.0 / ((int64_t)nb_threads * iterations * HOLD));
+
+    return ret;
+}
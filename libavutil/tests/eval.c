@@ -22,8 +22,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "libavutil/common.h"
 #include "libavutil/libm.h"
-#include "libavutil/eval.h"
+#include "libavutil/eval.c"
 
 static const double const_values[] = {
     M_PI,
@@ -37,6 +38,118 @@ static const char *const const_names[] = {
     0
 };
 
+static const char *const batch_const_names[] = { "X", "Y", NULL };
+static const char *const func1_names[] = { "f", NULL };
+static const char *const func2_names[] = { "g", NULL };
+static int nb_calls;
+
+static double func1(void *opaque, double x)
+{
+    nb_calls++;
+    return 2 * x;
+}
+
+static double func2(void *opaque, double x, double y)
+{
+    nb_calls++;
+    return x - y;
+}
+
+static double (* const funcs1[])(void *, double) = { func1, NULL };
+static double (* const funcs2[])(void *, double, double) = { func2, NULL };
+
+/**
+ * Evaluate an expression for a range of X with av_expr_eval_batch() and
+ * with av_expr_eval(), and check that both give the same values and call
+ * the user functions as many times.
+ */
+static void test_batch(const char *s)
+{
+    double xs[40], batch[40], values[2] = { 0, 7 };
+    const double *arrays[2] = { xs, NULL };
+    int batch_calls, i, ret, ok = 1;
+    AVExpr *e;
+
+    ret = av_expr_parse(&e, s, batch_const_names, func1_names, funcs1,
+                        func2_names, funcs2, 0, NULL);
+    if (ret < 0) {
+        printf("'%s' failed to parse\n", s);
+        return;
+    }
+    for (i = 0; i < FF_ARRAY_ELEMS(xs); i++)
+        xs[i] = i - 10;
+
+    nb_calls = 0;
+    ret = av_expr_eval_batch(e, batch, FF_ARRAY_ELEMS(xs), values, arrays, NULL);
+    batch_calls = nb_calls;
+
+    nb_calls = 0;
+    for (i = 0; i < FF_ARRAY_ELEMS(xs); i++) {
+        double d;
+        values[0] = xs[i];
+        d = av_expr_eval(e, values, NULL);
+        if (d != batch[i] && !(isnan(d) && isnan(batch[i])))
+            ok = 0;
+    }
+    printf("'%s' batch: %s, %d calls%s\n", s, ret < 0 ? "failed" :
+           ok ? "same values" : "different values", nb_calls,
+           batch_calls == nb_calls ? "" : ", different number of calls");
+    av_expr_free(e);
+}
+
+static double eval_tree(AVExpr *e, const double *const_values)
+{
+    Parser p = { 0 };
+
+    p.var          = e->var;
+    p.const_values = const_values;
+    return eval_expr(&p, e);
+}
+
+/**
+ * Evaluate an expression for a range of X with av_expr_eval(), which runs
+ * its compiled instructions, and by walking its tree, and check that both
+ * give the same values and leave the variables in the same state.
+ */
+static void test_compiled(const char *name, const char *s)
+{
+    double values[2] = { 0, 7 }, vars[VARS];
+    int nb_jumps = 0, nb_trees = 0, nb_values = 0, i, ret, ok = 1;
+    AVExpr *e;
+
+    ret = av_expr_parse(&e, s, batch_const_names, func1_names, funcs1,
+                        func2_names, funcs2, 0, NULL);
+    if (ret < 0) {
+        printf("'%s' failed to parse\n", name);
+        return;
+    }
+    for (i = 0; i < e->nb_code; i++) {
+        nb_jumps  += e->code[i].op == op_jz || e->code[i].op == op_jnz ||
+                     e->code[i].op == op_jmp;
+        nb_trees  += e->code[i].op == op_tree;
+        nb_values += e->code[i].op == op_value;
+    }
+
+    for (i = 0; i < 40; i++) {
+        double compiled, tree, compiled_vars[VARS];
+
+        /* both start from the variables left by the previous tree walk */
+        values[0] = i - 10;
+        memcpy(vars, e->var, sizeof(vars));
+        compiled = av_expr_eval(e, values, NULL);
+        memcpy(compiled_vars, e->var, sizeof(compiled_vars));
+        memcpy(e->var, vars, sizeof(vars));
+        tree = eval_tree(e, values);
+        if ((compiled != tree && !(isnan(compiled) && isnan(tree))) ||
+            memcmp(compiled_vars, e->var, sizeof(vars)))
+            ok = 0;
+    }
+    printf("'%s' compiled: %s, %d instructions, %d jumps, %d trees, %d values\n",
+           name, ok ? "same values" : "different values",
+           e->nb_code, nb_jumps, nb_trees, nb_values);
+    av_expr_free(e);
+}
+
 int main(int argc, char **argv)
 {
     int i;
@@ -168,6 +281,39 @@ int main(int argc, char **argv)
     if (ret < 0)
         printf("av_expr_parse_and_eval failed\n");
 
+    test_batch("X*Y+1");
+    test_batch("if(gt(X,4),X/2,Y-X)");
+    test_batch("ifnot(X,1/X,sqrt(X))");
+    test_batch("clip(X,-2,3)+between(X,Y,9)");
+    test_batch("if(gt(X,4),f(X),X)");
+    test_batch("ifnot(lt(X,3),X,g(X,Y))");
+    test_batch("between(X,2,f(X))");
+    test_batch("f(X)+g(Y,X)");
+    test_batch("st(0,X);ld(0)*2");
+
+    test_compiled("if", "if(gt(X,4),X/2,Y-X)");
+    test_compiled("ifnot", "ifnot(X,1/X,sqrt(X))+if(lt(X,0),X)");
+    test_compiled("nested if", "if(X,ifnot(gt(X,Y),-X,if(eq(X,9),1,2)),Y)");
+    test_compiled("folded", "X*(2+3*4)+sin(1)*exp(2)-max(4,Y)");
+    test_compiled("ld st", "st(1,ld(1)+X);ld(1)*Y+ld(2)");
+    test_compiled("random", "random(2)*X");
+    test_compiled("while", "st(0,X);while(lt(ld(0),20),st(0,ld(0)+3))");
+    test_compiled("taylor", "taylor(1,X/10)");
+    test_compiled("root", "root(ld(0)-X*X/100,10)");
+    test_compiled("side effects", "between(X,st(3,ld(3)+1),9)+ld(3)");
+    test_compiled("calls", "if(gt(X,4),f(X),g(X,Y))");
+    {
+        char deep[512] = "";
+
+        /* each nesting uses one more register than MAX_REGS allows */
+        for (i = 0; i < 40; i++)
+            av_strlcat(deep, "X*(1+", sizeof(deep));
+        av_strlcat(deep, "Y", sizeof(deep));
+        for (i = 0; i < 40; i++)
+            av_strlcat(deep, ")", sizeof(deep));
+        test_compiled("deep", deep);
+    }
+
     if (argc > 1 && !strcmp(argv[1], "-t")) {
         for (i = 0; i < 1050; i++) {
             START_TIMER;
@@ -172,6 +172,11 @@ fmtstdout(){
     ffmpeg -bitexact "$@" -f $fmt -
 }
 
+progress_json(){
+    # the keys of the last report, with the objects and arrays holding them
+    ffmpeg -progress_json pipe:1 "$@" -f null - | tail -n 1 | sed -e 's/:[^],{}[]*//g'
+}
+
 enc_dec_pcm(){
     out_fmt=$1
     dec_fmt=$2
@@ -41,6 +41,43 @@ fate-ffmpeg-filter_colorkey: CMD = framecrc -auto_conversion_filters -idct simpl
 FATE_FFMPEG-$(CONFIG_COLOR_FILTER) += fate-ffmpeg-lavfi
 fate-ffmpeg-lavfi: CMD = framecrc -lavfi color=d=1:r=5 -fflags +bitexact
 
+# the branches of the split run in parallel
+FATE_FFMPEG-$(call ALLYES, TESTSRC2_FILTER SPLIT_FILTER HFLIP_FILTER CROP_FILTER) += fate-ffmpeg-parallel-filters-split
+fate-ffmpeg-parallel-filters-split: CMD = framecrc -parallel_filters 1 -filter_complex_threads 2 -filter_complex "testsrc2=d=1:r=5:s=64x48,split[a][b];[a]hflip[o1];[b]crop=32:24[o2]" -map "[o1]" -map "[o2]"
+
+# the frames of the input are filtered for both outputs in parallel
+FATE_FFMPEG-$(call ALLYES, TESTSRC2_FILTER HFLIP_FILTER CROP_FILTER LAVFI_INDEV FRAMECRC_MUXER) += fate-ffmpeg-parallel-filters-outputs
+fate-ffmpeg-parallel-filters-outputs: CMD = ffmpeg -parallel_filters 1 -f lavfi -i testsrc2=d=1:r=5:s=64x48 -map 0:v -vf hflip -bitexact -f framecrc - -map 0:v -vf crop=32:24 -bitexact -f framecrc -
+
+# the keys of the last -progress_json report
+FATE_FFMPEG-$(call ALLYES, TESTSRC2_FILTER HFLIP_FILTER LAVFI_INDEV NULL_MUXER) += fate-ffmpeg-progress-json
+fate-ffmpeg-progress-json: CMD = progress_json -f lavfi -i testsrc2=d=1:r=5:s=64x48 -vf hflip
+
+# the counters of the output streams are read while the output threads run
+FATE_FFMPEG-$(call ALLYES, TESTSRC2_FILTER HFLIP_FILTER LAVFI_INDEV NULL_MUXER) += fate-ffmpeg-progress-json-threads
+fate-ffmpeg-progress-json-threads: CMD = progress_json -f lavfi -i testsrc2=d=1:r=5:s=64x48 -vf hflip -thread_queue_size 8
+fate-ffmpeg-progress-json-threads: REF = $(SRC_PATH)/tests/ref/fate/ffmpeg-progress-json
+
+tests/data/reinit-sizes-00.png: TAG = GEN
+tests/data/reinit-sizes-00.png: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i testsrc=s=64x48:r=5:d=0.6 -flags +bitexact -start_number 0 \
+        -y $(TARGET_PATH)/tests/data/reinit-sizes-%02d.png 2>/dev/null; \
+        $(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i testsrc=s=32x24:r=5:d=0.6 -flags +bitexact -start_number 3 \
+        -y $(TARGET_PATH)/tests/data/reinit-sizes-%02d.png 2>/dev/null
+
+# the frames of the second size are scaled to the first one, and framestep
+# keeps counting across the change; -cpuflags 0 makes the scaling bitexact
+FATE_FFMPEG-$(call ALLYES, TESTSRC_FILTER LAVFI_INDEV PNG_ENCODER IMAGE2_MUXER IMAGE2_DEMUXER PNG_DECODER SCALE_FILTER FORMAT_FILTER FRAMESTEP_FILTER) += fate-ffmpeg-reinit-filter-convert
+fate-ffmpeg-reinit-filter-convert: tests/data/reinit-sizes-00.png
+fate-ffmpeg-reinit-filter-convert: CMD = framecrc -cpuflags 0 -reinit_filter 2 -framerate 5 -i $(TARGET_PATH)/tests/data/reinit-sizes-%02d.png -vf framestep=2
+
+FATE_FFMPEG_JOBS-$(call ALLYES, COLOR_FILTER LAVFI_INDEV FRAMECRC_MUXER) += fate-ffmpeg-jobs
+fate-ffmpeg-jobs: tests/data/jobs/two-outputs
+fate-ffmpeg-jobs: CMD = ffmpeg -jobs $(TARGET_PATH)/tests/data/jobs/two-outputs -parallel_jobs 1
+FATE_FFMPEG-$(HAVE_FORK) += $(FATE_FFMPEG_JOBS-yes)
+
 FATE_SAMPLES_FFMPEG-$(CONFIG_RAWVIDEO_DEMUXER) += fate-force_key_frames
 fate-force_key_frames: tests/data/vsynth_lena.yuv
 fate-force_key_frames: CMD = enc_dec \
@@ -135,6 +135,18 @@ fate-filter-colorchannelmixer: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf scale,fo
 FATE_FILTER_VSYNTH-$(CONFIG_DRAWBOX_FILTER) += fate-filter-drawbox
 fate-filter-drawbox: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf drawbox=224:24:88:72:red@0.5
 
+FATE_FILTER_VSYNTH-$(CONFIG_DRAWBOX_FILTER) += fate-filter-drawbox-fill fate-filter-drawbox-odd fate-filter-drawbox-threads
+fate-filter-drawbox-fill: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf drawbox=13:7:201:97:blue@0.6:t=fill
+fate-filter-drawbox-odd: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf drawbox=x=31:y=17:w=101:h=55:t=5:c=green@0.7,drawbox=x=-3:y=211:w=333:h=37:t=7:c=yellow
+# the slices must not change the output
+fate-filter-drawbox-threads: REF = $(SRC_PATH)/tests/ref/fate/filter-drawbox-odd
+fate-filter-drawbox-threads: CMD = framecrc -filter_threads 4 -c:v pgmyuv -i $(SRC) -vf drawbox=x=31:y=17:w=101:h=55:t=5:c=green@0.7,drawbox=x=-3:y=211:w=333:h=37:t=7:c=yellow
+
+FATE_FILTER_VSYNTH-$(CONFIG_DRAWGRID_FILTER) += fate-filter-drawgrid fate-filter-drawgrid-threads
+fate-filter-drawgrid: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf drawgrid=x=5:y=3:w=37:h=29:t=3:c=red@0.5
+fate-filter-drawgrid-threads: REF = $(SRC_PATH)/tests/ref/fate/filter-drawgrid
+fate-filter-drawgrid-threads: CMD = framecrc -filter_threads 4 -c:v pgmyuv -i $(SRC) -vf drawgrid=x=5:y=3:w=37:h=29:t=3:c=red@0.5
+
 FATE_FILTER_VSYNTH-$(CONFIG_FADE_FILTER) += fate-filter-fade
 fate-filter-fade: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf fade=in:5:15,fade=out:30:15
 
@@ -407,6 +419,65 @@ FATE_FILTER_VSYNTH-$(CONFIG_TRIM_FILTER) += $(FATE_TRIM)
 FATE_FILTER-$(call ALLYES, TESTSRC2_FILTER UNTILE_FILTER) += fate-filter-untile
 fate-filter-untile: CMD = framecrc -lavfi testsrc2=d=1:r=2,untile=2x2
 
+FATE_FILTER-yes += fate-filter-framepool
+fate-filter-framepool: libavfilter/tests/framepool$(EXESUF)
+fate-filter-framepool: CMD = run libavfilter/tests/framepool$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, COLOR_FILTER NULL_FILTER) += fate-filter-readyheap
+fate-filter-readyheap: libavfilter/tests/readyheap$(EXESUF)
+fate-filter-readyheap: CMD = run libavfilter/tests/readyheap$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, TESTSRC_FILTER TESTSRC2_FILTER FORMAT_FILTER LUTYUV_FILTER LUTRGB_FILTER NEGATE_FILTER) += fate-filter-fuse
+fate-filter-fuse: libavfilter/tests/fuse$(EXESUF)
+fate-filter-fuse: CMD = run libavfilter/tests/fuse$(EXESUF)
+
+FATE_FILTER-$(CONFIG_FRAMECHANGE_FILTER) += fate-filter-framechange-roi
+fate-filter-framechange-roi: libavfilter/tests/framechange$(EXESUF)
+fate-filter-framechange-roi: CMD = run libavfilter/tests/framechange$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, TESTSRC2_FILTER FORMAT_FILTER SENDCMD_FILTER DRAWBOX_FILTER HFLIP_FILTER NEGATE_FILTER VFLIP_FILTER DRAWGRID_FILTER) += fate-filter-graphthreads
+fate-filter-graphthreads: libavfilter/tests/graphthreads$(EXESUF)
+fate-filter-graphthreads: CMD = run libavfilter/tests/graphthreads$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, LUTYUV_FILTER EQ_FILTER FRAMECHANGE_FILTER) += fate-filter-inplace
+fate-filter-inplace: libavfilter/tests/inplace$(EXESUF)
+fate-filter-inplace: CMD = run libavfilter/tests/inplace$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, TESTSRC_FILTER SPLIT_FILTER NULL_FILTER HFLIP_FILTER) += fate-filter-stats
+fate-filter-stats: libavfilter/tests/filterstats$(EXESUF)
+fate-filter-stats: CMD = run libavfilter/tests/filterstats$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, TESTSRC2_FILTER CROP_FILTER FORMAT_FILTER HFLIP_FILTER) += fate-filter-graphtemplate
+fate-filter-graphtemplate: libavfilter/tests/graphtemplate$(EXESUF)
+fate-filter-graphtemplate: CMD = run libavfilter/tests/graphtemplate$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, COLOR_FILTER FORMAT_FILTER ZOOM_FILTER) += fate-filter-zoom-native-odd-in fate-filter-zoom-native-odd-out
+fate-filter-zoom-native-odd-in:  CMD = framecrc -lavfi color=gray:s=97x63:d=0.2:r=10,format=yuv420p,zoom=zoom=1.5:width=97:height=63:exact=1:engine=native
+fate-filter-zoom-native-odd-out: CMD = framecrc -lavfi color=gray:s=97x63:d=0.2:r=10,format=yuv420p,zoom=zoom=0.7:width=97:height=63:exact=1:engine=native:fillcolor=white
+
+# five keyframes every 0.5s as native endian doubles t, x, y, z
+tests/data/zoom-keyframes.bin: TAG = GEN
+tests/data/zoom-keyframes.bin: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i "aevalsrc=0.5*n|0.5+0.2*sin(n)|0.5-0.05*n|1+0.25*n*n:s=100:n=5:d=0.05" \
+        -c:a pcm_f64$(if $(HAVE_BIGENDIAN),be,le) -f f64$(if $(HAVE_BIGENDIAN),be,le) \
+        -y $(TARGET_PATH)/$@ 2>/dev/null
+
+FATE_FILTER_ZOOM_KEYFRAMES = linear cubic ease
+FATE_FILTER_ZOOM_KEYFRAMES := $(FATE_FILTER_ZOOM_KEYFRAMES:%=fate-filter-zoom-keyframes-%)
+$(FATE_FILTER_ZOOM_KEYFRAMES): tests/data/zoom-keyframes.bin
+$(FATE_FILTER_ZOOM_KEYFRAMES): CMD = framecrc -lavfi testsrc2=s=96x64:r=5:d=2.4,format=yuv420p,zoom=keyframes=$(TARGET_PATH)/tests/data/zoom-keyframes.bin:keyframe_interp=$(@:fate-filter-zoom-keyframes-%=%):width=96:height=64:exact=1:engine=native
+FATE_FILTER-$(call ALLYES, AEVALSRC_FILTER LAVFI_INDEV PCM_F64LE_ENCODER PCM_F64BE_ENCODER PCM_F64LE_MUXER PCM_F64BE_MUXER TESTSRC2_FILTER FORMAT_FILTER ZOOM_FILTER) += $(FATE_FILTER_ZOOM_KEYFRAMES)
+
+# a white square moving over testsrc2
+FRAMECHANGE_SRC = testsrc2=s=64x48:r=5:d=1.6,format=yuv420p[bg];color=white:s=16x16:r=5,format=yuva420p[fg];[bg][fg]overlay=x=6*n:y=16:shortest=1
+FRAMECHANGE_DEPS = TESTSRC2_FILTER COLOR_FILTER FORMAT_FILTER OVERLAY_FILTER FRAMECHANGE_FILTER
+FATE_FILTER-$(call ALLYES, $(FRAMECHANGE_DEPS)) += fate-filter-framechange-absolute fate-filter-framechange-percentage
+fate-filter-framechange-absolute:   CMD = framecrc -lavfi "$(FRAMECHANGE_SRC),framechange=show=1:planes=7"
+fate-filter-framechange-percentage: CMD = framecrc -lavfi "$(FRAMECHANGE_SRC),framechange=show=1:planes=1:mode=percentage:threshold=40"
+FATE_FILTER-$(call ALLYES, $(FRAMECHANGE_DEPS)) += fate-filter-framechange-blocks
+fate-filter-framechange-blocks:     CMD = framecrc -lavfi "$(FRAMECHANGE_SRC),framechange=show=1:planes=3:block_size=16"
+
 FATE_FILTER_VSYNTH-$(CONFIG_UNSHARP_FILTER) += fate-filter-unsharp
 fate-filter-unsharp: CMD = framecrc -c:v pgmyuv -i $(SRC) -vf unsharp=11:11:-1.5:11:11:-1.5
 
@@ -808,6 +879,16 @@ FATE_METADATA_FILTER-$(call ALLYES, $(SIGNALSTATS_DEPS)) += fate-filter-metadata
 fate-filter-metadata-signalstats-yuv420p: CMD = run $(FILTER_METADATA_COMMAND) "sws_flags=+accurate_rnd+bitexact;color=white:duration=1:r=1,signalstats"
 fate-filter-metadata-signalstats-yuv420p10: CMD = run $(FILTER_METADATA_COMMAND) "sws_flags=+accurate_rnd+bitexact;color=white:duration=1:r=1,format=yuv420p10,signalstats"
 
+FATE_METADATA_FILTER_LAVFI-$(call ALLYES, FFPROBE AVDEVICE LAVFI_INDEV $(FRAMECHANGE_DEPS)) += fate-filter-metadata-framechange-planes
+fate-filter-metadata-framechange-planes: CMD = run $(FILTER_METADATA_COMMAND) "$(FRAMECHANGE_SRC),framechange=planes=7:threshold=20"
+
+FATE_METADATA_FILTER_LAVFI-$(call ALLYES, FFPROBE AVDEVICE LAVFI_INDEV $(FRAMECHANGE_DEPS)) += fate-filter-metadata-framechange-blocks
+fate-filter-metadata-framechange-blocks: CMD = run $(FILTER_METADATA_COMMAND) "$(FRAMECHANGE_SRC),framechange=block_size=8:block_threshold=0.2"
+
+# the square is opaque over a half transparent background
+FATE_METADATA_FILTER_LAVFI-$(call ALLYES, FFPROBE AVDEVICE LAVFI_INDEV LUTYUV_FILTER $(FRAMECHANGE_DEPS)) += fate-filter-metadata-framechange-alpha
+fate-filter-metadata-framechange-alpha: CMD = run $(FILTER_METADATA_COMMAND) "testsrc2=s=64x48:r=5:d=1.6,format=yuva420p,lutyuv=a=128[bg];color=white:s=16x16:r=5,format=yuva420p[fg];[bg][fg]overlay=x=6*n:y=16:shortest=1,framechange=planes=9:mode=percentage"
+
 SILENCEDETECT_DEPS = FFPROBE AVDEVICE LAVFI_INDEV AMOVIE_FILTER TTA_DEMUXER TTA_DECODER SILENCEDETECT_FILTER
 FATE_METADATA_FILTER-$(call ALLYES, $(SILENCEDETECT_DEPS)) += fate-filter-metadata-silencedetect
 fate-filter-metadata-silencedetect: SRC = $(TARGET_SAMPLES)/lossless-audio/inside.tta
@@ -860,9 +941,10 @@ FATE_FILTER_SAMPLES-$(call ALLYES, $(REFCMP_DEPS) SSIM_FILTER) += fate-filter-re
 fate-filter-refcmp-ssim-yuv: CMD = refcmp_metadata ssim yuv422p 0.015
 
 FATE_SAMPLES_FFPROBE += $(FATE_METADATA_FILTER-yes)
+FATE_FFPROBE += $(FATE_METADATA_FILTER_LAVFI-yes)
 FATE_SAMPLES_FFMPEG += $(FATE_FILTER_SAMPLES-yes)
 FATE_FFMPEG += $(FATE_FILTER-yes)
 
 fate-vfilter: $(FATE_FILTER-yes) $(FATE_FILTER_SAMPLES-yes) $(FATE_FILTER_VSYNTH-yes)
 
-fate-filter: fate-afilter fate-vfilter $(FATE_METADATA_FILTER-yes)
+fate-filter: fate-afilter fate-vfilter $(FATE_METADATA_FILTER-yes) $(FATE_METADATA_FILTER_LAVFI-yes)